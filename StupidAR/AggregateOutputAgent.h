@@ -0,0 +1,282 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "IOutputAgent.h"
+#include "convert.h"
+#include "DriftController.h"
+#include "FractionalResampler.h"
+#include "FrameRing.h"
+
+namespace StupidAR {
+
+    /// Combines several agents into one logical device with the sum of their channels
+    /// The first child is the clock master: its callback drives the aggregate's callback, whose output is fanned out
+    /// to one FIFO per child. Every child reads its channels back through a variable-ratio resampler; the other
+    /// children steer the ratio with a PI loop on their FIFO's fill level, which tracks their clock's drift
+    /// relative to the master without a shared word clock. The master reads at a fixed ratio of 1 through an
+    /// identical FIFO, so all channels see the same latency and stay sample-aligned.
+    /// The fill level fed to the loop is corrected for where the master is within its period (from callback
+    /// timestamps), otherwise the beating of the children's buffer switches would show up as drift.
+    /// The aggregate's callback always gets Float buffers, conversion to each child's format is done here.
+    class AggregateOutputAgent final : public IOutputAgent {
+    public:
+        using AgentFactory = std::function<std::unique_ptr<IOutputAgent>(CallbackType)>;
+
+        // Current time in seconds on a clock shared by all children's callbacks
+        using TimeSource = std::function<double()>;
+
+        struct ChildStats {
+            double ratio;     // Input frames per output frame currently applied
+            double drift_ppm; // Estimated clock drift relative to the master, positive when the child runs fast
+            size_t fifo_fill; // Frames
+            uint64_t underruns;
+            uint64_t overruns;
+        };
+
+    private:
+        struct Child {
+            std::unique_ptr<IOutputAgent> agent;
+            int32_t first_channel;
+            int32_t channels;
+            int32_t buffer_size;
+            ConvertFn from_float;
+            std::unique_ptr<FrameRing> fifo;
+            std::unique_ptr<FractionalResampler> resampler;
+            std::unique_ptr<DriftController> controller;
+            std::vector<std::vector<float>> planar;
+            std::vector<float*> planar_pointers;
+            std::atomic<double> ratio;
+            std::atomic<double> drift_ppm;
+            std::atomic<uint64_t> underruns;
+            std::atomic<uint64_t> overruns;
+
+            Child() : ratio(1), drift_ppm(0), underruns(0), overruns(0) {
+            }
+        };
+
+        CallbackType m_callback;
+        TimeSource m_now;
+        std::vector<std::unique_ptr<Child>> m_children;
+        int32_t m_output_channels;
+        size_t m_latency_frames;
+        std::vector<std::vector<float>> m_mix;
+        std::vector<float*> m_mix_channels;
+        std::vector<char*> m_mix_pointers;
+        std::atomic<double> m_master_write_time;
+        bool m_prepared;
+
+    public:
+        /// `factories` create the children with the callback they are given, the first child is the clock master
+        /// `latency_periods` is the FIFO pre-fill in periods of the largest child buffer; it must absorb the worst
+        /// relative phase of the children's callbacks.
+        /// `now` is only replaced for simulation, by default it is `std::chrono::steady_clock`.
+        AggregateOutputAgent(const std::vector<AgentFactory>& factories, CallbackType callback, int32_t latency_periods = 2, TimeSource now = TimeSource())
+            : m_callback(std::move(callback)),
+              m_now(now ? std::move(now) : steady_seconds),
+              m_output_channels(0),
+              m_latency_frames(0),
+              m_master_write_time(0),
+              m_prepared(false) {
+            if (factories.empty()) {
+                throw std::invalid_argument("AggregateOutputAgent needs at least one child");
+            }
+
+            for (size_t i = 0; i < factories.size(); ++i) {
+                auto child = std::make_unique<Child>();
+                Child* pchild = child.get();
+                child->agent = factories[i]([this, pchild](char** buffers) { return on_child_callback(*pchild, buffers); });
+                m_children.push_back(std::move(child));
+            }
+
+            const int32_t rate = m_children[0]->agent->sampling_rate();
+            int32_t max_buffer = 0;
+            for (auto& child : m_children) {
+                if (child->agent->sampling_rate() != rate) {
+                    throw std::invalid_argument("AggregateOutputAgent children must run at the same nominal sampling rate");
+                }
+
+                child->first_channel = m_output_channels;
+                child->channels = child->agent->output_channels();
+                child->buffer_size = child->agent->buffer_size();
+                child->from_float = converter_for(SampleFormat::Float, child->agent->pcm_format());
+                if (!child->from_float) {
+                    throw std::invalid_argument("AggregateOutputAgent child has an unknown PCM format");
+                }
+
+                m_output_channels += child->channels;
+                max_buffer = std::max(max_buffer, child->buffer_size);
+            }
+
+            m_latency_frames = size_t(latency_periods) * max_buffer;
+            for (auto& child : m_children) {
+                child->fifo = std::make_unique<FrameRing>(child->channels, 2 * m_latency_frames + 4 * max_buffer);
+                child->resampler = std::make_unique<FractionalResampler>(child->channels, child->buffer_size);
+                child->controller = std::make_unique<DriftController>(child->buffer_size);
+                child->planar.assign(child->channels, std::vector<float>(child->buffer_size));
+                for (auto& channel : child->planar) {
+                    child->planar_pointers.push_back(channel.data());
+                }
+            }
+
+            m_mix.assign(m_output_channels, std::vector<float>(master().buffer_size));
+            for (auto& channel : m_mix) {
+                m_mix_channels.push_back(channel.data());
+                m_mix_pointers.push_back(reinterpret_cast<char*>(channel.data()));
+            }
+        }
+
+        ~AggregateOutputAgent() {
+            stop();
+        }
+
+        int32_t sampling_rate() override {
+            return master().agent->sampling_rate();
+        }
+
+        int32_t buffer_size() override {
+            return master().buffer_size;
+        }
+
+        int32_t output_channels() override {
+            return m_output_channels;
+        }
+
+        SampleFormat pcm_format() override {
+            return SampleFormat::Float;
+        }
+
+        /// The FIFO pre-fill on top of the slowest child's own latency
+        int32_t output_latency() override {
+            int32_t latency = 0;
+            for (auto& child : m_children) {
+                latency = std::max(latency, child->agent->output_latency());
+            }
+            return int32_t(m_latency_frames) + latency;
+        }
+
+        /// Primes the master only: its callback fills every child's FIFO, so the followers start with the
+        /// primed periods queued and play them while the master plays its own.
+        int32_t prepare(int32_t n_buffers) override {
+            reset_streams();
+            m_prepared = true;
+            return master().agent->prepare(n_buffers);
+        }
+
+        void start() override {
+            if (!m_prepared) {
+                reset_streams();
+            }
+            m_prepared = false;
+
+            // Followers first, so that the master never writes into a FIFO nobody reads
+            for (size_t i = m_children.size(); i-- > 0;) {
+                m_children[i]->agent->start();
+            }
+        }
+
+        void stop() override {
+            for (auto& child : m_children) {
+                child->agent->stop();
+            }
+            m_prepared = false;
+        }
+
+        /// Children must not change format on their own, so the listener is never called
+        void set_reconfigure_callback(ReconfigureCallbackType) override {
+        }
+
+        /// Not supported: the children would have to change in lockstep, and the FIFOs be re-planned around them
+        bool reconfigure(int32_t, int32_t) override {
+            return false;
+        }
+
+        size_t children() const {
+            return m_children.size();
+        }
+
+        IOutputAgent& child(size_t index) {
+            return *m_children[index]->agent;
+        }
+
+        ChildStats child_stats(size_t index) const {
+            const Child& child = *m_children[index];
+            return {
+                child.ratio.load(std::memory_order_relaxed),
+                child.drift_ppm.load(std::memory_order_relaxed),
+                child.fifo->available(),
+                child.underruns.load(std::memory_order_relaxed),
+                child.overruns.load(std::memory_order_relaxed),
+            };
+        }
+
+    private:
+        static double steady_seconds() {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        Child& master() {
+            return *m_children[0];
+        }
+
+        void reset_streams() {
+            for (auto& child : m_children) {
+                child->fifo->reset();
+                child->fifo->write_silence(m_latency_frames);
+                child->resampler->reset();
+                child->controller->reset();
+                child->ratio = 1;
+                child->drift_ppm = 0;
+            }
+            m_master_write_time = m_now();
+        }
+
+        // Fill level of a follower's FIFO as if the master produced continuously instead of once per period
+        double smoothed_fill(Child& child) {
+            const double master_period = double(master().buffer_size) / master().agent->sampling_rate();
+            double write_time;
+            size_t available;
+            do { // The master may write in between, take a consistent pair
+                write_time = m_master_write_time.load(std::memory_order_acquire);
+                available = child.fifo->available();
+            } while (write_time != m_master_write_time.load(std::memory_order_acquire));
+
+            const double elapsed = std::min(std::max(m_now() - write_time, 0.0), master_period);
+            return double(available) - master().buffer_size + elapsed * master().agent->sampling_rate();
+        }
+
+        bool on_child_callback(Child& child, char** buffers) {
+            bool result = true;
+
+            if (&child == &master()) {
+                result = m_callback(m_mix_pointers.data());
+
+                for (auto& c : m_children) {
+                    if (c->fifo->write(&m_mix_channels[c->first_channel], child.buffer_size) != size_t(child.buffer_size)) {
+                        c->overruns.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+                m_master_write_time.store(m_now(), std::memory_order_release);
+            } else {
+                child.ratio.store(child.controller->update(smoothed_fill(child)), std::memory_order_relaxed);
+                child.drift_ppm.store(child.controller->drift_ppm(), std::memory_order_relaxed);
+            }
+
+            const double ratio = child.ratio.load(std::memory_order_relaxed);
+            if (child.resampler->process(*child.fifo, child.planar_pointers.data(), child.buffer_size, ratio) != 0) {
+                child.underruns.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            for (int32_t c = 0; c < child.channels; ++c) {
+                child.from_float(reinterpret_cast<const char*>(child.planar_pointers[c]), 1, buffers[c], 1, child.buffer_size);
+            }
+
+            return result;
+        }
+    };
+
+}
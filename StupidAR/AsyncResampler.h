@@ -0,0 +1,152 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "simd.h"
+
+namespace StupidAR {
+
+    /// Variable-ratio resampler on planar float channels, for steering one clock domain into another
+    /// Cubic Hermite interpolation in Farrow form, like `FractionalResampler`, but built for many channels: the read
+    /// positions and the four interpolation weights of each output frame depend on the ratio alone, so they are
+    /// computed once per call and shared by every channel, whose inner loop is then four loads and a 4x4 weighted
+    /// sum per four output frames (SSE2 where available).
+    /// The ratio may change on every call without discontinuities: the read position is continuous, only its speed
+    /// changes. Input goes straight into the resampler's own buffers: ask `input_frames()` how many frames the next
+    /// call consumes, write them at `input()`, then `process()` with the same ratio.
+    /// Latency is two input frames.
+    class AsyncResampler {
+    public:
+        static constexpr size_t kLatencyFrames = 2;
+
+    private:
+        // Output frame at position p interpolates x[floor(p) - 1] .. x[floor(p) + 2]; this many frames are kept
+        // from one call to the next
+        static const size_t kHistory = 4;
+
+        size_t m_channels;
+        size_t m_max_output_frames;
+        double m_max_ratio;
+        size_t m_stride; // Floats per channel: kHistory of history, then room for the input of one call
+        double m_position; // Read position of the next output frame, relative to the first history frame
+        std::vector<float> m_frames;
+        std::vector<float*> m_inputs;
+        std::vector<int32_t> m_index;   // Per output frame: first of the four input frames it interpolates
+        std::vector<float> m_weights;   // Per output frame: the four weights, interleaved
+
+    public:
+        AsyncResampler(size_t channels, size_t max_output_frames, double max_ratio = 1.01)
+            : m_channels(channels),
+              m_max_output_frames(max_output_frames),
+              m_max_ratio(max_ratio),
+              m_stride(kHistory + size_t(std::ceil(max_output_frames * max_ratio)) + 2),
+              m_position(0),
+              m_frames(channels * m_stride),
+              m_inputs(channels),
+              m_index(max_output_frames),
+              m_weights(4 * max_output_frames) {
+            for (size_t c = 0; c < channels; ++c) {
+                m_inputs[c] = &m_frames[c * m_stride + kHistory];
+            }
+            reset();
+        }
+
+        size_t channels() const {
+            return m_channels;
+        }
+
+        size_t max_output_frames() const {
+            return m_max_output_frames;
+        }
+
+        /// Forgets all history
+        void reset() {
+            std::fill(m_frames.begin(), m_frames.end(), 0.0f);
+            m_position = 2.0;
+        }
+
+        /// `ratio` (input frames per output frame) as `process()` applies it: clamped to [1 / max_ratio, max_ratio]
+        double clamp_ratio(double ratio) const {
+            return std::min(std::max(ratio, 1.0 / m_max_ratio), m_max_ratio);
+        }
+
+        /// Number of input frames the next `process()` of `frames` frames at `ratio` consumes
+        size_t input_frames(size_t frames, double ratio) const {
+            frames = std::min(frames, m_max_output_frames);
+            if (frames == 0) {
+                return 0;
+            }
+            const double last = m_position + (frames - 1) * clamp_ratio(ratio);
+            const ptrdiff_t needed = ptrdiff_t(std::floor(last)) + 3 - ptrdiff_t(kHistory);
+            return size_t(std::max<ptrdiff_t>(needed, 0));
+        }
+
+        /// Per channel, where the input of the next `process()` goes
+        float* const* input() const {
+            return m_inputs.data();
+        }
+
+        /// Produces `frames` planar output frames from the `input_frames(frames, ratio)` frames written to `input()`
+        void process(float* const* out, size_t frames, double ratio) {
+            frames = std::min(frames, m_max_output_frames);
+            ratio = clamp_ratio(ratio);
+            if (frames == 0) {
+                return;
+            }
+            const size_t consumed = input_frames(frames, ratio);
+
+            // Where each output frame reads, and with which weights
+            double position = m_position;
+            for (size_t i = 0; i < frames; ++i) {
+                const double whole = std::floor(position);
+                const float mu = float(position - whole);
+                const float mu2 = mu * mu;
+                const float mu3 = mu2 * mu;
+                m_index[i] = int32_t(whole) - 1;
+                float* w = &m_weights[4 * i];
+                w[0] = -0.5f * mu + mu2 - 0.5f * mu3;
+                w[1] = 1.0f - 2.5f * mu2 + 1.5f * mu3;
+                w[2] = 0.5f * mu + 2.0f * mu2 - 1.5f * mu3;
+                w[3] = -0.5f * mu2 + 0.5f * mu3;
+                position += ratio;
+            }
+
+            for (size_t c = 0; c < m_channels; ++c) {
+                interpolate(&m_frames[c * m_stride], out[c], frames);
+
+                // The last input frames are the next call's history
+                float* x = &m_frames[c * m_stride];
+                std::copy_n(x + consumed, kHistory, x);
+            }
+
+            m_position = position - double(consumed);
+        }
+
+    private:
+        void interpolate(const float* x, float* out, size_t frames) const {
+            const int32_t* index = m_index.data();
+            const float* w = m_weights.data();
+            size_t i = 0;
+#ifdef STUPIDAR_SSE2
+            for (; i + 4 <= frames; i += 4) {
+                __m128 a = _mm_mul_ps(_mm_loadu_ps(x + index[i]), _mm_loadu_ps(w + 4 * i));
+                __m128 b = _mm_mul_ps(_mm_loadu_ps(x + index[i + 1]), _mm_loadu_ps(w + 4 * i + 4));
+                __m128 c = _mm_mul_ps(_mm_loadu_ps(x + index[i + 2]), _mm_loadu_ps(w + 4 * i + 8));
+                __m128 d = _mm_mul_ps(_mm_loadu_ps(x + index[i + 3]), _mm_loadu_ps(w + 4 * i + 12));
+                _MM_TRANSPOSE4_PS(a, b, c, d);
+                _mm_storeu_ps(out + i, _mm_add_ps(_mm_add_ps(a, b), _mm_add_ps(c, d)));
+            }
+#endif
+            for (; i < frames; ++i) {
+                const float* t = x + index[i];
+                const float* wi = w + 4 * i;
+                out[i] = t[0] * wi[0] + t[1] * wi[1] + t[2] * wi[2] + t[3] * wi[3];
+            }
+        }
+    };
+
+}
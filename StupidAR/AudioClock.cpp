@@ -0,0 +1,17 @@
+#include "AudioClock.h"
+
+namespace StupidAR {
+
+    AudioClock::AudioClock(LPUNKNOWN pUnknown, HRESULT* pResult, DeviceClock& clock)
+        : CBaseReferenceClock(NAME("Audio Clock"), pUnknown, pResult),
+          m_clock(clock) {
+    }
+
+    AudioClock::~AudioClock() {
+    }
+
+    REFERENCE_TIME AudioClock::GetPrivateTime() {
+        return m_clock.time(monotonic_seconds());
+    }
+
+}
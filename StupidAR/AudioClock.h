@@ -0,0 +1,20 @@
+#pragma once
+
+#include "streams.h"
+#include "DeviceClock.h"
+
+namespace StupidAR {
+
+    // IReferenceClock that follows the device the renderer plays to, so the graph runs at the DAC's pace
+    class AudioClock final : public CBaseReferenceClock {
+    public:
+        AudioClock(LPUNKNOWN, HRESULT*, DeviceClock&);
+        ~AudioClock(); // Owned by the renderer rather than by its own reference count
+
+        REFERENCE_TIME GetPrivateTime() override;
+
+    private:
+        DeviceClock& m_clock;
+    };
+
+}
@@ -0,0 +1,56 @@
+#include "BasicAudio.h"
+
+namespace StupidAR {
+
+    BasicAudio::BasicAudio(LPUNKNOWN pUnknown, GainStage& gain, int32_t channels)
+        : CBasicAudio(NAME("Basic Audio"), pUnknown),
+          m_gain(gain),
+          m_channels(channels),
+          m_volume(0),
+          m_balance(0) {
+    }
+
+    STDMETHODIMP BasicAudio::put_Volume(long lVolume) {
+        if (lVolume < -10000 || lVolume > 0) {
+            return E_INVALIDARG;
+        }
+
+        CAutoLock lock(&m_lock);
+        m_volume = lVolume;
+        Apply();
+        return S_OK;
+    }
+
+    STDMETHODIMP BasicAudio::get_Volume(long* plVolume) {
+        CheckPointer(plVolume, E_POINTER);
+
+        CAutoLock lock(&m_lock);
+        *plVolume = m_volume;
+        return S_OK;
+    }
+
+    STDMETHODIMP BasicAudio::put_Balance(long lBalance) {
+        if (lBalance < -10000 || lBalance > 10000) {
+            return E_INVALIDARG;
+        }
+
+        CAutoLock lock(&m_lock);
+        m_balance = lBalance;
+        Apply();
+        return S_OK;
+    }
+
+    STDMETHODIMP BasicAudio::get_Balance(long* plBalance) {
+        CheckPointer(plBalance, E_POINTER);
+
+        CAutoLock lock(&m_lock);
+        *plBalance = m_balance;
+        return S_OK;
+    }
+
+    // The gain stage ramps to the new gains, so changes don't click
+    void BasicAudio::Apply() {
+        m_gain.set_gains(volume_balance_gains(m_volume, m_balance, m_channels));
+    }
+
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "streams.h"
+#include "GainStage.h"
+
+namespace StupidAR {
+
+    // IBasicAudio (software volume and balance) on top of the renderer's gain stage
+    class BasicAudio final : public CBasicAudio {
+    public:
+        BasicAudio(LPUNKNOWN, GainStage&, int32_t channels);
+
+        STDMETHODIMP put_Volume(long lVolume) override;
+        STDMETHODIMP get_Volume(long* plVolume) override;
+        STDMETHODIMP put_Balance(long lBalance) override;
+        STDMETHODIMP get_Balance(long* plBalance) override;
+
+    private:
+        void Apply();
+
+        CCritSec m_lock;
+        GainStage& m_gain;
+        int32_t m_channels;
+        long m_volume;
+        long m_balance;
+    };
+
+}
@@ -1,25 +1,29 @@
 #pragma once
 
-#include <queue>
 #include <mutex>
 #include <condition_variable>
+#include <vector>
 
 namespace StupidAR {
 
     /// Fixed-size, blocking queue with support for flushing
+    /// Items live in a ring of slots allocated up front, so neither adding nor retrieving items allocates; only
+    /// `resize()` beyond every earlier size does. Taken items leave a default-constructed `T` in their slot.
     template <typename T>
     class BlockingQueue {
     private:
         bool m_flushing;
         size_t m_size;
-        std::deque<T> m_items;
+        std::vector<T> m_slots;
+        size_t m_head;
+        size_t m_count;
         std::mutex m_lock;
         std::condition_variable m_not_full;
         std::condition_variable m_not_empty;
 
     public:
         explicit BlockingQueue(size_t size)
-            : m_size(size), m_flushing(false) {
+            : m_flushing(false), m_size(size), m_slots(size), m_head(0), m_count(0) {
         }
 
         /// Blocks until not full or closed
@@ -27,13 +31,13 @@ namespace StupidAR {
         template <typename E, typename enable_if = typename std::enable_if_t<std::is_constructible_v<T, E>>>
         bool put(E&& e) {
             std::unique_lock<std::mutex> l(m_lock);
-            m_not_full.wait(l, [&]() { return m_items.size() != m_size || m_flushing; });
+            m_not_full.wait(l, [&]() { return m_count < m_size || m_flushing; });
 
             if (m_flushing) {
                 return false;
             }
 
-            m_items.push_back(std::forward<E>(e));
+            push_back(std::forward<E>(e));
             m_not_empty.notify_one();
 
             return true;
@@ -45,11 +49,11 @@ namespace StupidAR {
         bool offer(E&& e) {
             std::unique_lock<std::mutex> l(m_lock);
 
-            if (m_items.size() == m_size || m_flushing) {
+            if (m_count >= m_size || m_flushing) {
                 return false;
             }
 
-            m_items.push_back(std::forward<E>(e));
+            push_back(std::forward<E>(e));
             m_not_empty.notify_one();
 
             return true;
@@ -59,14 +63,13 @@ namespace StupidAR {
         /// Returns `true` if `out` was succesfully initialized from the front of the queue
         bool take(T& out) {
             std::unique_lock<std::mutex> l(m_lock);
-            m_not_empty.wait(l, [&]() { return m_items.size() != 0 || m_flushing; });
+            m_not_empty.wait(l, [&]() { return m_count != 0 || m_flushing; });
 
             if (m_flushing) {
                 return false;
             }
 
-            out = std::move(m_items.front());
-            m_items.pop_front();
+            pop_front(out);
             m_not_full.notify_one();
 
             return true;
@@ -77,9 +80,8 @@ namespace StupidAR {
         bool poll(T& out) {
             std::unique_lock<std::mutex> l(m_lock);
 
-            if (!m_items.empty()) {
-                out = std::move(m_items.front());
-                m_items.pop_front();
+            if (m_count != 0) {
+                pop_front(out);
                 m_not_full.notify_one();
 
                 return true;
@@ -99,7 +101,11 @@ namespace StupidAR {
             }
 
             m_flushing = true;
-            m_items.clear();
+            while (m_count != 0) {
+                m_slots[m_head] = T();
+                m_head = (m_head + 1) % m_slots.size();
+                --m_count;
+            }
 
             m_not_full.notify_all();
             m_not_empty.notify_all();
@@ -110,6 +116,48 @@ namespace StupidAR {
             std::unique_lock<std::mutex> l(m_lock);
             m_flushing = false;
         }
+
+        /// Changes the maximum number of items in place, keeping the enqueued ones
+        /// When shrinking below the current number of items, nothing is dropped: `put()` blocks until enough were taken.
+        void resize(size_t size) {
+            std::unique_lock<std::mutex> l(m_lock);
+            if (size > m_slots.size()) {
+                std::vector<T> slots(size);
+                for (size_t i = 0; i < m_count; ++i) {
+                    slots[i] = std::move(m_slots[(m_head + i) % m_slots.size()]);
+                }
+                m_slots = std::move(slots);
+                m_head = 0;
+            }
+            m_size = size;
+            m_not_full.notify_all();
+        }
+
+        /// Maximum number of items
+        size_t capacity() {
+            std::unique_lock<std::mutex> l(m_lock);
+            return m_size;
+        }
+
+        /// Number of enqueued items
+        size_t count() {
+            std::unique_lock<std::mutex> l(m_lock);
+            return m_count;
+        }
+
+    private:
+        template <typename E>
+        void push_back(E&& e) {
+            m_slots[(m_head + m_count) % m_slots.size()] = T(std::forward<E>(e));
+            ++m_count;
+        }
+
+        void pop_front(T& out) {
+            out = std::move(m_slots[m_head]);
+            m_slots[m_head] = T();
+            m_head = (m_head + 1) % m_slots.size();
+            --m_count;
+        }
     };
 
 }
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace StupidAR {
+
+    // Speaker positions, bit-compatible with `WAVEFORMATEXTENSIBLE::dwChannelMask`
+    // Interleaved channels appear in the order of their bits, lowest first.
+    enum Speaker : uint32_t {
+        kSpeakerFrontLeft = 0x1,
+        kSpeakerFrontRight = 0x2,
+        kSpeakerFrontCenter = 0x4,
+        kSpeakerLowFrequency = 0x8,
+        kSpeakerBackLeft = 0x10,
+        kSpeakerBackRight = 0x20,
+        kSpeakerFrontLeftOfCenter = 0x40,
+        kSpeakerFrontRightOfCenter = 0x80,
+        kSpeakerBackCenter = 0x100,
+        kSpeakerSideLeft = 0x200,
+        kSpeakerSideRight = 0x400,
+        kSpeakerTopCenter = 0x800,
+        kSpeakerTopFrontLeft = 0x1000,
+        kSpeakerTopFrontCenter = 0x2000,
+        kSpeakerTopFrontRight = 0x4000,
+        kSpeakerTopBackLeft = 0x8000,
+        kSpeakerTopBackCenter = 0x10000,
+        kSpeakerTopBackRight = 0x20000,
+    };
+
+    // The layout Windows assumes for a channel count when no mask is given, 0 (no positions) if there is none
+    inline uint32_t default_channel_mask(int32_t channels) {
+        switch (channels) {
+        case 1:
+            return kSpeakerFrontCenter;
+        case 2:
+            return kSpeakerFrontLeft | kSpeakerFrontRight;
+        case 4:
+            return kSpeakerFrontLeft | kSpeakerFrontRight | kSpeakerBackLeft | kSpeakerBackRight;
+        case 6:
+            return kSpeakerFrontLeft | kSpeakerFrontRight | kSpeakerFrontCenter | kSpeakerLowFrequency | kSpeakerBackLeft | kSpeakerBackRight;
+        case 8:
+            return kSpeakerFrontLeft | kSpeakerFrontRight | kSpeakerFrontCenter | kSpeakerLowFrequency | kSpeakerBackLeft | kSpeakerBackRight
+                 | kSpeakerSideLeft | kSpeakerSideRight;
+        default:
+            return 0;
+        }
+    }
+
+    // Speaker of each of the first `channels` channels of `mask`, 0 for channels beyond the mask
+    inline std::vector<uint32_t> channel_speakers(uint32_t mask, int32_t channels) {
+        std::vector<uint32_t> speakers(channels, 0);
+        int32_t c = 0;
+        for (uint32_t bit = 1; bit != 0 && c < channels; bit <<= 1) {
+            if (mask & bit) {
+                speakers[c++] = bit;
+            }
+        }
+        return speakers;
+    }
+
+    // -1 for speakers on the left, 1 for those on the right, 0 for those in the middle
+    inline int32_t speaker_side(uint32_t speaker) {
+        const uint32_t left = kSpeakerFrontLeft | kSpeakerBackLeft | kSpeakerFrontLeftOfCenter | kSpeakerSideLeft
+                            | kSpeakerTopFrontLeft | kSpeakerTopBackLeft;
+        const uint32_t right = kSpeakerFrontRight | kSpeakerBackRight | kSpeakerFrontRightOfCenter | kSpeakerSideRight
+                             | kSpeakerTopFrontRight | kSpeakerTopBackRight;
+        return (speaker & left) ? -1 : (speaker & right) ? 1 : 0;
+    }
+
+    namespace detail {
+
+        // Where a speaker missing from the output layout is folded to: the first alternative whose speakers all exist
+        struct Fold {
+            uint32_t speaker;
+            uint32_t targets;
+            float gain;
+        };
+
+        constexpr float kMinus3dB = 0.70710678f;
+        constexpr float kMinus6dB = 0.5f;
+
+        const Fold kFolds[] = {
+            { kSpeakerFrontLeft, kSpeakerFrontCenter, kMinus3dB },
+            { kSpeakerFrontRight, kSpeakerFrontCenter, kMinus3dB },
+            { kSpeakerFrontCenter, kSpeakerFrontLeft | kSpeakerFrontRight, kMinus3dB },
+            { kSpeakerBackLeft, kSpeakerSideLeft, 1.0f },
+            { kSpeakerBackLeft, kSpeakerFrontLeft, kMinus3dB },
+            { kSpeakerBackRight, kSpeakerSideRight, 1.0f },
+            { kSpeakerBackRight, kSpeakerFrontRight, kMinus3dB },
+            { kSpeakerSideLeft, kSpeakerBackLeft, 1.0f },
+            { kSpeakerSideLeft, kSpeakerFrontLeft, kMinus3dB },
+            { kSpeakerSideRight, kSpeakerBackRight, 1.0f },
+            { kSpeakerSideRight, kSpeakerFrontRight, kMinus3dB },
+            { kSpeakerBackCenter, kSpeakerBackLeft | kSpeakerBackRight, kMinus3dB },
+            { kSpeakerBackCenter, kSpeakerSideLeft | kSpeakerSideRight, kMinus3dB },
+            { kSpeakerBackCenter, kSpeakerFrontLeft | kSpeakerFrontRight, kMinus6dB },
+            { kSpeakerFrontLeftOfCenter, kSpeakerFrontLeft, 1.0f },
+            { kSpeakerFrontRightOfCenter, kSpeakerFrontRight, 1.0f },
+            { kSpeakerTopCenter, kSpeakerFrontLeft | kSpeakerFrontRight, kMinus6dB },
+            { kSpeakerTopFrontLeft, kSpeakerFrontLeft, kMinus3dB },
+            { kSpeakerTopFrontCenter, kSpeakerFrontCenter, kMinus3dB },
+            { kSpeakerTopFrontCenter, kSpeakerFrontLeft | kSpeakerFrontRight, kMinus6dB },
+            { kSpeakerTopFrontRight, kSpeakerFrontRight, kMinus3dB },
+            { kSpeakerTopBackLeft, kSpeakerBackLeft, kMinus3dB },
+            { kSpeakerTopBackLeft, kSpeakerSideLeft, kMinus3dB },
+            { kSpeakerTopBackLeft, kSpeakerFrontLeft, kMinus6dB },
+            { kSpeakerTopBackCenter, kSpeakerBackLeft | kSpeakerBackRight, kMinus6dB },
+            { kSpeakerTopBackCenter, kSpeakerFrontLeft | kSpeakerFrontRight, kMinus6dB },
+            { kSpeakerTopBackRight, kSpeakerBackRight, kMinus3dB },
+            { kSpeakerTopBackRight, kSpeakerSideRight, kMinus3dB },
+            { kSpeakerTopBackRight, kSpeakerFrontRight, kMinus6dB },
+            // The LFE channel is dropped when the output has none: bass management is the device's business
+        };
+
+    }
+
+    // Gain matrix from an input to an output layout, `out_channels` rows of `in_channels` coefficients
+    // Speakers present on both sides are copied, the others are folded into their nearest neighbours (downmix);
+    // output speakers with no input stay silent (no synthesized upmix). Rows summing to more than unity are
+    // normalized so the mix cannot clip. Without a mask on either side channels are matched by index.
+    inline std::vector<float> remix_matrix(uint32_t in_mask, int32_t in_channels, uint32_t out_mask, int32_t out_channels) {
+        std::vector<float> matrix(size_t(out_channels) * in_channels, 0.0f);
+
+        if (in_mask == 0 || out_mask == 0) {
+            for (int32_t c = 0; c < out_channels && c < in_channels; ++c) {
+                matrix[size_t(c) * in_channels + c] = 1.0f;
+            }
+            return matrix;
+        }
+
+        const std::vector<uint32_t> in_speakers = channel_speakers(in_mask, in_channels);
+        const std::vector<uint32_t> out_speakers = channel_speakers(out_mask, out_channels);
+        const auto out_index = [&](uint32_t speaker) {
+            for (int32_t o = 0; o < out_channels; ++o) {
+                if (out_speakers[o] == speaker) {
+                    return o;
+                }
+            }
+            return -1;
+        };
+
+        for (int32_t i = 0; i < in_channels; ++i) {
+            const uint32_t speaker = in_speakers[i];
+            if (speaker == 0) {
+                continue;
+            }
+
+            const int32_t o = out_index(speaker);
+            if (o >= 0) {
+                matrix[size_t(o) * in_channels + i] = 1.0f;
+                continue;
+            }
+
+            for (const detail::Fold& fold : detail::kFolds) {
+                if (fold.speaker != speaker || (out_mask & fold.targets) != fold.targets) {
+                    continue;
+                }
+                for (uint32_t bit = 1; bit != 0; bit <<= 1) {
+                    const int32_t target = (fold.targets & bit) ? out_index(bit) : -1;
+                    if (target >= 0) {
+                        matrix[size_t(target) * in_channels + i] += fold.gain;
+                    }
+                }
+                break;
+            }
+        }
+
+        for (int32_t o = 0; o < out_channels; ++o) {
+            float sum = 0.0f;
+            for (int32_t i = 0; i < in_channels; ++i) {
+                sum += matrix[size_t(o) * in_channels + i];
+            }
+            if (sum > 1.0f) {
+                for (int32_t i = 0; i < in_channels; ++i) {
+                    matrix[size_t(o) * in_channels + i] /= sum;
+                }
+            }
+        }
+
+        return matrix;
+    }
+
+}
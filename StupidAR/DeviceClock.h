@@ -0,0 +1,215 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+
+#include "FrameTime.h"
+
+namespace StupidAR {
+
+    // Seconds on the monotonic clock the device clock is fed and read with
+    inline double monotonic_seconds() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /// Reference time (100 ns units, like `REFERENCE_TIME`) driven by the number of frames the device has consumed
+    /// Each agent callback marks one more period consumed. The arrival times of the callbacks are jittery, so they
+    /// are smoothed by a second-order delay-locked loop (F. Adriaensen, "Using a DLL to filter time", 2005), which
+    /// tracks both the start of the current period and the actual period length, i.e. the DAC's real sampling rate.
+    /// Between callbacks the position is interpolated along the loop's estimate and held at the predicted end of the
+    /// period, and readings never go backwards.
+    /// While the device is stopped the clock runs on the system clock from where it was, so it is continuous across
+    /// stops, starts and format changes.
+    /// `on_period()` is for the agent callback, `start()`, `stop()` and `set_format()` for when it is quiesced,
+    /// `time()` for any thread.
+    class DeviceClock {
+    public:
+        static constexpr int64_t kUnitsPerSecond = FrameRate::kUnitsPerSecond;
+
+    private:
+        double m_bandwidth; // Hz
+
+        // Written by the callback (or while it is quiesced), read by anyone under the sequence lock
+        std::atomic<uint32_t> m_sequence;
+        std::atomic<bool> m_locked;
+        std::atomic<double> m_t0;       // Smoothed start of the current period
+        std::atomic<double> m_t1;       // Predicted start of the next one
+        std::atomic<int64_t> m_n0;      // Frames consumed at m_t0
+        std::atomic<int64_t> m_origin;  // Locked: reference time of frame 0
+        std::atomic<double> m_anchor;   // Free-running: system time of m_anchor_time
+        std::atomic<int64_t> m_anchor_time;
+        std::atomic<int32_t> m_sampling_rate;
+        std::atomic<int32_t> m_period_frames;
+        std::atomic<double> m_period_seconds; // Smoothed period length
+
+        // Callback only
+        double m_b;
+        double m_c;
+        bool m_running;
+        bool m_first;
+
+        std::atomic<int64_t> m_last; // Latest reading, for monotonicity
+
+    public:
+        explicit DeviceClock(double now, double bandwidth = 0.5)
+            : m_bandwidth(bandwidth),
+              m_sequence(0),
+              m_locked(false),
+              m_t0(0),
+              m_t1(0),
+              m_n0(0),
+              m_origin(0),
+              m_anchor(now),
+              m_anchor_time(int64_t(now * kUnitsPerSecond)),
+              m_sampling_rate(0),
+              m_period_frames(0),
+              m_period_seconds(0),
+              m_b(0),
+              m_c(0),
+              m_running(false),
+              m_first(false),
+              m_last(INT64_MIN) {
+        }
+
+        /// The device starts consuming periods of `period_frames` frames at `sampling_rate`
+        /// The clock locks to it at the first callback, and runs free until then.
+        void start(double now, int32_t sampling_rate, int32_t period_frames) {
+            free_run(now); // Readers don't look at the format while the clock runs free
+            m_sampling_rate = sampling_rate;
+            m_period_frames = period_frames;
+            if (sampling_rate <= 0 || period_frames <= 0) {
+                m_running = false;
+                return;
+            }
+
+            // Loop coefficients for a critically damped second-order DLL updated once per period
+            const double nominal = double(period_frames) / sampling_rate;
+            const double omega = 2 * 3.14159265358979323846 * m_bandwidth * nominal;
+            m_b = std::sqrt(2.0) * omega;
+            m_c = omega * omega;
+            m_period_seconds = nominal;
+            m_running = true;
+            m_first = true;
+        }
+
+        /// The device stopped, the clock runs free from where it is
+        void stop(double now) {
+            free_run(now);
+            m_running = false;
+        }
+
+        /// The device format changed under a running stream: restarts the loop without a jump in time
+        void set_format(double now, int32_t sampling_rate, int32_t period_frames) {
+            const bool running = m_running;
+            start(now, sampling_rate, period_frames);
+            m_running = running && m_running;
+        }
+
+        /// Agent callback: one more period is being consumed, as of `now`
+        void on_period(double now) {
+            if (!m_running) {
+                return;
+            }
+
+            const double period = m_period_seconds.load(std::memory_order_relaxed);
+            if (m_first) {
+                m_first = false;
+                publish(now, now + period, 0, time(now));
+                return;
+            }
+
+            const double t1 = m_t1.load(std::memory_order_relaxed);
+            const int64_t n1 = m_n0.load(std::memory_order_relaxed) + m_period_frames.load(std::memory_order_relaxed);
+            const double error = now - t1;
+
+            if (std::abs(error) > 4 * period) {
+                // Lost lock (an overrun, the system suspended...): start over from here at the nominal period
+                const double nominal = double(m_period_frames) / m_sampling_rate;
+                m_period_seconds.store(nominal, std::memory_order_relaxed);
+                const int64_t origin = time(now) - FrameRate(m_sampling_rate.load(std::memory_order_relaxed)).time(n1);
+                publish(now, now + nominal, n1, origin);
+                return;
+            }
+
+            m_period_seconds.store(period + m_c * error, std::memory_order_relaxed);
+            publish(t1, t1 + m_b * error + period, n1, m_origin.load(std::memory_order_relaxed));
+        }
+
+        /// Reference time at system time `now`, never less than an earlier reading
+        int64_t time(double now) {
+            int64_t t = raw_time(now);
+            int64_t last = m_last.load(std::memory_order_relaxed);
+            while (t > last && !m_last.compare_exchange_weak(last, t, std::memory_order_relaxed)) {
+            }
+            return std::max(t, last);
+        }
+
+        /// Measured over nominal sampling rate of the device, 1 before it ever ran
+        double rate_ratio() const {
+            const double period = m_period_seconds.load(std::memory_order_relaxed);
+            if (period <= 0) {
+                return 1.0;
+            }
+            return double(m_period_frames.load(std::memory_order_relaxed)) / m_sampling_rate.load(std::memory_order_relaxed) / period;
+        }
+
+    private:
+        int64_t raw_time(double now) const {
+            while (true) {
+                const uint32_t sequence = m_sequence.load(std::memory_order_acquire);
+                if (sequence & 1) {
+                    continue;
+                }
+
+                const bool locked = m_locked.load(std::memory_order_relaxed);
+                const double t0 = m_t0.load(std::memory_order_relaxed);
+                const double t1 = m_t1.load(std::memory_order_relaxed);
+                const int64_t n0 = m_n0.load(std::memory_order_relaxed);
+                const int64_t origin = m_origin.load(std::memory_order_relaxed);
+                const double anchor = m_anchor.load(std::memory_order_relaxed);
+                const int64_t anchor_time = m_anchor_time.load(std::memory_order_relaxed);
+                const int32_t sampling_rate = m_sampling_rate.load(std::memory_order_relaxed);
+                const int32_t period_frames = m_period_frames.load(std::memory_order_relaxed);
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (m_sequence.load(std::memory_order_relaxed) != sequence) {
+                    continue;
+                }
+
+                if (!locked) {
+                    return anchor_time + std::llround((now - anchor) * kUnitsPerSecond);
+                }
+                // Interpolated within the period, held at its end until the next callback; the frame count is exact
+                const double progress = std::min(std::max((now - t0) / (t1 - t0), 0.0), 1.0);
+                const FrameRate rate(sampling_rate);
+                const int64_t start = rate.time(n0);
+                return origin + start + std::llround(progress * double(rate.time(n0 + period_frames) - start));
+            }
+        }
+
+        void free_run(double now) {
+            const int64_t t = time(now);
+            m_sequence.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            m_locked.store(false, std::memory_order_relaxed);
+            m_anchor.store(now, std::memory_order_relaxed);
+            m_anchor_time.store(t, std::memory_order_relaxed);
+            m_sequence.fetch_add(1, std::memory_order_release);
+        }
+
+        void publish(double t0, double t1, int64_t n0, int64_t origin) {
+            m_sequence.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            m_locked.store(true, std::memory_order_relaxed);
+            m_t0.store(t0, std::memory_order_relaxed);
+            m_t1.store(t1, std::memory_order_relaxed);
+            m_n0.store(n0, std::memory_order_relaxed);
+            m_origin.store(origin, std::memory_order_relaxed);
+            m_sequence.fetch_add(1, std::memory_order_release);
+        }
+    };
+
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+
+namespace StupidAR {
+
+    /// PI controller that turns the fill level of a FIFO between two clock domains into a resampling ratio
+    /// The ratio is in input frames per output frame: above 1 when the FIFO fills up (the consumer is slow), below 1 when it drains.
+    /// Unless a target is set explicitly, the fill level observed once the loop has settled becomes the target,
+    /// which keeps the latency (and thus the alignment of the two domains) where it was at start-up.
+    class DriftController {
+    private:
+        double m_kp;
+        double m_ki;
+        double m_smoothing;
+        size_t m_settle_updates;
+
+        bool m_explicit_target;
+        size_t m_updates;
+        bool m_has_target;
+        double m_target;
+        double m_filtered;
+        double m_integral;
+        double m_ratio;
+
+    public:
+        /// `period_frames` is the number of output frames between updates
+        /// `bandwidth` is the loop's natural frequency in radians per update; lower is smoother but slower to lock
+        DriftController(double period_frames, double bandwidth = 0.001, size_t settle_updates = 64)
+            : m_kp(2 * 0.7 * bandwidth / period_frames), // Damping factor of 0.7
+              m_ki(bandwidth * bandwidth / period_frames),
+              m_smoothing(10 * bandwidth < 1 ? 10 * bandwidth : 1),
+              m_settle_updates(settle_updates),
+              m_explicit_target(false),
+              m_target(0) {
+            reset();
+        }
+
+        /// Forgets the loop state and, unless it was set explicitly, the target
+        void reset() {
+            m_updates = 0;
+            m_has_target = m_explicit_target;
+            m_filtered = 0;
+            m_integral = 0;
+            m_ratio = 1;
+        }
+
+        /// Fixes the target fill level instead of latching it
+        void set_target(double fill) {
+            m_explicit_target = true;
+            m_has_target = true;
+            m_target = fill;
+        }
+
+        double target() const {
+            return m_target;
+        }
+
+        /// Feeds one fill level observation, returns the new ratio
+        double update(double fill) {
+            m_filtered = m_updates == 0 ? fill : m_filtered + m_smoothing * (fill - m_filtered);
+            ++m_updates;
+
+            if (!m_has_target) {
+                if (m_updates < m_settle_updates) {
+                    return m_ratio;
+                }
+                m_has_target = true;
+                m_target = m_filtered;
+            }
+
+            const double error = m_filtered - m_target;
+            m_integral += m_ki * error;
+            m_ratio = 1 + m_kp * error + m_integral;
+
+            return m_ratio;
+        }
+
+        double ratio() const {
+            return m_ratio;
+        }
+
+        /// Estimated clock drift of the consumer relative to the producer, in parts per million
+        /// Based on the integral term alone, which is the steady-state ratio without the proportional term's reaction to noise.
+        double drift_ppm() const {
+            return (1 / (1 + m_integral) - 1) * 1e6;
+        }
+    };
+
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+
+namespace StupidAR {
+
+    // Trade-off between the cost of a resampler and how transparent it is
+    enum class ResamplerQuality {
+        Fast,     // Flat to 80% of the lower Nyquist frequency, 60 dB of stopband rejection
+        Balanced, // 90%, 100 dB
+        High,     // 95%, 130 dB
+    };
+
+    // What a quality tier asks of the filters
+    struct ResamplerSpec {
+        double passband;    // Fraction of the lower Nyquist frequency that is kept flat
+        double stopband_db; // Rejection of everything that would alias or image into it
+
+        static ResamplerSpec of(ResamplerQuality quality) {
+            switch (quality) {
+            case ResamplerQuality::Fast:
+                return { 0.80, 60 };
+            case ResamplerQuality::High:
+                return { 0.95, 130 };
+            default:
+                return { 0.90, 100 };
+            }
+        }
+    };
+
+    // Kaiser window design (J. F. Kaiser, "Nonrecursive digital filter design using the I0-sinh window function", 1974)
+    namespace kaiser {
+
+        constexpr double kPi = 3.14159265358979323846;
+
+        // Estimated length of a filter with `stopband_db` of rejection and a transition band `transition` wide,
+        // in cycles per sample
+        inline double length(double stopband_db, double transition) {
+            return (stopband_db - 7.95) / (14.36 * transition);
+        }
+
+        // Window shape for `stopband_db` of rejection, above 50 dB like every resampler tier
+        inline double beta(double stopband_db) {
+            return 0.1102 * (stopband_db - 8.7);
+        }
+
+        // Zeroth-order modified Bessel function of the first kind
+        inline double bessel_i0(double x) {
+            double sum = 1, term = 1;
+            for (int k = 1; k < 64 && term > sum * 1e-17; ++k) {
+                term *= (x / (2 * k)) * (x / (2 * k));
+                sum += term;
+            }
+            return sum;
+        }
+
+        // The window at `r`, from -1 at the first tap to 1 at the last
+        inline double window(double r, double beta) {
+            return bessel_i0(beta * std::sqrt(std::fmax(0.0, 1 - r * r))) / bessel_i0(beta);
+        }
+
+    }
+
+}
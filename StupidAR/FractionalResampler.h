@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+namespace StupidAR {
+
+    /// Variable-ratio resampler for small rate corrections (clock drift), cubic Hermite interpolation in Farrow form
+    /// The ratio may change on every call without discontinuities: only the speed at which the fractional read position
+    /// advances changes, the position itself is continuous.
+    /// Works on interleaved float frames pulled from any source with `size_t read(float* dst, size_t frames)`.
+    class FractionalResampler {
+    public:
+        // Interpolating between x[i] and x[i + 1] needs x[i + 2], so two input frames are always held ahead of the output
+        static const size_t kLookahead = 2;
+
+    private:
+        static const size_t kHistory = 4;
+
+        size_t m_channels;
+        size_t m_max_output_frames;
+        double m_max_ratio;
+        double m_position; // Read position relative to history frame 2
+        std::vector<float> m_frames; // kHistory frames of history followed by the frames read by the current call
+
+    public:
+        FractionalResampler(size_t channels, size_t max_output_frames, double max_ratio = 1.01)
+            : m_channels(channels),
+              m_max_output_frames(max_output_frames),
+              m_max_ratio(max_ratio),
+              m_frames((kHistory + max_input_frames(max_output_frames, max_ratio)) * channels) {
+            reset();
+        }
+
+        size_t channels() const {
+            return m_channels;
+        }
+
+        /// Forgets all history, the next output frame is the next input frame
+        void reset() {
+            std::fill(m_frames.begin(), m_frames.end(), 0.0f);
+            m_position = double(kLookahead);
+        }
+
+        /// Produces `frames` planar output frames, consuming input frames at `ratio` input frames per output frame
+        /// `ratio` is clamped to [1 / max_ratio, max_ratio].
+        /// Returns the number of input frames the source could not deliver (replaced with silence).
+        template <typename Source>
+        size_t process(Source& source, float* const* out, size_t frames, double ratio) {
+            frames = std::min(frames, m_max_output_frames);
+            ratio = std::min(std::max(ratio, 1.0 / m_max_ratio), m_max_ratio);
+
+            if (frames == 0) {
+                return 0;
+            }
+
+            const size_t needed = size_t(std::floor(m_position + (frames - 1) * ratio)) + 1;
+            float* input = &m_frames[kHistory * m_channels];
+            const size_t got = source.read(input, needed);
+            std::fill(input + got * m_channels, input + needed * m_channels, 0.0f);
+
+            double position = m_position;
+            for (size_t i = 0; i < frames; ++i) {
+                const double whole = std::floor(position);
+                const float mu = float(position - whole);
+                const float* x = &m_frames[size_t(ptrdiff_t(whole) + ptrdiff_t(kLookahead) - 1) * m_channels]; // x[-1], whole >= -1
+
+                for (size_t c = 0; c < m_channels; ++c) {
+                    const float xm1 = x[c];
+                    const float x0 = x[m_channels + c];
+                    const float x1 = x[2 * m_channels + c];
+                    const float x2 = x[3 * m_channels + c];
+
+                    const float c1 = 0.5f * (x1 - xm1);
+                    const float c2 = xm1 - 2.5f * x0 + 2.0f * x1 - 0.5f * x2;
+                    const float c3 = 0.5f * (x2 - xm1) + 1.5f * (x0 - x1);
+                    out[c][i] = ((c3 * mu + c2) * mu + c1) * mu + x0;
+                }
+
+                position += ratio;
+            }
+
+            m_position = position - double(needed);
+            std::copy_n(&m_frames[needed * m_channels], kHistory * m_channels, m_frames.begin());
+
+            return needed - got;
+        }
+
+    private:
+        static size_t max_input_frames(size_t output_frames, double max_ratio) {
+            return size_t(std::ceil(kLookahead + output_frames * max_ratio)) + 1;
+        }
+    };
+
+}
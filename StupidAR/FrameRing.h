@@ -0,0 +1,95 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace StupidAR {
+
+    /// Lock-free single-producer, single-consumer FIFO of interleaved float frames
+    /// Meant for passing audio between two device callbacks, neither of which may block.
+    class FrameRing {
+    private:
+        size_t m_channels;
+        size_t m_capacity;
+        std::vector<float> m_data;
+        std::atomic<uint64_t> m_written;
+        std::atomic<uint64_t> m_read;
+
+    public:
+        FrameRing(size_t channels, size_t capacity)
+            : m_channels(channels), m_capacity(capacity), m_data(channels * capacity), m_written(0), m_read(0) {
+        }
+
+        size_t channels() const {
+            return m_channels;
+        }
+
+        size_t capacity() const {
+            return m_capacity;
+        }
+
+        /// Number of frames that can be read, may only be trusted by the consumer
+        size_t available() const {
+            return size_t(m_written.load(std::memory_order_acquire) - m_read.load(std::memory_order_relaxed));
+        }
+
+        /// Number of frames that can be written, may only be trusted by the producer
+        size_t space() const {
+            return m_capacity - size_t(m_written.load(std::memory_order_relaxed) - m_read.load(std::memory_order_acquire));
+        }
+
+        /// Producer side: writes up to `frames` frames from planar buffers, `src[c][i]`
+        /// Returns the number of frames written
+        size_t write(const float* const* src, size_t frames) {
+            const uint64_t w = m_written.load(std::memory_order_relaxed);
+            frames = std::min(frames, space());
+
+            for (size_t i = 0; i < frames; ++i) {
+                float* frame = &m_data[((w + i) % m_capacity) * m_channels];
+                for (size_t c = 0; c < m_channels; ++c) {
+                    frame[c] = src[c][i];
+                }
+            }
+
+            m_written.store(w + frames, std::memory_order_release);
+            return frames;
+        }
+
+        /// Producer side: writes up to `frames` frames of silence
+        size_t write_silence(size_t frames) {
+            const uint64_t w = m_written.load(std::memory_order_relaxed);
+            frames = std::min(frames, space());
+
+            for (size_t i = 0; i < frames; ++i) {
+                std::fill_n(&m_data[((w + i) % m_capacity) * m_channels], m_channels, 0.0f);
+            }
+
+            m_written.store(w + frames, std::memory_order_release);
+            return frames;
+        }
+
+        /// Consumer side: reads up to `frames` interleaved frames into `dst`
+        /// Returns the number of frames read
+        size_t read(float* dst, size_t frames) {
+            const uint64_t r = m_read.load(std::memory_order_relaxed);
+            frames = std::min(frames, available());
+
+            for (size_t i = 0; i < frames; ++i) {
+                const float* frame = &m_data[((r + i) % m_capacity) * m_channels];
+                std::copy_n(frame, m_channels, dst + i * m_channels);
+            }
+
+            m_read.store(r + frames, std::memory_order_release);
+            return frames;
+        }
+
+        /// Empties the ring, only valid while neither side is running
+        void reset() {
+            m_written = 0;
+            m_read = 0;
+        }
+    };
+
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+namespace StupidAR {
+
+    // How a quotient that doesn't come out even is rounded
+    enum class Rounding {
+        Down,    // Toward negative infinity
+        Up,      // Toward positive infinity
+        Nearest, // Halves up
+    };
+
+    // Exact integer arithmetic through 128-bit intermediates, usable in constant expressions
+    namespace wide {
+
+        // High and low halves of a * b, in 32-bit limbs
+        constexpr void multiply_limbs(uint64_t a, uint64_t b, uint64_t& high, uint64_t& low) {
+            const uint64_t a1 = a >> 32, a0 = a & 0xFFFFFFFF;
+            const uint64_t b1 = b >> 32, b0 = b & 0xFFFFFFFF;
+            const uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+            const uint64_t middle = (p00 >> 32) + (p01 & 0xFFFFFFFF) + (p10 & 0xFFFFFFFF);
+            high = p11 + (p01 >> 32) + (p10 >> 32) + (middle >> 32);
+            low = (middle << 32) | (p00 & 0xFFFFFFFF);
+        }
+
+        // (high:low) / divisor, for high < divisor so that the quotient fits, in two 64-by-32-bit steps
+        // (H. S. Warren, "Hacker's Delight", 9-3)
+        constexpr uint64_t divide_limbs(uint64_t high, uint64_t low, uint64_t divisor, uint64_t& remainder) {
+            constexpr uint64_t b = uint64_t(1) << 32;
+            int shift = 0;
+            while ((divisor << shift) >> 63 == 0) {
+                ++shift;
+            }
+            const uint64_t v = divisor << shift;
+            const uint64_t vn1 = v >> 32, vn0 = v & 0xFFFFFFFF;
+            const uint64_t un32 = (high << shift) | (shift == 0 ? 0 : low >> (64 - shift));
+            const uint64_t un10 = low << shift;
+            const uint64_t un1 = un10 >> 32, un0 = un10 & 0xFFFFFFFF;
+
+            uint64_t q1 = un32 / vn1;
+            uint64_t rhat = un32 - q1 * vn1;
+            while (q1 >= b || q1 * vn0 > b * rhat + un1) {
+                --q1;
+                rhat += vn1;
+                if (rhat >= b) {
+                    break;
+                }
+            }
+            const uint64_t un21 = un32 * b + un1 - q1 * v;
+            uint64_t q0 = un21 / vn1;
+            rhat = un21 - q0 * vn1;
+            while (q0 >= b || q0 * vn0 > b * rhat + un0) {
+                --q0;
+                rhat += vn1;
+                if (rhat >= b) {
+                    break;
+                }
+            }
+            remainder = (un21 * b + un0 - q0 * v) >> shift;
+            return q1 * b + q0;
+        }
+
+        // High and low halves of a * b
+        constexpr void multiply(uint64_t a, uint64_t b, uint64_t& high, uint64_t& low) {
+#if defined(__SIZEOF_INT128__)
+            const unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+            high = uint64_t(product >> 64);
+            low = uint64_t(product);
+#else
+            multiply_limbs(a, b, high, low);
+#endif
+        }
+
+        // (high:low) / divisor, for high < divisor
+        constexpr uint64_t divide(uint64_t high, uint64_t low, uint64_t divisor, uint64_t& remainder) {
+#if defined(__SIZEOF_INT128__)
+            const unsigned __int128 dividend = (static_cast<unsigned __int128>(high) << 64) | low;
+            remainder = uint64_t(dividend % divisor);
+            return uint64_t(dividend / divisor);
+#else
+            return divide_limbs(high, low, divisor, remainder);
+#endif
+        }
+
+        // a * b / c, rounded as asked, for c > 0 and a result that fits
+        constexpr int64_t muldiv(int64_t a, int64_t b, int64_t c, Rounding rounding) {
+            const bool negative = (a < 0) != (b < 0);
+            const uint64_t ua = a < 0 ? 0 - uint64_t(a) : uint64_t(a);
+            const uint64_t ub = b < 0 ? 0 - uint64_t(b) : uint64_t(b);
+            uint64_t high = 0, low = 0, remainder = 0;
+            multiply(ua, ub, high, low);
+            uint64_t quotient = divide(high, low, uint64_t(c), remainder);
+
+            // The magnitude goes up where the signed result moves away from zero
+            if (remainder != 0) {
+                switch (rounding) {
+                case Rounding::Down:
+                    quotient += negative ? 1 : 0;
+                    break;
+                case Rounding::Up:
+                    quotient += negative ? 0 : 1;
+                    break;
+                case Rounding::Nearest:
+                    quotient += (negative ? remainder > uint64_t(c) - remainder : remainder >= uint64_t(c) - remainder) ? 1 : 0;
+                    break;
+                }
+            }
+            return negative ? int64_t(0 - quotient) : int64_t(quotient);
+        }
+
+    }
+
+    /// Frames per second as an exact fraction, and conversions between frame counts and 100 ns `REFERENCE_TIME`
+    /// units through it
+    /// 44.1 kHz frames don't divide 100 ns units evenly, and floating point loses track of a position over a long
+    /// session; here every conversion is computed exactly with 128-bit intermediates and rounded once, the way the caller asks.
+    /// With the default `Nearest`, a frame count converted to time and back is unchanged for any position that fits
+    /// in 64 bits (centuries), at any rate up to 10 MHz.
+    class FrameRate {
+    public:
+        static constexpr int64_t kUnitsPerSecond = 10000000;
+
+    private:
+        int64_t m_numerator;
+        int64_t m_denominator;
+
+    public:
+        /// `numerator` frames every `denominator` seconds, both positive for a valid rate; kept in lowest terms
+        constexpr FrameRate(int64_t numerator, int64_t denominator = 1)
+            : m_numerator(numerator), m_denominator(denominator) {
+            int64_t a = numerator < 0 ? -numerator : numerator, b = denominator < 0 ? -denominator : denominator;
+            while (b != 0) {
+                const int64_t t = a % b;
+                a = b;
+                b = t;
+            }
+            if (a > 1) {
+                m_numerator /= a;
+                m_denominator /= a;
+            }
+        }
+
+        /// The rate closest to `frames_per_second` in millionths of a frame per second, for rates that come from a
+        /// floating-point factor (a playback rate)
+        static FrameRate approximate(double frames_per_second) {
+            return FrameRate(std::llround(frames_per_second * 1000000), 1000000);
+        }
+
+        constexpr int64_t numerator() const {
+            return m_numerator;
+        }
+
+        constexpr int64_t denominator() const {
+            return m_denominator;
+        }
+
+        constexpr bool valid() const {
+            return m_numerator > 0 && m_denominator > 0;
+        }
+
+        /// Frames in `time` units
+        constexpr int64_t frames(int64_t time, Rounding rounding = Rounding::Nearest) const {
+            return wide::muldiv(time, m_numerator, m_denominator * kUnitsPerSecond, rounding);
+        }
+
+        /// Time `frames` frames take, in units
+        constexpr int64_t time(int64_t frames, Rounding rounding = Rounding::Nearest) const {
+            return wide::muldiv(frames, m_denominator * kUnitsPerSecond, m_numerator, rounding);
+        }
+
+        /// The number of frames at rate `to` that last as long as `frames` frames at this rate
+        constexpr int64_t convert(int64_t frames, const FrameRate& to, Rounding rounding = Rounding::Nearest) const {
+            return wide::muldiv(frames, to.m_numerator * m_denominator, to.m_denominator * m_numerator, rounding);
+        }
+
+        constexpr bool operator==(const FrameRate& other) const {
+            return m_numerator == other.m_numerator && m_denominator == other.m_denominator;
+        }
+
+        constexpr bool operator!=(const FrameRate& other) const {
+            return !(*this == other);
+        }
+    };
+
+}
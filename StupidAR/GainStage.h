@@ -0,0 +1,194 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "ChannelLayout.h"
+
+namespace StupidAR {
+
+    // How a gain change is spread over its ramp
+    enum class GainCurve {
+        Linear,      // Constant change of amplitude per frame
+        Exponential, // Constant change of level (dB) per frame, even-sounding over the whole range
+    };
+
+    // The gain of every device channel over a run of frames, as handed to the render kernels
+    // While ramping, channel c's gain at frame i is `start[c] + step[c] * i` (Linear) or `start[c] * step[c]^i`
+    // (Exponential), clamped to `target[c]`.
+    struct GainSegment {
+        enum class Kind {
+            Unity,
+            Constant, // `start` holds the gains
+            Ramp,
+        };
+
+        Kind kind;
+        GainCurve curve;
+        const float* start;
+        const float* step;
+        const float* target;
+    };
+
+    /// Per-channel gain that is changed from any thread and applied click-free by the render callback
+    /// A change becomes a ramp from the current to the new gains over `ramp_frames` frames. When the ramp is over the
+    /// gain is constant again, so the renderer can go back to a constant-gain kernel, or to none at all at unity.
+    class GainStage {
+    private:
+        // Exponential ramps can't start from or end at 0, they go to -100 dB instead and snap to 0 at the end
+        static constexpr float kExponentialFloor = 1e-5f;
+
+        std::mutex m_lock; // Guards m_pending, the callback only ever try_locks it
+        std::vector<float> m_pending;
+        std::atomic<bool> m_changed;
+        std::atomic<bool> m_unity_target;
+        GainCurve m_curve;
+        size_t m_ramp_frames;
+
+        // Owned by the callback
+        std::vector<float> m_current;
+        std::vector<float> m_target;
+        std::vector<float> m_step;
+        size_t m_remaining;
+        bool m_unity;
+
+    public:
+        explicit GainStage(int32_t channels = 0, size_t ramp_frames = 480, GainCurve curve = GainCurve::Linear)
+            : m_changed(false), m_unity_target(true), m_curve(curve), m_ramp_frames(ramp_frames), m_remaining(0), m_unity(true) {
+            set_channels(channels);
+        }
+
+        /// Resets every channel to unity gain, may only be called while the callback is quiesced
+        void set_channels(int32_t channels) {
+            std::lock_guard<std::mutex> l(m_lock);
+            m_pending.assign(channels, 1.0f);
+            m_current.assign(channels, 1.0f);
+            m_target.assign(channels, 1.0f);
+            m_step.assign(channels, 0.0f);
+            m_remaining = 0;
+            m_unity = true;
+            m_unity_target = true;
+            m_changed = false;
+        }
+
+        /// May only be called while the callback is quiesced
+        void set_ramp(size_t ramp_frames, GainCurve curve) {
+            m_ramp_frames = ramp_frames;
+            m_curve = curve;
+        }
+
+        /// Sets new target gains, one per channel; callable from any thread
+        /// Returns false if the channel count doesn't match.
+        bool set_gains(const std::vector<float>& gains) {
+            std::lock_guard<std::mutex> l(m_lock);
+            if (gains.size() != m_pending.size()) {
+                return false;
+            }
+
+            m_pending = gains;
+            m_unity_target = std::all_of(gains.begin(), gains.end(), [](float g) { return g == 1.0f; });
+            m_changed.store(true, std::memory_order_release);
+            return true;
+        }
+
+        /// The most recently set target gains
+        std::vector<float> gains() {
+            std::lock_guard<std::mutex> l(m_lock);
+            return m_pending;
+        }
+
+        /// True if the gain is, or is heading to, unity on every channel
+        bool unity_target() const {
+            return m_unity_target;
+        }
+
+        /// Render callback: the gains for the next run of frames, picking up changes made since the last run
+        GainSegment segment() {
+            if (m_changed.load(std::memory_order_acquire) && m_lock.try_lock()) {
+                m_target = m_pending; // Same size, no allocation
+                m_changed = false;
+                m_lock.unlock();
+                start_ramp();
+            }
+
+            if (m_remaining > 0) {
+                return { GainSegment::Kind::Ramp, m_curve, m_current.data(), m_step.data(), m_target.data() };
+            }
+            return { m_unity ? GainSegment::Kind::Unity : GainSegment::Kind::Constant, m_curve, m_current.data(), m_step.data(), m_target.data() };
+        }
+
+        /// Render callback: moves the ramp on by the `frames` frames just rendered with the last `segment()`
+        void advance(size_t frames) {
+            if (m_remaining == 0) {
+                return;
+            }
+
+            if (frames >= m_remaining) {
+                finish_ramp();
+                return;
+            }
+
+            m_remaining -= frames;
+            for (size_t c = 0; c < m_current.size(); ++c) {
+                const float g = m_curve == GainCurve::Linear ? m_current[c] + m_step[c] * float(frames)
+                                                             : m_current[c] * std::pow(m_step[c], float(frames));
+                const bool rising = m_curve == GainCurve::Linear ? m_step[c] >= 0.0f : m_step[c] >= 1.0f;
+                m_current[c] = rising ? std::min(g, m_target[c]) : std::max(g, m_target[c]);
+            }
+        }
+
+    private:
+        void start_ramp() {
+            if (m_ramp_frames == 0) {
+                finish_ramp();
+                return;
+            }
+
+            const float frames = float(m_ramp_frames);
+            for (size_t c = 0; c < m_current.size(); ++c) {
+                if (m_curve == GainCurve::Linear) {
+                    m_step[c] = (m_target[c] - m_current[c]) / frames;
+                } else {
+                    m_current[c] = std::max(m_current[c], kExponentialFloor);
+                    m_step[c] = std::pow(std::max(m_target[c], kExponentialFloor) / m_current[c], 1.0f / frames);
+                }
+            }
+            m_remaining = m_ramp_frames;
+            m_unity = false;
+        }
+
+        void finish_ramp() {
+            m_current = m_target;
+            m_remaining = 0;
+            m_unity = std::all_of(m_current.begin(), m_current.end(), [](float g) { return g == 1.0f; });
+        }
+    };
+
+    // Per-channel gains for an IBasicAudio-style volume and balance, in hundredths of a dB
+    // Volume runs from -10000 (silence) to 0, balance from -10000 (right channels silent) to 10000 (left channels silent).
+    // Sides come from the default layout of `channels`; without one, even channels count as left and odd ones as right.
+    inline std::vector<float> volume_balance_gains(int32_t volume, int32_t balance, int32_t channels) {
+        const auto gain = [](int32_t hundredths_db) {
+            return hundredths_db <= -10000 ? 0.0f : std::pow(10.0f, float(hundredths_db) / 2000.0f);
+        };
+
+        const float level = gain(volume);
+        const float left = balance > 0 ? gain(-balance) : 1.0f;
+        const float right = balance < 0 ? gain(balance) : 1.0f;
+
+        const uint32_t mask = default_channel_mask(channels);
+        const std::vector<uint32_t> speakers = channel_speakers(mask, channels);
+
+        std::vector<float> gains(channels);
+        for (int32_t c = 0; c < channels; ++c) {
+            const int32_t side = mask != 0 ? speaker_side(speakers[c]) : (c % 2 == 0 ? -1 : 1);
+            gains[c] = level * (side < 0 ? left : side > 0 ? right : 1.0f);
+        }
+        return gains;
+    }
+
+}
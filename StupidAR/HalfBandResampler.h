@@ -0,0 +1,353 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "FirDesign.h"
+#include "simd.h"
+
+namespace StupidAR {
+
+    /// Half-band low-pass FIR filter, cutting off at a quarter of its sampling rate, for converting by a factor of two
+    /// A Kaiser-windowed sinc of 4K - 1 taps keeps the half-band structure: every other tap is zero, the center one
+    /// is 1/2, and the others are symmetric about it. Only the K distinct non-zero ones are stored, and each is
+    /// applied to a pair of samples, K multiplications per output where a general filter of the same length has 4K - 1.
+    /// The transition band is centered on the cutoff, so its width alone sets where the passband ends.
+    class HalfBandFilter {
+    private:
+        double m_transition;
+        double m_stopband_db;
+        std::vector<float> m_coefficients; // Of the taps 1, 3, 5... away from the center
+
+    public:
+        /// `transition` is the width of the transition band in cycles per sample, between 0 and 1/2
+        static std::shared_ptr<const HalfBandFilter> build(double transition, double stopband_db) {
+            if (!(transition > 0 && transition < 0.5)) {
+                return nullptr;
+            }
+            return std::shared_ptr<const HalfBandFilter>(new HalfBandFilter(transition, stopband_db));
+        }
+
+        double transition() const {
+            return m_transition;
+        }
+
+        double stopband_db() const {
+            return m_stopband_db;
+        }
+
+        /// K, the number of distinct non-zero taps besides the center one
+        size_t half_taps() const {
+            return m_coefficients.size();
+        }
+
+        size_t length() const {
+            return 4 * m_coefficients.size() - 1;
+        }
+
+        /// out[j] = sum over k < K of c[k] * (x[j + K - 1 - k] + x[j + K + k]), for j < n
+        /// That is the filter without its center tap, run over a stream holding only the samples the non-zero taps
+        /// apply to: the even input samples when decimating, the input itself when interpolating. Vectorized across
+        /// consecutive outputs, so every load is contiguous.
+        void convolve(const float* x, size_t n, float* out) const {
+            const size_t half = m_coefficients.size();
+            const float* c = m_coefficients.data();
+            size_t j = 0;
+#ifdef STUPIDAR_SSE2
+            for (; j + 8 <= n; j += 8) {
+                const float* left = x + j + half - 1;
+                const float* right = x + j + half;
+                __m128 a = _mm_setzero_ps();
+                __m128 b = _mm_setzero_ps();
+                for (size_t k = 0; k < half; ++k) {
+                    const __m128 ck = _mm_set1_ps(c[k]);
+                    a = _mm_add_ps(a, _mm_mul_ps(ck, _mm_add_ps(_mm_loadu_ps(left - k), _mm_loadu_ps(right + k))));
+                    b = _mm_add_ps(b, _mm_mul_ps(ck, _mm_add_ps(_mm_loadu_ps(left - k + 4), _mm_loadu_ps(right + k + 4))));
+                }
+                _mm_storeu_ps(out + j, a);
+                _mm_storeu_ps(out + j + 4, b);
+            }
+#endif
+            for (; j < n; ++j) {
+                const float* left = x + j + half - 1;
+                const float* right = x + j + half;
+                float sum = 0.0f;
+                for (size_t k = 0; k < half; ++k) {
+                    sum += c[k] * (left[-ptrdiff_t(k)] + right[k]);
+                }
+                out[j] = sum;
+            }
+        }
+
+    private:
+        HalfBandFilter(double transition, double stopband_db)
+            : m_transition(transition),
+              m_stopband_db(stopband_db) {
+            // Kaiser's estimate runs a little short for the shortest filters, so it is only where the search starts
+            const double length = kaiser::length(stopband_db, transition) + 1;
+            size_t half = std::max(size_t(std::ceil((length + 1) / 4)), size_t(1));
+            while (!design(half, kaiser::beta(stopband_db))) {
+                ++half;
+            }
+        }
+
+        // Designs the filter with `half` distinct taps, returns whether it rejects the stopband as asked
+        bool design(size_t half, double beta) {
+            // Tap 2k + 1 away from the center; the outermost ones are the ends of the window
+            const double span = double(2 * half - 1);
+            double sum = 0;
+            std::vector<double> taps(half);
+            for (size_t k = 0; k < half; ++k) {
+                const double x = double(2 * k + 1);
+                taps[k] = (k % 2 == 0 ? 1 : -1) / (kaiser::kPi * x) * kaiser::window(x / span, beta);
+                sum += taps[k];
+            }
+
+            // Unity gain at DC: 1/2 + 2 * sum = 1
+            m_coefficients.resize(half);
+            for (size_t k = 0; k < half; ++k) {
+                m_coefficients[k] = float(taps[k] * 0.25 / sum);
+            }
+
+            // The response of the coefficients as stored, across the stopband, densely enough to catch every ripple
+            const double limit = std::pow(10.0, -m_stopband_db / 20);
+            const double start = 0.25 + 0.5 * m_transition;
+            const size_t points = 64 * half;
+            for (size_t i = 0; i <= points; ++i) {
+                const double f = start + (0.5 - start) * double(i) / double(points);
+                double response = 0.5;
+                for (size_t k = 0; k < half; ++k) {
+                    response += 2 * double(m_coefficients[k]) * std::cos(2 * kaiser::kPi * f * double(2 * k + 1));
+                }
+                if (std::abs(response) > limit) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    };
+
+    /// Converts by 2^n on planar float channels, through a cascade of `HalfBandFilter`s, one per factor of two
+    /// Decimating, a stage computes only the outputs it keeps, each from the even input samples under the non-zero
+    /// taps plus the odd one under the center tap; interpolating, it passes every input sample through (the center
+    /// tap) and computes only the ones in between. The stage filters are given from the lowest rate up: the one at
+    /// the lowest rate sets the passband and has to be sharp, the ones above it only keep images and aliases off
+    /// that passband, so they are much shorter.
+    /// Unlike `PolyphaseFilter`, the top of the input band may alias into the transition band above the passband
+    /// when decimating; the passband itself is protected all the same.
+    /// Block interface like `PolyphaseResampler`: write up to `max_input_frames()` frames at `input()`, `process()`
+    /// them; the state carries over from one call to the next.
+    class HalfBandResampler {
+    private:
+        struct Stage {
+            std::shared_ptr<const HalfBandFilter> filter;
+            size_t capacity; // Input frames per call
+            size_t offset;   // Floats per channel before the input, the most history the stage keeps
+            size_t history;  // Frames of history right before the input now
+            size_t stride;
+            std::vector<float> frames;
+
+            float* input(size_t channel) {
+                return &frames[channel * stride + offset];
+            }
+        };
+
+        bool m_up;
+        size_t m_channels;
+        size_t m_max_input_frames;
+        std::vector<Stage> m_stages; // In processing order: from the lowest rate up when interpolating, down otherwise
+        std::vector<float*> m_inputs;
+        std::vector<float> m_even;   // Scratch: a channel's even and odd samples, or its filtered ones
+        std::vector<float> m_odd;
+        std::vector<float> m_filtered;
+
+    public:
+        /// `filters` from the stage at the lowest rate up; `up` to interpolate, otherwise decimates
+        HalfBandResampler(const std::vector<std::shared_ptr<const HalfBandFilter>>& filters, bool up, size_t channels, size_t max_input_frames)
+            : m_up(up),
+              m_channels(channels),
+              m_max_input_frames(max_input_frames),
+              m_inputs(channels) {
+            size_t capacity = max_input_frames;
+            size_t scratch = 0, filtered = 0;
+            for (size_t s = 0; s < filters.size(); ++s) {
+                Stage stage;
+                stage.filter = filters[up ? s : filters.size() - 1 - s];
+                stage.capacity = capacity;
+                const size_t half = stage.filter->half_taps();
+                stage.offset = up ? 2 * half - 1 : 4 * half - 1;
+                stage.history = 0;
+                stage.stride = stage.offset + capacity;
+                stage.frames.resize(channels * stage.stride);
+                scratch = std::max(scratch, stage.stride / 2 + 1);
+                filtered = std::max(filtered, capacity);
+                m_stages.push_back(std::move(stage));
+                capacity = up ? 2 * capacity : capacity / 2 + 1;
+            }
+            m_even.resize(scratch);
+            m_odd.resize(scratch);
+            m_filtered.resize(filtered);
+
+            for (size_t c = 0; c < channels; ++c) {
+                m_inputs[c] = m_stages.empty() ? nullptr : m_stages.front().input(c);
+            }
+            reset();
+        }
+
+        bool up() const {
+            return m_up;
+        }
+
+        /// n, the cascade converts by 2^n
+        size_t stages() const {
+            return m_stages.size();
+        }
+
+        /// Filter of stage `s`, counted from the lowest rate up
+        const HalfBandFilter& filter(size_t s) const {
+            return *m_stages[m_up ? s : m_stages.size() - 1 - s].filter;
+        }
+
+        size_t channels() const {
+            return m_channels;
+        }
+
+        /// Group delay in input frames, each stage's filter being symmetric about its center tap
+        double delay_frames() const {
+            double delay = 0;
+            double scale = 1; // Input frames per frame at the stage's input
+            for (const Stage& stage : m_stages) {
+                const double center = double(2 * stage.filter->half_taps() - 1); // At the higher of the stage's rates
+                if (m_up) {
+                    delay += 0.5 * center * scale;
+                    scale *= 0.5;
+                } else {
+                    delay += center * scale;
+                    scale *= 2;
+                }
+            }
+            return delay;
+        }
+
+        size_t max_input_frames() const {
+            return m_max_input_frames;
+        }
+
+        /// Most frames one `process()` call can produce
+        size_t max_output_frames() const {
+            return m_up ? m_max_input_frames << m_stages.size() : (m_stages.back().capacity + 1) / 2;
+        }
+
+        /// Forgets the filter state: the next input starts from silence
+        void reset() {
+            for (Stage& stage : m_stages) {
+                std::fill(stage.frames.begin(), stage.frames.end(), 0.0f);
+                // A decimator keeps an odd number of frames at first, so that outputs land on whole pairs
+                stage.history = m_up ? stage.offset : stage.offset - 1;
+            }
+        }
+
+        /// Per channel, where the input of the next `process()` goes
+        float* const* input() const {
+            return m_inputs.data();
+        }
+
+        /// Number of frames the next `process()` of `frames` input frames produces
+        size_t output_frames(size_t frames) const {
+            for (const Stage& stage : m_stages) {
+                frames = stage_output_frames(stage, frames);
+            }
+            return frames;
+        }
+
+        /// Filters the `frames` frames written to `input()` into `out`, returns the number of frames produced
+        size_t process(size_t frames, float* const* out) {
+            frames = std::min(frames, m_max_input_frames);
+            for (size_t s = 0; s < m_stages.size(); ++s) {
+                Stage& stage = m_stages[s];
+                const size_t produced = stage_output_frames(stage, frames);
+                for (size_t c = 0; c < m_channels; ++c) {
+                    float* target = s + 1 < m_stages.size() ? m_stages[s + 1].input(c) : out[c];
+                    if (m_up) {
+                        interpolate(stage, c, frames, target);
+                    } else {
+                        decimate(stage, c, frames, produced, target);
+                    }
+                }
+                if (!m_up) {
+                    stage.history += frames - 2 * produced;
+                }
+                frames = produced;
+            }
+            return frames;
+        }
+
+    private:
+        size_t stage_output_frames(const Stage& stage, size_t frames) const {
+            return m_up ? 2 * frames : (stage.history + frames - (stage.offset - 1)) / 2;
+        }
+
+        // Output m is centered on input 2m + 2K - 1 counted from the start of the history
+        void decimate(Stage& stage, size_t channel, size_t frames, size_t produced, float* out) {
+            const size_t half = stage.filter->half_taps();
+            float* line = &stage.frames[channel * stage.stride];
+            const float* x = line + stage.offset - stage.history;
+
+            // The pairs the outputs read, split into even and odd samples
+            const size_t pairs = produced + 2 * half - 1;
+            float* even = m_even.data();
+            float* odd = m_odd.data();
+            size_t i = 0;
+#ifdef STUPIDAR_SSE2
+            for (; i + 4 <= pairs; i += 4) {
+                const __m128 a = _mm_loadu_ps(x + 2 * i);
+                const __m128 b = _mm_loadu_ps(x + 2 * i + 4);
+                _mm_storeu_ps(even + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+                _mm_storeu_ps(odd + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+            }
+#endif
+            for (; i < pairs; ++i) {
+                even[i] = x[2 * i];
+                odd[i] = x[2 * i + 1];
+            }
+
+            stage.filter->convolve(even, produced, out);
+            simd::mac(out, odd + half - 1, 0.5f, produced);
+
+            // What the next outputs need, right before the next input
+            const size_t available = stage.history + frames;
+            const size_t keep = available - 2 * produced;
+            std::copy(x + 2 * produced, x + available, line + stage.offset - keep);
+        }
+
+        // Output 2m is halfway between inputs m - K and m - K + 1, output 2m + 1 is input m - K + 1
+        void interpolate(Stage& stage, size_t channel, size_t frames, float* out) {
+            const size_t half = stage.filter->half_taps();
+            float* line = &stage.frames[channel * stage.stride];
+            float* filtered = m_filtered.data();
+            stage.filter->convolve(line, frames, filtered);
+
+            const float* center = line + half;
+            size_t m = 0;
+#ifdef STUPIDAR_SSE2
+            const __m128 two = _mm_set1_ps(2.0f);
+            for (; m + 4 <= frames; m += 4) {
+                const __m128 between = _mm_mul_ps(two, _mm_loadu_ps(filtered + m));
+                const __m128 through = _mm_loadu_ps(center + m);
+                _mm_storeu_ps(out + 2 * m, _mm_unpacklo_ps(between, through));
+                _mm_storeu_ps(out + 2 * m + 4, _mm_unpackhi_ps(between, through));
+            }
+#endif
+            for (; m < frames; ++m) {
+                out[2 * m] = 2.0f * filtered[m];
+                out[2 * m + 1] = center[m];
+            }
+
+            std::copy(line + frames, line + frames + stage.offset, line);
+        }
+    };
+
+}
@@ -7,12 +7,32 @@
 
 namespace StupidAR {
 
+    // Everything the PCM data handed to an agent depends on
+    struct StreamFormat {
+        int32_t sampling_rate;
+        int32_t buffer_size;
+        int32_t output_channels;
+        SampleFormat pcm_format;
+
+        bool operator==(const StreamFormat& other) const {
+            return sampling_rate == other.sampling_rate && buffer_size == other.buffer_size
+                && output_channels == other.output_channels && pcm_format == other.pcm_format;
+        }
+
+        bool operator!=(const StreamFormat& other) const {
+            return !(*this == other);
+        }
+    };
+
     // It manages device/driver specific stuff. It requests PCM data from you via a callback. The callback is passed to a constructor or a factory function.
     class IOutputAgent {
     public:
         // Accepts an array of buffers, one per channel. Returns true when successfully filled the buffers.
         using CallbackType = std::function<bool(char**)>;
 
+        // Notification of a format change, see `reconfigure()`. Receives the old and the new format.
+        using ReconfigureCallbackType = std::function<void(const StreamFormat&, const StreamFormat&)>;
+
         virtual ~IOutputAgent() {}
 
         // Sampling rate in Hz
@@ -27,11 +47,35 @@ namespace StupidAR {
         // The expected format for the PCM data
         virtual SampleFormat pcm_format() = 0;
 
+        // Frames from the callback returning a period to the DAC playing its first frame, as the device reports it
+        // (the buffering of the driver and the device, the converter's filters). It may change with the format.
+        virtual int32_t output_latency() = 0;
+
+        // Pulls up to `n_buffers` periods through the callback before the device is started, so that the device
+        // has data to play the instant it starts. The primed periods are played first after `start()`, and the
+        // callback is only invoked again once they are used up, which gives the upstream graph a head start.
+        // Must be called while stopped. Returns the number of periods primed (stops at the first failed callback).
+        virtual int32_t prepare(int32_t n_buffers) = 0;
+
         // The agent will start requesting PCM data after this method returns.
         virtual void start() = 0;
 
         // The agent will stop requesting PCM data after this method returns.
         virtual void stop() = 0;
+
+        // Sets the listener for format changes, whether requested through `reconfigure()` or initiated by the device.
+        // The handshake: the agent quiesces the callback (waits for a running one to return and invokes none),
+        // applies the new format, calls the listener so that downstream buffers, plans and queues can be adapted
+        // in place, and then resumes requesting data (if it was started) in the new format.
+        virtual void set_reconfigure_callback(ReconfigureCallbackType callback) = 0;
+
+        // Changes the sampling rate and buffer size without stopping or recreating the agent. Primed periods are dropped.
+        // Returns false if the device does not support the requested format, in which case nothing changes.
+        virtual bool reconfigure(int32_t sampling_rate, int32_t buffer_size) = 0;
+
+        StreamFormat format() {
+            return { sampling_rate(), buffer_size(), output_channels(), pcm_format() };
+        }
     };
 
 }
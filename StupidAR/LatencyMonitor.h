@@ -0,0 +1,109 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace StupidAR {
+
+    // End-to-end latency over a session, in seconds
+    struct LatencyStats {
+        double current;
+        double min;
+        double average;
+        double max;
+        double p99;            // 99% of the observations were at most this, to the resolution of the histogram
+        uint64_t observations; // 0 before the first one, when the rest is 0 as well
+    };
+
+    /// Keeps the running statistics of a latency observed over and over (once per agent callback)
+    /// Observations go into a histogram of fixed bins, so that percentiles come without keeping the observations or
+    /// sorting them; longer ones than the histogram's range all land in its last bin. One thread observes, wait-free
+    /// and without allocating, any other may read the statistics at any time; a read racing an observation may see
+    /// it in some of the figures and not yet in others.
+    class LatencyMonitor {
+    public:
+        static constexpr double kResolutionSeconds = 0.0005;
+        static constexpr size_t kBins = 8192; // Up to 4 s
+
+    private:
+        std::unique_ptr<std::atomic<uint64_t>[]> m_bins;
+        std::atomic<uint64_t> m_observations;
+        std::atomic<double> m_current;
+        std::atomic<double> m_min;
+        std::atomic<double> m_max;
+        std::atomic<double> m_sum;
+
+    public:
+        LatencyMonitor()
+            : m_bins(new std::atomic<uint64_t>[kBins]) {
+            reset();
+        }
+
+        /// Starts over, may only be called while nothing is observed
+        void reset() {
+            for (size_t i = 0; i < kBins; ++i) {
+                m_bins[i].store(0, std::memory_order_relaxed);
+            }
+            m_current.store(0, std::memory_order_relaxed);
+            m_min.store(0, std::memory_order_relaxed);
+            m_max.store(0, std::memory_order_relaxed);
+            m_sum.store(0, std::memory_order_relaxed);
+            m_observations.store(0, std::memory_order_release);
+        }
+
+        /// Observing thread only
+        void observe(double seconds) {
+            seconds = std::max(seconds, 0.0);
+            const uint64_t count = m_observations.load(std::memory_order_relaxed);
+            m_current.store(seconds, std::memory_order_relaxed);
+            m_min.store(count == 0 ? seconds : std::min(m_min.load(std::memory_order_relaxed), seconds), std::memory_order_relaxed);
+            m_max.store(std::max(m_max.load(std::memory_order_relaxed), seconds), std::memory_order_relaxed);
+            m_sum.store(m_sum.load(std::memory_order_relaxed) + seconds, std::memory_order_relaxed);
+            m_bins[bin(seconds)].fetch_add(1, std::memory_order_relaxed);
+            m_observations.store(count + 1, std::memory_order_release);
+        }
+
+        LatencyStats stats() const {
+            LatencyStats stats = {};
+            stats.observations = m_observations.load(std::memory_order_acquire);
+            if (stats.observations == 0) {
+                return stats;
+            }
+            stats.current = m_current.load(std::memory_order_relaxed);
+            stats.min = m_min.load(std::memory_order_relaxed);
+            stats.max = m_max.load(std::memory_order_relaxed);
+            stats.average = m_sum.load(std::memory_order_relaxed) / double(stats.observations);
+            stats.p99 = percentile(0.99, stats.min, stats.max);
+            return stats;
+        }
+
+    private:
+        static size_t bin(double seconds) {
+            return std::min(size_t(seconds / kResolutionSeconds), kBins - 1);
+        }
+
+        // Upper edge of the bin the fraction `p` of the observations reaches, within [min, max]
+        double percentile(double p, double min, double max) const {
+            uint64_t total = 0;
+            for (size_t i = 0; i < kBins; ++i) {
+                total += m_bins[i].load(std::memory_order_relaxed);
+            }
+
+            const uint64_t rank = std::max(uint64_t(std::ceil(p * double(total))), uint64_t(1));
+            uint64_t seen = 0;
+            size_t i = 0;
+            for (; i + 1 < kBins; ++i) {
+                seen += m_bins[i].load(std::memory_order_relaxed);
+                if (seen >= rank) {
+                    break;
+                }
+            }
+            return std::min(std::max(double(i + 1) * kResolutionSeconds, min), max);
+        }
+    };
+
+}
@@ -0,0 +1,31 @@
+#include <cmath>
+
+#include "LatencyReport.h"
+
+namespace StupidAR {
+
+    namespace {
+        REFERENCE_TIME ToReferenceTime(double seconds) {
+            return REFERENCE_TIME(std::llround(seconds * RenderCore<IMediaSample>::kUnitsPerSecond));
+        }
+    }
+
+    LatencyReport::LatencyReport(LPUNKNOWN pUnknown, const RenderCore<IMediaSample>& core)
+        : CUnknown(NAME("Latency Report"), pUnknown),
+          m_core(core) {
+    }
+
+    STDMETHODIMP LatencyReport::GetLatency(LatencyReportData* pData) {
+        CheckPointer(pData, E_POINTER);
+
+        const LatencyStats stats = m_core.latency_stats();
+        pData->rtCurrent = ToReferenceTime(stats.current);
+        pData->rtMin = ToReferenceTime(stats.min);
+        pData->rtAverage = ToReferenceTime(stats.average);
+        pData->rtMax = ToReferenceTime(stats.max);
+        pData->rtP99 = ToReferenceTime(stats.p99);
+        pData->cObservations = stats.observations;
+        return S_OK;
+    }
+
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "streams.h"
+#include "RenderCore.h"
+
+namespace StupidAR {
+
+    // End-to-end latency of the renderer, from Receive() to the DAC, in 100 ns units
+    struct LatencyReportData {
+        REFERENCE_TIME rtCurrent;
+        REFERENCE_TIME rtMin;
+        REFERENCE_TIME rtAverage;
+        REFERENCE_TIME rtMax;
+        REFERENCE_TIME rtP99;
+        ULONGLONG cObservations; // One per device period since the filter last went active, 0 before the first
+    };
+
+    const IID IID_ILatencyReport = { 0x5bc6c108, 0x1861, 0x488e, { 0xb0, 0xd0, 0x23, 0x24, 0xb0, 0x8c, 0x8c, 0xd3 } }; // {5BC6C108-1861-488E-B0D0-2324B08C8CD3}
+
+    DECLARE_INTERFACE_(ILatencyReport, IUnknown) {
+        // The estimate as of the last device period, and its statistics since the filter last went active
+        STDMETHOD(GetLatency)(THIS_ LatencyReportData* pData) PURE;
+    };
+
+    // ILatencyReport on top of the render core's latency monitor
+    class LatencyReport final : public CUnknown, public ILatencyReport {
+    public:
+        LatencyReport(LPUNKNOWN, const RenderCore<IMediaSample>&);
+
+        DECLARE_IUNKNOWN
+
+        STDMETHODIMP GetLatency(LatencyReportData* pData) override;
+
+    private:
+        const RenderCore<IMediaSample>& m_core;
+    };
+
+}
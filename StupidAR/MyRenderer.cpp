@@ -1,12 +1,167 @@
+#include <algorithm>
+#include <limits>
+#include <thread>
+
+#include <mmreg.h>
+
+#include "common.h"
 #include "MyRenderer.h"
+#include "NullOutputAgent.h"
 
 namespace StupidAR {
 
+    namespace {
+        // Upper bound only: the upstream allocator's buffer count is what actually limits the queue depth
+        const size_t kQueueSamples = 64;
+
+        // Periods pulled through the callback before the device starts, so that it plays from the very first period
+        const int32_t kPrimeBuffers = 2;
+
+        // The one place that decides what the filter plays to
+        // Until there is a device agent, a clock-paced null device stands in for it.
+        std::unique_ptr<IOutputAgent> CreateOutputAgent(IOutputAgent::CallbackType callback) {
+            return std::make_unique<NullOutputAgent>(std::move(callback), 48000, 480, 2, SampleFormat::Float);
+        }
+
+        // Helpers for the callback on devices with enough channels to be worth it, one per 8 channels beyond the first 8
+        // and no more than there are other cores; nullptr for serial rendering
+        std::shared_ptr<WorkerPool> CreateWorkerPool(int32_t channels) {
+            if (channels < RenderCore<IMediaSample>::kParallelMinChannels) {
+                return nullptr;
+            }
+
+            const size_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+            const size_t workers = std::min(cores - 1, size_t(channels / 8 - 1));
+            return workers != 0 ? std::make_shared<WorkerPool>(workers) : nullptr;
+        }
+
+        bool ParseWaveFormat(const CMediaType* pMediaType, SourceFormat& source) {
+            if (*pMediaType->FormatType() != FORMAT_WaveFormatEx || pMediaType->FormatLength() < sizeof(WAVEFORMATEX)) {
+                return false;
+            }
+
+            const WAVEFORMATEX* wfx = reinterpret_cast<const WAVEFORMATEX*>(pMediaType->Format());
+            bool is_float = wfx->wFormatTag == WAVE_FORMAT_IEEE_FLOAT;
+            bool is_pcm = wfx->wFormatTag == WAVE_FORMAT_PCM;
+            source.channel_mask = 0;
+            source.valid_bits = 0;
+
+            if (wfx->wFormatTag == WAVE_FORMAT_EXTENSIBLE) {
+                if (pMediaType->FormatLength() < sizeof(WAVEFORMATEXTENSIBLE)) {
+                    return false;
+                }
+                const WAVEFORMATEXTENSIBLE* wfex = reinterpret_cast<const WAVEFORMATEXTENSIBLE*>(wfx);
+                is_float = wfex->SubFormat == MEDIASUBTYPE_IEEE_FLOAT;
+                is_pcm = wfex->SubFormat == MEDIASUBTYPE_PCM;
+                source.channel_mask = wfex->dwChannelMask;
+                if (wfex->Samples.wValidBitsPerSample != 0 && wfex->Samples.wValidBitsPerSample != wfx->wBitsPerSample) {
+                    source.valid_bits = wfex->Samples.wValidBitsPerSample;
+                }
+            }
+
+            switch (wfx->wBitsPerSample) {
+            case 8:
+                source.format = SampleFormat::U8;
+                break;
+            case 16:
+                source.format = SampleFormat::S16;
+                break;
+            case 24:
+                source.format = SampleFormat::S24;
+                break;
+            case 32:
+                source.format = is_float ? SampleFormat::Float : SampleFormat::S32;
+                break;
+            case 64:
+                source.format = SampleFormat::Double;
+                break;
+            default:
+                return false;
+            }
+            if (!(is_pcm && wfx->wBitsPerSample <= 32) && !(is_float && wfx->wBitsPerSample >= 32)) {
+                return false;
+            }
+            if (source.valid_bits > wfx->wBitsPerSample) {
+                return false;
+            }
+
+            source.channels = wfx->nChannels;
+            source.sampling_rate = wfx->nSamplesPerSec;
+            if (source.channel_mask == 0) {
+                // Plain PCM and float, and extensible formats without positions: the usual layout for the count
+                source.channel_mask = default_channel_mask(source.channels);
+            }
+            return source.channels > 0 && wfx->nBlockAlign == source.frame_bytes();
+        }
+    }
+
     MyRenderer::MyRenderer(LPUNKNOWN pUnknown, HRESULT* pResult)
-        : CBaseRenderer(kMyFilterGuid, kMyFilterName, pUnknown, pResult) {
+        : CBaseRenderer(kMyFilterGuid, kMyFilterName, pUnknown, pResult),
+          m_core(kQueueSamples),
+          m_device_clock(monotonic_seconds()),
+          m_agent(CreateOutputAgent([this](char** buffers) {
+              m_device_clock.on_period(monotonic_seconds());
+              return m_core.render(buffers);
+          })),
+          m_basic_audio(GetOwner(), m_core.gain(), m_agent->output_channels()),
+          m_latency_report(GetOwner(), m_core),
+          m_clock(std::make_unique<AudioClock>(GetOwner(), pResult, m_device_clock)),
+          m_drained_work(CreateThreadpoolWork(OnDrained, this, nullptr)) {
+        if (!m_drained_work && pResult && SUCCEEDED(*pResult)) {
+            *pResult = HRESULT_FROM_WIN32(GetLastError());
+        }
+        m_core.set_device_format(m_agent->format());
+        m_core.set_output_latency(m_agent->output_latency());
+        m_core.set_worker_pool(CreateWorkerPool(m_agent->output_channels()));
+        m_core.enable_adaptive_depth();
+        m_core.set_wait_callback([this]() {
+            m_start_gate.notify(std::numeric_limits<size_t>::max()); // Full before the gate's threshold: as much as there will be
+        });
+        m_core.set_drained_callback([this]() {
+            if (m_drained_work) {
+                SubmitThreadpoolWork(m_drained_work);
+            }
+        });
+        m_agent->set_reconfigure_callback([this](const StreamFormat& old_format, const StreamFormat& new_format) {
+            m_core.on_reconfigure(old_format, new_format);
+            m_core.set_output_latency(m_agent->output_latency());
+            m_device_clock.set_format(monotonic_seconds(), new_format.sampling_rate, new_format.buffer_size);
+        });
     }
 
     MyRenderer::~MyRenderer() {
+        m_agent->stop();
+        if (m_drained_work) {
+            WaitForThreadpoolWorkCallbacks(m_drained_work, TRUE);
+            CloseThreadpoolWork(m_drained_work);
+        }
+    }
+
+    STDMETHODIMP MyRenderer::NonDelegatingQueryInterface(REFIID riid, void** ppv) {
+        if (riid == IID_IBasicAudio) {
+            return GetInterface(static_cast<IBasicAudio*>(&m_basic_audio), ppv);
+        }
+        if (riid == IID_ILatencyReport) {
+            return GetInterface(static_cast<ILatencyReport*>(&m_latency_report), ppv);
+        }
+        if (riid == IID_IReferenceClock || riid == IID_IReferenceClockTimerControl) {
+            // Exposing the clock makes the graph pick it as the reference, and time follows the device
+            return m_clock->NonDelegatingQueryInterface(riid, ppv);
+        }
+
+        return CBaseRenderer::NonDelegatingQueryInterface(riid, ppv);
+    }
+
+    // Unless the graph runs on the device's clock, upstream may deliver at a slightly different pace than the device
+    // plays: the core resamples to make up for it. The graph manager only changes clocks while stopped, with nothing queued.
+    STDMETHODIMP MyRenderer::SetSyncSource(IReferenceClock* pClock) {
+        CAutoLock cRendererLock(&m_InterfaceLock);
+
+        RETURN_FAILED(CBaseRenderer::SetSyncSource(pClock));
+        if (m_State == State_Stopped) {
+            m_core.set_drift_compensation(pClock != nullptr && pClock != static_cast<IReferenceClock*>(m_clock.get()));
+        }
+        return S_OK;
     }
 
     HRESULT MyRenderer::CheckMediaType(const CMediaType*) {
@@ -14,12 +169,156 @@ namespace StupidAR {
         return S_OK;
     }
 
+    // Builds (or fetches from the cache) the render plan for the new format, so the callback never looks at the format
     HRESULT MyRenderer::SetMediaType(const CMediaType* pMediaType) {
+        SourceFormat source;
+        if (!ParseWaveFormat(pMediaType, source) || !m_core.set_source_format(source)) {
+            return VFW_E_TYPE_NOT_ACCEPTED;
+        }
+
         return S_OK;
     }
 
     HRESULT MyRenderer::DoRenderSample(IMediaSample* pSample) {
+        // Not used: Receive() queues samples for the agent instead of scheduling them on the reference clock
         return S_OK;
     }
 
+    // Samples are queued by reference as soon as they arrive, the agent's callback paces the stream.
+    // The queue may block, so the filter locks are only held around the checks, never around the push:
+    // Stop() and BeginFlush() take them and then release a blocked push through the core.
+    // The rate of the segment (from NewSegment(), on this same thread) is applied by time-stretching on push.
+    HRESULT MyRenderer::Receive(IMediaSample* pSample) {
+        double rate;
+        {
+            CAutoLock cRendererLock(&m_InterfaceLock);
+
+            RETURN_FAILED(m_pInputPin->CBaseInputPin::Receive(pSample));
+            if (m_bEOS) {
+                return VFW_E_SAMPLE_REJECTED_EOS;
+            }
+
+            AM_SAMPLE2_PROPERTIES* pProps = m_pInputPin->SampleProps();
+            if (pProps->pMediaType) {
+                RETURN_FAILED(m_pInputPin->SetMediaType(static_cast<CMediaType*>(pProps->pMediaType)));
+            }
+            rate = m_pInputPin->CurrentRate();
+        }
+        m_core.set_playback_rate(rate);
+
+        BYTE* pData = nullptr;
+        RETURN_FAILED(pSample->GetPointer(&pData));
+
+        REFERENCE_TIME tStart, tStop;
+        if (FAILED(pSample->GetTime(&tStart, &tStop))) {
+            tStart = RenderCore<IMediaSample>::kNoTime;
+        }
+
+        if (!m_core.push(pSample, reinterpret_cast<const char*>(pData), pSample->GetActualDataLength(),
+                         RenderCore<IMediaSample>::Silence::Unknown, tStart)) {
+            return S_FALSE; // Flushing or stopping
+        }
+        m_start_gate.notify(size_t(m_core.queued_frames()));
+
+        Ready(); // A queued sample completes a pending transition to paused
+        return S_OK;
+    }
+
+    // The base class asks whether a sample is held when a transition to paused completes; here samples are queued
+    // in the core instead, and a pause from running with audio queued is ready right away. Nothing else would make it
+    // ready: a paused agent plays nothing, so a push waiting for room never returns to call Ready().
+    BOOL MyRenderer::HaveCurrentSample() {
+        return m_core.queued_frames() > 0 ? TRUE : FALSE;
+    }
+
+    HRESULT MyRenderer::BeginFlush() {
+        m_core.begin_flush();
+        return CBaseRenderer::BeginFlush();
+    }
+
+    HRESULT MyRenderer::EndFlush() {
+        m_core.end_flush();
+        return CBaseRenderer::EndFlush();
+    }
+
+    HRESULT MyRenderer::Active() {
+        m_core.end_flush();
+        m_core.reset_stats();
+        return CBaseRenderer::Active();
+    }
+
+    HRESULT MyRenderer::Inactive() {
+        m_core.begin_flush();
+        m_start_gate.disarm();
+        m_agent->stop();
+        m_device_clock.stop(monotonic_seconds());
+        m_core.release_current();
+
+        const auto stats = m_core.stats();
+        DbgLog((LOG_TRACE, 1, TEXT("Session: %I64u frames, %I64u silent (fast path), %I64u bit-perfect, %I64u underrun"),
+                stats.frames_rendered, stats.silent_frames, stats.bit_perfect_frames, stats.underrun_frames));
+        DbgLog((LOG_TRACE, 1, TEXT("Discontinuities: %I64u frames of silence inserted, %I64u dropped"), stats.inserted_frames, stats.dropped_frames));
+        DbgLog((LOG_TRACE, 1, TEXT("Queue depth: target %d ms, %u samples"), int(m_core.target_latency() * 1000), unsigned(m_core.queue_capacity())));
+        const LatencyStats latency = m_core.latency_stats();
+        DbgLog((LOG_TRACE, 1, TEXT("Latency: %d ms min, %d ms average, %d ms max, %d ms p99"), int(latency.min * 1000),
+                int(latency.average * 1000), int(latency.max * 1000), int(latency.p99 * 1000)));
+
+        return CBaseRenderer::Inactive();
+    }
+
+    // The base class would complete right away: samples are queued in the core, never held as m_pMediaSample.
+    // SendEndOfStream() holds EC_COMPLETE back until the core has played the queue out and calls OnDrained().
+    HRESULT MyRenderer::EndOfStream() {
+        m_core.end_of_stream();
+        m_start_gate.notify(std::numeric_limits<size_t>::max()); // Nothing more is coming, play what there is
+        return CBaseRenderer::EndOfStream();
+    }
+
+    // Called with the renderer lock held, from EndOfStream(), StartStreaming() and OnDrained(); flushes and stops
+    // reset both the core and the base class's end of stream, so a pending completion is cancelled
+    HRESULT MyRenderer::SendEndOfStream() {
+        if (!m_core.drained()) {
+            return S_OK;
+        }
+        return CBaseRenderer::SendEndOfStream();
+    }
+
+    VOID CALLBACK MyRenderer::OnDrained(PTP_CALLBACK_INSTANCE, PVOID pContext, PTP_WORK) {
+        MyRenderer* pRenderer = static_cast<MyRenderer*>(pContext);
+        CAutoLock cSampleLock(&pRenderer->m_RendererLock);
+        pRenderer->SendEndOfStream();
+    }
+
+    // Run(tStart) maps stream time 0 to tStart on the reference clock; the device starts playing right away, so its
+    // first frame plays at stream time now - tStart, and the core lines the queued samples up with that.
+    HRESULT MyRenderer::OnStartStreaming() {
+        m_core.restart_timing();
+        const double now = monotonic_seconds();
+        REFERENCE_TIME reference;
+        if (!m_pClock || FAILED(m_pClock->GetTime(&reference))) {
+            reference = m_device_clock.time(now);
+        }
+        m_core.align_start(reference - REFERENCE_TIME(m_tStart));
+
+        // Whatever was queued while paused is primed right away; a short queue waits for upstream to catch up, unless
+        // nothing more can come before the agent runs (the end of the stream, or a push waiting for room)
+        const StreamFormat format = m_agent->format();
+        m_device_clock.start(now, format.sampling_rate, format.buffer_size);
+        m_start_gate.arm(*m_agent, kPrimeBuffers, size_t(kPrimeBuffers + 1) * size_t(format.buffer_size));
+        const bool complete = m_bEOS || m_core.push_waiting();
+        m_start_gate.notify(complete ? std::numeric_limits<size_t>::max() : size_t(m_core.queued_frames()));
+        return S_OK;
+    }
+
+    HRESULT MyRenderer::OnStopStreaming() {
+        m_start_gate.disarm();
+        m_agent->stop();
+        m_device_clock.stop(monotonic_seconds());
+        return S_OK;
+    }
+
+    bool MyRenderer::IsBitPerfect() const {
+        return m_core.bit_perfect();
+    }
+
 }
@@ -1,6 +1,15 @@
 #pragma once
 
+#include <memory>
+
 #include "streams.h"
+#include "AudioClock.h"
+#include "BasicAudio.h"
+#include "DeviceClock.h"
+#include "IOutputAgent.h"
+#include "LatencyReport.h"
+#include "RenderCore.h"
+#include "StartGate.h"
 
 namespace StupidAR {
 
@@ -12,10 +21,38 @@ namespace StupidAR {
         MyRenderer(LPUNKNOWN, HRESULT*);
         ~MyRenderer();
 
+        STDMETHODIMP NonDelegatingQueryInterface(REFIID, void**) override;
+        STDMETHODIMP SetSyncSource(IReferenceClock*) override;
 
         HRESULT CheckMediaType(const CMediaType*) override;
         HRESULT SetMediaType(const CMediaType*) override;
         HRESULT DoRenderSample(IMediaSample*) override;
+
+        HRESULT Receive(IMediaSample*) override;
+        HRESULT BeginFlush() override;
+        HRESULT EndFlush() override;
+        HRESULT Active() override;
+        HRESULT Inactive() override;
+        HRESULT EndOfStream() override;
+        HRESULT OnStartStreaming() override;
+        HRESULT OnStopStreaming() override;
+        HRESULT SendEndOfStream() override;
+        BOOL HaveCurrentSample() override;
+
+        // True while the negotiated format reaches the device untouched (no conversion, remixing or gain)
+        bool IsBitPerfect() const;
+
+    private:
+        static VOID CALLBACK OnDrained(PTP_CALLBACK_INSTANCE, PVOID, PTP_WORK);
+
+        RenderCore<IMediaSample> m_core;
+        DeviceClock m_device_clock;
+        std::unique_ptr<IOutputAgent> m_agent; // Declared after m_core and m_device_clock: its callback uses them until it is destroyed
+        StartGate m_start_gate;                // Primes and starts the agent once the queue holds enough to play on
+        BasicAudio m_basic_audio;
+        LatencyReport m_latency_report;
+        std::unique_ptr<AudioClock> m_clock;
+        PTP_WORK m_drained_work; // Delivers EC_COMPLETE off the callback thread, which must never wait for the renderer lock
     };
 
 }
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "IOutputAgent.h"
+#include "PrerollBuffers.h"
+#include "ThreadConfig.h"
+
+namespace StupidAR {
+
+    /// Output agent that discards everything, paced by the system clock
+    /// Requests one period every `buffer_size()` / `sampling_rate()` seconds from its own thread, like a device would.
+    /// Useful as a stand-in device and for measuring the scheduling behaviour of the callback thread.
+    class NullOutputAgent final : public IOutputAgent {
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        CallbackType m_callback;
+        ReconfigureCallbackType m_reconfigure_callback;
+        int32_t m_sampling_rate;
+        int32_t m_buffer_size;
+        int32_t m_output_channels;
+        SampleFormat m_pcm_format;
+        ThreadConfig m_thread_config;
+        ThreadConfigResult m_thread_config_result;
+        std::vector<std::vector<char>> m_buffers;
+        std::vector<char*> m_buffer_pointers;
+        PrerollBuffers m_preroll;
+        Clock::duration m_period;
+        std::mutex m_callback_lock; // Held while the callback runs, taking it quiesces the callback
+        std::atomic<bool> m_running;
+        std::thread m_thread;
+
+    public:
+        NullOutputAgent(CallbackType callback, int32_t sampling_rate, int32_t buffer_size, int32_t output_channels, SampleFormat pcm_format,
+                        ThreadConfig thread_config = ThreadConfig())
+            : m_callback(std::move(callback)),
+              m_sampling_rate(sampling_rate),
+              m_buffer_size(buffer_size),
+              m_output_channels(output_channels),
+              m_pcm_format(pcm_format),
+              m_thread_config(std::move(thread_config)),
+              m_buffers(output_channels),
+              m_buffer_pointers(output_channels),
+              m_running(false) {
+            apply_format();
+        }
+
+        ~NullOutputAgent() {
+            stop();
+        }
+
+        int32_t sampling_rate() override {
+            return m_sampling_rate;
+        }
+
+        int32_t buffer_size() override {
+            return m_buffer_size;
+        }
+
+        int32_t output_channels() override {
+            return m_output_channels;
+        }
+
+        SampleFormat pcm_format() override {
+            return m_pcm_format;
+        }
+
+        // Nothing is played, a period is gone as soon as the callback returns
+        int32_t output_latency() override {
+            return 0;
+        }
+
+        int32_t prepare(int32_t n_buffers) override {
+            return m_preroll.prime(m_callback, n_buffers, m_output_channels, m_buffer_size * sample_size(m_pcm_format));
+        }
+
+        void start() override {
+            if (m_running) {
+                return;
+            }
+
+            m_running = true;
+            m_thread = std::thread([this]() { run(); });
+        }
+
+        void stop() override {
+            m_running = false;
+            if (m_thread.joinable()) {
+                m_thread.join();
+            }
+            m_preroll.clear();
+        }
+
+        void set_reconfigure_callback(ReconfigureCallbackType callback) override {
+            std::lock_guard<std::mutex> l(m_callback_lock);
+            m_reconfigure_callback = std::move(callback);
+        }
+
+        /// The listener runs on the calling thread with the callback quiesced, it must not call back into the agent
+        bool reconfigure(int32_t sampling_rate, int32_t buffer_size) override {
+            if (sampling_rate <= 0 || buffer_size <= 0) {
+                return false;
+            }
+
+            std::lock_guard<std::mutex> l(m_callback_lock);
+            const StreamFormat old_format = format();
+            m_sampling_rate = sampling_rate;
+            m_buffer_size = buffer_size;
+            apply_format();
+            m_preroll.clear();
+
+            if (m_reconfigure_callback) {
+                m_reconfigure_callback(old_format, format());
+            }
+
+            return true;
+        }
+
+        /// What the callback thread's `ThreadConfig` turned into, valid after `stop()`
+        ThreadConfigResult thread_config_result() const {
+            return m_thread_config_result;
+        }
+
+    private:
+        void run() {
+            m_thread_config_result = apply_thread_config(m_thread_config);
+
+            Clock::time_point deadline = Clock::now();
+            while (m_running) {
+                {
+                    std::lock_guard<std::mutex> l(m_callback_lock);
+                    if (!m_preroll.play(m_buffer_pointers.data())) {
+                        m_callback(m_buffer_pointers.data());
+                    }
+                    deadline += m_period;
+                }
+
+                std::this_thread::sleep_until(deadline);
+            }
+        }
+
+        void apply_format() {
+            for (int32_t i = 0; i < m_output_channels; ++i) {
+                m_buffers[i].resize(m_buffer_size * sample_size(m_pcm_format));
+                m_buffer_pointers[i] = m_buffers[i].data();
+            }
+
+            m_period = std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>(double(m_buffer_size) / m_sampling_rate)
+            );
+        }
+    };
+
+}
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "FirDesign.h"
+#include "simd.h"
+
+namespace StupidAR {
+
+    /// Windowed-sinc low-pass filter for converting one fixed sampling rate to another, split into polyphase banks
+    /// The rates reduce to a rational ratio up/down; the prototype is designed at up x the source rate (Kaiser window,
+    /// the length from the quality tier's passband and rejection), then split into `up` phases of `taps()` coefficients
+    /// each, stored in convolution order so an output sample is a single dot product with the input history.
+    /// The stopband starts at the lower of the two Nyquist frequencies, so nothing aliases into the passband.
+    /// Immutable once built, shared by every stream with the same rates and quality.
+    class PolyphaseFilter {
+    public:
+        // Phases beyond this (rates without a small common ratio, like 44100 and 47999) are not supported
+        static constexpr size_t kMaxPhases = 1024;
+
+    private:
+        int32_t m_source_rate;
+        int32_t m_target_rate;
+        ResamplerQuality m_quality;
+        size_t m_up;
+        size_t m_down;
+        size_t m_taps;
+        double m_stopband_db;
+        std::vector<float> m_bank; // m_up phases of m_taps coefficients
+
+    public:
+        /// Returns nullptr if there is no ratio small enough between the rates
+        static std::shared_ptr<const PolyphaseFilter> build(int32_t source_rate, int32_t target_rate, ResamplerQuality quality) {
+            if (source_rate <= 0 || target_rate <= 0) {
+                return nullptr;
+            }
+            const size_t divisor = gcd(size_t(source_rate), size_t(target_rate));
+            const size_t up = size_t(target_rate) / divisor;
+            const size_t down = size_t(source_rate) / divisor;
+            if (up > kMaxPhases) {
+                return nullptr;
+            }
+            return std::shared_ptr<const PolyphaseFilter>(new PolyphaseFilter(source_rate, target_rate, quality, up, down));
+        }
+
+        int32_t source_rate() const {
+            return m_source_rate;
+        }
+
+        int32_t target_rate() const {
+            return m_target_rate;
+        }
+
+        ResamplerQuality quality() const {
+            return m_quality;
+        }
+
+        size_t up() const {
+            return m_up;
+        }
+
+        size_t down() const {
+            return m_down;
+        }
+
+        /// Coefficients per phase, a multiple of 4
+        size_t taps() const {
+            return m_taps;
+        }
+
+        /// Rejection the filter was designed for
+        double stopband_db() const {
+            return m_stopband_db;
+        }
+
+        /// Group delay in source frames: the prototype is symmetric about its center
+        double delay_frames() const {
+            return (double(m_taps * m_up) - 1) / (2.0 * double(m_up));
+        }
+
+        /// Coefficients of `phase`, to be applied to the `taps()` most recent input samples, oldest first
+        const float* phase(size_t phase) const {
+            return &m_bank[phase * m_taps];
+        }
+
+    private:
+        PolyphaseFilter(int32_t source_rate, int32_t target_rate, ResamplerQuality quality, size_t up, size_t down)
+            : m_source_rate(source_rate),
+              m_target_rate(target_rate),
+              m_quality(quality),
+              m_up(up),
+              m_down(down) {
+            const ResamplerSpec spec = ResamplerSpec::of(quality);
+            m_stopband_db = spec.stopband_db;
+
+            // Frequencies in cycles per sample at the lower rate, then at the upsampled rate
+            const double scale = double(std::max(up, down));
+            const double transition = 0.5 * (1 - spec.passband) / scale;
+            const double cutoff = 0.25 * (1 + spec.passband) / scale;
+
+            // Kaiser's estimates of the length and shape for the rejection and transition band
+            m_taps = (size_t(std::ceil(kaiser::length(m_stopband_db, transition) / double(up))) + 3) & ~size_t(3);
+            const double beta = kaiser::beta(m_stopband_db);
+
+            const size_t n = m_taps * up;
+            const double center = 0.5 * double(n - 1);
+            std::vector<double> prototype(n);
+            for (size_t i = 0; i < n; ++i) {
+                const double x = double(i) - center;
+                const double sinc = x == 0 ? 2 * cutoff : std::sin(2 * kaiser::kPi * cutoff * x) / (kaiser::kPi * x);
+                prototype[i] = sinc * kaiser::window(2 * double(i) / double(n - 1) - 1, beta) * double(up);
+            }
+
+            // Output sample at phase p is the sum of x[base - i] * h[p + i * up]; stored oldest input first
+            m_bank.resize(up * m_taps);
+            for (size_t p = 0; p < up; ++p) {
+                for (size_t t = 0; t < m_taps; ++t) {
+                    m_bank[p * m_taps + t] = float(prototype[p + (m_taps - 1 - t) * up]);
+                }
+            }
+        }
+
+        static size_t gcd(size_t a, size_t b) {
+            while (b != 0) {
+                const size_t r = a % b;
+                a = b;
+                b = r;
+            }
+            return a;
+        }
+    };
+
+    /// Filters built so far, so that every stream with the same rates and quality shares one bank
+    class PolyphaseFilterCache {
+    private:
+        std::mutex m_lock;
+        std::vector<std::shared_ptr<const PolyphaseFilter>> m_filters;
+
+    public:
+        /// Returns the filter, building it on first use; nullptr if there is none
+        std::shared_ptr<const PolyphaseFilter> get(int32_t source_rate, int32_t target_rate, ResamplerQuality quality) {
+            std::lock_guard<std::mutex> l(m_lock);
+            for (const auto& filter : m_filters) {
+                if (filter->source_rate() == source_rate && filter->target_rate() == target_rate && filter->quality() == quality) {
+                    return filter;
+                }
+            }
+
+            auto filter = PolyphaseFilter::build(source_rate, target_rate, quality);
+            if (filter) {
+                m_filters.push_back(filter);
+            }
+            return filter;
+        }
+    };
+
+    /// Fixed-ratio sample-rate converter on planar float channels, running a `PolyphaseFilter`
+    /// Input goes straight into the resampler's own delay lines: write up to `max_input_frames()` frames at `input()`,
+    /// then `process()` them, which produces `output_frames()` frames; the filter state carries over from one call
+    /// to the next, so a stream can be fed in blocks of any size.
+    /// Each output sample is one dot product of the phase's coefficients with a channel's history, with the taps in
+    /// the SIMD lanes.
+    class PolyphaseResampler {
+    private:
+        std::shared_ptr<const PolyphaseFilter> m_filter;
+        size_t m_channels;
+        size_t m_max_input_frames;
+        size_t m_history; // taps - 1 frames kept from one call to the next
+        size_t m_stride;
+        uint64_t m_time;  // Next output, in upsampled frames since the start of the current input
+        std::vector<float> m_frames;
+        std::vector<float*> m_inputs;
+
+    public:
+        PolyphaseResampler(std::shared_ptr<const PolyphaseFilter> filter, size_t channels, size_t max_input_frames)
+            : m_filter(std::move(filter)),
+              m_channels(channels),
+              m_max_input_frames(max_input_frames),
+              m_history(m_filter->taps() - 1),
+              m_stride(m_history + max_input_frames),
+              m_frames(channels * m_stride),
+              m_inputs(channels) {
+            for (size_t c = 0; c < channels; ++c) {
+                m_inputs[c] = &m_frames[c * m_stride + m_history];
+            }
+            reset();
+        }
+
+        const PolyphaseFilter& filter() const {
+            return *m_filter;
+        }
+
+        size_t channels() const {
+            return m_channels;
+        }
+
+        size_t max_input_frames() const {
+            return m_max_input_frames;
+        }
+
+        /// Most frames one `process()` call can produce
+        size_t max_output_frames() const {
+            return m_max_input_frames * m_filter->up() / m_filter->down() + 1;
+        }
+
+        /// Forgets the filter state: the next input starts from silence
+        void reset() {
+            std::fill(m_frames.begin(), m_frames.end(), 0.0f);
+            m_time = 0;
+        }
+
+        /// Per channel, where the input of the next `process()` goes
+        float* const* input() const {
+            return m_inputs.data();
+        }
+
+        /// Number of frames the next `process()` of `frames` input frames produces
+        size_t output_frames(size_t frames) const {
+            const uint64_t end = uint64_t(frames) * m_filter->up();
+            return m_time < end ? size_t((end - m_time + m_filter->down() - 1) / m_filter->down()) : 0;
+        }
+
+        /// Filters the `frames` frames written to `input()` into `out`, returns the number of frames produced
+        size_t process(size_t frames, float* const* out) {
+            frames = std::min(frames, m_max_input_frames);
+            const size_t produced = output_frames(frames);
+            const size_t up = m_filter->up();
+            const size_t down = m_filter->down();
+            const size_t taps = m_filter->taps();
+
+            for (size_t c = 0; c < m_channels; ++c) {
+                // The window of the output at input frame `base` ends there, and starts `m_history` frames before it
+                const float* x = &m_frames[c * m_stride];
+                uint64_t time = m_time;
+                for (size_t j = 0; j < produced; ++j, time += down) {
+                    const size_t base = size_t(time / up);
+                    out[c][j] = simd::dot(x + base, m_filter->phase(size_t(time % up)), taps);
+                }
+
+                float* line = &m_frames[c * m_stride];
+                std::copy_n(line + frames, m_history, line);
+            }
+
+            m_time = m_time + uint64_t(produced) * down - uint64_t(frames) * up;
+            return produced;
+        }
+    };
+
+}
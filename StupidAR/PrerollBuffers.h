@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstring>
+#include <vector>
+
+#include "IOutputAgent.h"
+
+namespace StupidAR {
+
+    /// Storage for the periods an agent primes in `IOutputAgent::prepare()`
+    /// Agents without their own device-side buffering hand these out in order before invoking the callback again.
+    class PrerollBuffers {
+    private:
+        int32_t m_channels;
+        size_t m_period_bytes;
+        std::vector<std::vector<char>> m_periods; // One contiguous block of channels * period_bytes per period
+        std::vector<char*> m_pointers;
+        int32_t m_primed;
+        int32_t m_played;
+
+    public:
+        PrerollBuffers()
+            : m_channels(0), m_period_bytes(0), m_primed(0), m_played(0) {
+        }
+
+        /// Calls `callback` up to `n_buffers` times, keeping what it produced
+        /// Returns the number of periods primed
+        int32_t prime(const IOutputAgent::CallbackType& callback, int32_t n_buffers, int32_t channels, size_t period_bytes) {
+            m_channels = channels;
+            m_period_bytes = period_bytes;
+            m_primed = 0;
+            m_played = 0;
+            m_pointers.resize(channels);
+            if (m_periods.size() < size_t(n_buffers)) {
+                m_periods.resize(n_buffers);
+            }
+
+            while (m_primed < n_buffers) {
+                std::vector<char>& period = m_periods[m_primed];
+                period.resize(channels * period_bytes);
+                for (int32_t c = 0; c < channels; ++c) {
+                    m_pointers[c] = &period[c * period_bytes];
+                }
+
+                if (!callback(m_pointers.data())) {
+                    break;
+                }
+                ++m_primed;
+            }
+
+            return m_primed;
+        }
+
+        /// Number of primed periods not yet played
+        int32_t pending() const {
+            return m_primed - m_played;
+        }
+
+        /// Copies the next primed period into the device buffers
+        /// Returns `false` (and leaves the buffers alone) when all primed periods were played
+        bool play(char** buffers) {
+            if (m_played == m_primed) {
+                return false;
+            }
+
+            const char* period = m_periods[m_played].data();
+            for (int32_t c = 0; c < m_channels; ++c) {
+                std::memcpy(buffers[c], period + c * m_period_bytes, m_period_bytes);
+            }
+            ++m_played;
+
+            return true;
+        }
+
+        /// Drops any primed periods that were not played
+        void clear() {
+            m_primed = 0;
+            m_played = 0;
+        }
+    };
+
+}
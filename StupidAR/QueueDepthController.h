@@ -0,0 +1,194 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+namespace StupidAR {
+
+    // Tuning of a `QueueDepthController`
+    struct QueueDepthSettings {
+        double min_frames = 0;            // 0 for two periods
+        double max_frames = 0;            // 0 for one second
+        double jitter_margin = 2.0;       // Headroom kept over the observed jitter, as a multiple of it
+        double grow_factor = 1.5;
+        double hold_seconds = 5.0;
+        double shrink_per_second = 0.02;  // Fraction of the target (and of the jitter peaks) given up per second
+    };
+
+    /// Picks how much audio to keep queued from how irregularly it arrives and is consumed
+    /// Two observations feed it: upstream deliveries (how far behind real time the producer falls, e.g. while the
+    /// decoder stalls) and agent callbacks (how far their spacing strays from the period). The target fill is the
+    /// period plus a margin over the peaks of both. An underrun grows the target at once, by `grow_factor`; once
+    /// nothing went wrong for `hold_seconds` the target and the jitter peaks shrink back by `shrink_per_second`.
+    /// Deliveries and updates come from the streaming thread, callbacks from the agent callback, which never blocks.
+    /// Times are in seconds on any monotonic clock.
+    class QueueDepthController {
+    private:
+        QueueDepthSettings m_settings;
+        double m_period_frames;
+        double m_sampling_rate;
+
+        // Streaming thread
+        bool m_has_delivery;
+        double m_last_delivery;
+        double m_last_delivery_frames;
+        double m_lateness;       // Seconds the producer is behind real time (Lindley's recursion)
+        double m_delivery_peak;
+        double m_last_update;
+        double m_last_underrun;
+        uint64_t m_underruns_seen;
+        std::atomic<double> m_target;
+        std::atomic<bool> m_restart;
+
+        // Callback thread
+        bool m_has_callback;
+        double m_last_callback;
+        double m_callback_peak_local;
+        std::atomic<double> m_callback_peak;
+        std::atomic<uint64_t> m_underruns;
+
+    public:
+        QueueDepthController(double period_frames, double sampling_rate, QueueDepthSettings settings = QueueDepthSettings())
+            : m_settings(settings),
+              m_period_frames(period_frames),
+              m_sampling_rate(sampling_rate),
+              m_target(0),
+              m_restart(false),
+              m_callback_peak(0),
+              m_underruns(0) {
+            if (m_settings.min_frames <= 0) {
+                m_settings.min_frames = 2 * period_frames;
+            }
+            if (m_settings.max_frames <= 0) {
+                m_settings.max_frames = sampling_rate;
+            }
+            m_settings.max_frames = std::max(m_settings.max_frames, m_settings.min_frames);
+            reset();
+        }
+
+        /// Follows a change of the device format, may only be called while the callback is quiesced
+        void set_format(double period_frames, double sampling_rate) {
+            m_period_frames = period_frames;
+            m_sampling_rate = sampling_rate;
+        }
+
+        /// Forgets everything observed, may only be called while neither thread is feeding the controller
+        void reset() {
+            m_has_delivery = false;
+            m_last_delivery = 0;
+            m_last_delivery_frames = 0;
+            m_lateness = 0;
+            m_delivery_peak = 0;
+            m_last_update = 0;
+            m_last_underrun = 0;
+            m_underruns_seen = m_underruns.load();
+            m_target = m_settings.min_frames;
+            m_restart = false;
+
+            m_has_callback = false;
+            m_last_callback = 0;
+            m_callback_peak_local = 0;
+            m_callback_peak = 0;
+        }
+
+        /// Drops the timing references, keeping the target: the next delivery and callback start afresh
+        /// For after a pause, which is not jitter. Callable from any thread while the callback is quiesced.
+        void restart() {
+            m_restart = true;
+            m_has_callback = false;
+        }
+
+        /// Streaming thread: `frames` frames arrived at `now`
+        void on_delivery(double now, size_t frames) {
+            if (m_restart.exchange(false)) {
+                m_has_delivery = false;
+            }
+
+            if (m_has_delivery) {
+                // The previous delivery covered its duration; arriving later than that puts the producer behind
+                const double interval = now - m_last_delivery;
+                m_lateness = std::max(0.0, m_lateness + interval - m_last_delivery_frames / m_sampling_rate);
+                m_delivery_peak = std::max(m_delivery_peak, m_lateness);
+            } else {
+                m_last_update = now;
+            }
+
+            m_has_delivery = true;
+            m_last_delivery = now;
+            m_last_delivery_frames = double(frames);
+        }
+
+        /// Streaming thread: recomputes the target at `now`, returns it in frames
+        double update(double now) {
+            const double dt = std::max(0.0, now - m_last_update);
+            m_last_update = now;
+
+            const uint64_t underruns = m_underruns.load(std::memory_order_acquire);
+            const bool underrun = underruns != m_underruns_seen;
+            m_underruns_seen = underruns;
+
+            double target = m_target.load(std::memory_order_relaxed);
+            const bool holding = underrun || now - m_last_underrun < m_settings.hold_seconds;
+            if (underrun) {
+                m_last_underrun = now;
+                target = std::max(target * m_settings.grow_factor, target + m_period_frames);
+            } else if (!holding) {
+                const double decay = std::max(0.0, 1.0 - m_settings.shrink_per_second * dt);
+                target *= decay;
+                m_delivery_peak *= decay;
+                m_lateness = std::min(m_lateness, m_delivery_peak);
+            }
+
+            target = std::max(target, demand());
+            target = std::min(std::max(target, m_settings.min_frames), m_settings.max_frames);
+            m_target.store(target, std::memory_order_relaxed);
+            return target;
+        }
+
+        /// Callback thread: a callback started at `now`, and had to make up `underrun_frames` frames of silence
+        void on_callback(double now, size_t underrun_frames) {
+            if (m_has_callback) {
+                const double deviation = std::abs(now - m_last_callback - m_period_frames / m_sampling_rate);
+                // Decays at the same pace as the target, but the callback has no notion of the hold time
+                const double decay = std::max(0.0, 1.0 - m_settings.shrink_per_second * (now - m_last_callback));
+                m_callback_peak_local = std::max(m_callback_peak_local * decay, deviation);
+                m_callback_peak.store(m_callback_peak_local, std::memory_order_relaxed);
+            }
+            m_has_callback = true;
+            m_last_callback = now;
+
+            if (underrun_frames != 0) {
+                m_underruns.fetch_add(1, std::memory_order_release);
+            }
+        }
+
+        /// Target fill level, in frames
+        double target_frames() const {
+            return m_target.load(std::memory_order_relaxed);
+        }
+
+        double target_seconds() const {
+            return target_frames() / m_sampling_rate;
+        }
+
+        /// Streaming thread: peak lateness of deliveries, in seconds
+        double delivery_jitter() const {
+            return m_delivery_peak;
+        }
+
+        /// Peak deviation of callbacks from the period, in seconds
+        double callback_jitter() const {
+            return m_callback_peak.load(std::memory_order_relaxed);
+        }
+
+    private:
+        // Frames the observed jitter calls for
+        double demand() const {
+            return m_period_frames + m_settings.jitter_margin * (m_delivery_peak + callback_jitter()) * m_sampling_rate;
+        }
+    };
+
+}
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "FirDesign.h"
+#include "HalfBandResampler.h"
+#include "PolyphaseResampler.h"
+
+namespace StupidAR {
+
+    /// Fixed-ratio sample-rate converter on planar float channels, whichever way suits the ratio
+    /// Conversions by 2^n (48 to 96 or 192 kHz, 44.1 to 88.2 kHz and back) run through a `HalfBandResampler`
+    /// cascade, everything else through a `PolyphaseResampler`. Both have the same block interface, forwarded here.
+    /// Built by a `RateConverterFactory`.
+    class RateConverter {
+    private:
+        int32_t m_source_rate;
+        int32_t m_target_rate;
+        ResamplerQuality m_quality;
+        std::unique_ptr<PolyphaseResampler> m_polyphase;
+        std::unique_ptr<HalfBandResampler> m_half_band;
+
+    public:
+        RateConverter(int32_t source_rate, int32_t target_rate, ResamplerQuality quality, std::unique_ptr<PolyphaseResampler> polyphase)
+            : m_source_rate(source_rate),
+              m_target_rate(target_rate),
+              m_quality(quality),
+              m_polyphase(std::move(polyphase)) {
+        }
+
+        RateConverter(int32_t source_rate, int32_t target_rate, ResamplerQuality quality, std::unique_ptr<HalfBandResampler> half_band)
+            : m_source_rate(source_rate),
+              m_target_rate(target_rate),
+              m_quality(quality),
+              m_half_band(std::move(half_band)) {
+        }
+
+        int32_t source_rate() const {
+            return m_source_rate;
+        }
+
+        int32_t target_rate() const {
+            return m_target_rate;
+        }
+
+        ResamplerQuality quality() const {
+            return m_quality;
+        }
+
+        /// The general filter, nullptr for a half-band cascade
+        const PolyphaseFilter* polyphase_filter() const {
+            return m_polyphase ? &m_polyphase->filter() : nullptr;
+        }
+
+        /// Number of half-band stages, 0 for the general path
+        size_t half_band_stages() const {
+            return m_half_band ? m_half_band->stages() : 0;
+        }
+
+        /// How far the output lags the input, in seconds
+        double delay() const {
+            return (m_half_band ? m_half_band->delay_frames() : m_polyphase->filter().delay_frames()) / m_source_rate;
+        }
+
+        size_t channels() const {
+            return m_half_band ? m_half_band->channels() : m_polyphase->channels();
+        }
+
+        size_t max_input_frames() const {
+            return m_half_band ? m_half_band->max_input_frames() : m_polyphase->max_input_frames();
+        }
+
+        size_t max_output_frames() const {
+            return m_half_band ? m_half_band->max_output_frames() : m_polyphase->max_output_frames();
+        }
+
+        void reset() {
+            if (m_half_band) {
+                m_half_band->reset();
+            } else {
+                m_polyphase->reset();
+            }
+        }
+
+        float* const* input() const {
+            return m_half_band ? m_half_band->input() : m_polyphase->input();
+        }
+
+        size_t output_frames(size_t frames) const {
+            return m_half_band ? m_half_band->output_frames(frames) : m_polyphase->output_frames(frames);
+        }
+
+        size_t process(size_t frames, float* const* out) {
+            return m_half_band ? m_half_band->process(frames, out) : m_polyphase->process(frames, out);
+        }
+    };
+
+    /// Builds `RateConverter`s, sharing the filters of every converter with the same rates and quality
+    class RateConverterFactory {
+    private:
+        struct HalfBandKey {
+            ResamplerQuality quality;
+            size_t stage;
+            std::shared_ptr<const HalfBandFilter> filter;
+        };
+
+        PolyphaseFilterCache m_polyphase;
+        std::mutex m_lock;
+        std::vector<HalfBandKey> m_half_band;
+
+    public:
+        /// Returns nullptr if there is no converter between the rates
+        std::unique_ptr<RateConverter> create(int32_t source_rate, int32_t target_rate, ResamplerQuality quality, size_t channels, size_t max_input_frames) {
+            if (source_rate <= 0 || target_rate <= 0 || channels == 0 || max_input_frames == 0) {
+                return nullptr;
+            }
+
+            const size_t stages = octaves(source_rate, target_rate);
+            if (stages != 0) {
+                std::vector<std::shared_ptr<const HalfBandFilter>> filters;
+                for (size_t s = 0; s < stages; ++s) {
+                    filters.push_back(half_band(quality, s));
+                }
+                return std::make_unique<RateConverter>(source_rate, target_rate, quality,
+                    std::make_unique<HalfBandResampler>(filters, target_rate > source_rate, channels, max_input_frames));
+            }
+
+            std::shared_ptr<const PolyphaseFilter> filter = m_polyphase.get(source_rate, target_rate, quality);
+            if (!filter) {
+                return nullptr;
+            }
+            return std::make_unique<RateConverter>(source_rate, target_rate, quality,
+                std::make_unique<PolyphaseResampler>(std::move(filter), channels, max_input_frames));
+        }
+
+    private:
+        // n if one rate is 2^n times the other, 0 otherwise
+        static size_t octaves(int32_t source_rate, int32_t target_rate) {
+            const int32_t low = std::min(source_rate, target_rate);
+            const int32_t high = std::max(source_rate, target_rate);
+            if (low == high || high % low != 0) {
+                return 0;
+            }
+            const int32_t ratio = high / low;
+            if ((ratio & (ratio - 1)) != 0) {
+                return 0;
+            }
+            size_t n = 0;
+            while ((int32_t(1) << n) < ratio) {
+                ++n;
+            }
+            return n;
+        }
+
+        // Filter of stage `stage` from the lowest rate up, for the passband of `quality`
+        // Relative to the stage's higher rate, the passband ends at passband / 2^(stage + 2), and the stopband starts
+        // where its aliases and images would fall back onto that.
+        std::shared_ptr<const HalfBandFilter> half_band(ResamplerQuality quality, size_t stage) {
+            std::lock_guard<std::mutex> l(m_lock);
+            for (const HalfBandKey& key : m_half_band) {
+                if (key.quality == quality && key.stage == stage) {
+                    return key.filter;
+                }
+            }
+
+            const ResamplerSpec spec = ResamplerSpec::of(quality);
+            const double passband = spec.passband / double(size_t(4) << stage);
+            auto filter = HalfBandFilter::build(0.5 - 2 * passband, spec.stopband_db);
+            m_half_band.push_back({ quality, stage, filter });
+            return filter;
+        }
+    };
+
+}
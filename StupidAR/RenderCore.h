@@ -0,0 +1,1314 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "AsyncResampler.h"
+#include "BlockingQueue.h"
+#include "DriftController.h"
+#include "FrameTime.h"
+#include "GainStage.h"
+#include "IOutputAgent.h"
+#include "LatencyMonitor.h"
+#include "QueueDepthController.h"
+#include "RateConverter.h"
+#include "RenderPlan.h"
+#include "SampleRef.h"
+#include "StreamArena.h"
+#include "TimelineTracker.h"
+#include "WorkerPool.h"
+#include "WsolaStretcher.h"
+#include "convert.h"
+#include "simd.h"
+
+namespace StupidAR {
+
+    // When queued audio is converted to the device format
+    enum class ConversionPolicy {
+        Late,  // In the callback: the queue holds compact source-format audio, by reference to the upstream samples
+        Early, // On push: the callback only copies, but everything queued takes device-format memory
+    };
+
+    /// The platform-independent part of the renderer: a queue of upstream samples and the agent callback draining it
+    /// Samples are queued by reference (`SampleRef`), not copied. The callback renders straight from the upstream
+    /// allocator's memory into the agent's buffers through the sample's `RenderPlan` and drops the reference once
+    /// the sample is fully consumed, so each sample is touched exactly once between the decoder and the device.
+    /// That is the `ConversionPolicy::Late` default; with `Early`, samples are rendered into device-format buffers as
+    /// they are pushed and released right away, trading memory for a cheaper callback. Those buffers come from a
+    /// `StreamArena` set up with the device format, so once the formats are negotiated nothing on the streaming path
+    /// allocates: not the queue, not early conversion, not the callback.
+    /// With a `WorkerPool`, the device channels of a run are rendered in slices across the pool and the callback
+    /// thread; runs with too few channels or frames to pay for the handoff are rendered serially.
+    /// The queue holds at most `queue_samples` samples; with adaptive depth, a `QueueDepthController` lowers that to
+    /// what the observed jitter calls for, and producers block earlier.
+    /// With drift compensation, for producers on a clock of their own, the queue is rendered in float and an
+    /// `AsyncResampler` feeds the device, its ratio steered by a `DriftController` on the queue's fill level.
+    /// Sources at another sampling rate than the device are converted on push by a `RateConverter`, and queued
+    /// in the arena like early conversions: the filter state belongs to the stream, not to the callback. Segments
+    /// played at another rate than real time go through a `WsolaStretcher` on the same path, ahead of the converter.
+    /// Samples may carry their stream time; after `align_start()` the callback pads or trims the head of the queue so
+    /// that the first timestamped frame lands on the device frame playing at that time. Later on, a `TimelineTracker`
+    /// finds where timestamps jump: gaps are filled with silence and overlaps dropped on push, and the audio after
+    /// either fades in from where the audio before it left off.
+    /// Every callback also estimates how long audio pushed then takes to reach the DAC: the audio queued ahead of it,
+    /// the delay of the stretcher and the converters, the period being played and the device's own latency; a
+    /// `LatencyMonitor` keeps the statistics of that.
+    /// `Sample` needs COM-style `AddRef()`/`Release()`; the filter uses `IMediaSample`, tests a fake.
+    template <typename Sample>
+    class RenderCore {
+    public:
+        struct Stats {
+            uint64_t frames_rendered;
+            uint64_t underrun_frames; // Frames of silence the callback had to make up for an empty queue
+            uint64_t samples_consumed;
+            uint64_t bit_perfect_frames; // Frames passed through untouched by a bit-perfect plan
+            uint64_t silent_frames;      // Frames of digital silence written on the fast path, without rendering
+            uint64_t inserted_frames;    // Frames of silence queued for gaps in the timestamps
+            uint64_t dropped_frames;     // Frames dropped where timestamps overlap, in device frames
+        };
+
+        // What the producer knows about a buffer's content
+        enum class Silence {
+            Unknown, // Scan it
+            Silent,
+            Audible,
+        };
+
+        // Invoked on the callback thread once the stream has played out after `end_of_stream()`, see `drained()`
+        using DrainedCallback = std::function<void()>;
+
+        // Invoked on the streaming thread before `push()` waits for the callback to make room, see `set_wait_callback()`
+        using WaitCallback = std::function<void()>;
+
+        // Fewest device channels worth splitting across threads by default
+        static constexpr int32_t kParallelMinChannels = 16;
+
+        // Timestamps are stream times in 100 ns units, like `REFERENCE_TIME`
+        static constexpr int64_t kUnitsPerSecond = FrameRate::kUnitsPerSecond;
+        static constexpr int64_t kNoTime = TimelineTracker::kNoTime;
+
+    private:
+        // Fewest samples (frames x channels) in a run worth splitting across threads
+        static constexpr size_t kParallelMinSamples = 4096;
+
+        // Render-format audio the arena holds for early or rate conversion and fades; beyond that, samples are converted late
+        static constexpr double kEarlyConversionSeconds = 1.0;
+
+        // Longest run of audio queued as one buffer by rate conversion, so that it always fits in the arena
+        static constexpr double kRateBlockSeconds = 0.125;
+
+        // Timestamps off by less than this from the running position are played on continuously
+        static constexpr double kDiscontinuityToleranceSeconds = 0.010;
+
+        // Jumps longer than this start a new timeline rather than being filled or dropped
+        static constexpr double kMaxDiscontinuitySeconds = 10.0;
+
+        // Fade into the audio after a gap or a drop
+        static constexpr double kSpliceSeconds = 0.005;
+
+        struct QueuedBuffer {
+            SampleRef<Sample> sample;
+            const char* data;
+            size_t frames;
+            std::shared_ptr<const RenderPlan> plan; // The plan at the time of queueing, in-band format changes may follow
+            bool silent;                            // All digital silence, the callback skips the plan
+            uint64_t converted_end;                 // Early conversion: `data` holds device-format samples, one channel after
+                                                    // another, in the arena chunk ending there; 0 if not converted
+            bool reshaped;                          // Rate-converted or time-stretched on push, never bit-perfect
+            int64_t start_time;                     // Stream time of the first frame, kNoTime if unknown
+        };
+
+        // Where audio queued from one push goes on the timeline: `frames` frames at the render rate after `start`
+        // (kNoTime if unknown). Times along it are computed from the start, they don't pick up rounding buffer after buffer.
+        struct QueuePosition {
+            int64_t start;
+            int64_t frames;
+        };
+
+        BlockingQueue<QueuedBuffer> m_queue;
+        const size_t m_max_samples;
+
+        // Negotiated on the streaming thread
+        PlanCache m_plans;
+        StreamFormat m_render; // What queued audio is rendered to: the device format, or float with drift compensation
+        bool m_drift_compensation;
+        SourceFormat m_source;
+        std::shared_ptr<const RenderPlan> m_plan;
+        ConversionPolicy m_policy;
+        StreamArena m_arena;
+        StreamFormat m_arena_format; // Render format the arena was laid out for, whatever the policy or rate conversion
+        ArenaFifo m_converted;
+        char** m_push_channels;      // Early conversion: channel pointers into the chunk being converted
+        RateConverterFactory m_rate_converters;
+        ResamplerQuality m_resampler_quality;
+        std::unique_ptr<RateConverter> m_rate_converter; // nullptr while the source runs at the device's rate
+        std::shared_ptr<const RenderPlan> m_rate_plan;        // Source to float at the source rate, for the stretcher or converter
+        std::vector<char*> m_rate_input;
+        std::vector<float> m_rate_output;
+        std::vector<float*> m_rate_output_channels;
+        ConvertFn m_float_to_render;
+        std::atomic<double> m_playback_rate;                  // Of the current segment, 1 for real time
+        std::unique_ptr<WsolaStretcher> m_stretcher;          // nullptr at real time, once drained
+        int32_t m_stretcher_rate;
+        std::vector<char*> m_stretch_input;
+        std::vector<float> m_stretch_output;
+        std::vector<float*> m_stretch_output_channels;
+        std::atomic<bool> m_rate_reset;                       // Set by flushes: the filter state and timeline belong to dropped audio
+        std::atomic<double> m_stage_latency;                  // Seconds audio spends in the stretcher and the rate converter
+        TimelineTracker m_timeline;
+        std::shared_ptr<const RenderPlan> m_float_plan;       // Source to float at the render rate, for fades
+        size_t m_splice_frames;
+        bool m_splice_pending;                                // The next audio queued fades in from m_splice_last
+        std::vector<float> m_splice;
+        std::vector<float*> m_splice_channels;
+        std::vector<char*> m_splice_targets;
+        std::vector<float> m_splice_last;                     // Last frame queued, per render channel
+        std::vector<char*> m_splice_last_targets;
+        std::atomic<bool> m_flushing;
+        std::mutex m_push_lock;            // Held by the streaming thread's calls, reconfiguration waits for them
+        std::atomic<bool> m_interrupted;   // A reconfiguration released the push under way
+        std::atomic<bool> m_push_waiting;  // For the callback to make room in the queue or the arena
+        WaitCallback m_on_wait;
+        std::mutex m_room_lock;
+        std::condition_variable m_room;    // Arena space freed by the callback, or a flush or reconfiguration to give up for
+        std::unique_ptr<QueueDepthController> m_depth; // nullptr for a fixed queue depth
+        size_t m_capacity;
+        double m_average_frames;                       // Frames per queued buffer, for sizing the queue
+        std::atomic<int64_t> m_queued_frames;          // In all queued buffers, counted once the callback has them
+
+        GainStage m_gain;
+
+        // Owned by the callback
+        StreamFormat m_device;
+        std::shared_ptr<const RenderPlan> m_copy_plan; // Mono render format to itself, for early-converted buffers
+        std::shared_ptr<WorkerPool> m_pool;
+        int32_t m_parallel_min_channels;
+        QueuedBuffer m_current;
+        size_t m_current_offset;
+        std::atomic<bool> m_drop_current;
+        std::atomic<size_t> m_current_frames; // Frames left of m_current, for the latency
+        std::atomic<bool> m_depth_armed;      // Set by pushes, cleared by flushes and end of stream: running dry then is no underrun
+        std::atomic<bool> m_end_of_stream;    // Set by `end_of_stream()`, cleared by flushes
+        std::atomic<bool> m_drained;          // Everything queued before the end of the stream has been handed to the device
+        DrainedCallback m_on_drained;
+        int64_t m_start_origin;               // Stream time of the first frame pulled after `align_start()`, kNoTime once aligned
+        int64_t m_start_elapsed;              // Frames pulled since, until a buffer is there to align
+        int64_t m_start_shift;                // Frames of silence still to insert (> 0) or of queued audio to skip (< 0)
+        std::unique_ptr<AsyncResampler> m_resampler; // Drift compensation, nullptr without
+        std::unique_ptr<DriftController> m_drift;
+        std::vector<char*> m_staging;                // The resampler's input, as render buffers
+        std::vector<float> m_resampled;
+        std::vector<float*> m_resampled_channels;
+        ConvertFn m_from_float;
+        std::atomic<double> m_drift_ratio;
+        std::atomic<int32_t> m_output_latency;       // Frames, as the agent reports it
+        LatencyMonitor m_latency;
+
+        std::atomic<uint64_t> m_frames_rendered;
+        std::atomic<uint64_t> m_underrun_frames;
+        std::atomic<uint64_t> m_samples_consumed;
+        std::atomic<uint64_t> m_bit_perfect_frames;
+        std::atomic<uint64_t> m_silent_frames;
+        std::atomic<uint64_t> m_inserted_frames;
+        std::atomic<uint64_t> m_dropped_frames;
+
+    public:
+        explicit RenderCore(size_t queue_samples)
+            : m_queue(queue_samples),
+              m_max_samples(queue_samples),
+              m_render(),
+              m_drift_compensation(false),
+              m_source(),
+              m_policy(ConversionPolicy::Late),
+              m_arena_format(),
+              m_push_channels(nullptr),
+              m_resampler_quality(ResamplerQuality::Balanced),
+              m_float_to_render(nullptr),
+              m_playback_rate(1.0),
+              m_stretcher_rate(0),
+              m_rate_reset(false),
+              m_stage_latency(0),
+              m_timeline(int64_t(kDiscontinuityToleranceSeconds * kUnitsPerSecond), int64_t(kMaxDiscontinuitySeconds * kUnitsPerSecond)),
+              m_splice_frames(0),
+              m_splice_pending(false),
+              m_flushing(false),
+              m_interrupted(false),
+              m_push_waiting(false),
+              m_capacity(queue_samples),
+              m_average_frames(0),
+              m_queued_frames(0),
+              m_device(),
+              m_parallel_min_channels(kParallelMinChannels),
+              m_current(),
+              m_current_offset(0),
+              m_drop_current(false),
+              m_current_frames(0),
+              m_depth_armed(false),
+              m_end_of_stream(false),
+              m_drained(false),
+              m_start_origin(kNoTime),
+              m_start_elapsed(0),
+              m_start_shift(0),
+              m_from_float(nullptr),
+              m_drift_ratio(1),
+              m_output_latency(0),
+              m_frames_rendered(0),
+              m_underrun_frames(0),
+              m_samples_consumed(0),
+              m_bit_perfect_frames(0),
+              m_silent_frames(0),
+              m_inserted_frames(0),
+              m_dropped_frames(0) {
+        }
+
+        /// Sets the format of samples pushed from now on, returns false if there is no conversion to the device format
+        /// Samples already queued keep the plan they were pushed with.
+        bool set_source_format(const SourceFormat& source) {
+            std::lock_guard<std::mutex> lock(m_push_lock);
+            return apply_source_format(source);
+        }
+
+        /// Sets the filter quality sources at another rate than the device are converted with from now on, like `push()`
+        /// only on the streaming thread
+        void set_resampler_quality(ResamplerQuality quality) {
+            std::lock_guard<std::mutex> lock(m_push_lock);
+            m_resampler_quality = quality;
+            if (m_plan && m_rate_converter) {
+                apply_source_format(m_source);
+            }
+        }
+
+        ResamplerQuality resampler_quality() const {
+            return m_resampler_quality;
+        }
+
+        /// Plays what is pushed from now on `rate` times as fast, pitch unchanged (`WsolaStretcher`), like `push()`
+        /// only on the streaming thread
+        /// Rates are clamped to [0.5, 2], anything not positive is taken as 1. Going back to 1 hands on the input the
+        /// stretcher held back and bypasses it from then on.
+        void set_playback_rate(double rate) {
+            std::lock_guard<std::mutex> lock(m_push_lock);
+            rate = rate > 0 ? std::min(std::max(rate, WsolaStretcher::kMinRate), WsolaStretcher::kMaxRate) : 1.0;
+            if (rate == m_playback_rate) {
+                return;
+            }
+            m_playback_rate = rate;
+            if (m_stretcher) {
+                m_stretcher->set_rate(rate);
+            }
+            if (m_plan && !apply_source_format(m_source)) {
+                m_plan = nullptr;
+            }
+        }
+
+        double playback_rate() const {
+            return m_playback_rate;
+        }
+
+        /// What sources are converted to the device's rate with, nullptr if they need nothing
+        const RateConverter* rate_converter() const {
+            return m_rate_converter.get();
+        }
+
+        /// Sets the device format, may only be called while the callback is quiesced
+        void set_device_format(const StreamFormat& device) {
+            if (device.output_channels != m_device.output_channels) {
+                m_gain.set_channels(device.output_channels);
+            }
+            m_device = device;
+            m_render = device;
+            if (m_drift_compensation) {
+                m_render.pcm_format = SampleFormat::Float;
+            }
+            if (m_depth) {
+                m_depth->set_format(double(device.buffer_size), double(device.sampling_rate));
+            }
+            m_copy_plan = m_plans.get(PlanKey(
+                { m_render.pcm_format, 1, 0, 0, device.sampling_rate },
+                { device.sampling_rate, device.buffer_size, 1, m_render.pcm_format }
+            ));
+            if (m_plan && !apply_source_format(m_source)) {
+                m_plan = nullptr;
+            }
+            prepare_resampler();
+            prepare_splice();
+            prepare_arena();
+        }
+
+        /// The plan samples pushed from now on are rendered with, nullptr before a source format is set
+        std::shared_ptr<const RenderPlan> plan() const {
+            return m_plan;
+        }
+
+        /// True if samples pushed from now on are passed to the device untouched
+        bool bit_perfect() const {
+            return m_plan && m_plan->bit_perfect() && m_gain.unity_target() && !m_drift_compensation && m_playback_rate == 1.0
+                && (m_source.sampling_rate == 0 || m_source.sampling_rate == m_render.sampling_rate);
+        }
+
+        /// Software volume, one gain per device channel, applied with a ramp
+        GainStage& gain() {
+            return m_gain;
+        }
+
+        /// Sets when samples pushed from now on are converted, like `push()` only on the streaming thread
+        void set_conversion_policy(ConversionPolicy policy) {
+            std::lock_guard<std::mutex> lock(m_push_lock);
+            m_policy = policy;
+        }
+
+        ConversionPolicy conversion_policy() const {
+            return m_policy;
+        }
+
+        /// Memory a queued frame takes under the current policy
+        size_t queued_bytes_per_frame() const {
+            if (!m_plan) {
+                return 0;
+            }
+            if (m_policy == ConversionPolicy::Late) {
+                return m_source.frame_bytes();
+            }
+            return sample_size(m_plan->key().device_format) * m_plan->key().device_channels;
+        }
+
+        /// Renders device channels in parallel on `pool` (nullptr for serial) once there are at least `min_channels`
+        /// May only be called while the callback is quiesced.
+        void set_worker_pool(std::shared_ptr<WorkerPool> pool, int32_t min_channels = kParallelMinChannels) {
+            m_pool = std::move(pool);
+            m_parallel_min_channels = min_channels;
+        }
+
+        /// Resamples queued audio to keep the queue's fill level where it settled, for producers on a clock of their own
+        /// (a live source, when the graph doesn't run on the device's clock), which would otherwise slowly fill or
+        /// drain the queue until it glitches. Like the device format, may only be changed while the callback is quiesced;
+        /// returns false, leaving it as it is, while anything is queued (or held by the callback) in the old render format.
+        bool set_drift_compensation(bool enabled) {
+            std::lock_guard<std::mutex> lock(m_push_lock);
+            if (enabled == m_drift_compensation) {
+                return true;
+            }
+            if (m_queue.count() != 0 || m_current_frames.load(std::memory_order_relaxed) != 0) {
+                return false;
+            }
+            m_drift_compensation = enabled;
+            set_device_format(m_device);
+            return true;
+        }
+
+        bool drift_compensation() const {
+            return m_drift_compensation;
+        }
+
+        /// Queued frames consumed per device frame, 1 without drift compensation
+        double drift_ratio() const {
+            return m_drift_ratio.load(std::memory_order_relaxed);
+        }
+
+        /// Adapts the queue depth to the observed jitter from now on, may only be called while the callback is quiesced
+        void enable_adaptive_depth(QueueDepthSettings settings = QueueDepthSettings()) {
+            m_depth = std::make_unique<QueueDepthController>(double(m_device.buffer_size), double(m_device.sampling_rate), settings);
+        }
+
+        /// Forgets the timing of the last delivery and callback, so a pause doesn't count as jitter
+        /// May only be called while the callback is quiesced.
+        void restart_timing() {
+            if (m_depth) {
+                m_depth->restart();
+            }
+            if (m_drift) {
+                m_drift->reset();
+            }
+        }
+
+        /// Plays queued audio from its timestamps: `origin` is the stream time at which the device plays the first frame
+        /// the callback renders from now on
+        /// The first buffer the callback reaches is placed on the device frame of its timestamp, to the nearest frame:
+        /// if that is still to come, silence is inserted ahead of it, if it has passed, the audio up to there is skipped.
+        /// Once aligned, playback runs on continuously. Buffers without a timestamp cancel the alignment.
+        /// May only be called while the callback is quiesced, typically right before the agent starts.
+        void align_start(int64_t origin) {
+            m_start_origin = origin;
+            m_start_elapsed = 0;
+            m_start_shift = 0;
+        }
+
+        /// Tells the core no more samples are coming, so the queue running dry is not taken for an underrun
+        /// Once the callback has found nothing left to play for a whole period, the stream is `drained()`.
+        void end_of_stream() {
+            m_depth_armed = false;
+            m_end_of_stream = true;
+        }
+
+        /// True once everything pushed before `end_of_stream()` has been handed to the device; a flush starts over
+        bool drained() const {
+            return m_drained.load(std::memory_order_acquire);
+        }
+
+        /// Sets what to call, once per stream, when it becomes `drained()`
+        /// It runs on the callback thread: it must not block, nor wait for anything that stops the agent.
+        /// May only be called while the callback is quiesced.
+        void set_drained_callback(DrainedCallback callback) {
+            m_on_drained = std::move(callback);
+        }
+
+        /// Sets what to call on the streaming thread right before `push()` waits for the callback to make room, e.g. to
+        /// start the agent if it is not running yet. May only be called while nothing is pushed.
+        void set_wait_callback(WaitCallback callback) {
+            m_on_wait = std::move(callback);
+        }
+
+        /// True while `push()` waits for the callback to make room
+        bool push_waiting() const {
+            return m_push_waiting.load(std::memory_order_acquire);
+        }
+
+        /// The queue depth the adaptive controller aims for, in seconds; 0 with a fixed depth
+        double target_latency() const {
+            return m_depth ? m_depth->target_seconds() : 0.0;
+        }
+
+        /// Audio queued ahead of the device, in seconds: queued buffers and the rest of the one the callback is working on
+        double latency() const {
+            if (m_device.sampling_rate <= 0) {
+                return 0.0;
+            }
+            return double(queued_frames()) / m_device.sampling_rate;
+        }
+
+        /// Sets the device's output latency in frames, as the agent reports it (`IOutputAgent::output_latency()`)
+        void set_output_latency(int32_t frames) {
+            m_output_latency.store(std::max(frames, 0), std::memory_order_relaxed);
+        }
+
+        /// How long audio takes from `push()` to the DAC, estimated on every callback, since the last `reset_stats()`
+        LatencyStats latency_stats() const {
+            return m_latency.stats();
+        }
+
+        /// Maximum number of queued samples right now
+        size_t queue_capacity() {
+            return m_queue.capacity();
+        }
+
+        /// Number of distinct plans built so far
+        size_t cached_plans() {
+            return m_plans.size();
+        }
+
+        /// `IOutputAgent` reconfiguration listener
+        /// Queued audio survives a buffer size change untouched; after a sampling rate change it would play at the wrong
+        /// speed, and after a sample format or channel change its plans (or early conversions) no longer fit: it is dropped.
+        /// Waits for the streaming thread to leave `push()`; one waiting for room, which only the stopped callback would
+        /// make, is released and its sample dropped, along with everything queued ahead of it.
+        void on_reconfigure(const StreamFormat& old_format, const StreamFormat& new_format) {
+            std::unique_lock<std::mutex> lock(m_push_lock, std::try_to_lock);
+            const bool interrupt = !lock.owns_lock();
+            if (interrupt) {
+                m_interrupted = true;
+                m_queue.begin_flush();
+                wake_producer();
+                lock.lock();
+            }
+
+            const bool format_changed = old_format.sampling_rate != new_format.sampling_rate || old_format.pcm_format != new_format.pcm_format
+                                     || old_format.output_channels != new_format.output_channels;
+            if (interrupt || format_changed) {
+                m_queue.begin_flush();
+                m_queued_frames = 0;
+                m_rate_reset = true;
+                if (format_changed) {
+                    m_current = QueuedBuffer();
+                }
+            }
+            set_device_format(new_format);
+            if ((interrupt || format_changed) && !m_flushing) {
+                m_queue.end_flush();
+            }
+            m_interrupted = false;
+        }
+
+        /// Queues `bytes` of interleaved PCM at `data`, which must stay valid while `sample` is referenced
+        /// Unless the producer says otherwise, the buffer is scanned for digital silence, which the callback then writes
+        /// straight to the device without rendering. The scan stops at the first audible sample, so it is cheap for music.
+        /// `start_time` is the stream time of the first frame, for `align_start()`; converted audio carries the time of
+        /// the input that produced it, give or take the delay of the filters.
+        /// Blocks while the queue is full. Returns false when flushing, or when no source format was set.
+        bool push(Sample* sample, const char* data, size_t bytes, Silence silence = Silence::Unknown, int64_t start_time = kNoTime) {
+            std::lock_guard<std::mutex> lock(m_push_lock);
+            // Released by a reconfiguration rather than a flush: dropped like the audio queued ahead of it
+            return push_sample(sample, data, bytes, silence, start_time) || m_interrupted.load();
+        }
+
+        /// The agent callback: fills one period, with silence where the queue runs dry
+        bool render(char** buffers) {
+            const double started = m_depth ? now_seconds() : 0.0;
+            if (m_drop_current.exchange(false, std::memory_order_acquire)) {
+                m_current = QueuedBuffer();
+                m_current_frames.store(0, std::memory_order_relaxed);
+                if (m_resampler) {
+                    m_resampler->reset();
+                    m_drift->reset();
+                }
+            }
+
+            const size_t period = size_t(m_device.buffer_size);
+            size_t missing;
+            size_t requested = period;
+            if (m_resampler) {
+                const double ratio = m_resampler->clamp_ratio(m_drift->update(double(queued_frames())));
+                requested = m_resampler->input_frames(period, ratio);
+                missing = pull(m_staging.data(), requested);
+                m_resampler->process(m_resampled_channels.data(), period, ratio);
+                for (int32_t c = 0; c < m_device.output_channels; ++c) {
+                    m_from_float(reinterpret_cast<const char*>(m_resampled_channels[c]), 1, buffers[c], 1, period);
+                }
+                m_drift_ratio.store(ratio, std::memory_order_relaxed);
+            } else {
+                missing = pull(buffers, period);
+            }
+
+            m_current_frames.store(m_current.frames != 0 ? m_current.frames - m_current_offset : 0, std::memory_order_relaxed);
+            observe_latency();
+            if (m_depth) {
+                const bool underrun = missing != 0 && m_depth_armed.load(std::memory_order_relaxed);
+                m_depth->on_callback(started, underrun ? missing : 0);
+            }
+            m_frames_rendered.fetch_add(period, std::memory_order_relaxed);
+
+            // A period with nothing at all to play: the last audio went out with the one before
+            if (missing == requested && m_end_of_stream.load(std::memory_order_relaxed) && !m_drained.exchange(true, std::memory_order_acq_rel)) {
+                if (m_on_drained) {
+                    m_on_drained();
+                }
+            }
+
+            return true;
+        }
+
+        /// Drops all queued samples and releases producers blocked in `push()`, until `end_flush()`
+        /// The sample the callback is working on is dropped on its next invocation (or by `release_current()`).
+        void begin_flush() {
+            m_flushing = true;
+            m_queue.begin_flush();
+            wake_producer();
+            m_rate_reset = true;
+            m_drop_current = true;
+            m_depth_armed = false;
+            m_end_of_stream = false;
+            m_drained = false;
+        }
+
+        void end_flush() {
+            m_flushing = false;
+            m_queued_frames = 0; // Pushes fail while flushing, whatever was counted has been dropped
+            m_queue.end_flush();
+        }
+
+        /// Releases the partially consumed sample right away, may only be called while the callback is quiesced
+        void release_current() {
+            m_current = QueuedBuffer();
+            m_current_frames = 0;
+            m_drop_current = false;
+        }
+
+        /// Number of queued samples, not counting the one the callback is working on
+        size_t queued_samples() {
+            return m_queue.count();
+        }
+
+        /// Frames ahead of the device, in the render format: queued, and left of the buffer the callback is working on
+        /// The count of queued frames may lag a buffer behind the callback taking it, and is never less than 0.
+        int64_t queued_frames() const {
+            return std::max(m_queued_frames.load(std::memory_order_relaxed), int64_t(0))
+                 + int64_t(m_current_frames.load(std::memory_order_relaxed));
+        }
+
+        Stats stats() const {
+            return {
+                m_frames_rendered.load(std::memory_order_relaxed),
+                m_underrun_frames.load(std::memory_order_relaxed),
+                m_samples_consumed.load(std::memory_order_relaxed),
+                m_bit_perfect_frames.load(std::memory_order_relaxed),
+                m_silent_frames.load(std::memory_order_relaxed),
+                m_inserted_frames.load(std::memory_order_relaxed),
+                m_dropped_frames.load(std::memory_order_relaxed),
+            };
+        }
+
+        /// Starts a new session of statistics
+        void reset_stats() {
+            m_frames_rendered = 0;
+            m_underrun_frames = 0;
+            m_samples_consumed = 0;
+            m_bit_perfect_frames = 0;
+            m_silent_frames = 0;
+            m_inserted_frames = 0;
+            m_dropped_frames = 0;
+            m_latency.reset();
+        }
+
+    private:
+        static double now_seconds() {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        // Fills `frames` frames of `buffers`, in the render format, from the queue
+        // Returns the number of frames made up with silence where it ran dry.
+        size_t pull(char** buffers, size_t frames) {
+            size_t written = 0;
+
+            while (written < frames) {
+                if (m_start_shift > 0) {
+                    // Ahead of the first frame's time: not an underrun, the device is early
+                    const size_t run = size_t(std::min(int64_t(frames - written), m_start_shift));
+                    write_silence(buffers, written, run);
+                    written += run;
+                    m_start_shift -= int64_t(run);
+                    continue;
+                }
+
+                if (m_current.frames == 0) {
+                    const uint64_t committed = m_converted.committed();
+                    if (!m_queue.poll(m_current)) {
+                        free_converted(committed); // Whatever was converted has been played or flushed
+                        break;
+                    }
+                    m_current_offset = 0;
+                    m_queued_frames.fetch_sub(int64_t(m_current.frames), std::memory_order_relaxed);
+                }
+
+                if (m_start_origin != kNoTime) {
+                    align(written);
+                    continue;
+                }
+
+                size_t run;
+                if (m_start_shift < 0) {
+                    // Past the first frame's time: skip what should have played already
+                    run = size_t(std::min(int64_t(m_current.frames - m_current_offset), -m_start_shift));
+                    m_start_shift += int64_t(run);
+                } else {
+                    run = std::min(frames - written, m_current.frames - m_current_offset);
+                    write_frames(m_current, m_current_offset, run, buffers, written);
+                    written += run;
+                }
+                m_current_offset += run;
+
+                if (m_current_offset == m_current.frames) {
+                    if (m_current.converted_end != 0) {
+                        free_converted(m_current.converted_end);
+                    }
+                    m_current = QueuedBuffer(); // Releases the sample back to its allocator
+                    m_samples_consumed.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            if (m_start_origin != kNoTime) {
+                m_start_elapsed += int64_t(frames); // Nothing to align yet, time goes on
+            }
+
+            if (written < frames) {
+                write_silence(buffers, written, frames - written);
+                m_underrun_frames.fetch_add(frames - written, std::memory_order_relaxed);
+            }
+
+            return frames - written;
+        }
+
+        // Writes `frames` frames of silence at `written`
+        // Gain ramps run on through gaps, they are about time, not samples.
+        void write_silence(char** buffers, size_t written, size_t frames) {
+            m_gain.segment();
+            m_gain.advance(frames);
+            for (int32_t c = 0; c < m_render.output_channels; ++c) {
+                fill_silence(m_render.pcm_format, buffers[c] + written * sample_size(m_render.pcm_format), frames);
+            }
+        }
+
+        // Callback: audio pushed now plays once everything ahead of it has, after the period just rendered and
+        // the device's own latency
+        void observe_latency() {
+            if (m_device.sampling_rate <= 0) {
+                return;
+            }
+            const int64_t frames = queued_frames() + std::max(m_start_shift, int64_t(0)) + m_device.buffer_size
+                                 + m_output_latency.load(std::memory_order_relaxed);
+            double seconds = double(frames) / m_device.sampling_rate + m_stage_latency.load(std::memory_order_relaxed);
+            if (m_resampler) {
+                seconds += double(AsyncResampler::kLatencyFrames) / m_device.sampling_rate;
+            }
+            m_latency.observe(seconds);
+        }
+
+        // Streaming thread: publishes how long audio takes through the stretcher (what it holds, at the playback rate)
+        // and the rate converter
+        void update_stage_latency() {
+            double seconds = m_rate_converter ? m_rate_converter->delay() : 0.0;
+            if (m_stretcher && m_stretcher_rate > 0) {
+                seconds += double(m_stretcher->pending_frames()) / (m_stretcher_rate * m_playback_rate);
+            }
+            m_stage_latency.store(seconds, std::memory_order_relaxed);
+        }
+
+        // Sets the shift that puts the current buffer where its timestamp says, `written` frames into this pull
+        void align(size_t written) {
+            if (m_current.start_time != kNoTime && m_render.sampling_rate > 0) {
+                const int64_t due = render_rate().frames(m_current.start_time - m_start_origin) + int64_t(m_current_offset);
+                m_start_shift = due - (m_start_elapsed + int64_t(written));
+            }
+            m_start_origin = kNoTime;
+        }
+
+        // Frames per second of what is queued
+        FrameRate render_rate() const {
+            return FrameRate(std::max(m_render.sampling_rate, 1));
+        }
+
+        // Frames per second of stream time pushed: the source's rate, over the playback rate when stretching
+        FrameRate stream_rate() const {
+            const int32_t source_rate = std::max(m_source.sampling_rate != 0 ? m_source.sampling_rate : m_render.sampling_rate, 1);
+            return m_playback_rate == 1.0 ? FrameRate(source_rate) : FrameRate::approximate(source_rate * m_playback_rate);
+        }
+
+        int64_t time_at(const QueuePosition& position) const {
+            return position.start != kNoTime ? position.start + render_rate().time(position.frames) : kNoTime;
+        }
+
+        // Sets the format of samples pushed from now on, with the push lock held (or while quiesced)
+        bool apply_source_format(const SourceFormat& source) {
+            std::shared_ptr<const RenderPlan> plan = m_plans.get(PlanKey(source, m_render));
+            if (!plan) {
+                return false;
+            }
+
+            if (source.sampling_rate != 0 && source.sampling_rate != m_render.sampling_rate) {
+                if (!prepare_rate_conversion(source)) {
+                    return false;
+                }
+            } else {
+                m_rate_converter.reset();
+            }
+            if ((m_rate_converter || m_stretcher || m_playback_rate != 1.0) && !prepare_float_path(source)) {
+                return false;
+            }
+
+            StreamFormat render_float = m_render;
+            render_float.pcm_format = SampleFormat::Float;
+            m_float_plan = m_plans.get(PlanKey(source, render_float));
+
+            m_source = source;
+            m_plan = std::move(plan);
+            update_stage_latency();
+            return true;
+        }
+
+        // Sets up conversion from the rate of `source` to the device's, keeping the filter state if the rate stays
+        bool prepare_rate_conversion(const SourceFormat& source) {
+            const size_t channels = size_t(m_render.output_channels);
+            if (!m_rate_converter || m_rate_converter->source_rate() != source.sampling_rate || m_rate_converter->target_rate() != m_render.sampling_rate
+                || m_rate_converter->quality() != m_resampler_quality || m_rate_converter->channels() != channels) {
+                const size_t block = std::max(size_t(kRateBlockSeconds * source.sampling_rate), size_t(1));
+                std::unique_ptr<RateConverter> converter = m_rate_converters.create(source.sampling_rate, m_render.sampling_rate, m_resampler_quality, channels, block);
+                if (!converter) {
+                    return false;
+                }
+                m_rate_converter = std::move(converter);
+                m_rate_input.resize(channels);
+                std::transform(m_rate_converter->input(), m_rate_converter->input() + channels, m_rate_input.begin(),
+                               [](float* channel) { return reinterpret_cast<char*>(channel); });
+                const size_t output = m_rate_converter->max_output_frames();
+                m_rate_output.assign(channels * output, 0.0f);
+                m_rate_output_channels.resize(channels);
+                for (size_t c = 0; c < channels; ++c) {
+                    m_rate_output_channels[c] = &m_rate_output[c * output];
+                }
+            }
+            return true;
+        }
+
+        // Sets up the float path of `source`: its plan to float at its own rate, and the stretcher if the rate calls for it
+        bool prepare_float_path(const SourceFormat& source) {
+            StreamFormat source_rate = m_render;
+            source_rate.sampling_rate = source.sampling_rate != 0 ? source.sampling_rate : m_render.sampling_rate;
+            source_rate.pcm_format = SampleFormat::Float;
+            std::shared_ptr<const RenderPlan> plan = m_plans.get(PlanKey(source, source_rate));
+            if (!plan) {
+                return false;
+            }
+
+            // A stretcher left at real time is drained on the next push, unless what it holds is in another format
+            const size_t channels = size_t(m_render.output_channels);
+            if (m_stretcher && (m_stretcher->channels() != channels || m_stretcher_rate != source_rate.sampling_rate)) {
+                m_stretcher.reset();
+            }
+            if (m_playback_rate != 1.0 && !m_stretcher) {
+                const size_t block = std::max(size_t(kRateBlockSeconds * source_rate.sampling_rate), size_t(1));
+                m_stretcher = std::make_unique<WsolaStretcher>(channels, source_rate.sampling_rate, block);
+                m_stretcher_rate = source_rate.sampling_rate;
+                m_stretch_input.resize(channels);
+                std::transform(m_stretcher->input(), m_stretcher->input() + channels, m_stretch_input.begin(),
+                               [](float* channel) { return reinterpret_cast<char*>(channel); });
+                const size_t output = m_stretcher->max_output_frames();
+                m_stretch_output.assign(channels * output, 0.0f);
+                m_stretch_output_channels.resize(channels);
+                for (size_t c = 0; c < channels; ++c) {
+                    m_stretch_output_channels[c] = &m_stretch_output[c * output];
+                }
+            }
+            if (m_stretcher) {
+                m_stretcher->set_rate(m_playback_rate);
+            }
+
+            m_rate_plan = std::move(plan);
+            return true;
+        }
+
+        // `push()`, with the push lock held
+        bool push_sample(Sample* sample, const char* data, size_t bytes, Silence silence, int64_t start_time) {
+            if (!m_plan) {
+                return false;
+            }
+
+            size_t frames = bytes / m_source.frame_bytes();
+            if (frames == 0) {
+                return true;
+            }
+
+            // Bookkeeping is in device frames
+            const FrameRate stream_rate = this->stream_rate();
+            const size_t device_frames = size_t(stream_rate.convert(int64_t(frames), render_rate(), Rounding::Down));
+            if (device_frames != 0) { // A frame or so converted down to the device's rate, nothing to size the queue by
+                m_average_frames = m_average_frames == 0.0 ? double(device_frames) : m_average_frames + 0.1 * (double(device_frames) - m_average_frames);
+                if (m_depth) {
+                    adapt_depth(device_frames);
+                }
+            }
+
+            if (m_rate_reset.exchange(false)) {
+                if (m_rate_converter) {
+                    m_rate_converter->reset();
+                }
+                if (m_stretcher) {
+                    m_stretcher->reset();
+                }
+                m_timeline.reset();
+                m_splice_pending = false;
+                std::fill(m_splice_last.begin(), m_splice_last.end(), 0.0f);
+            }
+
+            // Fill gaps, drop overlaps
+            const int64_t jump = m_timeline.follow(start_time, int64_t(frames), stream_rate);
+            if (jump > 0) {
+                if (!insert_silence(size_t(render_rate().frames(jump)), start_time - jump)) {
+                    return false;
+                }
+            } else if (jump < 0) {
+                const size_t dropped = size_t(std::min(stream_rate.frames(-jump), int64_t(frames)));
+                m_dropped_frames.fetch_add(uint64_t(stream_rate.convert(int64_t(dropped), render_rate())), std::memory_order_relaxed);
+                if (dropped == frames) {
+                    return true;
+                }
+                data += dropped * m_source.frame_bytes();
+                frames -= dropped;
+                start_time -= jump;
+            }
+            if (jump != 0) {
+                m_splice_pending = true;
+            }
+
+            if (m_stretcher && m_playback_rate == 1.0 && !drain_stretcher()) {
+                return false;
+            }
+            QueuePosition position { start_time, 0 };
+            if (m_rate_converter || m_stretcher) {
+                return push_converted(data, frames, position);
+            }
+            if (m_splice_pending && !push_splice(data, frames, position)) {
+                return false;
+            }
+            if (frames == 0) {
+                return true;
+            }
+            start_time = time_at(position);
+
+            const bool silent = silence == Silence::Silent
+                || (silence == Silence::Unknown && simd::all_bytes_equal(data, frames * m_source.frame_bytes(), silence_byte(m_source.format)));
+            remember_last(data, frames, silent);
+
+            if (m_policy == ConversionPolicy::Late) {
+                return queue(QueuedBuffer { SampleRef<Sample>(sample), data, frames, m_plan, silent, 0, false, start_time });
+            }
+
+            // Early: the sample is not referenced, it goes back upstream as soon as this returns
+            QueuedBuffer buffer { SampleRef<Sample>(), nullptr, frames, m_plan, silent, 0, false, start_time };
+            if (!silent) {
+                const size_t channels = size_t(m_plan->key().device_channels);
+                const size_t channel_bytes = frames * sample_size(m_plan->key().device_format);
+                char* chunk = m_push_channels ? m_converted.allocate(channel_bytes * channels, buffer.converted_end) : nullptr;
+                if (!chunk) {
+                    // The arena is full of converted audio already, this one is converted late
+                    return queue(QueuedBuffer { SampleRef<Sample>(sample), data, frames, m_plan, silent, 0, false, start_time });
+                }
+
+                for (size_t c = 0; c < channels; ++c) {
+                    m_push_channels[c] = chunk + c * channel_bytes;
+                }
+                m_plan->render(data, frames, m_push_channels, 0);
+                buffer.data = chunk;
+            }
+
+            const bool queued = queue(std::move(buffer));
+            m_converted.commit(); // Queued or dropped by a flush, either way the callback frees it
+            return queued;
+        }
+
+        // Stretches and converts `frames` frames to the device's rate and queues them at `position`, in as many buffers
+        // as the block sizes take
+        bool push_converted(const char* data, size_t frames, QueuePosition& position) {
+            if (m_converted.capacity() == 0) {
+                return false;
+            }
+
+            while (frames != 0) {
+                bool queued;
+                size_t block;
+                if (m_stretcher) {
+                    block = std::min(frames, m_stretcher->max_input_frames());
+                    m_rate_plan->render(data, block, m_stretch_input.data(), 0);
+                    const size_t stretched = m_stretcher->process(block, m_stretch_output_channels.data());
+                    queued = resample_and_queue(m_stretch_output_channels.data(), stretched, position);
+                } else {
+                    block = std::min(frames, m_rate_converter->max_input_frames());
+                    m_rate_plan->render(data, block, m_rate_input.data(), 0);
+                    queued = convert_and_queue(block, position);
+                }
+                if (!queued) {
+                    return false;
+                }
+                data += block * m_source.frame_bytes();
+                frames -= block;
+            }
+            update_stage_latency();
+            return true;
+        }
+
+        // Queues the first frames of `data` fading in from the last frame queued, in the arena, and moves past them
+        bool push_splice(const char*& data, size_t& frames, QueuePosition& position) {
+            if (!m_float_plan || m_converted.capacity() == 0) {
+                m_splice_pending = false; // Played as it is
+                return true;
+            }
+            const size_t head = std::min(frames, m_splice_frames);
+            m_float_plan->render(data, head, m_splice_targets.data(), 0);
+            if (!queue_float(m_splice_channels.data(), head, position)) {
+                return false;
+            }
+            data += head * m_source.frame_bytes();
+            frames -= head;
+            return true;
+        }
+
+        // Queues `frames` frames of silence for a gap in the timestamps from `time` on; what follows fades in from it
+        bool insert_silence(size_t frames, int64_t time) {
+            m_inserted_frames.fetch_add(frames, std::memory_order_relaxed);
+            std::fill(m_splice_last.begin(), m_splice_last.end(), 0.0f);
+            return frames == 0 || queue(QueuedBuffer { SampleRef<Sample>(), nullptr, frames, m_plan, true, 0, true, time });
+        }
+
+        // Keeps the last frame of `data`, in float, for a fade that may follow
+        void remember_last(const char* data, size_t frames, bool silent) {
+            if (silent || !m_float_plan || m_splice_last_targets.size() != size_t(m_float_plan->key().device_channels)) {
+                std::fill(m_splice_last.begin(), m_splice_last.end(), 0.0f);
+                return;
+            }
+            m_float_plan->render(data + (frames - 1) * m_source.frame_bytes(), 1, m_splice_last_targets.data(), 0);
+        }
+
+        // Back at real time: queues what the stretcher held back, and bypasses it from now on
+        bool drain_stretcher() {
+            const size_t drained = m_stretcher->drain(m_stretch_output_channels.data());
+            m_stretcher.reset();
+            update_stage_latency();
+            QueuePosition position { kNoTime, 0 };
+            return m_converted.capacity() != 0 && resample_and_queue(m_stretch_output_channels.data(), drained, position);
+        }
+
+        // Converts `frames` float frames at the source rate to the device's and queues them at `position`
+        bool resample_and_queue(const float* const* channels, size_t frames, QueuePosition& position) {
+            if (!m_rate_converter) {
+                return queue_float(channels, frames, position);
+            }
+            for (size_t done = 0; done < frames;) {
+                const size_t block = std::min(frames - done, m_rate_converter->max_input_frames());
+                for (size_t c = 0; c < m_rate_converter->channels(); ++c) {
+                    std::copy_n(channels[c] + done, block, m_rate_converter->input()[c]);
+                }
+                if (!convert_and_queue(block, position)) {
+                    return false;
+                }
+                done += block;
+            }
+            return true;
+        }
+
+        // Converts the `frames` frames written to the converter's input and queues them at `position`
+        bool convert_and_queue(size_t frames, QueuePosition& position) {
+            const size_t produced = m_rate_converter->process(frames, m_rate_output_channels.data());
+            return queue_float(m_rate_output_channels.data(), produced, position);
+        }
+
+        // Queues `frames` float frames at the device's rate, converted to the render format in the arena, at
+        // `position`, which is moved on past them
+        // Waits for the callback to free arena space when there is none, like `queue()` waits for a slot.
+        bool queue_float(const float* const* channels, size_t frames, QueuePosition& position) {
+            const size_t count = size_t(m_render.output_channels);
+            const size_t sample_bytes = sample_size(m_render.pcm_format);
+            const size_t most = std::max(size_t(kRateBlockSeconds * m_render.sampling_rate), size_t(1));
+
+            for (size_t done = 0; done < frames;) {
+                size_t run = std::min(frames - done, most);
+                const float* const* source = channels;
+                size_t from = done;
+                if (m_splice_pending) {
+                    // Fades in from the last frame queued, in a buffer of its own
+                    run = std::min(run, m_splice_frames);
+                    for (size_t c = 0; c < count; ++c) {
+                        const float last = m_splice_last[c];
+                        for (size_t n = 0; n < run; ++n) {
+                            const float w = float(n + 1) / float(run + 1);
+                            m_splice_channels[c][n] = last + w * (channels[c][done + n] - last);
+                        }
+                    }
+                    source = m_splice_channels.data();
+                    from = 0;
+                    m_splice_pending = false;
+                }
+
+                QueuedBuffer buffer { SampleRef<Sample>(), nullptr, run, m_plan, false, 0, true, time_at(position) };
+                char* chunk = m_converted.allocate(run * count * sample_bytes, buffer.converted_end);
+                if (!chunk && !(chunk = wait_for_room(run * count * sample_bytes, buffer.converted_end))) {
+                    return false;
+                }
+
+                for (size_t c = 0; c < count; ++c) {
+                    m_float_to_render(reinterpret_cast<const char*>(source[c] + from), 1, chunk + c * run * sample_bytes, 1, run);
+                }
+                buffer.data = chunk;
+
+                const bool queued = queue(std::move(buffer));
+                m_converted.commit(); // Queued or dropped by a flush, either way the callback frees it
+                if (!queued) {
+                    return false;
+                }
+                done += run;
+                position.frames += int64_t(run);
+                if (done == frames) {
+                    for (size_t c = 0; c < count; ++c) {
+                        m_splice_last[c] = source[c][from + run - 1];
+                    }
+                }
+            }
+            return true;
+        }
+
+        bool queue(QueuedBuffer&& buffer) {
+            const int64_t frames = int64_t(buffer.frames);
+            if (!m_queue.offer(std::move(buffer))) { // Left as it was if full
+                begin_wait();
+                const bool put = m_queue.put(std::move(buffer));
+                m_push_waiting = false;
+                if (!put) {
+                    return false;
+                }
+            }
+            m_queued_frames.fetch_add(frames, std::memory_order_relaxed);
+            m_depth_armed.store(true, std::memory_order_relaxed);
+            return true;
+        }
+
+        // About to wait for the callback to make room
+        void begin_wait() {
+            m_push_waiting = true;
+            if (m_on_wait) {
+                m_on_wait();
+            }
+        }
+
+        // Allocates `bytes` in the arena once the callback has freed enough, nullptr if a flush or a reconfiguration
+        // comes first
+        char* wait_for_room(size_t bytes, uint64_t& end) {
+            begin_wait();
+            // Pairs with the fence in `free_converted()`: either the allocation sees the space, or the callback sees the wait
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            char* chunk = nullptr;
+            std::unique_lock<std::mutex> lock(m_room_lock);
+            while (!(chunk = m_converted.allocate(bytes, end)) && !m_flushing.load() && !m_interrupted.load()) {
+                m_room.wait(lock);
+            }
+            m_push_waiting = false;
+            return chunk;
+        }
+
+        // Releases a push waiting for arena space, to find that it is flushing or interrupted
+        void wake_producer() {
+            {
+                std::lock_guard<std::mutex> lock(m_room_lock);
+            }
+            m_room.notify_all();
+        }
+
+        // Callback: hands arena space back up to `end`, and wakes a push waiting for it
+        // The lock is only taken while a push waits, from which it is only ever held for an allocation attempt.
+        void free_converted(uint64_t end) {
+            m_converted.free(end);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (m_push_waiting.load(std::memory_order_relaxed)) {
+                std::lock_guard<std::mutex> lock(m_room_lock);
+                m_room.notify_one();
+            }
+        }
+
+        // Sets up drift compensation for the device format, or tears it down
+        void prepare_resampler() {
+            if (!m_drift_compensation || m_device.sampling_rate <= 0) {
+                m_resampler.reset();
+                m_drift.reset();
+                m_drift_ratio = 1;
+                return;
+            }
+
+            const size_t channels = size_t(m_device.output_channels);
+            const size_t period = size_t(m_device.buffer_size);
+            m_from_float = converter_for(SampleFormat::Float, m_device.pcm_format);
+            if (m_resampler && m_resampler->channels() == channels && m_resampler->max_output_frames() == period) {
+                return;
+            }
+
+            m_resampler = std::make_unique<AsyncResampler>(channels, period);
+            m_drift = std::make_unique<DriftController>(double(period));
+            m_drift_ratio = 1;
+            m_staging.resize(channels);
+            std::transform(m_resampler->input(), m_resampler->input() + channels, m_staging.begin(),
+                           [](float* channel) { return reinterpret_cast<char*>(channel); });
+            m_resampled.assign(channels * period, 0.0f);
+            m_resampled_channels.resize(channels);
+            for (size_t c = 0; c < channels; ++c) {
+                m_resampled_channels[c] = &m_resampled[c * period];
+            }
+        }
+
+        // Sizes the fade buffers for the render format
+        void prepare_splice() {
+            const size_t channels = size_t(std::max(m_render.output_channels, 0));
+            m_splice_frames = std::max(size_t(kSpliceSeconds * m_render.sampling_rate), size_t(1));
+            m_splice.assign(channels * m_splice_frames, 0.0f);
+            m_splice_channels.resize(channels);
+            m_splice_targets.resize(channels);
+            m_splice_last.assign(channels, 0.0f);
+            m_splice_last_targets.resize(channels);
+            for (size_t c = 0; c < channels; ++c) {
+                m_splice_channels[c] = &m_splice[c * m_splice_frames];
+                m_splice_targets[c] = reinterpret_cast<char*>(m_splice_channels[c]);
+                m_splice_last_targets[c] = reinterpret_cast<char*>(&m_splice_last[c]);
+            }
+            m_float_to_render = converter_for(SampleFormat::Float, m_render.pcm_format);
+        }
+
+        // Lays the arena out for the render format, unless it already is
+        // The layout is for the worst case (early conversion, rate conversion, stretching and fades all at once) and
+        // only ever changes with the render format, while the callback is quiesced: queued or held chunks never move.
+        void prepare_arena() {
+            if (m_render.sampling_rate <= 0 || m_render == m_arena_format) {
+                return;
+            }
+            // A buffer size change doesn't change the layout, and queued conversions survive it
+            StreamFormat format = m_render;
+            format.buffer_size = m_arena_format.buffer_size;
+            if (m_push_channels && format == m_arena_format) {
+                m_arena_format = m_render;
+                return;
+            }
+
+            const size_t channels = size_t(m_render.output_channels);
+            const size_t converted = size_t(kEarlyConversionSeconds * m_render.sampling_rate) * channels * sample_size(m_render.pcm_format);
+            const size_t bytes = converted + channels * sizeof(char*) + 2 * StreamArena::kAlignment;
+
+            if (m_arena.size() < bytes) {
+                m_arena.reserve(bytes);
+            }
+            m_arena.reset();
+            m_push_channels = m_arena.allocate_array<char*>(channels);
+            if (!m_push_channels || !m_converted.reserve(m_arena, converted)) {
+                m_push_channels = nullptr; // No arena, no early conversion
+            }
+            m_arena_format = m_render;
+        }
+
+        // Streaming thread: lets the controller see a delivery of `frames` frames and sizes the queue for its target
+        void adapt_depth(size_t frames) {
+            const double now = now_seconds();
+            m_depth->on_delivery(now, frames);
+            const double target = m_depth->update(now);
+
+            const size_t samples = size_t(std::ceil(target / m_average_frames));
+            const size_t capacity = std::min(std::max(samples, size_t(1)), m_max_samples);
+            if (capacity != m_capacity) {
+                m_capacity = capacity;
+                m_queue.resize(capacity);
+            }
+        }
+
+        void write_frames(const QueuedBuffer& buffer, size_t offset, size_t frames, char** buffers, size_t written) {
+            const GainSegment gain = m_gain.segment();
+            const size_t channels = size_t(m_device.output_channels);
+
+            if (m_pool && m_pool->workers() != 0 && m_device.output_channels >= m_parallel_min_channels
+                && frames * channels >= kParallelMinSamples) {
+                const size_t slices = std::min(m_pool->workers() + 1, channels);
+                auto slice = [&](size_t i) {
+                    render_channels(buffer, offset, frames, buffers, written, gain, i * channels / slices, (i + 1) * channels / slices);
+                };
+                m_pool->run(slices, slice);
+            } else {
+                render_channels(buffer, offset, frames, buffers, written, gain, 0, channels);
+            }
+            m_gain.advance(frames);
+
+            if (buffer.silent) {
+                m_silent_frames.fetch_add(frames, std::memory_order_relaxed);
+            }
+            if (buffer.plan->bit_perfect() && !buffer.reshaped && gain.kind == GainSegment::Kind::Unity && !m_resampler) {
+                m_bit_perfect_frames.fetch_add(frames, std::memory_order_relaxed);
+            }
+        }
+
+        // Renders device channels [first, last) of a run, possibly on a pool thread
+        void render_channels(const QueuedBuffer& buffer, size_t offset, size_t frames, char** buffers, size_t written, const GainSegment& gain,
+                             size_t first, size_t last) const {
+            if (buffer.silent) {
+                for (size_t c = first; c < last; ++c) {
+                    fill_silence(m_render.pcm_format, buffers[c] + written * sample_size(m_render.pcm_format), frames);
+                }
+            } else if (buffer.converted_end != 0) {
+                const size_t sample_bytes = sample_size(m_render.pcm_format);
+                for (size_t c = first; c < last; ++c) {
+                    // The copy plan is mono: point its gain at this channel's
+                    const GainSegment channel_gain = { gain.kind, gain.curve, gain.start + c, gain.step + c, gain.target + c };
+                    const char* src = buffer.data + (c * buffer.frames + offset) * sample_bytes;
+                    m_copy_plan->render(src, frames, &buffers[c], written, channel_gain);
+                }
+            } else {
+                buffer.plan->render(buffer.data + offset * buffer.plan->key().source.frame_bytes(), frames, buffers, written, gain, first, last);
+            }
+        }
+    };
+
+}
@@ -0,0 +1,436 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "ChannelLayout.h"
+#include "GainStage.h"
+#include "IOutputAgent.h"
+#include "convert.h"
+#include "simd.h"
+
+namespace StupidAR {
+
+    // Layout of the interleaved PCM data in upstream samples
+    struct SourceFormat {
+        SampleFormat format;
+        int32_t channels;
+        uint32_t channel_mask; // Speaker positions, 0 for the layout Windows assumes for the channel count
+        int32_t valid_bits;    // 0 if every bit of the container is valid
+        int32_t sampling_rate; // 0 if unknown
+
+        size_t frame_bytes() const {
+            return sample_size(format) * channels;
+        }
+
+        bool operator==(const SourceFormat& other) const {
+            return format == other.format && channels == other.channels && channel_mask == other.channel_mask
+                && valid_bits == other.valid_bits && sampling_rate == other.sampling_rate;
+        }
+
+        bool operator!=(const SourceFormat& other) const {
+            return !(*this == other);
+        }
+    };
+
+    // Everything a render plan is built from
+    struct PlanKey {
+        SourceFormat source;
+        SampleFormat device_format;
+        int32_t device_channels;
+        int32_t device_sampling_rate;
+
+        PlanKey(const SourceFormat& source, const StreamFormat& device)
+            : source(source),
+              device_format(device.pcm_format),
+              device_channels(device.output_channels),
+              device_sampling_rate(device.sampling_rate) {
+        }
+
+        bool operator==(const PlanKey& other) const {
+            return source == other.source && device_format == other.device_format && device_channels == other.device_channels
+                && device_sampling_rate == other.device_sampling_rate;
+        }
+
+        bool operator!=(const PlanKey& other) const {
+            return !(*this == other);
+        }
+    };
+
+    /// Immutable recipe for turning interleaved source frames into the device's per-channel buffers
+    /// Every decision that depends on the formats (sample conversion, channel remix, gain) is made once, when the plan
+    /// is built, and baked into a single kernel: rendering a run of frames is one indirect call, with no branching
+    /// on the format inside.
+    /// The remix matrix comes from the channel layouts (`remix_matrix()`). Sparse matrices, where every device channel
+    /// is fed by at most one source channel, become a plain copy/reorder with per-channel gain; dense ones are mixed
+    /// in float with SIMD multiply-accumulate.
+    /// Run-time gain (`GainStage`) has its own kernels, picked per run by the kind of segment: a constant gain is
+    /// folded into the mix coefficients, a ramp is applied to the mixed block while it is still in L1, so neither costs
+    /// a pass over memory.
+    /// Device channels are independent of each other, so a run can be rendered in slices of channels on several threads.
+    class RenderPlan {
+    public:
+        using Kernel = void(*)(const RenderPlan& plan, const char* src, size_t frames, char** dst, size_t dst_offset, const GainSegment& gain,
+                               size_t first, size_t last);
+
+    private:
+        struct MixTerm {
+            size_t input;
+            float gain;
+        };
+
+        enum class GainApply {
+            None,
+            Constant,
+            Linear,
+            Exponential,
+        };
+
+        // Float samples of scratch space on the stack of the matrix kernel
+        static constexpr size_t kMixScratch = 4096;
+
+        PlanKey m_key;
+        std::vector<float> m_matrix;    // Device channels x source channels, gains included
+        std::vector<int32_t> m_routing; // Sparse plans: source channel feeding each device channel, -1 for silence
+        std::vector<float> m_gains;     // Sparse plans: gain of each device channel
+        std::vector<std::vector<MixTerm>> m_mix; // Dense plans: non-zero terms of each matrix row
+        bool m_sparse;
+        bool m_bit_perfect;
+        Kernel m_kernel;
+        Kernel m_constant_gain_kernel;
+        Kernel m_linear_ramp_kernel;
+        Kernel m_exponential_ramp_kernel;
+
+    public:
+        /// Builds the plan for `key` with per-device-channel `gains` (unity if empty) and a remix `matrix`
+        /// (device channels x source channels, derived from the channel layouts if empty)
+        /// Returns nullptr if there is no conversion between the formats.
+        static std::shared_ptr<const RenderPlan> build(const PlanKey& key, std::vector<float> gains = std::vector<float>(),
+                                                       std::vector<float> matrix = std::vector<float>()) {
+            if (key.source.channels <= 0 || key.device_channels <= 0) {
+                return nullptr;
+            }
+
+            std::shared_ptr<RenderPlan> plan(new RenderPlan(key, std::move(gains), std::move(matrix)));
+            return plan->m_kernel && plan->m_constant_gain_kernel ? plan : nullptr;
+        }
+
+        /// Renders `frames` frames from `src` into each `dst` channel buffer, starting `dst_offset` samples in
+        void render(const char* src, size_t frames, char** dst, size_t dst_offset) const {
+            static const GainSegment unity = { GainSegment::Kind::Unity, GainCurve::Linear, nullptr, nullptr, nullptr };
+            m_kernel(*this, src, frames, dst, dst_offset, unity, 0, m_routing.size());
+        }
+
+        /// Like `render()`, with the run-time `gain` applied on top of the plan's own
+        void render(const char* src, size_t frames, char** dst, size_t dst_offset, const GainSegment& gain) const {
+            render(src, frames, dst, dst_offset, gain, 0, m_routing.size());
+        }
+
+        /// Like `render()`, but only device channels [first, last); `dst` and `gain` are still indexed by device channel
+        void render(const char* src, size_t frames, char** dst, size_t dst_offset, const GainSegment& gain, size_t first, size_t last) const {
+            switch (gain.kind) {
+            case GainSegment::Kind::Unity:
+                m_kernel(*this, src, frames, dst, dst_offset, gain, first, last);
+                break;
+            case GainSegment::Kind::Constant:
+                m_constant_gain_kernel(*this, src, frames, dst, dst_offset, gain, first, last);
+                break;
+            case GainSegment::Kind::Ramp:
+                (gain.curve == GainCurve::Linear ? m_linear_ramp_kernel : m_exponential_ramp_kernel)(*this, src, frames, dst, dst_offset, gain, first, last);
+                break;
+            }
+        }
+
+        const PlanKey& key() const {
+            return m_key;
+        }
+
+        const std::vector<float>& matrix() const {
+            return m_matrix;
+        }
+
+        /// True if every device channel is a (scaled) copy of at most one source channel
+        bool sparse() const {
+            return m_sparse;
+        }
+
+        /// Source channel feeding each device channel (-1 for silence), valid for sparse plans
+        const std::vector<int32_t>& routing() const {
+            return m_routing;
+        }
+
+        /// Gain of each device channel, valid for sparse plans
+        const std::vector<float>& gains() const {
+            return m_gains;
+        }
+
+        /// True if the plan passes samples through untouched: same sample format and rate on both ends, identity
+        /// channel routing and unity gain. Its kernel only deinterleaves (or copies, for mono).
+        bool bit_perfect() const {
+            return m_bit_perfect;
+        }
+
+        bool unity_gain() const {
+            if (!m_sparse) {
+                return false;
+            }
+            for (float g : m_gains) {
+                if (g != 1.0f) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+    private:
+        RenderPlan(const PlanKey& key, std::vector<float> gains, std::vector<float> matrix)
+            : m_key(key),
+              m_matrix(std::move(matrix)),
+              m_routing(key.device_channels, -1),
+              m_gains(std::move(gains)),
+              m_mix(key.device_channels),
+              m_sparse(true),
+              m_bit_perfect(false),
+              m_kernel(nullptr),
+              m_constant_gain_kernel(nullptr),
+              m_linear_ramp_kernel(nullptr),
+              m_exponential_ramp_kernel(nullptr) {
+            const size_t in_channels = size_t(key.source.channels);
+            const size_t out_channels = size_t(key.device_channels);
+
+            if (in_channels + 1 > kMixScratch / 4) {
+                return;
+            }
+
+            if (m_matrix.size() != in_channels * out_channels) {
+                const uint32_t source_mask = key.source.channel_mask != 0 ? key.source.channel_mask : default_channel_mask(key.source.channels);
+                m_matrix = remix_matrix(source_mask, key.source.channels, default_channel_mask(key.device_channels), key.device_channels);
+            }
+            m_gains.resize(out_channels, 1.0f);
+
+            for (size_t o = 0; o < out_channels; ++o) {
+                for (size_t i = 0; i < in_channels; ++i) {
+                    const float gain = m_matrix[o * in_channels + i] * m_gains[o];
+                    m_matrix[o * in_channels + i] = gain;
+                    if (gain != 0.0f) {
+                        m_mix[o].push_back({ i, gain });
+                    }
+                }
+                m_sparse = m_sparse && m_mix[o].size() <= 1;
+            }
+
+            m_constant_gain_kernel = select_matrix_kernel<GainApply::Constant>();
+            m_linear_ramp_kernel = select_matrix_kernel<GainApply::Linear>();
+            m_exponential_ramp_kernel = select_matrix_kernel<GainApply::Exponential>();
+
+            if (!m_sparse) {
+                m_kernel = select_matrix_kernel<GainApply::None>();
+                return;
+            }
+
+            for (size_t o = 0; o < out_channels; ++o) {
+                m_routing[o] = m_mix[o].empty() ? -1 : int32_t(m_mix[o][0].input);
+                m_gains[o] = m_mix[o].empty() ? 1.0f : m_mix[o][0].gain;
+            }
+
+            m_bit_perfect = key.source.format == key.device_format && key.source.channels == key.device_channels
+                         && (key.source.sampling_rate == 0 || key.source.sampling_rate == key.device_sampling_rate)
+                         && identity_routing() && unity_gain();
+
+            if (m_bit_perfect) {
+                m_kernel = visit_format(key.source.format, Kernel(nullptr), [](auto format) {
+                    return Kernel(&passthrough_kernel<decltype(format)::value>);
+                });
+            } else {
+                m_kernel = unity_gain() ? select_kernel<true>() : select_kernel<false>();
+            }
+        }
+
+        bool identity_routing() const {
+            for (size_t c = 0; c < m_routing.size(); ++c) {
+                if (m_routing[c] != int32_t(c)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        template <bool unity_gain>
+        Kernel select_kernel() const {
+            return visit_format(m_key.source.format, Kernel(nullptr), [&](auto from) {
+                return visit_format(m_key.device_format, Kernel(nullptr), [&](auto to) {
+                    return Kernel(&kernel<decltype(from)::value, decltype(to)::value, unity_gain>);
+                });
+            });
+        }
+
+        template <GainApply apply>
+        Kernel select_matrix_kernel() const {
+            return visit_format(m_key.source.format, Kernel(nullptr), [&](auto from) {
+                return visit_format(m_key.device_format, Kernel(nullptr), [&](auto to) {
+                    return Kernel(&matrix_kernel<decltype(from)::value, decltype(to)::value, apply>);
+                });
+            });
+        }
+
+        template <SampleFormat format>
+        static void passthrough_kernel(const RenderPlan& plan, const char* src, size_t frames, char** dst, size_t dst_offset, const GainSegment&,
+                                       size_t first, size_t last) {
+            using sample_t = typename PcmFormatTraits<format>::sample_t;
+
+            const size_t channels = plan.m_routing.size();
+            if (channels == 1 && last > first) {
+                std::memcpy(dst[0] + dst_offset * sizeof(sample_t), src, frames * sizeof(sample_t));
+                return;
+            }
+
+            const sample_t* s = reinterpret_cast<const sample_t*>(src);
+            for (size_t c = first; c < last; ++c) {
+                sample_t* d = reinterpret_cast<sample_t*>(dst[c]) + dst_offset;
+                for (size_t i = 0; i < frames; ++i) {
+                    d[i] = s[i * channels + c];
+                }
+            }
+        }
+
+        template <SampleFormat from, SampleFormat to, bool unity_gain>
+        static void kernel(const RenderPlan& plan, const char* src, size_t frames, char** dst, size_t dst_offset, const GainSegment&,
+                           size_t first, size_t last) {
+            using src_t = typename PcmFormatTraits<from>::sample_t;
+            using dst_t = typename PcmFormatTraits<to>::sample_t;
+            // Gain is applied in double precision when either end has more than float's 24 bits of mantissa
+            constexpr SampleFormat mix = from == SampleFormat::Double || from == SampleFormat::S32 || to == SampleFormat::Double
+                                      || to == SampleFormat::S32 ? SampleFormat::Double : SampleFormat::Float;
+            using mix_t = typename PcmFormatTraits<mix>::sample_t;
+
+            const src_t* s = reinterpret_cast<const src_t*>(src);
+            const size_t stride = size_t(plan.m_key.source.channels);
+
+            for (size_t c = first; c < last; ++c) {
+                dst_t* d = reinterpret_cast<dst_t*>(dst[c]) + dst_offset;
+                const int32_t in = plan.m_routing[c];
+
+                if (in < 0) {
+                    fill_silence(to, reinterpret_cast<char*>(d), frames);
+                    continue;
+                }
+
+                const src_t* sc = s + in;
+                if constexpr (unity_gain) {
+                    for (size_t i = 0; i < frames; ++i) {
+                        d[i] = convert_any_sample<from, to>(sc[i * stride]);
+                    }
+                } else {
+                    const mix_t gain = mix_t(plan.m_gains[c]);
+                    for (size_t i = 0; i < frames; ++i) {
+                        d[i] = convert_any_sample<mix, to>(convert_any_sample<from, mix>(sc[i * stride]) * gain);
+                    }
+                }
+            }
+        }
+
+        // Deinterleaves blocks of source frames into float scratch, then builds each device channel from its row's terms
+        // Only the source channels the slice of device channels reads from are deinterleaved.
+        template <SampleFormat from, SampleFormat to, GainApply apply>
+        static void matrix_kernel(const RenderPlan& plan, const char* src, size_t frames, char** dst, size_t dst_offset, const GainSegment& gain,
+                                  size_t first, size_t last) {
+            using src_t = typename PcmFormatTraits<from>::sample_t;
+            using dst_t = typename PcmFormatTraits<to>::sample_t;
+
+            alignas(16) float scratch[kMixScratch];
+            const size_t in_channels = size_t(plan.m_key.source.channels);
+            const size_t block = (kMixScratch / (in_channels + 1)) & ~size_t(3); // Keeps every channel 16-byte aligned
+            float* const mixed = scratch + in_channels * block;
+
+            const src_t* s = reinterpret_cast<const src_t*>(src);
+
+            bool needed[kMixScratch / 4] = {};
+            for (size_t o = first; o < last; ++o) {
+                for (const MixTerm& term : plan.m_mix[o]) {
+                    needed[term.input] = true;
+                }
+            }
+
+            for (size_t done = 0; done < frames; done += block) {
+                const size_t n = std::min(block, frames - done);
+
+                for (size_t i = 0; i < in_channels; ++i) {
+                    if (!needed[i]) {
+                        continue;
+                    }
+                    float* x = scratch + i * block;
+                    const src_t* sc = s + done * in_channels + i;
+                    for (size_t f = 0; f < n; ++f) {
+                        x[f] = convert_any_sample<from, SampleFormat::Float>(sc[f * in_channels]);
+                    }
+                }
+
+                for (size_t o = first; o < last; ++o) {
+                    dst_t* d = reinterpret_cast<dst_t*>(dst[o]) + dst_offset + done;
+                    const std::vector<MixTerm>& terms = plan.m_mix[o];
+
+                    if (terms.empty()) {
+                        fill_silence(to, reinterpret_cast<char*>(d), n);
+                        continue;
+                    }
+
+                    // Float devices are mixed into directly
+                    float* const out = to == SampleFormat::Float ? reinterpret_cast<float*>(d) : mixed;
+                    const float scale = apply == GainApply::Constant ? gain.start[o] : 1.0f;
+                    simd::mul(out, scratch + terms[0].input * block, terms[0].gain * scale, n);
+                    for (size_t t = 1; t < terms.size(); ++t) {
+                        simd::mac(out, scratch + terms[t].input * block, terms[t].gain * scale, n);
+                    }
+
+                    if constexpr (apply == GainApply::Linear) {
+                        simd::mul_linear_ramp(out, out, gain.start[o] + gain.step[o] * float(done), gain.step[o], gain.target[o], n);
+                    } else if constexpr (apply == GainApply::Exponential) {
+                        simd::mul_exp_ramp(out, out, gain.start[o] * std::pow(gain.step[o], float(done)), gain.step[o], gain.target[o], n);
+                    }
+
+                    if constexpr (to != SampleFormat::Float) {
+                        for (size_t f = 0; f < n; ++f) {
+                            d[f] = convert_any_sample<SampleFormat::Float, to>(mixed[f]);
+                        }
+                    }
+                }
+            }
+        }
+    };
+
+    /// Render plans by key, so renegotiating a format seen before costs a lookup
+    /// Plans are shared: buffers queued with a plan keep it alive even if the cache is cleared.
+    class PlanCache {
+    private:
+        std::mutex m_lock;
+        std::vector<std::shared_ptr<const RenderPlan>> m_plans;
+
+    public:
+        /// Returns the plan for `key`, building it on first use; nullptr if there is no conversion
+        std::shared_ptr<const RenderPlan> get(const PlanKey& key) {
+            std::lock_guard<std::mutex> l(m_lock);
+            for (const auto& plan : m_plans) {
+                if (plan->key() == key) {
+                    return plan;
+                }
+            }
+
+            auto plan = RenderPlan::build(key);
+            if (plan) {
+                m_plans.push_back(plan);
+            }
+            return plan;
+        }
+
+        size_t size() {
+            std::lock_guard<std::mutex> l(m_lock);
+            return m_plans.size();
+        }
+    };
+
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <utility>
+
+namespace StupidAR {
+
+    /// Owning reference to a reference-counted sample (anything with COM-style `AddRef()`/`Release()`)
+    /// Lets upstream buffers (`IMediaSample` in the filter, a fake sample type in tests) travel through queues
+    /// without copying their payload: the buffer goes back to its allocator when the last reference is dropped.
+    template <typename Sample>
+    class SampleRef {
+    private:
+        Sample* m_sample;
+
+    public:
+        SampleRef()
+            : m_sample(nullptr) {
+        }
+
+        explicit SampleRef(Sample* sample)
+            : m_sample(sample) {
+            if (m_sample) {
+                m_sample->AddRef();
+            }
+        }
+
+        SampleRef(const SampleRef& other)
+            : SampleRef(other.m_sample) {
+        }
+
+        SampleRef(SampleRef&& other) noexcept
+            : m_sample(other.m_sample) {
+            other.m_sample = nullptr;
+        }
+
+        SampleRef& operator=(SampleRef other) noexcept {
+            std::swap(m_sample, other.m_sample);
+            return *this;
+        }
+
+        ~SampleRef() {
+            reset();
+        }
+
+        /// Drops the reference
+        void reset() {
+            if (m_sample) {
+                m_sample->Release();
+                m_sample = nullptr;
+            }
+        }
+
+        Sample* get() const {
+            return m_sample;
+        }
+
+        Sample* operator->() const {
+            return m_sample;
+        }
+
+        explicit operator bool() const {
+            return m_sample != nullptr;
+        }
+    };
+
+}
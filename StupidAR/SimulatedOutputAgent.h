@@ -0,0 +1,136 @@
+#pragma once
+
+#include <vector>
+
+#include "IOutputAgent.h"
+#include "PrerollBuffers.h"
+
+namespace StupidAR {
+
+    /// Output agent without a device behind it
+    /// The callback is invoked synchronously from `tick()`, so the "device clock" is whatever the caller makes it.
+    /// Used for testing the render path deterministically and for offline rendering.
+    class SimulatedOutputAgent final : public IOutputAgent {
+    private:
+        CallbackType m_callback;
+        ReconfigureCallbackType m_reconfigure_callback;
+        int32_t m_sampling_rate;
+        int32_t m_buffer_size;
+        int32_t m_output_channels;
+        SampleFormat m_pcm_format;
+        int32_t m_output_latency;
+        bool m_started;
+        int64_t m_frames_played;
+        std::vector<std::vector<char>> m_buffers;
+        std::vector<char*> m_buffer_pointers;
+        PrerollBuffers m_preroll;
+
+    public:
+        SimulatedOutputAgent(CallbackType callback, int32_t sampling_rate, int32_t buffer_size, int32_t output_channels, SampleFormat pcm_format)
+            : m_callback(std::move(callback)),
+              m_sampling_rate(sampling_rate),
+              m_buffer_size(buffer_size),
+              m_output_channels(output_channels),
+              m_pcm_format(pcm_format),
+              m_output_latency(0),
+              m_started(false),
+              m_frames_played(0),
+              m_buffers(output_channels),
+              m_buffer_pointers(output_channels) {
+            resize_buffers();
+        }
+
+        int32_t sampling_rate() override {
+            return m_sampling_rate;
+        }
+
+        int32_t buffer_size() override {
+            return m_buffer_size;
+        }
+
+        int32_t output_channels() override {
+            return m_output_channels;
+        }
+
+        SampleFormat pcm_format() override {
+            return m_pcm_format;
+        }
+
+        int32_t output_latency() override {
+            return m_output_latency;
+        }
+
+        /// Sets what the simulated device reports as its output latency
+        void set_output_latency(int32_t frames) {
+            m_output_latency = frames;
+        }
+
+        int32_t prepare(int32_t n_buffers) override {
+            return m_preroll.prime(m_callback, n_buffers, m_output_channels, m_buffer_size * sample_size(m_pcm_format));
+        }
+
+        void start() override {
+            m_started = true;
+        }
+
+        void stop() override {
+            m_started = false;
+            m_preroll.clear();
+        }
+
+        void set_reconfigure_callback(ReconfigureCallbackType callback) override {
+            m_reconfigure_callback = std::move(callback);
+        }
+
+        /// Must not be called from inside the callback, which is all the quiescing a synchronous agent needs
+        bool reconfigure(int32_t sampling_rate, int32_t buffer_size) override {
+            if (sampling_rate <= 0 || buffer_size <= 0) {
+                return false;
+            }
+
+            const StreamFormat old_format = format();
+            m_sampling_rate = sampling_rate;
+            m_buffer_size = buffer_size;
+            resize_buffers();
+            m_preroll.clear();
+
+            if (m_reconfigure_callback) {
+                m_reconfigure_callback(old_format, format());
+            }
+
+            return true;
+        }
+
+        /// Requests one period of PCM data, as the device would on a buffer switch
+        /// Returns the callback's result, or `false` if the agent is not started
+        bool tick() {
+            if (!m_started) {
+                return false;
+            }
+
+            const bool result = m_preroll.play(m_buffer_pointers.data()) || m_callback(m_buffer_pointers.data());
+            m_frames_played += m_buffer_size;
+
+            return result;
+        }
+
+        /// Contents of the device buffer for `channel` as left by the last `tick()`
+        const char* buffer(int32_t channel) const {
+            return m_buffers[channel].data();
+        }
+
+        /// Number of frames the simulated device has consumed so far
+        int64_t frames_played() const {
+            return m_frames_played;
+        }
+
+    private:
+        void resize_buffers() {
+            for (int32_t i = 0; i < m_output_channels; ++i) {
+                m_buffers[i].resize(m_buffer_size * sample_size(m_pcm_format));
+                m_buffer_pointers[i] = m_buffers[i].data();
+            }
+        }
+    };
+
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+#include "IOutputAgent.h"
+
+namespace StupidAR {
+
+    /// Starts an agent the instant the pipeline has buffered enough data
+    /// The producer reports its buffer level through `notify()`; the call that crosses the threshold primes the agent
+    /// and starts it right there, on the producer's thread, instead of waiting for a state change or a timer.
+    class StartGate {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+    private:
+        std::mutex m_lock;
+        IOutputAgent* m_agent;
+        int32_t m_prime_buffers;
+        size_t m_threshold;
+        std::atomic<bool> m_armed;
+        std::atomic<bool> m_started;
+        int32_t m_primed;
+        Clock::time_point m_armed_at;
+        Clock::time_point m_started_at;
+
+    public:
+        StartGate()
+            : m_agent(nullptr), m_prime_buffers(0), m_threshold(0), m_armed(false), m_started(false), m_primed(0) {
+        }
+
+        /// Arms the gate: `agent` will be primed with `prime_buffers` periods and started once `threshold` frames are buffered
+        /// The threshold should cover the primed periods plus what the callback needs while the upstream catches up.
+        void arm(IOutputAgent& agent, int32_t prime_buffers, size_t threshold) {
+            std::lock_guard<std::mutex> l(m_lock);
+            m_agent = &agent;
+            m_prime_buffers = prime_buffers;
+            m_threshold = threshold;
+            m_primed = 0;
+            m_started = false;
+            m_armed_at = Clock::now();
+            m_armed = true;
+        }
+
+        /// Disarms the gate without starting the agent
+        void disarm() {
+            std::lock_guard<std::mutex> l(m_lock);
+            m_armed = false;
+        }
+
+        /// Reports the number of frames the pipeline currently has buffered
+        /// Returns `true` if this call started the agent
+        bool notify(size_t buffered) {
+            if (!m_armed.load(std::memory_order_acquire) || buffered < m_threshold) {
+                return false;
+            }
+
+            std::lock_guard<std::mutex> l(m_lock);
+            if (!m_armed) {
+                return false;
+            }
+            m_armed = false;
+
+            m_primed = m_prime_buffers > 0 ? m_agent->prepare(m_prime_buffers) : 0;
+            m_agent->start();
+            m_started_at = Clock::now();
+            m_started = true;
+
+            return true;
+        }
+
+        bool armed() const {
+            return m_armed;
+        }
+
+        bool started() const {
+            return m_started;
+        }
+
+        /// Periods actually primed by the last start
+        int32_t primed() {
+            std::lock_guard<std::mutex> l(m_lock);
+            return m_primed;
+        }
+
+        /// Time from `arm()` to the agent being started, zero if it has not started yet
+        Clock::duration start_latency() {
+            std::lock_guard<std::mutex> l(m_lock);
+            return m_started ? m_started_at - m_armed_at : Clock::duration::zero();
+        }
+    };
+
+}
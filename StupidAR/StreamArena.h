@@ -0,0 +1,213 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace StupidAR {
+
+    /// One block of memory for the buffers of a stream, set up when the format is negotiated
+    /// Allocations are carved from it by bumping a pointer, cache-line aligned by default, and are all given back at
+    /// once by `reset()` or `reserve()`. The block is backed by huge pages where the platform allows it (large pages
+    /// on Windows need SeLockMemoryPrivilege, Linux falls back from hugetlbfs to transparent huge pages) and is
+    /// touched up front, so the render callback never takes a page fault in it.
+    class StreamArena {
+    public:
+        static constexpr size_t kAlignment = 64;
+
+    private:
+        char* m_base;
+        size_t m_size;
+        size_t m_used;
+        bool m_huge_pages;
+
+    public:
+        StreamArena()
+            : m_base(nullptr), m_size(0), m_used(0), m_huge_pages(false) {
+        }
+
+        ~StreamArena() {
+            release();
+        }
+
+        StreamArena(const StreamArena&) = delete;
+        StreamArena& operator=(const StreamArena&) = delete;
+
+        /// Replaces the block with one of at least `bytes` bytes, invalidating everything allocated from the old one
+        /// Returns false if the memory could not be had, leaving the arena empty.
+        bool reserve(size_t bytes) {
+            release();
+            if (bytes == 0) {
+                return true;
+            }
+
+#ifdef _WIN32
+            const SIZE_T large_page = GetLargePageMinimum();
+            if (large_page != 0) {
+                const size_t rounded = (bytes + large_page - 1) / large_page * large_page;
+                m_base = static_cast<char*>(VirtualAlloc(nullptr, rounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE));
+                if (m_base) {
+                    m_size = rounded;
+                    m_huge_pages = true;
+                }
+            }
+            if (!m_base) {
+                m_base = static_cast<char*>(VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+                m_size = m_base ? bytes : 0;
+            }
+#else
+            const size_t huge_page = size_t(2) << 20;
+#ifdef MAP_HUGETLB
+            const size_t rounded = (bytes + huge_page - 1) / huge_page * huge_page;
+            void* p = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED) {
+                m_base = static_cast<char*>(p);
+                m_size = rounded;
+                m_huge_pages = true;
+            }
+#endif
+            if (!m_base) {
+                void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (p != MAP_FAILED) {
+                    m_base = static_cast<char*>(p);
+                    m_size = bytes;
+#ifdef MADV_HUGEPAGE
+                    m_huge_pages = bytes >= huge_page && madvise(p, bytes, MADV_HUGEPAGE) == 0;
+#endif
+                }
+            }
+#endif
+
+            if (m_base) {
+                std::memset(m_base, 0, m_size);
+            }
+            return m_base != nullptr;
+        }
+
+        /// `bytes` bytes aligned to `alignment` (a power of two), nullptr when the arena is exhausted
+        void* allocate(size_t bytes, size_t alignment = kAlignment) {
+            const uintptr_t base = reinterpret_cast<uintptr_t>(m_base);
+            const uintptr_t start = (base + m_used + alignment - 1) & ~uintptr_t(alignment - 1);
+            if (!m_base || start + bytes > base + m_size) {
+                return nullptr;
+            }
+            m_used = size_t(start - base) + bytes;
+            return reinterpret_cast<void*>(start);
+        }
+
+        template <typename T>
+        T* allocate_array(size_t count, size_t alignment = kAlignment) {
+            return static_cast<T*>(allocate(count * sizeof(T), alignment < alignof(T) ? alignof(T) : alignment));
+        }
+
+        /// Gives back everything allocated, keeping the block
+        void reset() {
+            m_used = 0;
+        }
+
+        size_t size() const {
+            return m_size;
+        }
+
+        size_t used() const {
+            return m_used;
+        }
+
+        bool huge_pages() const {
+            return m_huge_pages;
+        }
+
+    private:
+        void release() {
+            if (m_base) {
+#ifdef _WIN32
+                VirtualFree(m_base, 0, MEM_RELEASE);
+#else
+                munmap(m_base, m_size);
+#endif
+            }
+            m_base = nullptr;
+            m_size = 0;
+            m_used = 0;
+            m_huge_pages = false;
+        }
+    };
+
+    /// Variable-size chunks carved in FIFO order from a region of a `StreamArena`, for one producer and one consumer
+    /// Chunks are contiguous: one that doesn't fit before the end of the region starts over at its beginning.
+    /// The consumer frees them in the order they were allocated, by handing back the end mark of the last one it is
+    /// done with; neither side ever blocks or allocates.
+    class ArenaFifo {
+    private:
+        char* m_data;
+        size_t m_capacity;
+        std::atomic<uint64_t> m_written;   // Producer: end of the last allocated chunk
+        std::atomic<uint64_t> m_committed; // Producer: end of the last chunk handed to the consumer
+        std::atomic<uint64_t> m_read;      // Consumer: end of the last freed chunk
+
+    public:
+        ArenaFifo()
+            : m_data(nullptr), m_capacity(0), m_written(0), m_committed(0), m_read(0) {
+        }
+
+        /// Takes `bytes` bytes (rounded down to the SIMD alignment) from `arena`, may only be called while neither side runs
+        bool reserve(StreamArena& arena, size_t bytes) {
+            bytes &= ~(StreamArena::kAlignment - 1);
+            m_data = static_cast<char*>(arena.allocate(bytes));
+            m_capacity = m_data ? bytes : 0;
+            m_written = 0;
+            m_committed = 0;
+            m_read = 0;
+            return m_data != nullptr;
+        }
+
+        size_t capacity() const {
+            return m_capacity;
+        }
+
+        /// Producer: a chunk of `bytes` bytes, aligned like the arena, or nullptr if there is no room now
+        /// `end` receives the mark to free it with.
+        char* allocate(size_t bytes, uint64_t& end) {
+            if (m_capacity == 0) {
+                return nullptr;
+            }
+            bytes = (bytes + StreamArena::kAlignment - 1) & ~(StreamArena::kAlignment - 1);
+            const uint64_t w = m_written.load(std::memory_order_relaxed);
+            const size_t offset = size_t(w % m_capacity);
+            const size_t skip = offset + bytes > m_capacity ? m_capacity - offset : 0;
+            if (bytes > m_capacity || w + skip + bytes - m_read.load(std::memory_order_acquire) > m_capacity) {
+                return nullptr;
+            }
+
+            end = w + skip + bytes;
+            m_written.store(end, std::memory_order_relaxed);
+            return m_data + (skip != 0 ? 0 : offset);
+        }
+
+        /// Producer: the chunks allocated so far are in the consumer's hands (queued), or dropped
+        void commit() {
+            m_committed.store(m_written.load(std::memory_order_relaxed), std::memory_order_release);
+        }
+
+        /// Consumer: frees every chunk up to the one ending at `end`
+        void free(uint64_t end) {
+            if (end > m_read.load(std::memory_order_relaxed)) {
+                m_read.store(end, std::memory_order_release);
+            }
+        }
+
+        /// Consumer: mark of everything committed so far
+        /// Read before finding the queue empty, it frees every chunk that could have been in it.
+        uint64_t committed() const {
+            return m_committed.load(std::memory_order_acquire);
+        }
+    };
+
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <climits>
+#include <cstddef>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+namespace StupidAR {
+
+    enum class SchedulingPolicy {
+        Normal,
+        Fifo,       // SCHED_FIFO on POSIX, time-critical priority on Windows
+        RoundRobin, // SCHED_RR on POSIX, time-critical priority on Windows
+    };
+
+    // Real-time settings for the agent callback thread and pipeline workers
+    struct ThreadConfig {
+        SchedulingPolicy policy = SchedulingPolicy::Normal;
+
+        // Priority for Fifo/RoundRobin, clamped to what the platform allows (1..99 on Linux)
+        int priority = 0;
+
+        // CPUs to pin the thread to, empty to leave the affinity alone
+        std::vector<int> cpus;
+
+        // Lock all current and future pages of the process into RAM (process-wide, POSIX only)
+        bool lock_memory = false;
+
+        // Touch this many bytes of stack up front, so the callback never page-faults on it
+        size_t prefault_stack_bytes = 0;
+    };
+
+    // What `apply_thread_config()` actually managed to do
+    // Settings that were not requested are reported as applied.
+    struct ThreadConfigResult {
+        bool scheduling = true;
+        bool affinity = true;
+        bool memory_locked = true;
+
+        bool all() const {
+            return scheduling && affinity && memory_locked;
+        }
+    };
+
+    namespace detail {
+
+        // Recurses in page-sized steps, touching each page
+        // The array is used after the recursive call, so the frames cannot be folded away.
+        inline void prefault_stack(size_t bytes) {
+            const size_t kStep = 4096;
+            volatile char page[kStep];
+            page[0] = 0;
+            if (bytes > kStep) {
+                prefault_stack(bytes - kStep);
+            }
+            page[kStep - 1] = page[0];
+        }
+
+    }
+
+    // Applies `config` to the calling thread
+    // Never fails: settings the process lacks permissions for (no CAP_SYS_NICE, low RLIMIT_MEMLOCK, ...) are skipped,
+    // and reported as such in the result, so callers can log and carry on with normal scheduling.
+    inline ThreadConfigResult apply_thread_config(const ThreadConfig& config) {
+        ThreadConfigResult result;
+
+#ifdef _WIN32
+        if (config.policy != SchedulingPolicy::Normal) {
+            result.scheduling = SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) != FALSE;
+        }
+
+        if (!config.cpus.empty()) {
+            DWORD_PTR mask = 0;
+            for (int cpu : config.cpus) {
+                if (cpu >= 0 && cpu < int(sizeof(DWORD_PTR) * CHAR_BIT)) {
+                    mask |= DWORD_PTR(1) << cpu;
+                }
+            }
+            result.affinity = mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+        }
+
+        if (config.lock_memory) {
+            result.memory_locked = false; // No process-wide equivalent of mlockall()
+        }
+#else
+        if (config.policy != SchedulingPolicy::Normal) {
+            const int policy = config.policy == SchedulingPolicy::Fifo ? SCHED_FIFO : SCHED_RR;
+            sched_param param = {};
+            param.sched_priority = config.priority;
+            if (param.sched_priority < sched_get_priority_min(policy)) {
+                param.sched_priority = sched_get_priority_min(policy);
+            }
+            if (param.sched_priority > sched_get_priority_max(policy)) {
+                param.sched_priority = sched_get_priority_max(policy);
+            }
+            result.scheduling = pthread_setschedparam(pthread_self(), policy, &param) == 0;
+        }
+
+        if (!config.cpus.empty()) {
+#ifdef __linux__
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (int cpu : config.cpus) {
+                if (cpu >= 0 && cpu < CPU_SETSIZE) {
+                    CPU_SET(cpu, &set);
+                }
+            }
+            result.affinity = CPU_COUNT(&set) != 0 && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+            result.affinity = false;
+#endif
+        }
+
+        if (config.lock_memory) {
+            result.memory_locked = mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+        }
+#endif
+
+        if (config.prefault_stack_bytes != 0) {
+            detail::prefault_stack(config.prefault_stack_bytes);
+        }
+
+        return result;
+    }
+
+}
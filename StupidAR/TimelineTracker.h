@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+#include "FrameTime.h"
+
+namespace StupidAR {
+
+    /// Follows the stream time of pushed audio and tells where it jumps
+    /// Each sample is expected where the one before it ended. Timestamps within `tolerance` of that are taken as
+    /// rounding and played on continuously; the running position, not the timestamps, carries on, so small errors
+    /// don't add up. The position is kept as the frames followed since the timestamp it started from, and converted
+    /// to time once per sample, so neither do the roundings of the sample durations. Beyond the tolerance, the sample
+    /// is off by a gap (audio missing, to be made up with silence) or an overlap (audio already played, to be dropped).
+    /// Jumps beyond `max_jump` are a new timeline rather than a discontinuity, and are followed as they are. Times are
+    /// in 100 ns units, like `REFERENCE_TIME`.
+    class TimelineTracker {
+    public:
+        static constexpr int64_t kNoTime = INT64_MIN;
+
+    private:
+        int64_t m_tolerance;
+        int64_t m_max_jump;
+        int64_t m_origin; // Where the running position counts from, kNoTime before the first timestamp
+        int64_t m_frames; // Followed since
+        FrameRate m_rate; // Of those frames
+
+    public:
+        TimelineTracker(int64_t tolerance, int64_t max_jump)
+            : m_tolerance(tolerance), m_max_jump(max_jump), m_origin(kNoTime), m_frames(0), m_rate(1) {
+        }
+
+        /// Forgets the timeline: the next timestamp starts a new one
+        void reset() {
+            m_origin = kNoTime;
+            m_frames = 0;
+        }
+
+        /// Where the next sample is expected to start, kNoTime if not known
+        int64_t expected() const {
+            return m_origin != kNoTime ? m_origin + m_rate.time(m_frames) : kNoTime;
+        }
+
+        /// Follows a sample starting at `start` (kNoTime if unknown) and lasting `frames` frames at `rate`
+        /// Returns how far it starts from where it was expected: positive for a gap, negative for an overlap, 0 if it
+        /// plays on continuously. The caller fills gaps and drops overlaps, the playing audio ends where the sample
+        /// does, or where it did if the whole sample overlaps.
+        int64_t follow(int64_t start, int64_t frames, const FrameRate& rate) {
+            if (rate != m_rate) {
+                // Carries on at the new rate from where the old one got to
+                m_origin = expected();
+                m_frames = 0;
+                m_rate = rate;
+            }
+            if (m_origin == kNoTime) {
+                if (start != kNoTime) {
+                    restart(start, frames);
+                }
+                return 0;
+            }
+            if (start == kNoTime) {
+                m_frames += frames;
+                return 0;
+            }
+
+            const int64_t expected = this->expected();
+            const int64_t jump = start - expected;
+            const int64_t distance = jump < 0 ? -jump : jump;
+            if (distance <= m_tolerance) {
+                m_frames += frames;
+                return 0;
+            }
+            if (distance > m_max_jump) {
+                restart(start, frames);
+                return 0;
+            }
+            if (start + rate.time(frames) > expected) {
+                restart(start, frames);
+            }
+            return jump;
+        }
+
+    private:
+        void restart(int64_t start, int64_t frames) {
+            m_origin = start;
+            m_frames = frames;
+        }
+    };
+
+}
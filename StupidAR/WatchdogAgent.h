@@ -0,0 +1,237 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "IOutputAgent.h"
+
+namespace StupidAR {
+
+    /// Wraps another agent and times every callback against the device period (`buffer_size()` / `sampling_rate()`)
+    /// A callback that takes longer than `budget` periods is an overrun: the device has (or is about to) run dry.
+    /// The pipeline may call `mark_stage()` from inside the callback so that overruns record the slowest stage.
+    class WatchdogAgent final : public IOutputAgent {
+    public:
+        using Clock = std::chrono::steady_clock;
+        using AgentFactory = std::function<std::unique_ptr<IOutputAgent>(CallbackType)>;
+
+        static const size_t kMaxStages = 16;
+        static const size_t kOverrunHistory = 32;
+
+        struct Overrun {
+            Clock::time_point entry;
+            Clock::duration duration;
+            Clock::duration lateness;
+            const char* stage; // Slowest stage, nullptr unless stage capture is enabled and stages were marked
+            Clock::duration stage_duration;
+        };
+
+        struct Stats {
+            Clock::duration period;
+            uint64_t callbacks;
+            uint64_t overruns;
+            Clock::duration worst_duration;
+            Clock::duration worst_lateness;
+            std::vector<Overrun> recent_overruns; // Oldest first, at most `kOverrunHistory`
+        };
+
+    private:
+        CallbackType m_callback;
+        ReconfigureCallbackType m_reconfigure_callback;
+        const double m_budget;
+        const bool m_capture_stages;
+        std::atomic<Clock::rep> m_period; // Read by `stats()` from any thread
+        Clock::duration m_deadline;
+
+        // Written by the callback thread only
+        std::array<const char*, kMaxStages> m_stage_names;
+        std::array<Clock::time_point, kMaxStages> m_stage_marks;
+        size_t m_stage_count;
+
+        std::atomic<uint64_t> m_callbacks;
+        std::atomic<uint64_t> m_overruns;
+        std::atomic<Clock::rep> m_worst_duration;
+        std::atomic<Clock::rep> m_worst_lateness;
+
+        // The callback thread only ever try_lock()s this, a contended record is counted but not stored
+        std::mutex m_history_lock;
+        std::array<Overrun, kOverrunHistory> m_history;
+        uint64_t m_history_count;
+
+        std::unique_ptr<IOutputAgent> m_agent;
+
+    public:
+        /// `factory` must create the wrapped agent with the callback it is given
+        /// `budget` is the fraction of the period the callback may use before it is considered an overrun
+        WatchdogAgent(const AgentFactory& factory, CallbackType callback, double budget = 1.0, bool capture_stages = false)
+            : m_callback(std::move(callback)),
+              m_budget(budget),
+              m_capture_stages(capture_stages),
+              m_period(0),
+              m_deadline(),
+              m_stage_names(),
+              m_stage_marks(),
+              m_stage_count(0),
+              m_callbacks(0),
+              m_overruns(0),
+              m_worst_duration(0),
+              m_worst_lateness(0),
+              m_history(),
+              m_history_count(0) {
+            m_agent = factory([this](char** buffers) { return on_callback(buffers); });
+            m_agent->set_reconfigure_callback([this](const StreamFormat& old_format, const StreamFormat& new_format) {
+                update_period();
+                if (m_reconfigure_callback) {
+                    m_reconfigure_callback(old_format, new_format);
+                }
+            });
+            update_period();
+        }
+
+        int32_t sampling_rate() override {
+            return m_agent->sampling_rate();
+        }
+
+        int32_t buffer_size() override {
+            return m_agent->buffer_size();
+        }
+
+        int32_t output_channels() override {
+            return m_agent->output_channels();
+        }
+
+        SampleFormat pcm_format() override {
+            return m_agent->pcm_format();
+        }
+
+        int32_t output_latency() override {
+            return m_agent->output_latency();
+        }
+
+        int32_t prepare(int32_t n_buffers) override {
+            update_period();
+            return m_agent->prepare(n_buffers);
+        }
+
+        void start() override {
+            update_period();
+            m_agent->start();
+        }
+
+        void stop() override {
+            m_agent->stop();
+        }
+
+        /// Must not be called while the wrapped agent may reconfigure itself
+        void set_reconfigure_callback(ReconfigureCallbackType callback) override {
+            m_reconfigure_callback = std::move(callback);
+        }
+
+        bool reconfigure(int32_t sampling_rate, int32_t buffer_size) override {
+            return m_agent->reconfigure(sampling_rate, buffer_size);
+        }
+
+        /// The wrapped agent
+        IOutputAgent& agent() {
+            return *m_agent;
+        }
+
+        /// Marks the beginning of a pipeline stage, may only be called from inside the callback
+        /// `name` must outlive the watchdog (string literals are the intended use)
+        void mark_stage(const char* name) {
+            if (!m_capture_stages || m_stage_count == kMaxStages) {
+                return;
+            }
+
+            m_stage_names[m_stage_count] = name;
+            m_stage_marks[m_stage_count] = Clock::now();
+            ++m_stage_count;
+        }
+
+        Stats stats() {
+            Stats s;
+            s.period = Clock::duration(m_period.load(std::memory_order_relaxed));
+            s.callbacks = m_callbacks.load(std::memory_order_relaxed);
+            s.overruns = m_overruns.load(std::memory_order_relaxed);
+            s.worst_duration = Clock::duration(m_worst_duration.load(std::memory_order_relaxed));
+            s.worst_lateness = Clock::duration(m_worst_lateness.load(std::memory_order_relaxed));
+
+            std::lock_guard<std::mutex> l(m_history_lock);
+            const uint64_t stored = std::min<uint64_t>(m_history_count, kOverrunHistory);
+            s.recent_overruns.reserve(stored);
+            for (uint64_t i = m_history_count - stored; i < m_history_count; ++i) {
+                s.recent_overruns.push_back(m_history[i % kOverrunHistory]);
+            }
+
+            return s;
+        }
+
+        void reset_stats() {
+            std::lock_guard<std::mutex> l(m_history_lock);
+            m_callbacks = 0;
+            m_overruns = 0;
+            m_worst_duration = 0;
+            m_worst_lateness = 0;
+            m_history_count = 0;
+        }
+
+    private:
+        void update_period() {
+            const Clock::duration period = std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>(double(m_agent->buffer_size()) / m_agent->sampling_rate())
+            );
+            m_period.store(period.count(), std::memory_order_relaxed);
+            m_deadline = std::chrono::duration_cast<Clock::duration>(period * m_budget);
+        }
+
+        bool on_callback(char** buffers) {
+            m_stage_count = 0;
+            const Clock::time_point entry = Clock::now();
+            const bool result = m_callback(buffers);
+            const Clock::time_point exit = Clock::now();
+
+            const Clock::duration duration = exit - entry;
+            m_callbacks.fetch_add(1, std::memory_order_relaxed);
+            store_max(m_worst_duration, duration.count());
+
+            if (duration > m_deadline) {
+                record_overrun(entry, exit, duration);
+            }
+
+            return result;
+        }
+
+        void record_overrun(Clock::time_point entry, Clock::time_point exit, Clock::duration duration) {
+            const Clock::duration lateness = duration - m_deadline;
+            m_overruns.fetch_add(1, std::memory_order_relaxed);
+            store_max(m_worst_lateness, lateness.count());
+
+            Overrun o = { entry, duration, lateness, nullptr, Clock::duration::zero() };
+            for (size_t i = 0; i < m_stage_count; ++i) {
+                const Clock::time_point end = i + 1 < m_stage_count ? m_stage_marks[i + 1] : exit;
+                if (end - m_stage_marks[i] > o.stage_duration) {
+                    o.stage = m_stage_names[i];
+                    o.stage_duration = end - m_stage_marks[i];
+                }
+            }
+
+            std::unique_lock<std::mutex> l(m_history_lock, std::try_to_lock);
+            if (l.owns_lock()) {
+                m_history[m_history_count % kOverrunHistory] = o;
+                ++m_history_count;
+            }
+        }
+
+        static void store_max(std::atomic<Clock::rep>& target, Clock::rep value) {
+            Clock::rep current = target.load(std::memory_order_relaxed);
+            while (value > current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+            }
+        }
+    };
+
+}
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ThreadConfig.h"
+#include "simd.h"
+
+namespace StupidAR {
+
+    namespace detail {
+
+        inline void cpu_relax() {
+#ifdef STUPIDAR_SSE2
+            _mm_pause();
+#else
+            std::this_thread::yield();
+#endif
+        }
+
+    }
+
+    /// Threads that help the agent callback with work that splits into independent tasks, like device channels
+    /// `run()` hands the tasks out and makes the calling thread take its share, then waits on a spin barrier until
+    /// all of them are done. Tasks are claimed, not assigned: a worker that is late to wake up (preempted, sleeping)
+    /// just finds fewer tasks left, and in the worst case the caller does them all itself, so a slow worker cannot
+    /// push the period past its deadline by more than one task.
+    /// Workers spin for a while after each job, so they are awake for the next period, then sleep until woken.
+    /// `run()` is for one thread at a time.
+    class WorkerPool {
+    public:
+        /// Most tasks handed out at once, larger jobs run in batches of this many
+        static constexpr size_t kMaxTasks = 0xffff;
+
+    private:
+        using TaskFn = void(*)(void* context, size_t task);
+
+        // Pause iterations an idle worker spins before going to sleep, a few hundred microseconds
+        static constexpr size_t kSpinIterations = 1 << 14;
+
+        // Generation of the current batch in the upper half, then its number of tasks in bits 16-31 and the index of
+        // the next unclaimed task in bits 0-15, so that a claim is only ever checked against the count of its own batch
+        std::atomic<uint64_t> m_claim;
+        std::atomic<size_t> m_done;
+        TaskFn m_fn;
+        void* m_context;
+        size_t m_first; // Task the batch starts at
+
+        std::mutex m_lock;
+        std::condition_variable m_wake;
+        std::atomic<size_t> m_sleepers;
+        std::atomic<bool> m_running;
+
+        ThreadConfig m_thread_config;
+        std::vector<std::thread> m_threads;
+
+    public:
+        explicit WorkerPool(size_t workers, ThreadConfig thread_config = ThreadConfig())
+            : m_claim(0),
+              m_done(0),
+              m_fn(nullptr),
+              m_context(nullptr),
+              m_first(0),
+              m_sleepers(0),
+              m_running(true),
+              m_thread_config(std::move(thread_config)) {
+            for (size_t i = 0; i < workers; ++i) {
+                m_threads.emplace_back([this]() { work(); });
+            }
+        }
+
+        ~WorkerPool() {
+            {
+                std::lock_guard<std::mutex> l(m_lock);
+                m_running = false;
+            }
+            m_wake.notify_all();
+            for (std::thread& thread : m_threads) {
+                thread.join();
+            }
+        }
+
+        WorkerPool(const WorkerPool&) = delete;
+        WorkerPool& operator=(const WorkerPool&) = delete;
+
+        /// Number of helper threads, not counting the caller of `run()`
+        size_t workers() const {
+            return m_threads.size();
+        }
+
+        /// Calls `fn(task)` for every task in [0, tasks) across the pool and the calling thread, returns when all are done
+        template <typename F>
+        void run(size_t tasks, F& fn) {
+            if (tasks == 0) {
+                return;
+            }
+            if (tasks == 1 || m_threads.empty()) {
+                for (size_t t = 0; t < tasks; ++t) {
+                    fn(t);
+                }
+                return;
+            }
+
+            m_fn = [](void* context, size_t task) { (*static_cast<F*>(context))(task); };
+            m_context = &fn;
+            for (size_t first = 0; first < tasks; first += kMaxTasks) {
+                run_batch(first, std::min(tasks - first, kMaxTasks));
+            }
+        }
+
+    private:
+        // Hands out tasks [first, first + count) of the current job and waits until they are done
+        void run_batch(size_t first, size_t count) {
+            m_first = first;
+            m_done.store(0, std::memory_order_relaxed);
+
+            const uint64_t generation = (m_claim.load(std::memory_order_relaxed) >> 32) + 1;
+            m_claim.store((generation << 32) | (uint64_t(count) << 16)); // Sequentially consistent with the sleeper count, see `work()`
+            if (m_sleepers.load() != 0) {
+                // Taking the lock orders the store with a worker about to wait, so the wakeup can't be lost
+                { std::lock_guard<std::mutex> l(m_lock); }
+                m_wake.notify_all();
+            }
+
+            execute(generation);
+            while (m_done.load(std::memory_order_acquire) != count) {
+                detail::cpu_relax();
+            }
+        }
+
+        // Claims and runs tasks of `generation` until there are none left
+        void execute(uint64_t generation) {
+            uint64_t claim = m_claim.load(std::memory_order_acquire);
+            while ((claim >> 32) == generation) {
+                const size_t task = size_t(claim & 0xffffu);
+                if (task >= size_t((claim >> 16) & 0xffffu)) {
+                    return;
+                }
+                if (!m_claim.compare_exchange_weak(claim, claim + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                    continue;
+                }
+
+                // The batch can't end, nor the next one start, before this task is counted as done
+                m_fn(m_context, m_first + task);
+                m_done.fetch_add(1, std::memory_order_release);
+                claim = m_claim.load(std::memory_order_acquire);
+            }
+        }
+
+        void work() {
+            apply_thread_config(m_thread_config);
+
+            uint64_t seen = m_claim.load(std::memory_order_acquire) >> 32;
+            while (true) {
+                uint64_t generation = m_claim.load(std::memory_order_acquire) >> 32;
+                for (size_t i = 0; i < kSpinIterations && generation == seen && m_running.load(std::memory_order_relaxed); ++i) {
+                    detail::cpu_relax();
+                    generation = m_claim.load(std::memory_order_acquire) >> 32;
+                }
+
+                if (generation == seen) {
+                    std::unique_lock<std::mutex> l(m_lock);
+                    m_sleepers.fetch_add(1);
+                    m_wake.wait(l, [&]() { return !m_running.load(std::memory_order_relaxed) || (m_claim.load() >> 32) != seen; });
+                    m_sleepers.fetch_sub(1);
+                    generation = m_claim.load(std::memory_order_acquire) >> 32;
+                }
+
+                if (!m_running.load(std::memory_order_relaxed)) {
+                    return;
+                }
+
+                seen = generation;
+                execute(generation);
+            }
+        }
+    };
+
+}
@@ -0,0 +1,248 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "simd.h"
+
+namespace StupidAR {
+
+    /// Changes the tempo of planar float channels without changing their pitch, by waveform-similarity overlap-add
+    /// (W. Verhelst and M. Roelands, "An overlap-add technique based on waveform similarity (WSOLA) for high quality
+    /// time-scale modification of speech", 1993)
+    /// The output is laid out in segments of two hops, overlapped by one under complementary Hann halves. Segment k is
+    /// taken from around k x hop x rate in the input; within a tolerance around that position it starts where the input
+    /// looks most like the natural continuation of the segment before it, so that periodic waveforms carry through the
+    /// overlap instead of cancelling out. The search runs on a mix of all channels, one normalized cross-correlation
+    /// (a vectorized dot product) per candidate position, and its result applies to every channel.
+    /// Block interface like the resamplers: write up to `max_input_frames()` frames at `input()`, `process()` them.
+    /// `drain()` hands on the input held back, untouched, so that playback can go on without the stretcher.
+    class WsolaStretcher {
+    public:
+        static constexpr double kMinRate = 0.5;
+        static constexpr double kMaxRate = 2.0;
+
+        // Output frames per segment, half of its window; long enough to hold a few periods of a low voice
+        static constexpr double kHopSeconds = 0.010;
+
+    private:
+        size_t m_channels;
+        size_t m_hop;
+        size_t m_tolerance;   // How far the search looks each side of the nominal position
+        size_t m_max_input_frames;
+        size_t m_offset;      // Floats per line before the input: the most input held from one call to the next
+        size_t m_stride;
+        double m_rate;
+        std::vector<float> m_rising;  // Rising half of the window; the falling half is 1 minus it
+        std::vector<float> m_frames;  // One line per channel, then the mix
+        std::vector<float*> m_inputs;
+        std::vector<float> m_overlap; // Per channel, the falling half of the last segment
+        std::vector<double> m_scores;
+
+        // Relative to the first frame held
+        size_t m_held;
+        bool m_started;
+        size_t m_continuation; // Second half of the last segment, which the next one overlaps
+        double m_nominal;      // Where the next segment would start, going exactly at the rate
+
+    public:
+        WsolaStretcher(size_t channels, int32_t sampling_rate, size_t max_input_frames)
+            : m_channels(channels),
+              m_hop(std::max(size_t(std::lround(kHopSeconds * sampling_rate)), size_t(4))),
+              m_tolerance(m_hop / 2),
+              m_max_input_frames(max_input_frames),
+              m_offset(3 * m_hop + 2 * m_tolerance + 2),
+              m_stride(m_offset + max_input_frames),
+              m_rate(1.0),
+              m_rising(m_hop),
+              m_frames((channels + 1) * m_stride),
+              m_inputs(channels),
+              m_overlap(channels * m_hop),
+              m_scores(2 * m_tolerance + 1) {
+            for (size_t n = 0; n < m_hop; ++n) {
+                const double s = std::sin(3.14159265358979323846 * (double(n) + 0.5) / (2.0 * double(m_hop)));
+                m_rising[n] = float(s * s);
+            }
+            for (size_t c = 0; c < channels; ++c) {
+                m_inputs[c] = &m_frames[c * m_stride + m_offset];
+            }
+            reset();
+        }
+
+        size_t channels() const {
+            return m_channels;
+        }
+
+        size_t hop() const {
+            return m_hop;
+        }
+
+        double rate() const {
+            return m_rate;
+        }
+
+        /// Input frames per output frame from the next segment on, clamped to [kMinRate, kMaxRate]
+        void set_rate(double rate) {
+            m_rate = std::min(std::max(rate, kMinRate), kMaxRate);
+        }
+
+        size_t max_input_frames() const {
+            return m_max_input_frames;
+        }
+
+        /// Input frames held that no output has been produced from yet
+        size_t pending_frames() const {
+            return m_started ? m_held - m_continuation : m_held;
+        }
+
+        /// Most frames one `process()` or `drain()` call can produce
+        size_t max_output_frames() const {
+            return 2 * (m_offset + m_max_input_frames) + m_hop;
+        }
+
+        /// Forgets the input held and the last segment: the next input starts a new stream
+        void reset() {
+            std::fill(m_overlap.begin(), m_overlap.end(), 0.0f);
+            m_held = 0;
+            m_started = false;
+            m_continuation = 0;
+            m_nominal = 0;
+        }
+
+        /// Per channel, where the input of the next `process()` goes
+        float* const* input() const {
+            return m_inputs.data();
+        }
+
+        /// Stretches the `frames` frames written to `input()` into `out`, returns the number of frames produced
+        /// Output comes a hop at a time, as soon as the input to search and lay out a whole segment is there.
+        size_t process(size_t frames, float* const* out) {
+            frames = std::min(frames, m_max_input_frames);
+
+            float* mix = line(m_channels) + m_offset;
+            std::fill(mix, mix + frames, 0.0f);
+            for (size_t c = 0; c < m_channels; ++c) {
+                simd::mac(mix, m_inputs[c], 1.0f, frames);
+            }
+
+            const size_t available = m_held + frames;
+            const float* x = line(m_channels) + m_offset - m_held;
+            size_t produced = 0;
+            while (true) {
+                if (!m_started) {
+                    // The first segment starts right at the beginning, whole up to its middle: no fade-in from silence
+                    if (available < 2 * m_hop) {
+                        break;
+                    }
+                    for (size_t c = 0; c < m_channels; ++c) {
+                        const float* segment = line(c) + m_offset - m_held;
+                        std::copy_n(segment, m_hop, out[c] + produced);
+                        fall(segment + m_hop, &m_overlap[c * m_hop]);
+                    }
+                    m_started = true;
+                    m_continuation = m_hop;
+                    m_nominal = m_rate * double(m_hop);
+                } else {
+                    const size_t nominal = size_t(m_nominal);
+                    const size_t low = nominal > m_tolerance ? nominal - m_tolerance : 0;
+                    const size_t high = nominal + m_tolerance;
+                    if (available < std::max(m_continuation + m_hop, high + 2 * m_hop)) {
+                        break;
+                    }
+
+                    const size_t start = search(x, low, high, nominal);
+                    for (size_t c = 0; c < m_channels; ++c) {
+                        const float* segment = line(c) + m_offset - m_held + start;
+                        float* overlap = &m_overlap[c * m_hop];
+                        float* o = out[c] + produced;
+                        for (size_t n = 0; n < m_hop; ++n) {
+                            o[n] = overlap[n] + m_rising[n] * segment[n];
+                        }
+                        fall(segment + m_hop, overlap);
+                    }
+                    m_continuation = start + m_hop;
+                    m_nominal += m_rate * double(m_hop);
+                }
+                produced += m_hop;
+            }
+
+            // What the next segments need: the continuation of the last one, and their search range
+            size_t keep_from = 0;
+            if (m_started) {
+                const double search_from = std::max(std::floor(m_nominal) - double(m_tolerance), 0.0);
+                keep_from = std::min(m_continuation, size_t(search_from));
+            }
+            const size_t keep = available - keep_from;
+            for (size_t c = 0; c <= m_channels; ++c) {
+                float* l = line(c);
+                std::copy(l + m_offset - m_held + keep_from, l + m_offset + frames, l + m_offset - keep);
+            }
+            m_held = keep;
+            m_continuation -= keep_from;
+            m_nominal -= double(keep_from);
+            return produced;
+        }
+
+        /// Writes out the input held back as it is, from where the last segment would naturally continue, and resets
+        /// Going on with the input that follows it is seamless: the windows of the last overlap add up to 1.
+        size_t drain(float* const* out) {
+            const size_t from = m_started ? m_continuation : 0;
+            const size_t frames = m_held > from ? m_held - from : 0;
+            for (size_t c = 0; c < m_channels; ++c) {
+                const float* held = line(c) + m_offset - m_held;
+                std::copy_n(held + from, frames, out[c]);
+            }
+            reset();
+            return frames;
+        }
+
+    private:
+        float* line(size_t index) {
+            return &m_frames[index * m_stride];
+        }
+
+        // overlap[n] = segment[n] * (1 - rising[n])
+        void fall(const float* segment, float* overlap) const {
+            for (size_t n = 0; n < m_hop; ++n) {
+                overlap[n] = segment[n] - m_rising[n] * segment[n];
+            }
+        }
+
+        // Start in [low, high] of the segment that best continues the last one, in the mix `x`
+        // The score is the cross-correlation with the continuation over the candidate's energy, squared with its sign
+        // kept; scores equal to rounding go to the candidate nearest to `nominal`.
+        size_t search(const float* x, size_t low, size_t high, size_t nominal) {
+            const float* continuation = x + m_continuation;
+            double energy = simd::dot(x + low, x + low, m_hop);
+            double best = -HUGE_VAL;
+            for (size_t p = low; p <= high; ++p) {
+                if (p != low) {
+                    const double in = x[p + m_hop - 1];
+                    const double out = x[p - 1];
+                    energy = std::max(energy + in * in - out * out, 0.0);
+                }
+                const double correlation = simd::dot(continuation, x + p, m_hop);
+                const double score = correlation * std::abs(correlation) / std::max(energy, 1e-20);
+                m_scores[p - low] = score;
+                best = std::max(best, score);
+            }
+
+            const double threshold = best - 1e-6 * std::abs(best);
+            size_t start = high + 1;
+            for (size_t p = low; p <= high; ++p) {
+                if (m_scores[p - low] >= threshold && (start > high || distance(p, nominal) < distance(start, nominal))) {
+                    start = p;
+                }
+            }
+            return start;
+        }
+
+        static size_t distance(size_t a, size_t b) {
+            return a > b ? a - b : b - a;
+        }
+    };
+
+}
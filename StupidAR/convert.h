@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+
+#include "pcm.h"
+
+namespace StupidAR {
+
+    // Like `convert_sample()`, but also defined for from == to
+    template <SampleFormat from, SampleFormat to>
+    typename PcmFormatTraits<to>::sample_t convert_any_sample(typename PcmFormatTraits<from>::sample_t sample) {
+        if constexpr (from == to) {
+            return sample;
+        } else {
+            return convert_sample<from, to>(sample);
+        }
+    }
+
+    // Converts `count` samples, reading every `src_stride`th sample of `src` and writing every `dst_stride`th sample of `dst`
+    // Strides are in samples, so (de)interleaving is a matter of passing the channel count as the stride.
+    template <SampleFormat from, SampleFormat to>
+    void convert_buffer(const char* src, size_t src_stride, char* dst, size_t dst_stride, size_t count) {
+        using src_t = typename PcmFormatTraits<from>::sample_t;
+        using dst_t = typename PcmFormatTraits<to>::sample_t;
+
+        const src_t* s = reinterpret_cast<const src_t*>(src);
+        dst_t* d = reinterpret_cast<dst_t*>(dst);
+
+        for (size_t i = 0; i < count; ++i) {
+            d[i * dst_stride] = convert_any_sample<from, to>(s[i * src_stride]);
+        }
+    }
+
+    using ConvertFn = void(*)(const char* src, size_t src_stride, char* dst, size_t dst_stride, size_t count);
+
+    namespace detail {
+
+        template <SampleFormat from>
+        ConvertFn converter_from(SampleFormat to) {
+            switch (to) {
+            case SampleFormat::Float:
+                return &convert_buffer<from, SampleFormat::Float>;
+            case SampleFormat::Double:
+                return &convert_buffer<from, SampleFormat::Double>;
+            case SampleFormat::U8:
+                return &convert_buffer<from, SampleFormat::U8>;
+            case SampleFormat::S16:
+                return &convert_buffer<from, SampleFormat::S16>;
+            case SampleFormat::S24:
+                return &convert_buffer<from, SampleFormat::S24>;
+            case SampleFormat::S32:
+                return &convert_buffer<from, SampleFormat::S32>;
+            case SampleFormat::S16of32:
+                return &convert_buffer<from, SampleFormat::S16of32>;
+            case SampleFormat::S18of32:
+                return &convert_buffer<from, SampleFormat::S18of32>;
+            case SampleFormat::S20of32:
+                return &convert_buffer<from, SampleFormat::S20of32>;
+            case SampleFormat::S24of32:
+                return &convert_buffer<from, SampleFormat::S24of32>;
+            default:
+                return nullptr;
+            }
+        }
+
+    }
+
+    // Run-time selection of `convert_buffer<from, to>`
+    // Returns nullptr if either format is SampleFormat::Unknown
+    inline ConvertFn converter_for(SampleFormat from, SampleFormat to) {
+        switch (from) {
+        case SampleFormat::Float:
+            return detail::converter_from<SampleFormat::Float>(to);
+        case SampleFormat::Double:
+            return detail::converter_from<SampleFormat::Double>(to);
+        case SampleFormat::U8:
+            return detail::converter_from<SampleFormat::U8>(to);
+        case SampleFormat::S16:
+            return detail::converter_from<SampleFormat::S16>(to);
+        case SampleFormat::S24:
+            return detail::converter_from<SampleFormat::S24>(to);
+        case SampleFormat::S32:
+            return detail::converter_from<SampleFormat::S32>(to);
+        case SampleFormat::S16of32:
+            return detail::converter_from<SampleFormat::S16of32>(to);
+        case SampleFormat::S18of32:
+            return detail::converter_from<SampleFormat::S18of32>(to);
+        case SampleFormat::S20of32:
+            return detail::converter_from<SampleFormat::S20of32>(to);
+        case SampleFormat::S24of32:
+            return detail::converter_from<SampleFormat::S24of32>(to);
+        default:
+            return nullptr;
+        }
+    }
+
+    // Calls `f(std::integral_constant<SampleFormat, format>())`, so `format` can be used as a template argument
+    // Returns `fallback` for SampleFormat::Unknown
+    template <typename R, typename F>
+    R visit_format(SampleFormat format, R fallback, F&& f) {
+        switch (format) {
+        case SampleFormat::Float:
+            return f(std::integral_constant<SampleFormat, SampleFormat::Float>());
+        case SampleFormat::Double:
+            return f(std::integral_constant<SampleFormat, SampleFormat::Double>());
+        case SampleFormat::U8:
+            return f(std::integral_constant<SampleFormat, SampleFormat::U8>());
+        case SampleFormat::S16:
+            return f(std::integral_constant<SampleFormat, SampleFormat::S16>());
+        case SampleFormat::S24:
+            return f(std::integral_constant<SampleFormat, SampleFormat::S24>());
+        case SampleFormat::S32:
+            return f(std::integral_constant<SampleFormat, SampleFormat::S32>());
+        case SampleFormat::S16of32:
+            return f(std::integral_constant<SampleFormat, SampleFormat::S16of32>());
+        case SampleFormat::S18of32:
+            return f(std::integral_constant<SampleFormat, SampleFormat::S18of32>());
+        case SampleFormat::S20of32:
+            return f(std::integral_constant<SampleFormat, SampleFormat::S20of32>());
+        case SampleFormat::S24of32:
+            return f(std::integral_constant<SampleFormat, SampleFormat::S24of32>());
+        default:
+            return fallback;
+        }
+    }
+
+}
@@ -1,6 +1,10 @@
 #pragma once
 
 #include <cstdint>
+#include <cstddef>
+#include <climits>
+#include <cstring>
+#include <type_traits>
 
 namespace StupidAR {
 
@@ -21,6 +25,39 @@ namespace StupidAR {
         S24of32,
     };
 
+    // Size of one sample in bytes, 0 for SampleFormat::Unknown
+    inline size_t sample_size(SampleFormat format) {
+        switch (format) {
+        case SampleFormat::U8:
+            return 1;
+        case SampleFormat::S16:
+            return 2;
+        case SampleFormat::S24:
+            return 3;
+        case SampleFormat::Float:
+        case SampleFormat::S32:
+        case SampleFormat::S16of32:
+        case SampleFormat::S18of32:
+        case SampleFormat::S20of32:
+        case SampleFormat::S24of32:
+            return 4;
+        case SampleFormat::Double:
+            return 8;
+        default:
+            return 0;
+        }
+    }
+
+    // The byte every byte of digital silence consists of (0x80 for U8, zero otherwise)
+    inline unsigned char silence_byte(SampleFormat format) {
+        return format == SampleFormat::U8 ? 0x80 : 0;
+    }
+
+    // Writes `count` samples of digital silence
+    inline void fill_silence(SampleFormat format, char* dst, size_t count) {
+        std::memset(dst, silence_byte(format), count * sample_size(format));
+    }
+
     // 24 bit, little endian, 2's complement integer
     struct pcm24_t {
         uint8_t data[3];
@@ -127,73 +164,73 @@ namespace StupidAR {
     // (define other int-float conversions in terms of these 4)
 
     template <>
-    float convert_sample<SampleFormat::S24, SampleFormat::Float>(pcm24_t sample) {
+    inline float convert_sample<SampleFormat::S24, SampleFormat::Float>(pcm24_t sample) {
         return sample.int_value() / (pcm24_t::max_i32 + 1.0f);
     }
 
     template <>
-    pcm24_t convert_sample<SampleFormat::Float, SampleFormat::S24>(float sample) {
+    inline pcm24_t convert_sample<SampleFormat::Float, SampleFormat::S24>(float sample) {
         return pcm24_t::value_of(int32_t(sample * (pcm24_t::max_i32 + 1.0f)));
     }
 
     template <>
-    double convert_sample<SampleFormat::S32, SampleFormat::Double>(int32_t sample) {
+    inline double convert_sample<SampleFormat::S32, SampleFormat::Double>(int32_t sample) {
         return sample / (INT32_MAX + 1.0);
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::Double, SampleFormat::S32>(double sample) {
+    inline int32_t convert_sample<SampleFormat::Double, SampleFormat::S32>(double sample) {
         return int32_t(sample * (INT32_MAX + 1.0));
     }
 
     // U8LE -> ... conversions:
 
     template <>
-    int16_t convert_sample<SampleFormat::U8, SampleFormat::S16>(uint8_t sample) {
+    inline int16_t convert_sample<SampleFormat::U8, SampleFormat::S16>(uint8_t sample) {
         return (int16_t(sample) - 128) << 8;
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::U8, SampleFormat::S16of32>(uint8_t sample) {
+    inline int32_t convert_sample<SampleFormat::U8, SampleFormat::S16of32>(uint8_t sample) {
         return int32_t(convert_sample<SampleFormat::U8, SampleFormat::S16>(sample));
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::U8, SampleFormat::S18of32>(uint8_t sample) {
+    inline int32_t convert_sample<SampleFormat::U8, SampleFormat::S18of32>(uint8_t sample) {
         return (int32_t(sample) - 128) << 10;
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::U8, SampleFormat::S20of32>(uint8_t sample) {
+    inline int32_t convert_sample<SampleFormat::U8, SampleFormat::S20of32>(uint8_t sample) {
         return (int32_t(sample) - 128) << 12;
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::U8, SampleFormat::S24of32>(uint8_t sample) {
+    inline int32_t convert_sample<SampleFormat::U8, SampleFormat::S24of32>(uint8_t sample) {
         return (int32_t(sample) - 128) << 16;
     }
 
     template <>
-    pcm24_t convert_sample<SampleFormat::U8, SampleFormat::S24>(uint8_t sample) {
+    inline pcm24_t convert_sample<SampleFormat::U8, SampleFormat::S24>(uint8_t sample) {
         return pcm24_t::value_of(
             convert_sample<SampleFormat::U8, SampleFormat::S24of32>(sample)
         );
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::U8, SampleFormat::S32>(uint8_t sample) {
+    inline int32_t convert_sample<SampleFormat::U8, SampleFormat::S32>(uint8_t sample) {
         return (int32_t(sample) - 128) << 24;
     }
 
     template <>
-    float convert_sample<SampleFormat::U8, SampleFormat::Float>(uint8_t sample) {
+    inline float convert_sample<SampleFormat::U8, SampleFormat::Float>(uint8_t sample) {
         return convert_sample<SampleFormat::S24, SampleFormat::Float>(
             convert_sample<SampleFormat::U8, SampleFormat::S24>(sample)
         );
     }
 
     template <>
-    double convert_sample<SampleFormat::U8, SampleFormat::Double>(uint8_t sample) {
+    inline double convert_sample<SampleFormat::U8, SampleFormat::Double>(uint8_t sample) {
         return convert_sample<SampleFormat::S32, SampleFormat::Double>(
             convert_sample<SampleFormat::U8, SampleFormat::S32>(sample)
         );
@@ -202,51 +239,56 @@ namespace StupidAR {
     // S16LE -> ... conversions:
 
     template <>
-    uint8_t convert_sample<SampleFormat::S16, SampleFormat::U8>(int16_t sample) {
+    inline uint8_t convert_sample<SampleFormat::S16, SampleFormat::U8>(int16_t sample) {
         return (sample >> 8) + 128;
     }
 
     template <>
-    int16_t convert_sample<SampleFormat::S16, SampleFormat::S16>(int16_t sample) {
+    inline int16_t convert_sample<SampleFormat::S16, SampleFormat::S16>(int16_t sample) {
+        return sample;
+    }
+
+    template <>
+    inline int32_t convert_sample<SampleFormat::S16, SampleFormat::S16of32>(int16_t sample) {
         return sample;
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S16, SampleFormat::S18of32>(int16_t sample) {
+    inline int32_t convert_sample<SampleFormat::S16, SampleFormat::S18of32>(int16_t sample) {
         return int32_t(sample) << 2;
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S16, SampleFormat::S20of32>(int16_t sample) {
+    inline int32_t convert_sample<SampleFormat::S16, SampleFormat::S20of32>(int16_t sample) {
         return int32_t(sample) << 4;
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S16, SampleFormat::S24of32>(int16_t sample) {
+    inline int32_t convert_sample<SampleFormat::S16, SampleFormat::S24of32>(int16_t sample) {
         return int32_t(sample) << 8;
     }
 
     template <>
-    pcm24_t convert_sample<SampleFormat::S16, SampleFormat::S24>(int16_t sample) {
+    inline pcm24_t convert_sample<SampleFormat::S16, SampleFormat::S24>(int16_t sample) {
         return pcm24_t::value_of(
             convert_sample<SampleFormat::S16, SampleFormat::S24of32>(sample)
         );
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S16, SampleFormat::S32>(int16_t sample) {
+    inline int32_t convert_sample<SampleFormat::S16, SampleFormat::S32>(int16_t sample) {
         return int32_t(sample) << 16;
     }
 
     template <>
-    float convert_sample<SampleFormat::S16, SampleFormat::Float>(int16_t sample) {
+    inline float convert_sample<SampleFormat::S16, SampleFormat::Float>(int16_t sample) {
         return convert_sample<SampleFormat::S24, SampleFormat::Float>(
             convert_sample<SampleFormat::S16, SampleFormat::S24>(sample)
         );
     }
 
     template <>
-    double convert_sample<SampleFormat::S16, SampleFormat::Double>(int16_t sample) {
+    inline double convert_sample<SampleFormat::S16, SampleFormat::Double>(int16_t sample) {
         return convert_sample<SampleFormat::S32, SampleFormat::Double>(
             convert_sample<SampleFormat::S16, SampleFormat::S32>(sample)
         );
@@ -255,42 +297,42 @@ namespace StupidAR {
     // S24LE -> ... conversions:
 
     template <>
-    uint8_t convert_sample<SampleFormat::S24, SampleFormat::U8>(pcm24_t sample) {
+    inline uint8_t convert_sample<SampleFormat::S24, SampleFormat::U8>(pcm24_t sample) {
         return (sample.int_value() >> 16) + 128;
     }
 
     template <>
-    int16_t convert_sample<SampleFormat::S24, SampleFormat::S16>(pcm24_t sample) {
+    inline int16_t convert_sample<SampleFormat::S24, SampleFormat::S16>(pcm24_t sample) {
         return sample.int_value() >> 8;
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S24, SampleFormat::S16of32>(pcm24_t sample) {
+    inline int32_t convert_sample<SampleFormat::S24, SampleFormat::S16of32>(pcm24_t sample) {
         return convert_sample<SampleFormat::S24, SampleFormat::S16>(sample);
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S24, SampleFormat::S18of32>(pcm24_t sample) {
+    inline int32_t convert_sample<SampleFormat::S24, SampleFormat::S18of32>(pcm24_t sample) {
         return sample.int_value() >> 6;
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S24, SampleFormat::S20of32>(pcm24_t sample) {
+    inline int32_t convert_sample<SampleFormat::S24, SampleFormat::S20of32>(pcm24_t sample) {
         return sample.int_value() >> 4;
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S24, SampleFormat::S24of32>(pcm24_t sample) {
+    inline int32_t convert_sample<SampleFormat::S24, SampleFormat::S24of32>(pcm24_t sample) {
         return sample.int_value();
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S24, SampleFormat::S32>(pcm24_t sample) {
+    inline int32_t convert_sample<SampleFormat::S24, SampleFormat::S32>(pcm24_t sample) {
         return sample.int_value() << 8;
     }
 
     template <>
-    double convert_sample<SampleFormat::S24, SampleFormat::Double>(pcm24_t sample) {
+    inline double convert_sample<SampleFormat::S24, SampleFormat::Double>(pcm24_t sample) {
         return convert_sample<SampleFormat::S32, SampleFormat::Double>(
             convert_sample<SampleFormat::S24, SampleFormat::S32>(sample)
         );
@@ -299,51 +341,51 @@ namespace StupidAR {
     // S16of32LE -> ... conversions:
 
     template <>
-    uint8_t convert_sample<SampleFormat::S16of32, SampleFormat::U8>(int32_t sample) {
+    inline uint8_t convert_sample<SampleFormat::S16of32, SampleFormat::U8>(int32_t sample) {
         return ((sample << 16) >> 24) + 128;
     }
 
     template <>
-    int16_t convert_sample<SampleFormat::S16of32, SampleFormat::S16>(int32_t sample) {
+    inline int16_t convert_sample<SampleFormat::S16of32, SampleFormat::S16>(int32_t sample) {
         return (sample << 16) >> 16;
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S16of32, SampleFormat::S18of32>(int32_t sample) {
+    inline int32_t convert_sample<SampleFormat::S16of32, SampleFormat::S18of32>(int32_t sample) {
         return (sample << 16) >> 14;
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S16of32, SampleFormat::S20of32>(int32_t sample) {
+    inline int32_t convert_sample<SampleFormat::S16of32, SampleFormat::S20of32>(int32_t sample) {
         return (sample << 16) >> 12;
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S16of32, SampleFormat::S24of32>(int32_t sample) {
+    inline int32_t convert_sample<SampleFormat::S16of32, SampleFormat::S24of32>(int32_t sample) {
         return (sample << 16) >> 8;
     }
 
     template <>
-    pcm24_t convert_sample<SampleFormat::S16of32, SampleFormat::S24>(int32_t sample) {
+    inline pcm24_t convert_sample<SampleFormat::S16of32, SampleFormat::S24>(int32_t sample) {
         return pcm24_t::value_of(
             convert_sample<SampleFormat::S16of32, SampleFormat::S24of32>(sample)
         );
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S16of32, SampleFormat::S32>(int32_t sample) {
+    inline int32_t convert_sample<SampleFormat::S16of32, SampleFormat::S32>(int32_t sample) {
         return sample << 16;
     }
 
     template <>
-    float convert_sample<SampleFormat::S16of32, SampleFormat::Float>(int32_t sample) {
+    inline float convert_sample<SampleFormat::S16of32, SampleFormat::Float>(int32_t sample) {
         return convert_sample<SampleFormat::S24, SampleFormat::Float>(
             convert_sample<SampleFormat::S16of32, SampleFormat::S24>(sample)
         );
     }
 
     template <>
-    double convert_sample<SampleFormat::S16of32, SampleFormat::Double>(int32_t sample) {
+    inline double convert_sample<SampleFormat::S16of32, SampleFormat::Double>(int32_t sample) {
         return convert_sample<SampleFormat::S32, SampleFormat::Double>(
             convert_sample<SampleFormat::S16of32, SampleFormat::S32>(sample)
         );
@@ -352,51 +394,51 @@ namespace StupidAR {
     // S18of32LE -> ... conversions:
 
     template <>
-    uint8_t convert_sample<SampleFormat::S18of32, SampleFormat::U8>(int32_t sample) {
+    inline uint8_t convert_sample<SampleFormat::S18of32, SampleFormat::U8>(int32_t sample) {
         return ((sample << 14) >> 24) + 128;
     }
 
     template <>
-    int16_t convert_sample<SampleFormat::S18of32, SampleFormat::S16>(int32_t sample) {
+    inline int16_t convert_sample<SampleFormat::S18of32, SampleFormat::S16>(int32_t sample) {
         return (sample << 14) >> 16;
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S18of32, SampleFormat::S16of32>(int32_t sample) {
+    inline int32_t convert_sample<SampleFormat::S18of32, SampleFormat::S16of32>(int32_t sample) {
         return convert_sample<SampleFormat::S18of32, SampleFormat::S16>(sample);
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S18of32, SampleFormat::S20of32>(int32_t sample) {
+    inline int32_t convert_sample<SampleFormat::S18of32, SampleFormat::S20of32>(int32_t sample) {
         return (sample << 14) >> 12;
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S18of32, SampleFormat::S24of32>(int32_t sample) {
+    inline int32_t convert_sample<SampleFormat::S18of32, SampleFormat::S24of32>(int32_t sample) {
         return (sample << 14) >> 8;
     }
 
     template <>
-    pcm24_t convert_sample<SampleFormat::S18of32, SampleFormat::S24>(int32_t sample) {
+    inline pcm24_t convert_sample<SampleFormat::S18of32, SampleFormat::S24>(int32_t sample) {
         return pcm24_t::value_of(
             convert_sample<SampleFormat::S18of32, SampleFormat::S24of32>(sample)
         );
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S18of32, SampleFormat::S32>(int32_t sample) {
+    inline int32_t convert_sample<SampleFormat::S18of32, SampleFormat::S32>(int32_t sample) {
         return sample << 14;
     }
 
     template <>
-    float convert_sample<SampleFormat::S18of32, SampleFormat::Float>(int32_t sample) {
+    inline float convert_sample<SampleFormat::S18of32, SampleFormat::Float>(int32_t sample) {
         return convert_sample<SampleFormat::S24, SampleFormat::Float>(
             convert_sample<SampleFormat::S18of32, SampleFormat::S24>(sample)
         );
     }
 
     template <>
-    double convert_sample<SampleFormat::S18of32, SampleFormat::Double>(int32_t sample) {
+    inline double convert_sample<SampleFormat::S18of32, SampleFormat::Double>(int32_t sample) {
         return convert_sample<SampleFormat::S32, SampleFormat::Double>(
             convert_sample<SampleFormat::S18of32, SampleFormat::S32>(sample)
         );
@@ -405,51 +447,51 @@ namespace StupidAR {
     // S20of32LE -> ... conversions:
 
     template <>
-    uint8_t convert_sample<SampleFormat::S20of32, SampleFormat::U8>(int32_t sample) {
+    inline uint8_t convert_sample<SampleFormat::S20of32, SampleFormat::U8>(int32_t sample) {
         return ((sample << 12) >> 24) + 128;
     }
 
     template <>
-    int16_t convert_sample<SampleFormat::S20of32, SampleFormat::S16>(int32_t sample) {
+    inline int16_t convert_sample<SampleFormat::S20of32, SampleFormat::S16>(int32_t sample) {
         return (sample << 12) >> 16;
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S20of32, SampleFormat::S16of32>(int32_t sample) {
+    inline int32_t convert_sample<SampleFormat::S20of32, SampleFormat::S16of32>(int32_t sample) {
         return convert_sample<SampleFormat::S20of32, SampleFormat::S16>(sample);
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S20of32, SampleFormat::S18of32>(int32_t sample) {
+    inline int32_t convert_sample<SampleFormat::S20of32, SampleFormat::S18of32>(int32_t sample) {
         return (sample << 12) >> 14;
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S20of32, SampleFormat::S24of32>(int32_t sample) {
+    inline int32_t convert_sample<SampleFormat::S20of32, SampleFormat::S24of32>(int32_t sample) {
         return (sample << 12) >> 8;
     }
 
     template <>
-    pcm24_t convert_sample<SampleFormat::S20of32, SampleFormat::S24>(int32_t sample) {
+    inline pcm24_t convert_sample<SampleFormat::S20of32, SampleFormat::S24>(int32_t sample) {
         return pcm24_t::value_of(
             convert_sample<SampleFormat::S20of32, SampleFormat::S24of32>(sample)
         );
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S20of32, SampleFormat::S32>(int32_t sample) {
+    inline int32_t convert_sample<SampleFormat::S20of32, SampleFormat::S32>(int32_t sample) {
         return sample << 12;
     }
 
     template <>
-    float convert_sample<SampleFormat::S20of32, SampleFormat::Float>(int32_t sample) {
+    inline float convert_sample<SampleFormat::S20of32, SampleFormat::Float>(int32_t sample) {
         return convert_sample<SampleFormat::S24, SampleFormat::Float>(
             convert_sample<SampleFormat::S20of32, SampleFormat::S24>(sample)
         );
     }
 
     template <>
-    double convert_sample<SampleFormat::S20of32, SampleFormat::Double>(int32_t sample) {
+    inline double convert_sample<SampleFormat::S20of32, SampleFormat::Double>(int32_t sample) {
         return convert_sample<SampleFormat::S32, SampleFormat::Double>(
             convert_sample<SampleFormat::S20of32, SampleFormat::S32>(sample)
         );
@@ -458,49 +500,49 @@ namespace StupidAR {
     // S24of32LE -> ... conversions:
 
     template <>
-    uint8_t convert_sample<SampleFormat::S24of32, SampleFormat::U8>(int32_t sample) {
+    inline uint8_t convert_sample<SampleFormat::S24of32, SampleFormat::U8>(int32_t sample) {
         return ((sample << 8) >> 24) + 128;
     }
 
     template <>
-    int16_t convert_sample<SampleFormat::S24of32, SampleFormat::S16>(int32_t sample) {
+    inline int16_t convert_sample<SampleFormat::S24of32, SampleFormat::S16>(int32_t sample) {
         return (sample << 8) >> 16;
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S24of32, SampleFormat::S16of32>(int32_t sample) {
+    inline int32_t convert_sample<SampleFormat::S24of32, SampleFormat::S16of32>(int32_t sample) {
         return convert_sample<SampleFormat::S24of32, SampleFormat::S16>(sample);
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S24of32, SampleFormat::S18of32>(int32_t sample) {
+    inline int32_t convert_sample<SampleFormat::S24of32, SampleFormat::S18of32>(int32_t sample) {
         return (sample << 8) >> 14;
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S24of32, SampleFormat::S20of32>(int32_t sample) {
+    inline int32_t convert_sample<SampleFormat::S24of32, SampleFormat::S20of32>(int32_t sample) {
         return (sample << 8) >> 12;
     }
 
     template <>
-    pcm24_t convert_sample<SampleFormat::S24of32, SampleFormat::S24>(int32_t sample) {
+    inline pcm24_t convert_sample<SampleFormat::S24of32, SampleFormat::S24>(int32_t sample) {
         return pcm24_t::value_of((sample << 8) >> 8);
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S24of32, SampleFormat::S32>(int32_t sample) {
+    inline int32_t convert_sample<SampleFormat::S24of32, SampleFormat::S32>(int32_t sample) {
         return sample << 8;
     }
 
     template <>
-    float convert_sample<SampleFormat::S24of32, SampleFormat::Float>(int32_t sample) {
+    inline float convert_sample<SampleFormat::S24of32, SampleFormat::Float>(int32_t sample) {
         return convert_sample<SampleFormat::S24, SampleFormat::Float>(
             convert_sample<SampleFormat::S24of32, SampleFormat::S24>(sample)
         );
     }
 
     template <>
-    double convert_sample<SampleFormat::S24of32, SampleFormat::Double>(int32_t sample) {
+    inline double convert_sample<SampleFormat::S24of32, SampleFormat::Double>(int32_t sample) {
         return convert_sample<SampleFormat::S32, SampleFormat::Double>(
             convert_sample<SampleFormat::S24of32, SampleFormat::S32>(sample)
         );
@@ -509,49 +551,49 @@ namespace StupidAR {
     // S32LE -> ... conversions:
 
     template <>
-    uint8_t convert_sample<SampleFormat::S32, SampleFormat::U8>(int32_t sample) {
+    inline uint8_t convert_sample<SampleFormat::S32, SampleFormat::U8>(int32_t sample) {
         return (sample >> 24) + 128;
     }
 
     template <>
-    int16_t convert_sample<SampleFormat::S32, SampleFormat::S16>(int32_t sample) {
+    inline int16_t convert_sample<SampleFormat::S32, SampleFormat::S16>(int32_t sample) {
         return sample >> 16;
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S32, SampleFormat::S16of32>(int32_t sample) {
+    inline int32_t convert_sample<SampleFormat::S32, SampleFormat::S16of32>(int32_t sample) {
         return convert_sample<SampleFormat::S32, SampleFormat::S16>(sample);
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S32, SampleFormat::S18of32>(int32_t sample) {
+    inline int32_t convert_sample<SampleFormat::S32, SampleFormat::S18of32>(int32_t sample) {
         return sample >> 14;
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S32, SampleFormat::S20of32>(int32_t sample) {
+    inline int32_t convert_sample<SampleFormat::S32, SampleFormat::S20of32>(int32_t sample) {
         return sample >> 12;
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S32, SampleFormat::S24of32>(int32_t sample) {
+    inline int32_t convert_sample<SampleFormat::S32, SampleFormat::S24of32>(int32_t sample) {
         return sample >> 8;
     }
 
     template <>
-    pcm24_t convert_sample<SampleFormat::S32, SampleFormat::S24>(int32_t sample) {
+    inline pcm24_t convert_sample<SampleFormat::S32, SampleFormat::S24>(int32_t sample) {
         return pcm24_t::value_of(
             convert_sample<SampleFormat::S32, SampleFormat::S24of32>(sample)
         );
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::S32, SampleFormat::S32>(int32_t sample) {
+    inline int32_t convert_sample<SampleFormat::S32, SampleFormat::S32>(int32_t sample) {
         return sample;
     }
 
     template <>
-    float convert_sample<SampleFormat::S32, SampleFormat::Float>(int32_t sample) {
+    inline float convert_sample<SampleFormat::S32, SampleFormat::Float>(int32_t sample) {
         return convert_sample<SampleFormat::S24, SampleFormat::Float>(
             convert_sample<SampleFormat::S32, SampleFormat::S24>(sample)
         );
@@ -560,56 +602,56 @@ namespace StupidAR {
     // Float -> ... conversions:
 
     template <>
-    uint8_t convert_sample<SampleFormat::Float, SampleFormat::U8>(float sample) {
+    inline uint8_t convert_sample<SampleFormat::Float, SampleFormat::U8>(float sample) {
         return convert_sample<SampleFormat::S24, SampleFormat::U8>(
             convert_sample<SampleFormat::Float, SampleFormat::S24>(sample)
         );
     }
 
     template <>
-    int16_t convert_sample<SampleFormat::Float, SampleFormat::S16>(float sample) {
+    inline int16_t convert_sample<SampleFormat::Float, SampleFormat::S16>(float sample) {
         return convert_sample<SampleFormat::S24, SampleFormat::S16>(
             convert_sample<SampleFormat::Float, SampleFormat::S24>(sample)
         );
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::Float, SampleFormat::S16of32>(float sample) {
+    inline int32_t convert_sample<SampleFormat::Float, SampleFormat::S16of32>(float sample) {
         return convert_sample<SampleFormat::S24, SampleFormat::S16of32>(
             convert_sample<SampleFormat::Float, SampleFormat::S24>(sample)
         );
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::Float, SampleFormat::S18of32>(float sample) {
+    inline int32_t convert_sample<SampleFormat::Float, SampleFormat::S18of32>(float sample) {
         return convert_sample<SampleFormat::S24, SampleFormat::S18of32>(
             convert_sample<SampleFormat::Float, SampleFormat::S24>(sample)
         );
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::Float, SampleFormat::S20of32>(float sample) {
+    inline int32_t convert_sample<SampleFormat::Float, SampleFormat::S20of32>(float sample) {
         return convert_sample<SampleFormat::S24, SampleFormat::S20of32>(
             convert_sample<SampleFormat::Float, SampleFormat::S24>(sample)
         );
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::Float, SampleFormat::S24of32>(float sample) {
+    inline int32_t convert_sample<SampleFormat::Float, SampleFormat::S24of32>(float sample) {
         return convert_sample<SampleFormat::S24, SampleFormat::S24of32>(
             convert_sample<SampleFormat::Float, SampleFormat::S24>(sample)
         );
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::Float, SampleFormat::S32>(float sample) {
+    inline int32_t convert_sample<SampleFormat::Float, SampleFormat::S32>(float sample) {
         return convert_sample<SampleFormat::S24, SampleFormat::S32>(
             convert_sample<SampleFormat::Float, SampleFormat::S24>(sample)
         );
     }
 
     template <>
-    double convert_sample<SampleFormat::Float, SampleFormat::Double>(float sample) {
+    inline double convert_sample<SampleFormat::Float, SampleFormat::Double>(float sample) {
         return convert_sample<SampleFormat::S32, SampleFormat::Double>(
             convert_sample<SampleFormat::Float, SampleFormat::S32>(sample)
         );
@@ -618,56 +660,56 @@ namespace StupidAR {
     // Double -> ... conversions:
 
     template <>
-    uint8_t convert_sample<SampleFormat::Double, SampleFormat::U8>(double sample) {
+    inline uint8_t convert_sample<SampleFormat::Double, SampleFormat::U8>(double sample) {
         return convert_sample<SampleFormat::S32, SampleFormat::U8>(
             convert_sample<SampleFormat::Double, SampleFormat::S32>(sample)
         );
     }
 
     template <>
-    int16_t convert_sample<SampleFormat::Double, SampleFormat::S16>(double sample) {
+    inline int16_t convert_sample<SampleFormat::Double, SampleFormat::S16>(double sample) {
         return convert_sample<SampleFormat::S32, SampleFormat::S16>(
             convert_sample<SampleFormat::Double, SampleFormat::S32>(sample)
         );
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::Double, SampleFormat::S16of32>(double sample) {
+    inline int32_t convert_sample<SampleFormat::Double, SampleFormat::S16of32>(double sample) {
         return convert_sample<SampleFormat::S32, SampleFormat::S16of32>(
             convert_sample<SampleFormat::Double, SampleFormat::S32>(sample)
         );
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::Double, SampleFormat::S18of32>(double sample) {
+    inline int32_t convert_sample<SampleFormat::Double, SampleFormat::S18of32>(double sample) {
         return convert_sample<SampleFormat::S32, SampleFormat::S18of32>(
             convert_sample<SampleFormat::Double, SampleFormat::S32>(sample)
         );
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::Double, SampleFormat::S20of32>(double sample) {
+    inline int32_t convert_sample<SampleFormat::Double, SampleFormat::S20of32>(double sample) {
         return convert_sample<SampleFormat::S32, SampleFormat::S20of32>(
             convert_sample<SampleFormat::Double, SampleFormat::S32>(sample)
         );
     }
 
     template <>
-    int32_t convert_sample<SampleFormat::Double, SampleFormat::S24of32>(double sample) {
+    inline int32_t convert_sample<SampleFormat::Double, SampleFormat::S24of32>(double sample) {
         return convert_sample<SampleFormat::S32, SampleFormat::S24of32>(
             convert_sample<SampleFormat::Double, SampleFormat::S32>(sample)
         );
     }
 
     template <>
-    pcm24_t convert_sample<SampleFormat::Double, SampleFormat::S24>(double sample) {
+    inline pcm24_t convert_sample<SampleFormat::Double, SampleFormat::S24>(double sample) {
         return convert_sample<SampleFormat::S32, SampleFormat::S24>(
             convert_sample<SampleFormat::Double, SampleFormat::S32>(sample)
         );
     }
 
     template <>
-    float convert_sample<SampleFormat::Double, SampleFormat::Float>(double sample) {
+    inline float convert_sample<SampleFormat::Double, SampleFormat::Float>(double sample) {
         return convert_sample<SampleFormat::S32, SampleFormat::Float>(
             convert_sample<SampleFormat::Double, SampleFormat::S32>(sample)
         );
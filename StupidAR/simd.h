@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define STUPIDAR_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace StupidAR {
+
+    // Float buffer primitives for the DSP stages, SSE2 where the target has it and scalar otherwise
+    // Buffers need no particular alignment.
+    namespace simd {
+
+#ifdef STUPIDAR_SSE2
+        constexpr bool kVectorized = true;
+#else
+        constexpr bool kVectorized = false;
+#endif
+
+        // dst[i] = src[i] * gain
+        inline void mul(float* dst, const float* src, float gain, size_t n) {
+            size_t i = 0;
+#ifdef STUPIDAR_SSE2
+            const __m128 g = _mm_set1_ps(gain);
+            for (; i + 4 <= n; i += 4) {
+                _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_loadu_ps(src + i), g));
+            }
+#endif
+            for (; i < n; ++i) {
+                dst[i] = src[i] * gain;
+            }
+        }
+
+        // dst[i] += src[i] * gain
+        inline void mac(float* dst, const float* src, float gain, size_t n) {
+            size_t i = 0;
+#ifdef STUPIDAR_SSE2
+            const __m128 g = _mm_set1_ps(gain);
+            for (; i + 4 <= n; i += 4) {
+                _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(_mm_loadu_ps(src + i), g)));
+            }
+#endif
+            for (; i < n; ++i) {
+                dst[i] += src[i] * gain;
+            }
+        }
+
+        // dst[i] = src[i] * (start + step * i), the gain clamped to `limit` once the ramp reaches it
+        // `dst` may be `src`.
+        inline void mul_linear_ramp(float* dst, const float* src, float start, float step, float limit, size_t n) {
+            const bool rising = step >= 0.0f;
+            size_t i = 0;
+#ifdef STUPIDAR_SSE2
+            const __m128 base = _mm_add_ps(_mm_set1_ps(start), _mm_mul_ps(_mm_set1_ps(step), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f)));
+            const __m128 s = _mm_set1_ps(step);
+            const __m128 l = _mm_set1_ps(limit);
+            for (; i + 4 <= n; i += 4) {
+                __m128 g = _mm_add_ps(base, _mm_mul_ps(s, _mm_set1_ps(float(i))));
+                g = rising ? _mm_min_ps(g, l) : _mm_max_ps(g, l);
+                _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_loadu_ps(src + i), g));
+            }
+#endif
+            for (; i < n; ++i) {
+                const float g = start + step * float(i);
+                dst[i] = src[i] * (rising ? std::min(g, limit) : std::max(g, limit));
+            }
+        }
+
+        // dst[i] = src[i] * start * ratio^i, the gain clamped to `limit` once the ramp reaches it
+        // `dst` may be `src`.
+        inline void mul_exp_ramp(float* dst, const float* src, float start, float ratio, float limit, size_t n) {
+            const bool rising = ratio >= 1.0f;
+            float g = start;
+            size_t i = 0;
+#ifdef STUPIDAR_SSE2
+            const float r2 = ratio * ratio;
+            __m128 gv = _mm_set_ps(start * r2 * ratio, start * r2, start * ratio, start);
+            const __m128 r4 = _mm_set1_ps(r2 * r2);
+            const __m128 l = _mm_set1_ps(limit);
+            for (; i + 4 <= n; i += 4) {
+                const __m128 clamped = rising ? _mm_min_ps(gv, l) : _mm_max_ps(gv, l);
+                _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_loadu_ps(src + i), clamped));
+                gv = _mm_mul_ps(gv, r4);
+            }
+            _mm_store_ss(&g, gv);
+#endif
+            for (; i < n; ++i) {
+                dst[i] = src[i] * (rising ? std::min(g, limit) : std::max(g, limit));
+                g *= ratio;
+            }
+        }
+
+        // Sum of a[i] * b[i]
+        inline float dot(const float* a, const float* b, size_t n) {
+            float sum = 0.0f;
+            size_t i = 0;
+#ifdef STUPIDAR_SSE2
+            __m128 acc0 = _mm_setzero_ps();
+            __m128 acc1 = _mm_setzero_ps();
+            for (; i + 8 <= n; i += 8) {
+                acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+                acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+            }
+            if (i + 4 <= n) {
+                acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+                i += 4;
+            }
+            acc0 = _mm_add_ps(acc0, acc1);
+            acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+            acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+            _mm_store_ss(&sum, acc0);
+#endif
+            for (; i < n; ++i) {
+                sum += a[i] * b[i];
+            }
+            return sum;
+        }
+
+        // True if all `bytes` bytes at `data` equal `value`, stops at the first 16 bytes that don't
+        inline bool all_bytes_equal(const void* data, size_t bytes, unsigned char value) {
+            const unsigned char* p = static_cast<const unsigned char*>(data);
+            size_t i = 0;
+#ifdef STUPIDAR_SSE2
+            const __m128i v = _mm_set1_epi8(char(value));
+            for (; i + 16 <= bytes; i += 16) {
+                const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+                if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, v)) != 0xffff) {
+                    return false;
+                }
+            }
+#endif
+            for (; i < bytes; ++i) {
+                if (p[i] != value) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+    }
+
+}
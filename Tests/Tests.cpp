@@ -1,10 +1,189 @@
 #define CATCH_CONFIG_MAIN
 #include "catch.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include "pcm.h"
+#include "AggregateOutputAgent.h"
+#include "AsyncResampler.h"
+#include "BlockingQueue.h"
+#include "DeviceClock.h"
+#include "FrameTime.h"
+#include "LatencyMonitor.h"
+#include "NullOutputAgent.h"
+#include "PolyphaseResampler.h"
+#include "QueueDepthController.h"
+#include "RateConverter.h"
+#include "RenderCore.h"
+#include "RenderPlan.h"
+#include "SimulatedOutputAgent.h"
+#include "StartGate.h"
+#include "StreamArena.h"
+#include "ThreadConfig.h"
+#include "TimelineTracker.h"
+#include "WatchdogAgent.h"
+#include "WorkerPool.h"
+#include "WsolaStretcher.h"
+
+#include "../baseclasses/muldiv128.h"
+
+#ifdef STUPIDAR_SSE2
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
 
 using namespace StupidAR;
 
+namespace {
+    // Heap allocations made while `g_count_allocations` is set, by any thread
+    std::atomic<bool> g_count_allocations(false);
+    std::atomic<size_t> g_allocations(0);
+
+    // Every replaceable form of operator new counts, and each goes back through its own operator delete
+    void* counted_allocate(size_t size) noexcept {
+        if (g_count_allocations.load(std::memory_order_relaxed)) {
+            g_allocations.fetch_add(1, std::memory_order_relaxed);
+        }
+        return std::malloc(size != 0 ? size : 1);
+    }
+
+    // Over-aligned blocks keep what malloc() returned just ahead of them
+    void* counted_allocate(size_t size, std::align_val_t alignment) noexcept {
+        const size_t align = std::max(size_t(alignment), alignof(void*));
+        void* block = counted_allocate(size + align + sizeof(void*));
+        if (!block) {
+            return nullptr;
+        }
+        const uintptr_t aligned = (reinterpret_cast<uintptr_t>(block) + sizeof(void*) + align - 1) & ~uintptr_t(align - 1);
+        reinterpret_cast<void**>(aligned)[-1] = block;
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    void counted_free(void* p) noexcept {
+        std::free(p);
+    }
+
+    void counted_free(void* p, std::align_val_t) noexcept {
+        if (p) {
+            std::free(static_cast<void**>(p)[-1]);
+        }
+    }
+}
+
+// GCC would inline the deletes into their callers and take free() of operator new's pointer for a mismatch
+#if defined(__GNUC__)
+#define COUNTED_DELETE __attribute__((noinline))
+#else
+#define COUNTED_DELETE
+#endif
+
+void* operator new(size_t size) {
+    if (void* p = counted_allocate(size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    if (void* p = counted_allocate(size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return counted_allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return counted_allocate(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    if (void* p = counted_allocate(size, alignment)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    if (void* p = counted_allocate(size, alignment)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return counted_allocate(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return counted_allocate(size, alignment);
+}
+
+COUNTED_DELETE void operator delete(void* p) noexcept {
+    counted_free(p);
+}
+
+COUNTED_DELETE void operator delete[](void* p) noexcept {
+    counted_free(p);
+}
+
+COUNTED_DELETE void operator delete(void* p, size_t) noexcept {
+    counted_free(p);
+}
+
+COUNTED_DELETE void operator delete[](void* p, size_t) noexcept {
+    counted_free(p);
+}
+
+COUNTED_DELETE void operator delete(void* p, const std::nothrow_t&) noexcept {
+    counted_free(p);
+}
+
+COUNTED_DELETE void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    counted_free(p);
+}
+
+COUNTED_DELETE void operator delete(void* p, std::align_val_t alignment) noexcept {
+    counted_free(p, alignment);
+}
+
+COUNTED_DELETE void operator delete[](void* p, std::align_val_t alignment) noexcept {
+    counted_free(p, alignment);
+}
+
+COUNTED_DELETE void operator delete(void* p, size_t, std::align_val_t alignment) noexcept {
+    counted_free(p, alignment);
+}
+
+COUNTED_DELETE void operator delete[](void* p, size_t, std::align_val_t alignment) noexcept {
+    counted_free(p, alignment);
+}
+
+COUNTED_DELETE void operator delete(void* p, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    counted_free(p, alignment);
+}
+
+COUNTED_DELETE void operator delete[](void* p, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    counted_free(p, alignment);
+}
+
 TEST_CASE("Sanity check", "[sanity]") {
     for (int32_t i = 0; i <= INT8_MAX; ++i) {
         REQUIRE((i >= 0 && i <= INT8_MAX));
@@ -134,3 +313,2566 @@ TEST_CASE("int32<->float", "[intfloat]") {
         REQUIRE(sample_fi == sample);
     }
 }
+
+TEST_CASE("Watchdog detects callback overruns", "[watchdog]") {
+    const auto factory = [](IOutputAgent::CallbackType callback) {
+        return std::make_unique<SimulatedOutputAgent>(std::move(callback), 48000, 48, 2, SampleFormat::Float); // 1 ms period
+    };
+
+    int tick = 0;
+    WatchdogAgent* pwatchdog = nullptr;
+    WatchdogAgent watchdog(factory, [&](char**) {
+        pwatchdog->mark_stage("convert");
+        pwatchdog->mark_stage("dsp");
+        if (tick++ % 4 == 3) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        return true;
+    }, 1.0, true);
+    pwatchdog = &watchdog;
+
+    auto& agent = static_cast<SimulatedOutputAgent&>(watchdog.agent());
+    watchdog.start();
+    for (int i = 0; i < 8; ++i) {
+        REQUIRE(agent.tick());
+    }
+    watchdog.stop();
+
+    const auto stats = watchdog.stats();
+    REQUIRE(stats.period == std::chrono::milliseconds(1));
+    REQUIRE(stats.callbacks == 8);
+    REQUIRE(stats.overruns == 2);
+    REQUIRE(stats.worst_lateness >= std::chrono::milliseconds(4));
+    REQUIRE(stats.recent_overruns.size() == 2);
+    REQUIRE(stats.recent_overruns[0].entry < stats.recent_overruns[1].entry);
+    REQUIRE(std::string(stats.recent_overruns[1].stage) == "dsp");
+
+    watchdog.reset_stats();
+    REQUIRE(watchdog.stats().overruns == 0);
+}
+
+TEST_CASE("Null agent paces the callback", "[null_agent]") {
+    std::atomic<int> calls(0);
+    NullOutputAgent agent([&](char**) { ++calls; return true; }, 48000, 480, 2, SampleFormat::S32); // 10 ms period
+
+    agent.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    agent.stop();
+
+    REQUIRE(calls >= 10);
+    REQUIRE(calls <= 30);
+    REQUIRE(agent.thread_config_result().all());
+}
+
+TEST_CASE("Thread configuration degrades gracefully", "[thread_config]") {
+    ThreadConfig config;
+    config.policy = SchedulingPolicy::Fifo;
+    config.priority = 1000; // Clamped
+    config.cpus = { 0 };
+    config.prefault_stack_bytes = 64 * 1024;
+
+    ThreadConfigResult result;
+    std::thread([&]() { result = apply_thread_config(config); }).join();
+
+    // Whether SCHED_FIFO is granted depends on the environment, but nothing else may go wrong
+    REQUIRE(result.affinity);
+    REQUIRE(result.memory_locked);
+}
+
+namespace {
+    struct Jitter {
+        double mean_us;
+        double stddev_us;
+        double max_us;
+    };
+
+    // Deviation of the null agent's callback entry times from the ideal period
+    Jitter measure_null_agent_jitter(const ThreadConfig& config, ThreadConfigResult& applied) {
+        const int32_t rate = 48000;
+        const int32_t frames = 64;
+        const int kCallbacks = 3000;
+
+        std::vector<std::chrono::steady_clock::time_point> entries;
+        entries.reserve(kCallbacks);
+        std::atomic<bool> done(false);
+
+        NullOutputAgent agent([&](char**) {
+            if (entries.size() < kCallbacks) {
+                entries.push_back(std::chrono::steady_clock::now());
+            } else {
+                done = true;
+            }
+            return true;
+        }, rate, frames, 2, SampleFormat::Float, config);
+
+        agent.start();
+        while (!done) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        agent.stop();
+        applied = agent.thread_config_result();
+
+        const double period_us = frames * 1e6 / rate;
+        double sum = 0, sum_sq = 0, max = 0;
+        for (size_t i = 1; i < entries.size(); ++i) {
+            const double deviation = std::abs(std::chrono::duration<double, std::micro>(entries[i] - entries[i - 1]).count() - period_us);
+            sum += deviation;
+            sum_sq += deviation * deviation;
+            max = std::max(max, deviation);
+        }
+
+        const double n = double(entries.size() - 1);
+        return { sum / n, std::sqrt(sum_sq / n - (sum / n) * (sum / n)), max };
+    }
+}
+
+TEST_CASE("Null agent callback jitter", "[.][benchmark][thread_config]") {
+    ThreadConfigResult applied;
+    const Jitter normal = measure_null_agent_jitter(ThreadConfig(), applied);
+
+    ThreadConfig rt;
+    rt.policy = SchedulingPolicy::Fifo;
+    rt.priority = 80;
+    rt.cpus = { 0 };
+    rt.lock_memory = true;
+    rt.prefault_stack_bytes = 256 * 1024;
+    const Jitter realtime = measure_null_agent_jitter(rt, applied);
+
+    WARN("normal:   mean " << normal.mean_us << " us, stddev " << normal.stddev_us << " us, max " << normal.max_us << " us");
+    WARN("realtime: mean " << realtime.mean_us << " us, stddev " << realtime.stddev_us << " us, max " << realtime.max_us << " us"
+         << " (scheduling " << (applied.scheduling ? "applied" : "denied")
+         << ", affinity " << (applied.affinity ? "applied" : "denied")
+         << ", mlockall " << (applied.memory_locked ? "applied" : "denied") << ")");
+}
+
+TEST_CASE("Fractional resampler is transparent at unity ratio", "[resampler]") {
+    std::vector<float> input(1000);
+    for (size_t i = 0; i < input.size(); ++i) {
+        input[i] = float(i);
+    }
+    FrameRing ring(1, input.size());
+    const float* src = input.data();
+    ring.write(&src, input.size());
+
+    FractionalResampler resampler(1, 100);
+    std::vector<float> output(100);
+    float* dst = output.data();
+    for (int block = 0; block < 9; ++block) {
+        REQUIRE(resampler.process(ring, &dst, 100, 1.0) == 0);
+        for (size_t i = 0; i < output.size(); ++i) {
+            REQUIRE(output[i] == float(block * 100 + i));
+        }
+    }
+}
+
+TEST_CASE("Aggregate agent compensates clock drift", "[aggregate]") {
+    const double kDriftPpm = 200; // The second device runs this much faster than the first
+    const int32_t kRate = 48000;
+
+    std::vector<SimulatedOutputAgent*> devices;
+    auto make_device = [&](int32_t buffer_size, int32_t channels, SampleFormat format) {
+        return [&devices, kRate, buffer_size, channels, format](IOutputAgent::CallbackType callback) {
+            auto device = std::make_unique<SimulatedOutputAgent>(std::move(callback), kRate, buffer_size, channels, format);
+            devices.push_back(device.get());
+            return device;
+        };
+    };
+
+    // Every channel carries the stream position, so alignment can be read straight off the device buffers
+    int64_t position = 0;
+    double now = 0;
+    AggregateOutputAgent aggregate({ make_device(64, 2, SampleFormat::Float), make_device(48, 3, SampleFormat::Float) }, [&](char** buffers) {
+        for (int32_t i = 0; i < 64; ++i, ++position) {
+            for (int32_t c = 0; c < 5; ++c) {
+                reinterpret_cast<float*>(buffers[c])[i] = float(position);
+            }
+        }
+        return true;
+    }, 2, [&]() { return now; });
+
+    REQUIRE(aggregate.output_channels() == 5);
+    REQUIRE(aggregate.buffer_size() == 64);
+    REQUIRE(aggregate.pcm_format() == SampleFormat::Float);
+
+    const double master_period = 64.0 / kRate;
+    const double follower_period = 48.0 / kRate / (1 + kDriftPpm * 1e-6);
+    double master_time = 0, follower_time = 0.0003;
+    double master_value = 0, master_value_time = 0;
+
+    // Stream position the follower plays at the start of its period, minus where the master is at that moment
+    auto offset = [&]() {
+        const double follower_value = reinterpret_cast<const float*>(devices[1]->buffer(2))[0];
+        return follower_value - (master_value + (follower_time - master_value_time) * kRate);
+    };
+
+    aggregate.start();
+    double early_offset = 0;
+    while (master_time < 60) {
+        if (master_time <= follower_time) {
+            now = master_time;
+            devices[0]->tick();
+            master_value = reinterpret_cast<const float*>(devices[0]->buffer(0))[0];
+            master_value_time = master_time;
+            master_time += master_period;
+        } else {
+            now = follower_time;
+            devices[1]->tick();
+            if (early_offset == 0 && follower_time > 5) {
+                early_offset = offset();
+            }
+            follower_time += follower_period;
+        }
+    }
+    follower_time -= follower_period;
+    const double late_offset = offset();
+    aggregate.stop();
+
+    const auto stats = aggregate.child_stats(1);
+    REQUIRE(std::abs(stats.drift_ppm - kDriftPpm) < 2);
+    REQUIRE(stats.overruns == 0);
+    REQUIRE(aggregate.child_stats(0).underruns == 0);
+    REQUIRE(std::abs(late_offset - early_offset) < 0.5);
+    REQUIRE(std::abs(late_offset) < 64);
+}
+
+TEST_CASE("Priming plays pulled periods before invoking the callback again", "[preroll]") {
+    int32_t next = 0;
+    SimulatedOutputAgent agent([&](char** buffers) {
+        for (int32_t i = 0; i < 4; ++i) {
+            reinterpret_cast<int32_t*>(buffers[0])[i] = next++;
+        }
+        return next <= 12;
+    }, 48000, 4, 1, SampleFormat::S32);
+
+    auto first = [&]() { return reinterpret_cast<const int32_t*>(agent.buffer(0))[0]; };
+
+    REQUIRE(agent.prepare(2) == 2);
+    REQUIRE(next == 8);
+
+    agent.start();
+    REQUIRE(agent.tick());
+    REQUIRE(first() == 0);
+    REQUIRE(agent.tick());
+    REQUIRE(first() == 4);
+    REQUIRE(next == 8); // Callback not invoked while primed periods were played
+    REQUIRE(agent.tick());
+    REQUIRE(first() == 8);
+    REQUIRE(next == 12);
+    agent.stop();
+
+    // Priming stops at the first failed callback
+    REQUIRE(agent.prepare(3) == 0);
+}
+
+TEST_CASE("Start gate primes and starts the agent once enough is buffered", "[preroll]") {
+    int calls = 0;
+    SimulatedOutputAgent agent([&](char**) { ++calls; return true; }, 48000, 64, 2, SampleFormat::S16);
+
+    StartGate gate;
+    REQUIRE_FALSE(gate.notify(1000));
+
+    gate.arm(agent, 2, 256);
+    REQUIRE(gate.armed());
+    REQUIRE_FALSE(agent.tick()); // Not started
+
+    REQUIRE_FALSE(gate.notify(128));
+    REQUIRE_FALSE(gate.started());
+    REQUIRE(gate.notify(256));
+    REQUIRE(gate.started());
+    REQUIRE(gate.primed() == 2);
+    REQUIRE(calls == 2);
+    REQUIRE_FALSE(gate.notify(512)); // Only once
+
+    REQUIRE(agent.tick());
+    REQUIRE(calls == 2);
+    agent.stop();
+}
+
+TEST_CASE("Blocking queue resizes in place", "[queue]") {
+    BlockingQueue<int> queue(4);
+    for (int i = 0; i < 4; ++i) {
+        REQUIRE(queue.offer(i));
+    }
+    REQUIRE_FALSE(queue.offer(4));
+
+    queue.resize(2); // Nothing dropped, but full until two are taken
+    REQUIRE(queue.count() == 4);
+    REQUIRE(queue.capacity() == 2);
+    int item = -1;
+    REQUIRE(queue.poll(item));
+    REQUIRE(item == 0);
+    REQUIRE_FALSE(queue.offer(4));
+    REQUIRE(queue.poll(item));
+    REQUIRE(queue.poll(item));
+    REQUIRE(queue.offer(4));
+
+    queue.resize(8);
+    for (int i = 5; i < 11; ++i) {
+        REQUIRE(queue.offer(i));
+    }
+    REQUIRE_FALSE(queue.offer(11));
+    REQUIRE(queue.poll(item));
+    REQUIRE(item == 3);
+}
+
+TEST_CASE("Agents reconfigure without being recreated", "[reconfigure]") {
+    SECTION("Simulated agent") {
+        int32_t frames_seen = 0;
+        SimulatedOutputAgent agent([&](char** buffers) {
+            std::memset(buffers[1], 0x7f, frames_seen * sample_size(SampleFormat::S24)); // Must fit the current buffers
+            return true;
+        }, 44100, 256, 2, SampleFormat::S24);
+        frames_seen = agent.buffer_size();
+
+        StreamFormat from = {}, to = {};
+        agent.set_reconfigure_callback([&](const StreamFormat& old_format, const StreamFormat& new_format) {
+            from = old_format;
+            to = new_format;
+            frames_seen = new_format.buffer_size;
+        });
+
+        agent.start();
+        REQUIRE(agent.tick());
+        REQUIRE_FALSE(agent.reconfigure(0, 512));
+        REQUIRE(agent.reconfigure(48000, 512));
+        REQUIRE(agent.tick());
+
+        REQUIRE(from == StreamFormat { 44100, 256, 2, SampleFormat::S24 });
+        REQUIRE(to == StreamFormat { 48000, 512, 2, SampleFormat::S24 });
+        REQUIRE(agent.format() == to);
+        REQUIRE(agent.buffer(1)[511 * 3] == 0x7f);
+    }
+
+    SECTION("Null agent quiesces the callback") {
+        std::atomic<int> calls(0);
+        std::atomic<bool> in_callback(false);
+        std::atomic<bool> overlapped(false);
+        NullOutputAgent agent([&](char**) {
+            in_callback = true;
+            ++calls;
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            in_callback = false;
+            return true;
+        }, 48000, 48, 2, SampleFormat::Float);
+
+        int calls_during = -1;
+        agent.set_reconfigure_callback([&](const StreamFormat&, const StreamFormat& new_format) {
+            overlapped = overlapped || in_callback;
+            const int before = calls;
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            calls_during = calls - before;
+            REQUIRE(new_format.buffer_size == 96);
+        });
+
+        agent.start();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        REQUIRE(agent.reconfigure(48000, 96));
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        const int after = calls;
+        agent.stop();
+
+        REQUIRE_FALSE(overlapped);
+        REQUIRE(calls_during == 0);
+        REQUIRE(after > 0);
+        REQUIRE(agent.buffer_size() == 96);
+    }
+}
+
+TEST_CASE("Watchdog follows reconfiguration of the wrapped agent", "[watchdog][reconfigure]") {
+    WatchdogAgent watchdog([](IOutputAgent::CallbackType callback) {
+        return std::make_unique<SimulatedOutputAgent>(std::move(callback), 48000, 48, 2, SampleFormat::Float);
+    }, [](char**) { return true; });
+
+    bool notified = false;
+    watchdog.set_reconfigure_callback([&](const StreamFormat&, const StreamFormat&) { notified = true; });
+    REQUIRE(watchdog.stats().period == std::chrono::milliseconds(1));
+    REQUIRE(watchdog.reconfigure(48000, 480));
+    REQUIRE(notified);
+    REQUIRE(watchdog.stats().period == std::chrono::milliseconds(10));
+
+    // Statistics may be read from any thread while the period changes
+    std::atomic<bool> stop(false);
+    std::atomic<int> torn(0);
+    std::thread reader([&]() {
+        while (!stop) {
+            const auto period = watchdog.stats().period;
+            if (period != std::chrono::milliseconds(1) && period != std::chrono::milliseconds(10)) {
+                ++torn;
+            }
+        }
+    });
+    for (int i = 0; i < 1000; ++i) {
+        REQUIRE(watchdog.reconfigure(48000, i % 2 == 0 ? 48 : 480));
+    }
+    stop = true;
+    reader.join();
+    REQUIRE(torn == 0);
+}
+
+namespace {
+    // Stand-in for IMediaSample: reference counted, payload owned by the "allocator" (the test)
+    struct FakeSample {
+        std::vector<char> payload;
+        int references = 0;
+        int releases = 0;
+
+        unsigned long AddRef() {
+            return ++references;
+        }
+
+        unsigned long Release() {
+            ++releases;
+            return --references;
+        }
+
+        template <typename T>
+        static FakeSample of(const std::vector<T>& interleaved) {
+            FakeSample s;
+            s.payload.resize(interleaved.size() * sizeof(T));
+            std::memcpy(s.payload.data(), interleaved.data(), s.payload.size());
+            return s;
+        }
+    };
+}
+
+TEST_CASE("Render core hands samples to the callback without copying", "[render_core]") {
+    RenderCore<FakeSample> core(4);
+    SimulatedOutputAgent agent([&](char** buffers) { return core.render(buffers); }, 48000, 4, 3, SampleFormat::S32);
+    core.set_device_format(agent.format());
+    REQUIRE(core.set_source_format({ SampleFormat::S16, 2 }));
+
+    // 6 stereo frames, then 2
+    FakeSample first = FakeSample::of<int16_t>({ 1, -1, 2, -2, 3, -3, 4, -4, 5, -5, 6, -6 });
+    FakeSample second = FakeSample::of<int16_t>({ 7, -7, 8, -8 });
+    REQUIRE(core.push(&first, first.payload.data(), first.payload.size()));
+    REQUIRE(core.push(&second, second.payload.data(), second.payload.size()));
+    REQUIRE(first.references == 1);
+
+    auto left = [&](int i) { return reinterpret_cast<const int32_t*>(agent.buffer(0))[i]; };
+    auto right = [&](int i) { return reinterpret_cast<const int32_t*>(agent.buffer(1))[i]; };
+    auto extra = [&](int i) { return reinterpret_cast<const int32_t*>(agent.buffer(2))[i]; };
+
+    agent.start();
+    REQUIRE(agent.tick());
+    REQUIRE(left(0) == (1 << 16));
+    REQUIRE(right(3) == (-4 * 65536));
+    REQUIRE(extra(0) == 0);
+    REQUIRE(first.references == 1); // Partially consumed, still referenced
+
+    REQUIRE(agent.tick());
+    REQUIRE(left(1) == (6 << 16));
+    REQUIRE(left(3) == (8 << 16));
+    REQUIRE(first.references == 0);
+    REQUIRE(first.releases == 1);
+    REQUIRE(second.references == 0);
+
+    REQUIRE(agent.tick()); // Underrun
+    REQUIRE(left(0) == 0);
+
+    const auto stats = core.stats();
+    REQUIRE(stats.frames_rendered == 12);
+    REQUIRE(stats.underrun_frames == 4);
+    REQUIRE(stats.samples_consumed == 2);
+}
+
+TEST_CASE("Render core releases samples on flush", "[render_core]") {
+    RenderCore<FakeSample> core(4);
+    SimulatedOutputAgent agent([&](char** buffers) { return core.render(buffers); }, 48000, 2, 1, SampleFormat::U8);
+    core.set_device_format(agent.format());
+    REQUIRE(core.set_source_format({ SampleFormat::Float, 1 }));
+
+    FakeSample a = FakeSample::of<float>({ 0.5f, 0.5f, 0.5f });
+    FakeSample b = FakeSample::of<float>({ 0.5f });
+    REQUIRE(core.push(&a, a.payload.data(), a.payload.size()));
+    REQUIRE(core.push(&b, b.payload.data(), b.payload.size()));
+
+    agent.start();
+    REQUIRE(agent.tick());
+    REQUIRE(uint8_t(agent.buffer(0)[0]) == 0xc0);
+
+    core.begin_flush();
+    REQUIRE(b.references == 0);
+    REQUIRE_FALSE(core.push(&b, b.payload.data(), b.payload.size()));
+    REQUIRE(a.references == 1); // Held by the callback until it runs again
+    REQUIRE(agent.tick());
+    REQUIRE(a.references == 0);
+    REQUIRE(uint8_t(agent.buffer(0)[1]) == 0x80); // Silence
+    core.end_flush();
+    REQUIRE(core.push(&b, b.payload.data(), b.payload.size()));
+}
+
+TEST_CASE("Render core reports the end of the stream once the queue has played out", "[render_core][end_of_stream]") {
+    RenderCore<FakeSample> core(8);
+    SimulatedOutputAgent agent([&](char** buffers) { return core.render(buffers); }, 48000, 4, 1, SampleFormat::S16);
+    core.set_device_format(agent.format());
+    int drained = 0;
+    core.set_drained_callback([&]() { ++drained; });
+    REQUIRE(core.set_source_format({ SampleFormat::S16, 1 }));
+
+    // 10 frames: two full periods and a partial one
+    FakeSample a = FakeSample::of<int16_t>({ 1, 2, 3, 4, 5, 6 });
+    FakeSample b = FakeSample::of<int16_t>({ 7, 8, 9, 10 });
+    REQUIRE(core.push(&a, a.payload.data(), a.payload.size()));
+    REQUIRE(core.push(&b, b.payload.data(), b.payload.size()));
+    core.end_of_stream();
+    REQUIRE_FALSE(core.drained());
+
+    agent.start();
+    REQUIRE(agent.tick());
+    REQUIRE(agent.tick());
+    REQUIRE_FALSE(core.drained()); // Both samples consumed, but not played out yet
+    REQUIRE(agent.tick());
+    REQUIRE_FALSE(core.drained()); // The last 2 frames went out with this period
+    REQUIRE(drained == 0);
+    REQUIRE(agent.tick());
+    REQUIRE(core.drained());
+    REQUIRE(drained == 1);
+    REQUIRE(agent.tick());
+    REQUIRE(drained == 1); // Once per stream
+
+    // A flush cancels it, the next stream reports its own end
+    core.begin_flush();
+    REQUIRE_FALSE(core.drained());
+    core.end_flush();
+    REQUIRE(agent.tick());
+    REQUIRE(drained == 1); // Running dry without an end of stream is an underrun
+    REQUIRE(core.push(&a, a.payload.data(), a.payload.size()));
+    core.end_of_stream();
+    core.begin_flush();
+    core.end_flush();
+    REQUIRE(agent.tick());
+    REQUIRE(agent.tick());
+    REQUIRE_FALSE(core.drained()); // Flushed before it played out
+    REQUIRE(drained == 1);
+    REQUIRE(core.push(&b, b.payload.data(), b.payload.size()));
+    core.end_of_stream();
+    REQUIRE(agent.tick());
+    REQUIRE(agent.tick());
+    REQUIRE(drained == 2);
+}
+
+TEST_CASE("A push waiting for room opens the start gate", "[render_core][preroll]") {
+    RenderCore<FakeSample> core(2);
+    SimulatedOutputAgent agent([&](char** buffers) { return core.render(buffers); }, 48000, 4, 1, SampleFormat::S16);
+    core.set_device_format(agent.format());
+    REQUIRE(core.set_source_format({ SampleFormat::S16, 1 }));
+
+    StartGate gate;
+    gate.arm(agent, 2, 1000); // More than the queue holds
+    core.set_wait_callback([&]() { gate.notify(std::numeric_limits<size_t>::max()); });
+
+    // Outlives everything queued, and nothing references a null sample
+    const std::vector<int16_t> payload = { 1, 2, 3, 4, 5, 6 };
+    auto push = [&]() { return core.push(nullptr, reinterpret_cast<const char*>(payload.data()), payload.size() * sizeof(int16_t)); };
+    REQUIRE(push());
+    REQUIRE(push());
+    REQUIRE_FALSE(gate.started());
+
+    // The third push finds the queue full: the agent is primed with 8 of the 12 queued frames, which makes room
+    REQUIRE(push());
+    REQUIRE(gate.started());
+    REQUIRE(gate.primed() == 2);
+    REQUIRE_FALSE(core.push_waiting());
+
+    auto first = [&]() { return reinterpret_cast<const int16_t*>(agent.buffer(0))[0]; };
+    REQUIRE(agent.tick());
+    REQUIRE(first() == 1);
+    REQUIRE(agent.tick());
+    REQUIRE(first() == 5);
+    REQUIRE(agent.tick());
+    REQUIRE(first() == 3);
+    REQUIRE(core.queued_frames() == 6);
+}
+
+TEST_CASE("Render core keeps queued audio across a buffer size change", "[render_core][reconfigure]") {
+    RenderCore<FakeSample> core(4);
+    SimulatedOutputAgent agent([&](char** buffers) { return core.render(buffers); }, 48000, 2, 1, SampleFormat::S16);
+    core.set_device_format(agent.format());
+    agent.set_reconfigure_callback([&](const StreamFormat& from, const StreamFormat& to) { core.on_reconfigure(from, to); });
+    REQUIRE(core.set_source_format({ SampleFormat::S16, 1 }));
+
+    FakeSample a = FakeSample::of<int16_t>({ 1, 2, 3, 4, 5, 6 });
+    REQUIRE(core.push(&a, a.payload.data(), a.payload.size()));
+    agent.start();
+    REQUIRE(agent.tick());
+
+    REQUIRE(agent.reconfigure(48000, 4));
+    REQUIRE(agent.tick());
+    REQUIRE(reinterpret_cast<const int16_t*>(agent.buffer(0))[3] == 6);
+
+    FakeSample b = FakeSample::of<int16_t>({ 7, 8 });
+    REQUIRE(core.push(&b, b.payload.data(), b.payload.size()));
+    REQUIRE(agent.reconfigure(44100, 4)); // Rate change drops queued audio
+    REQUIRE(b.references == 0);
+}
+
+TEST_CASE("Render core reconfigures while the streaming thread pushes", "[render_core][reconfigure]") {
+    RenderCore<FakeSample> core(4);
+    SimulatedOutputAgent agent([&](char** buffers) { return core.render(buffers); }, 48000, 64, 2, SampleFormat::S16);
+    core.set_device_format(agent.format());
+    agent.set_reconfigure_callback([&](const StreamFormat& from, const StreamFormat& to) { core.on_reconfigure(from, to); });
+    REQUIRE(core.set_source_format({ SampleFormat::S16, 2, 0, 0, 48000 }));
+
+    // Outlives everything queued, and nothing references a null sample
+    const std::vector<int16_t> payload(2 * 256, 1000);
+    std::atomic<bool> stop(false);
+    std::atomic<int> pushes(0);
+    std::atomic<int> failures(0);
+    std::thread producer([&]() {
+        while (!stop) {
+            if (!core.push(nullptr, reinterpret_cast<const char*>(payload.data()), payload.size() * sizeof(int16_t))) {
+                ++failures;
+            }
+            if (++pushes % 16 == 0) { // The converter is rebuilt in between
+                core.set_resampler_quality(pushes % 32 == 0 ? ResamplerQuality::Fast : ResamplerQuality::Balanced);
+            }
+        }
+    });
+
+    // Buffer size changes keep the queue, rate changes drop it and switch rate conversion on and off
+    agent.start();
+    const int32_t rates[] = { 48000, 44100, 48000, 96000 };
+    const int32_t sizes[] = { 64, 128, 32 };
+    for (int i = 0; i < 200; ++i) {
+        REQUIRE(agent.reconfigure(rates[(i / 3) % 4], sizes[i % 3]));
+        for (int t = 0; t < 8; ++t) {
+            REQUIRE(agent.tick());
+        }
+    }
+
+    const int failed = failures;
+    stop = true;
+    core.begin_flush(); // Releases the push waiting for room
+    producer.join();
+    REQUIRE(failed == 0);
+    REQUIRE(pushes > 0);
+    REQUIRE(core.stats().samples_consumed > 0);
+}
+
+TEST_CASE("Render plans are built once per format and route channels by speaker position", "[render_plan]") {
+    PlanCache cache;
+    const StreamFormat device = { 48000, 4, 8, SampleFormat::Float };
+
+    // 5.1 with side surrounds on a 7.1 device: surrounds land on the side channels, the back pair stays silent
+    const uint32_t side51 = kSpeakerFrontLeft | kSpeakerFrontRight | kSpeakerFrontCenter | kSpeakerLowFrequency
+                          | kSpeakerSideLeft | kSpeakerSideRight;
+    const SourceFormat source = { SampleFormat::S16, 6, side51, 0, 48000 };
+
+    auto plan = cache.get(PlanKey(source, device));
+    REQUIRE(plan);
+    REQUIRE(plan == cache.get(PlanKey(source, device)));
+    REQUIRE(cache.size() == 1);
+    REQUIRE(plan->routing() == std::vector<int32_t>({ 0, 1, 2, 3, -1, -1, 4, 5 }));
+
+    const std::vector<int16_t> frames = { 1, 2, 3, 4, 5, 6, -1, -2, -3, -4, -5, -6 };
+    std::vector<std::vector<float>> out(8, std::vector<float>(4, 1.0f));
+    std::vector<char*> buffers;
+    for (auto& channel : out) {
+        buffers.push_back(reinterpret_cast<char*>(channel.data()));
+    }
+    plan->render(reinterpret_cast<const char*>(frames.data()), 2, buffers.data(), 1);
+
+    REQUIRE(out[0][0] == 1.0f); // Untouched before the offset
+    REQUIRE(out[0][1] == convert_sample<SampleFormat::S16, SampleFormat::Float>(1));
+    REQUIRE(out[7][2] == convert_sample<SampleFormat::S16, SampleFormat::Float>(-6));
+    REQUIRE(out[4][1] == 0.0f);
+    REQUIRE(out[5][2] == 0.0f);
+
+    // Without speaker positions channels are routed by index
+    const SourceFormat unpositioned = { SampleFormat::S16, 6, 0, 0, 48000 };
+    REQUIRE(cache.get(PlanKey(unpositioned, device))->routing() == std::vector<int32_t>({ 0, 1, 2, 3, 4, 5, -1, -1 }));
+    REQUIRE(cache.size() == 2);
+
+    REQUIRE_FALSE(cache.get(PlanKey({ SampleFormat::Unknown, 2, 0, 0, 48000 }, device)));
+}
+
+TEST_CASE("Render plans fuse gain into the conversion", "[render_plan]") {
+    const StreamFormat device = { 48000, 4, 2, SampleFormat::S16 };
+    auto plan = RenderPlan::build(PlanKey({ SampleFormat::S16, 2, 0, 0, 48000 }, device), { 0.5f, 2.0f });
+    REQUIRE(plan);
+    REQUIRE_FALSE(plan->unity_gain());
+
+    const std::vector<int16_t> frames = { 1000, 1000, -1000, -1000 };
+    int16_t left[2], right[2];
+    char* buffers[] = { reinterpret_cast<char*>(left), reinterpret_cast<char*>(right) };
+    plan->render(reinterpret_cast<const char*>(frames.data()), 2, buffers, 0);
+
+    REQUIRE(left[0] == 500);
+    REQUIRE(right[1] == -2000);
+}
+
+TEST_CASE("Matching formats are passed through bit-perfect", "[render_plan][bit_perfect]") {
+    const StreamFormat device = { 48000, 2, 2, SampleFormat::S24 };
+    auto plan = RenderPlan::build(PlanKey({ SampleFormat::S24, 2, kSpeakerFrontLeft | kSpeakerFrontRight, 0, 48000 }, device));
+    REQUIRE(plan->bit_perfect());
+
+    const std::vector<uint8_t> frames = { 0x01, 0x02, 0x83, 0x04, 0x05, 0x86, 0xff, 0xfe, 0xfd, 0x00, 0x00, 0x80 };
+    uint8_t left[6], right[6];
+    char* buffers[] = { reinterpret_cast<char*>(left), reinterpret_cast<char*>(right) };
+    plan->render(reinterpret_cast<const char*>(frames.data()), 2, buffers, 0);
+    REQUIRE(std::memcmp(left, &frames[0], 3) == 0);
+    REQUIRE(std::memcmp(left + 3, &frames[6], 3) == 0);
+    REQUIRE(std::memcmp(right + 3, &frames[9], 3) == 0);
+
+    // Any stage doing work disables it
+    REQUIRE_FALSE(RenderPlan::build(PlanKey({ SampleFormat::S24, 2, 0, 0, 44100 }, device))->bit_perfect());
+    REQUIRE_FALSE(RenderPlan::build(PlanKey({ SampleFormat::S16, 2, 0, 0, 48000 }, device))->bit_perfect());
+    REQUIRE_FALSE(RenderPlan::build(PlanKey({ SampleFormat::S24, 1, 0, 0, 48000 }, device))->bit_perfect());
+    REQUIRE_FALSE(RenderPlan::build(PlanKey({ SampleFormat::S24, 2, 0, 0, 48000 }, device), { 1.0f, 0.5f })->bit_perfect());
+}
+
+TEST_CASE("Render core reports bit-perfect playback", "[render_core][bit_perfect]") {
+    RenderCore<FakeSample> core(4);
+    SimulatedOutputAgent agent([&](char** buffers) { return core.render(buffers); }, 48000, 4, 1, SampleFormat::Float);
+    core.set_device_format(agent.format());
+
+    REQUIRE(core.set_source_format({ SampleFormat::Float, 1, 0, 0, 48000 }));
+    REQUIRE(core.bit_perfect());
+    FakeSample a = FakeSample::of<float>({ 0.1f, -0.2f, 0.3f, -0.4f });
+    REQUIRE(core.push(&a, a.payload.data(), a.payload.size()));
+
+    REQUIRE(core.set_source_format({ SampleFormat::S16, 1, 0, 0, 48000 }));
+    REQUIRE_FALSE(core.bit_perfect());
+    FakeSample b = FakeSample::of<int16_t>({ 1, 2, 3, 4 });
+    REQUIRE(core.push(&b, b.payload.data(), b.payload.size()));
+
+    agent.start();
+    REQUIRE(agent.tick());
+    REQUIRE(std::memcmp(agent.buffer(0), a.payload.data(), a.payload.size()) == 0);
+    REQUIRE(agent.tick());
+    REQUIRE(core.stats().bit_perfect_frames == 4);
+}
+
+TEST_CASE("Remix matrices fold missing speakers into their neighbours", "[remix]") {
+    const uint32_t stereo = default_channel_mask(2);
+    const uint32_t back51 = default_channel_mask(6);
+
+    // 5.1 -> 2.0: L = FL + C/sqrt(2) + BL/sqrt(2), normalized; LFE dropped
+    const std::vector<float> down = remix_matrix(back51, 6, stereo, 2);
+    const float norm = 1.0f + 2.0f * 0.70710678f;
+    REQUIRE(down[0] == Approx(1.0f / norm));
+    REQUIRE(down[2] == Approx(0.70710678f / norm));
+    REQUIRE(down[3] == 0.0f);
+    REQUIRE(down[4] == Approx(0.70710678f / norm));
+    REQUIRE(down[5] == 0.0f);
+    REQUIRE(down[6 + 1] == Approx(1.0f / norm));
+
+    // Mono -> stereo is sparse: the center is copied to both sides at -3 dB
+    const StreamFormat device = { 48000, 4, 2, SampleFormat::Float };
+    auto upmix = RenderPlan::build(PlanKey({ SampleFormat::Float, 1, kSpeakerFrontCenter, 0, 48000 }, device));
+    REQUIRE(upmix->sparse());
+    REQUIRE(upmix->routing() == std::vector<int32_t>({ 0, 0 }));
+    REQUIRE(upmix->gains()[1] == Approx(0.70710678f));
+
+    // Sources without a mask take the usual layout for their channel count, rather than being matched by index
+    auto maskless_mono = RenderPlan::build(PlanKey({ SampleFormat::Float, 1, 0, 0, 48000 }, device));
+    REQUIRE(maskless_mono->routing() == std::vector<int32_t>({ 0, 0 }));
+    REQUIRE(maskless_mono->gains()[0] == Approx(0.70710678f));
+    REQUIRE(maskless_mono->gains()[1] == Approx(0.70710678f));
+
+    auto maskless_51 = RenderPlan::build(PlanKey({ SampleFormat::S16, 6, 0, 0, 48000 }, device));
+    REQUIRE(maskless_51->matrix() == down);
+
+    // The dense path matches a plain matrix multiplication
+    auto downmix = RenderPlan::build(PlanKey({ SampleFormat::S16, 6, back51, 0, 48000 }, device));
+    REQUIRE_FALSE(downmix->sparse());
+
+    const size_t n = 37; // Not a multiple of the vector width
+    std::vector<int16_t> frames(n * 6);
+    for (size_t i = 0; i < frames.size(); ++i) {
+        frames[i] = int16_t((i * 7919) % 65536 - 32768);
+    }
+    std::vector<float> left(n), right(n);
+    char* buffers[] = { reinterpret_cast<char*>(left.data()), reinterpret_cast<char*>(right.data()) };
+    downmix->render(reinterpret_cast<const char*>(frames.data()), n, buffers, 0);
+
+    for (size_t f = 0; f < n; ++f) {
+        for (size_t o = 0; o < 2; ++o) {
+            float expected = 0.0f;
+            for (size_t i = 0; i < 6; ++i) {
+                expected += down[o * 6 + i] * convert_sample<SampleFormat::S16, SampleFormat::Float>(frames[f * 6 + i]);
+            }
+            REQUIRE((o == 0 ? left : right)[f] == Approx(expected).margin(1e-6));
+        }
+    }
+}
+
+namespace {
+    // Nanoseconds per frame of rendering `frames` through `plan`, best of a few runs
+    double measure_plan(const RenderPlan& plan, size_t frames, int runs) {
+        const size_t in_channels = size_t(plan.key().source.channels);
+        const size_t out_channels = size_t(plan.key().device_channels);
+        std::vector<char> input(frames * plan.key().source.frame_bytes());
+        for (size_t i = 0; i < input.size() / sizeof(float); ++i) {
+            reinterpret_cast<float*>(input.data())[i] = float(i % in_channels) * 0.01f;
+        }
+        std::vector<std::vector<char>> output(out_channels, std::vector<char>(frames * sample_size(plan.key().device_format)));
+        std::vector<char*> buffers;
+        for (auto& channel : output) {
+            buffers.push_back(channel.data());
+        }
+
+        double best = 1e300;
+        for (int r = 0; r < runs; ++r) {
+            const auto start = std::chrono::steady_clock::now();
+            for (size_t f = 0; f < frames; f += 512) {
+                plan.render(input.data() + f * plan.key().source.frame_bytes(), 512, buffers.data(), f);
+            }
+            const auto elapsed = std::chrono::steady_clock::now() - start;
+            best = std::min(best, std::chrono::duration<double, std::nano>(elapsed).count() / frames);
+        }
+        return best;
+    }
+}
+
+TEST_CASE("Remix throughput", "[.][benchmark][remix]") {
+    const size_t frames = 512 * 512;
+
+    const StreamFormat stereo = { 48000, 512, 2, SampleFormat::Float };
+    auto downmix = RenderPlan::build(PlanKey({ SampleFormat::Float, 8, default_channel_mask(8), 0, 48000 }, stereo));
+    WARN("7.1 -> 2.0:  " << measure_plan(*downmix, frames, 5) << " ns/frame (simd " << simd::kVectorized << ")");
+
+    // Fan-out: every output channel is its own pan of the stereo input
+    const StreamFormat wide = { 48000, 512, 32, SampleFormat::Float };
+    std::vector<float> pan(32 * 2);
+    for (size_t o = 0; o < 32; ++o) {
+        pan[o * 2] = float(o) / 31.0f;
+        pan[o * 2 + 1] = 1.0f - float(o) / 31.0f;
+    }
+    auto fanout = RenderPlan::build(PlanKey({ SampleFormat::Float, 2, 0, 0, 48000 }, wide), {}, pan);
+    WARN("2.0 -> 32:   " << measure_plan(*fanout, frames, 5) << " ns/frame");
+}
+
+TEST_CASE("Gain changes ramp smoothly across periods", "[gain]") {
+    RenderCore<FakeSample> core(8);
+    SimulatedOutputAgent agent([&](char** buffers) { return core.render(buffers); }, 48000, 100, 2, SampleFormat::Float);
+    core.set_device_format(agent.format());
+    REQUIRE(core.set_source_format({ SampleFormat::Float, 2, 0, 0, 48000 }));
+    REQUIRE(core.bit_perfect());
+
+    std::vector<FakeSample> samples;
+    for (int i = 0; i < 8; ++i) {
+        samples.push_back(FakeSample::of<float>(std::vector<float>(2 * 100, 1.0f)));
+    }
+    for (auto& sample : samples) {
+        REQUIRE(core.push(&sample, sample.payload.data(), sample.payload.size()));
+    }
+
+    agent.start();
+    REQUIRE(agent.tick());
+    REQUIRE(reinterpret_cast<const float*>(agent.buffer(0))[99] == 1.0f);
+
+    SECTION("linear") {
+        REQUIRE(core.gain().set_gains({ 0.0f, 0.5f }));
+        REQUIRE_FALSE(core.bit_perfect());
+
+        std::vector<float> left, right;
+        for (int period = 0; period < 6; ++period) {
+            REQUIRE(agent.tick());
+            const float* l = reinterpret_cast<const float*>(agent.buffer(0));
+            const float* r = reinterpret_cast<const float*>(agent.buffer(1));
+            left.insert(left.end(), l, l + 100);
+            right.insert(right.end(), r, r + 100);
+        }
+
+        // 480-frame ramp: constant slope, continuous across periods, then held
+        for (size_t i = 0; i < 480; ++i) {
+            REQUIRE(left[i] == Approx(1.0f - float(i) / 480.0f).margin(1e-5));
+        }
+        REQUIRE(left[480] == 0.0f);
+        REQUIRE(left[599] == 0.0f);
+        REQUIRE(right[240] == Approx(0.75f).margin(1e-5));
+        REQUIRE(right[599] == 0.5f);
+    }
+
+    SECTION("exponential") {
+        core.gain().set_ramp(480, GainCurve::Exponential);
+        REQUIRE(core.gain().set_gains({ 0.01f, 1.0f }));
+
+        std::vector<float> left;
+        for (int period = 0; period < 6; ++period) {
+            REQUIRE(agent.tick());
+            const float* l = reinterpret_cast<const float*>(agent.buffer(0));
+            left.insert(left.end(), l, l + 100);
+        }
+
+        // -40 dB in 480 frames: a constant number of dB per frame
+        REQUIRE(left[240] == Approx(0.1f).epsilon(1e-3));
+        REQUIRE(left[120] == Approx(std::pow(10.0f, -0.5f)).epsilon(1e-3));
+        REQUIRE(left[599] == 0.01f);
+        REQUIRE(reinterpret_cast<const float*>(agent.buffer(1))[99] == 1.0f);
+    }
+}
+
+TEST_CASE("Volume and balance map to channel gains", "[gain]") {
+    const std::vector<float> stereo = volume_balance_gains(-600, 0, 2);
+    REQUIRE(stereo[0] == Approx(0.501187f));
+    REQUIRE(stereo[1] == stereo[0]);
+
+    const std::vector<float> right = volume_balance_gains(0, 2000, 6);
+    REQUIRE(right[0] == Approx(0.1f)); // Front left
+    REQUIRE(right[1] == 1.0f);         // Front right
+    REQUIRE(right[2] == 1.0f);         // Center
+    REQUIRE(right[4] == Approx(0.1f)); // Back left
+
+    REQUIRE(volume_balance_gains(-10000, 0, 2)[1] == 0.0f);
+    REQUIRE(volume_balance_gains(0, -10000, 2) == std::vector<float>({ 1.0f, 0.0f }));
+    REQUIRE(volume_balance_gains(0, 0, 8) == std::vector<float>(8, 1.0f));
+}
+
+TEST_CASE("Silent buffers take the fast path", "[render_core][silence]") {
+    RenderCore<FakeSample> core(4);
+    SimulatedOutputAgent agent([&](char** buffers) { return core.render(buffers); }, 48000, 4, 2, SampleFormat::U8);
+    core.set_device_format(agent.format());
+    REQUIRE(core.set_source_format({ SampleFormat::S16, 2, 0, 0, 48000 }));
+
+    FakeSample silent = FakeSample::of<int16_t>(std::vector<int16_t>(8, 0));
+    FakeSample audible = FakeSample::of<int16_t>({ 0, 0, 0, 0, 0, 0, 0, 256 });
+    FakeSample tagged = FakeSample::of<int16_t>(std::vector<int16_t>(8, 256)); // Producer says silent, is trusted
+    REQUIRE(core.push(&silent, silent.payload.data(), silent.payload.size()));
+    REQUIRE(core.push(&audible, audible.payload.data(), audible.payload.size()));
+    REQUIRE(core.push(&tagged, tagged.payload.data(), tagged.payload.size(), RenderCore<FakeSample>::Silence::Silent));
+
+    agent.start();
+    REQUIRE(agent.tick());
+    REQUIRE(uint8_t(agent.buffer(1)[3]) == 0x80);
+    REQUIRE(agent.tick());
+    REQUIRE(uint8_t(agent.buffer(1)[3]) == 0x81);
+    REQUIRE(agent.tick());
+    REQUIRE(uint8_t(agent.buffer(0)[0]) == 0x80);
+
+    auto stats = core.stats();
+    REQUIRE(stats.silent_frames == 8);
+    REQUIRE(stats.frames_rendered == 12);
+
+    core.reset_stats();
+    REQUIRE(core.stats().silent_frames == 0);
+}
+
+TEST_CASE("Silence scan finds the first audible byte anywhere", "[silence]") {
+    std::vector<unsigned char> buffer(67, 0);
+    REQUIRE(simd::all_bytes_equal(buffer.data(), buffer.size(), 0));
+    for (size_t i = 0; i < buffer.size(); ++i) {
+        buffer[i] = 1;
+        REQUIRE_FALSE(simd::all_bytes_equal(buffer.data(), buffer.size(), 0));
+        buffer[i] = 0;
+    }
+    REQUIRE(simd::all_bytes_equal(std::vector<unsigned char>(33, 0x80).data(), 33, 0x80));
+}
+
+TEST_CASE("Early and late conversion render the same audio", "[render_core][conversion]") {
+    const auto play = [](ConversionPolicy policy, std::vector<FakeSample>& samples) {
+        RenderCore<FakeSample> core(8);
+        SimulatedOutputAgent agent([&](char** buffers) { return core.render(buffers); }, 48000, 5, 2, SampleFormat::Float);
+        core.set_device_format(agent.format());
+        core.set_conversion_policy(policy);
+        core.gain().set_ramp(8, GainCurve::Linear);
+        REQUIRE(core.set_source_format({ SampleFormat::S16, 2, 0, 0, 48000 }));
+        for (auto& sample : samples) {
+            REQUIRE(core.push(&sample, sample.payload.data(), sample.payload.size()));
+        }
+        REQUIRE(core.queued_bytes_per_frame() == (policy == ConversionPolicy::Late ? 4 : 8));
+
+        std::vector<float> out;
+        agent.start();
+        for (int period = 0; period < 4; ++period) {
+            if (period == 1) {
+                REQUIRE(core.gain().set_gains({ 0.5f, 0.25f }));
+            }
+            REQUIRE(agent.tick());
+            for (int c = 0; c < 2; ++c) {
+                const float* p = reinterpret_cast<const float*>(agent.buffer(c));
+                out.insert(out.end(), p, p + 5);
+            }
+        }
+        return out;
+    };
+
+    const auto make = [] {
+        std::vector<FakeSample> samples;
+        samples.push_back(FakeSample::of<int16_t>({ 1000, -1000, 2000, -2000, 3000, -3000, 4000, -4000, 5000, -5000, 6000, -6000, 7000, -7000 }));
+        samples.push_back(FakeSample::of<int16_t>(std::vector<int16_t>(6, 0)));
+        samples.push_back(FakeSample::of<int16_t>(std::vector<int16_t>(20, 12345)));
+        return samples;
+    };
+
+    std::vector<FakeSample> late_samples = make();
+    std::vector<FakeSample> early_samples = make();
+    const std::vector<float> late = play(ConversionPolicy::Late, late_samples);
+    const std::vector<float> early = play(ConversionPolicy::Early, early_samples);
+    REQUIRE(late == early);
+    REQUIRE(late[5 * 2 * 2 + 4] != 0.0f); // The ramp is under way in the third period
+
+    // Early conversion gives the upstream buffer back on push
+    REQUIRE(early_samples[0].releases == 0);
+    REQUIRE(early_samples[0].references == 0);
+    REQUIRE(late_samples[0].releases == 1);
+}
+
+TEST_CASE("Conversion policy cost", "[.][benchmark][conversion]") {
+    const size_t period = 512;
+    const int periods = 2048;
+
+    for (ConversionPolicy policy : { ConversionPolicy::Late, ConversionPolicy::Early }) {
+        RenderCore<FakeSample> core(periods);
+        SimulatedOutputAgent agent([&](char** buffers) { return core.render(buffers); }, 48000, int32_t(period), 2, SampleFormat::Float);
+        core.set_device_format(agent.format());
+        core.set_conversion_policy(policy);
+        REQUIRE(core.set_source_format({ SampleFormat::S16, 2, 0, 0, 48000 }));
+
+        std::vector<int16_t> pcm(period * 2);
+        for (size_t i = 0; i < pcm.size(); ++i) {
+            pcm[i] = int16_t(i * 37);
+        }
+        std::vector<FakeSample> samples(periods, FakeSample::of<int16_t>(pcm));
+
+        const auto pushed = std::chrono::steady_clock::now();
+        for (auto& sample : samples) {
+            REQUIRE(core.push(&sample, sample.payload.data(), sample.payload.size()));
+        }
+        const auto started = std::chrono::steady_clock::now();
+        agent.start();
+        for (int i = 0; i < periods; ++i) {
+            agent.tick();
+        }
+        const auto finished = std::chrono::steady_clock::now();
+
+        const double frames = double(period) * periods;
+        const double push_ns = std::chrono::duration<double, std::nano>(started - pushed).count() / frames;
+        const double callback_ns = std::chrono::duration<double, std::nano>(finished - started).count() / frames;
+        WARN((policy == ConversionPolicy::Late ? "late:  " : "early: ") << push_ns << " ns/frame on push, "
+             << callback_ns << " ns/frame in the callback, " << core.queued_bytes_per_frame() << " bytes per queued frame");
+    }
+}
+
+TEST_CASE("Worker pool runs every task exactly once", "[worker_pool]") {
+    WorkerPool pool(3);
+    REQUIRE(pool.workers() == 3);
+
+    std::vector<std::atomic<int>> runs(37);
+    for (auto& r : runs) {
+        r = 0;
+    }
+    for (int job = 0; job < 1000; ++job) {
+        const size_t tasks = 1 + job % runs.size();
+        auto task = [&](size_t t) { runs[t].fetch_add(1, std::memory_order_relaxed); };
+        pool.run(tasks, task);
+    }
+
+    int total = 0;
+    for (auto& r : runs) {
+        total += r;
+    }
+    int expected = 0;
+    for (int job = 0; job < 1000; ++job) {
+        expected += int(1 + job % runs.size());
+    }
+    REQUIRE(total == expected);
+
+    // Idle workers go to sleep and must still be woken for the next job
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::atomic<int> late(0);
+    auto count = [&](size_t) { late.fetch_add(1); };
+    pool.run(8, count);
+    REQUIRE(late == 8);
+
+    // More tasks than one claim can count go out in batches, each still run exactly once
+    std::vector<std::atomic<int>> many(2 * WorkerPool::kMaxTasks + 5);
+    for (auto& r : many) {
+        r = 0;
+    }
+    auto mark = [&](size_t t) { many[t].fetch_add(1, std::memory_order_relaxed); };
+    pool.run(many.size(), mark);
+    REQUIRE(std::all_of(many.begin(), many.end(), [](const std::atomic<int>& r) { return r == 1; }));
+}
+
+namespace {
+    // A 64-channel S24 source to a 64-channel S32 device, every channel on its own gain ramp
+    std::vector<float> render_wide(std::shared_ptr<WorkerPool> pool, int periods, double* ns_per_frame = nullptr) {
+        const int32_t channels = 64;
+        const int32_t period = 512;
+
+        RenderCore<FakeSample> core(size_t(periods) + 1);
+        SimulatedOutputAgent agent([&](char** buffers) { return core.render(buffers); }, 192000, period, channels, SampleFormat::S32);
+        core.set_device_format(agent.format());
+        core.set_worker_pool(pool);
+        REQUIRE(core.set_source_format({ SampleFormat::S24, channels, 0, 0, 192000 }));
+
+        std::vector<FakeSample> samples;
+        for (int p = 0; p < periods; ++p) {
+            std::vector<char> pcm(size_t(period) * channels * 3);
+            for (size_t i = 0; i < pcm.size(); ++i) {
+                pcm[i] = char(i * 7 + p);
+            }
+            FakeSample s;
+            s.payload = pcm;
+            samples.push_back(s);
+        }
+        for (auto& sample : samples) {
+            REQUIRE(core.push(&sample, sample.payload.data(), sample.payload.size()));
+        }
+
+        std::vector<float> gains(channels);
+        for (int32_t c = 0; c < channels; ++c) {
+            gains[c] = float(c) / channels;
+        }
+        REQUIRE(core.gain().set_gains(gains));
+
+        std::vector<float> out;
+        agent.start();
+        const auto start = std::chrono::steady_clock::now();
+        for (int p = 0; p < periods; ++p) {
+            REQUIRE(agent.tick());
+            if (!ns_per_frame) {
+                for (int32_t c = 0; c < channels; ++c) {
+                    const int32_t* d = reinterpret_cast<const int32_t*>(agent.buffer(c));
+                    out.insert(out.end(), d, d + period);
+                }
+            }
+        }
+        if (ns_per_frame) {
+            *ns_per_frame = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (double(period) * periods);
+        }
+        return out;
+    }
+}
+
+TEST_CASE("Parallel rendering matches serial rendering", "[render_core][worker_pool]") {
+    const std::vector<float> serial = render_wide(nullptr, 4);
+    const std::vector<float> parallel = render_wide(std::make_shared<WorkerPool>(3), 4);
+    REQUIRE(serial == parallel);
+
+    // Too few channels: the pool is left alone
+    RenderCore<FakeSample> core(2);
+    SimulatedOutputAgent agent([&](char** buffers) { return core.render(buffers); }, 48000, 4, 2, SampleFormat::Float);
+    core.set_device_format(agent.format());
+    core.set_worker_pool(std::make_shared<WorkerPool>(2));
+    REQUIRE(core.set_source_format({ SampleFormat::Float, 2 }));
+    FakeSample sample = FakeSample::of<float>({ 0.25f, -0.25f, 0.5f, -0.5f, 0.75f, -0.75f, 1.0f, -1.0f });
+    REQUIRE(core.push(&sample, sample.payload.data(), sample.payload.size()));
+    agent.start();
+    REQUIRE(agent.tick());
+    REQUIRE(reinterpret_cast<const float*>(agent.buffer(1))[3] == -1.0f);
+}
+
+TEST_CASE("Parallel rendering throughput", "[.][benchmark][worker_pool]") {
+    const size_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+    double serial = 0.0;
+    render_wide(nullptr, 256, &serial);
+    WARN("64 x S24 -> 64 x S32 @ 192 kHz on " << cores << " cores, serial: " << serial << " ns/frame");
+    for (size_t workers = 1; workers <= 4; workers *= 2) {
+        double parallel = 0.0;
+        render_wide(std::make_shared<WorkerPool>(workers), 256, &parallel);
+        WARN(workers << " workers: " << parallel << " ns/frame");
+    }
+}
+
+TEST_CASE("Queue depth follows the observed jitter", "[queue_depth]") {
+    // 10 ms periods and deliveries at 48 kHz
+    QueueDepthController depth(480, 48000);
+    double t = 100.0;
+    const auto run = [&](double seconds, double callback_jitter, size_t underrun_every = 0) {
+        for (size_t i = 1; t < 100.0 + seconds; ++i) {
+            t += 0.01;
+            depth.on_delivery(t, 480);
+            depth.update(t);
+            depth.on_callback(t + (i % 2 ? callback_jitter : -callback_jitter), underrun_every && i % underrun_every == 0 ? 480 : 0);
+        }
+    };
+
+    run(1.0, 0.0);
+    REQUIRE(depth.target_frames() == 960.0); // Two periods, the minimum
+
+    run(2.0, 0.004);
+    REQUIRE(depth.callback_jitter() == Approx(0.008).margin(1e-4));
+    REQUIRE(depth.target_frames() == Approx(480.0 + 2 * 0.008 * 48000).epsilon(0.01));
+
+    // An underrun grows the target at once
+    const double before = depth.target_frames();
+    depth.on_callback(t += 0.01, 480);
+    depth.update(t);
+    REQUIRE(depth.target_frames() == Approx(before * 1.5));
+
+    // A stalled decoder: one delivery 100 ms late, while the callbacks carry on
+    for (int i = 0; i < 10; ++i) {
+        depth.on_callback(t += 0.01, 0);
+    }
+    depth.on_delivery(t += 0.01, 480);
+    depth.update(t);
+    REQUIRE(depth.delivery_jitter() == Approx(0.1).margin(0.011));
+    REQUIRE(depth.target_frames() >= 480.0 + 2 * 0.1 * 48000);
+
+    // Held for a while, then slowly given back
+    const auto tick = [&](double seconds) {
+        for (const double end = t + seconds; t < end;) {
+            t += 0.01;
+            depth.on_delivery(t, 480);
+            depth.update(t);
+            depth.on_callback(t, 0);
+        }
+    };
+    tick(0.5);
+    const double stalled = depth.target_frames();
+    tick(3.5);
+    REQUIRE(depth.target_frames() == stalled);
+    tick(10.0);
+    REQUIRE(depth.target_frames() < stalled);
+    REQUIRE(depth.target_frames() > stalled * 0.7);
+    tick(300.0);
+    REQUIRE(depth.target_frames() == 960.0);
+    REQUIRE(depth.target_seconds() == Approx(0.02));
+}
+
+TEST_CASE("Render core sizes its queue for the target depth", "[render_core][queue_depth]") {
+    RenderCore<FakeSample> core(64);
+    SimulatedOutputAgent agent([&](char** buffers) { return core.render(buffers); }, 48000, 480, 2, SampleFormat::Float);
+    core.set_device_format(agent.format());
+    REQUIRE(core.queue_capacity() == 64);
+    REQUIRE(core.target_latency() == 0.0);
+
+    core.enable_adaptive_depth();
+    REQUIRE(core.set_source_format({ SampleFormat::Float, 2, 0, 0, 48000 }));
+    FakeSample sample = FakeSample::of<float>(std::vector<float>(2 * 240, 0.5f));
+    REQUIRE(core.push(&sample, sample.payload.data(), sample.payload.size()));
+
+    // Two periods of 480 frames in samples of 240
+    REQUIRE(core.target_latency() == Approx(0.02));
+    REQUIRE(core.queue_capacity() == 4);
+    REQUIRE(core.latency() == Approx(0.005));
+
+    agent.start();
+    REQUIRE(agent.tick());
+    REQUIRE(core.latency() == 0.0);
+    core.end_of_stream();
+    REQUIRE(agent.tick()); // Drained after the end of the stream, not an underrun for the controller
+    REQUIRE(core.stats().underrun_frames == 720);
+}
+
+TEST_CASE("Queue depth ignores deliveries shorter than a device frame", "[render_core][queue_depth]") {
+    RenderCore<FakeSample> core(64);
+    SimulatedOutputAgent agent([&](char** buffers) { return core.render(buffers); }, 44100, 441, 2, SampleFormat::Float);
+    core.set_device_format(agent.format());
+    core.enable_adaptive_depth();
+    REQUIRE(core.set_source_format({ SampleFormat::Float, 2, 0, 0, 48000 }));
+
+    // 1 frame at 48 kHz is less than one at 44.1 kHz: no delivery to average, nor to divide the target by
+    FakeSample one = FakeSample::of<float>({ 0.5f, 0.5f });
+    REQUIRE(core.push(&one, one.payload.data(), one.payload.size()));
+    REQUIRE(core.queue_capacity() == 64);
+
+    FakeSample sample = FakeSample::of<float>(std::vector<float>(2 * 480, 0.5f));
+    REQUIRE(core.push(&sample, sample.payload.data(), sample.payload.size()));
+    REQUIRE(core.queue_capacity() < 64);
+    REQUIRE(core.queue_capacity() >= 1);
+}
+
+TEST_CASE("Stream arena hands out aligned memory until it runs out", "[arena]") {
+    StreamArena arena;
+    REQUIRE(arena.allocate(1) == nullptr);
+    REQUIRE(arena.reserve(4096));
+    REQUIRE(arena.size() >= 4096);
+
+    char* a = static_cast<char*>(arena.allocate(3));
+    float* b = arena.allocate_array<float>(5);
+    REQUIRE(reinterpret_cast<uintptr_t>(a) % StreamArena::kAlignment == 0);
+    REQUIRE(reinterpret_cast<uintptr_t>(b) % StreamArena::kAlignment == 0);
+    REQUIRE(reinterpret_cast<char*>(b) - a == 64);
+    REQUIRE(arena.allocate(arena.size()) == nullptr);
+    arena.reset();
+    REQUIRE(arena.allocate(3) == a);
+
+    // FIFO chunks wrap around instead of splitting
+    arena.reset();
+    ArenaFifo fifo;
+    REQUIRE(fifo.reserve(arena, 256));
+    uint64_t first = 0, second = 0, third = 0;
+    char* c1 = fifo.allocate(100, first);
+    char* c2 = fifo.allocate(100, second);
+    REQUIRE(c1 != nullptr);
+    REQUIRE(c2 == c1 + 128);
+    REQUIRE(fifo.allocate(100, third) == nullptr); // Would have to wrap onto the first chunk
+    fifo.free(first);
+    REQUIRE(fifo.allocate(100, third) == c1);
+    REQUIRE(third == 384);
+}
+
+TEST_CASE("Nothing allocates between start and stop", "[arena][render_core]") {
+    for (ConversionPolicy policy : { ConversionPolicy::Late, ConversionPolicy::Early }) {
+        RenderCore<FakeSample> core(8);
+        SimulatedOutputAgent agent([&](char** buffers) { return core.render(buffers); }, 48000, 2048, 16, SampleFormat::S32);
+        core.set_device_format(agent.format());
+        core.set_conversion_policy(policy);
+        core.enable_adaptive_depth();
+        core.set_worker_pool(std::make_shared<WorkerPool>(2));
+        REQUIRE(core.set_source_format({ SampleFormat::S16, 2, 0, 0, 48000 }));
+
+        std::vector<FakeSample> samples;
+        for (int i = 0; i < 64; ++i) {
+            samples.push_back(FakeSample::of<int16_t>(std::vector<int16_t>(2 * 1024, int16_t(i % 4 == 0 ? 0 : 1000 + i))));
+        }
+        const std::vector<float> gains(16, 0.5f);
+
+        // The producer is this thread, so keep the queue from filling up: a period takes two samples
+        bool ok = true;
+        size_t next = 0;
+        g_allocations = 0;
+        g_count_allocations = true;
+        agent.start();
+        while (next < samples.size()) {
+            for (int i = 0; i < 2 && next < samples.size(); ++i, ++next) {
+                ok = core.push(&samples[next], samples[next].payload.data(), samples[next].payload.size()) && ok;
+            }
+            if (next == 32) {
+                ok = core.gain().set_gains(gains) && ok;
+            }
+            ok = agent.tick() && ok;
+        }
+        agent.stop();
+        g_count_allocations = false;
+
+        REQUIRE(ok);
+        REQUIRE(g_allocations == 0);
+        REQUIRE(core.stats().samples_consumed == 64);
+        REQUIRE(core.stats().underrun_frames == 0);
+    }
+}
+
+TEST_CASE("Device clock locks to the rate the device consumes at", "[clock]") {
+    // Nominally 48 kHz, actually 10 Hz fast, callbacks up to a millisecond late
+    const double kActualRate = 48010;
+    const int32_t kPeriod = 480;
+    double now = 100.0;
+    DeviceClock clock(now);
+    SimulatedOutputAgent agent([&](char**) { clock.on_period(now); return true; }, 48000, kPeriod, 2, SampleFormat::Float);
+
+    std::minstd_rand random(42);
+    std::uniform_real_distribution<double> jitter(0.0, 0.001);
+
+    clock.start(now, agent.format().sampling_rate, agent.format().buffer_size);
+    agent.start();
+    const double start = now;
+    REQUIRE(agent.tick());
+    const int64_t origin = clock.time(now);
+
+    double worst = 0;
+    double ratio = 0;
+    int64_t last = origin;
+    bool monotonic = true;
+    for (int period = 1; period < 6000; ++period) {
+        const double due = start + period * kPeriod / kActualRate;
+        for (int i = 1; i <= 8; ++i) {
+            const double t = due - kPeriod / kActualRate + i * kPeriod / kActualRate / 8;
+            const int64_t reading = clock.time(t);
+            monotonic = monotonic && reading >= last;
+            last = reading;
+            if (period > 3000) {
+                // Callbacks are half a millisecond late on average, and so is the clock
+                const double ideal = origin + (t - start - 0.0005) * kActualRate / 48000 * DeviceClock::kUnitsPerSecond;
+                worst = std::max(worst, std::abs(reading - ideal) / DeviceClock::kUnitsPerSecond);
+            }
+        }
+        now = due + jitter(random);
+        REQUIRE(agent.tick());
+        if (period > 3000) {
+            ratio += clock.rate_ratio() / 2999;
+        }
+    }
+
+    REQUIRE(monotonic);
+    REQUIRE(ratio == Approx(kActualRate / 48000).epsilon(2e-5));
+    REQUIRE(worst < 0.0002);
+}
+
+TEST_CASE("Device clock runs on across stops and restarts", "[clock]") {
+    double now = 10.0;
+    DeviceClock clock(now);
+    SimulatedOutputAgent agent([&](char**) { clock.on_period(now); return true; }, 48000, 480, 2, SampleFormat::Float);
+
+    // Free-running before the device starts, and until its first callback
+    REQUIRE(clock.time(now) == 100000000);
+    now = 11.0;
+    clock.start(now, 48000, 480);
+    agent.start();
+    now = 11.5;
+    REQUIRE(clock.time(now) == 115000000);
+    REQUIRE(agent.tick());
+    REQUIRE(clock.time(now) == 115000000);
+
+    // Held at the end of a period the device hasn't got past yet
+    now = 11.51;
+    REQUIRE(agent.tick());
+    REQUIRE(clock.time(11.515) == 115150000);
+    REQUIRE(clock.time(11.6) == 115200000);
+
+    // A stall loses the lock without going back in time
+    now = 12.0;
+    REQUIRE(agent.tick());
+    REQUIRE(clock.time(now) == 115200000);
+    REQUIRE(clock.time(12.005) == 115250000);
+
+    agent.stop();
+    clock.stop(12.005);
+    REQUIRE(clock.time(13.0) == 125200000);
+
+    // A format change restarts the loop where the clock is
+    clock.start(13.0, 48000, 480);
+    agent.start();
+    now = 13.0;
+    REQUIRE(agent.tick());
+    REQUIRE(agent.reconfigure(96000, 960));
+    now = 13.005;
+    clock.set_format(now, 96000, 960);
+    REQUIRE(clock.time(now) == 125250000);
+    REQUIRE(agent.tick());
+    REQUIRE(clock.time(13.01) == 125300000);
+}
+
+TEST_CASE("Async resampler follows ratio changes continuously", "[resampler]") {
+    // Cubic Hermite interpolation is exact on a ramp, so every output frame is its own read position
+    AsyncResampler resampler(3, 64);
+    std::vector<float> output(3 * 64);
+    float* channels[] = { &output[0], &output[64], &output[128] };
+
+    double position = -2; // Two frames of latency
+    double next_input = 0;
+    for (int block = 0; block < 200; ++block) {
+        const double ratio = block < 100 ? 1.0 : 1.0 + 0.005 * std::sin(block * 0.3);
+        const size_t frames = 37 + block % 28;
+        const size_t needed = resampler.input_frames(frames, ratio);
+        for (size_t i = 0; i < needed; ++i, ++next_input) {
+            for (size_t c = 0; c < 3; ++c) {
+                resampler.input()[c][i] = float(next_input) * float(c + 1);
+            }
+        }
+        resampler.process(channels, frames, ratio);
+
+        for (size_t i = 0; i < frames; ++i, position += ratio) {
+            for (size_t c = 0; c < 3; ++c) {
+                const float expected = position < 0 ? 0.0f : float(position) * float(c + 1);
+                if (position >= 1) {
+                    REQUIRE(channels[c][i] == Approx(expected).epsilon(1e-5));
+                }
+                if (block < 100 && position >= 0) {
+                    REQUIRE(channels[c][i] == expected); // Bit-exact at unity
+                }
+            }
+        }
+        REQUIRE(next_input > position + 1); // Input was only ever asked for as far as it is needed
+    }
+}
+
+TEST_CASE("Drift compensation holds the queue level against a fast producer", "[render_core][drift]") {
+    const int32_t kPeriod = 480;
+    const double kFrequency = 1000.0 / 48000;
+
+    // Outlive the core, which may still hold one
+    std::vector<FakeSample> samples(128);
+    RenderCore<FakeSample> core(64);
+    SimulatedOutputAgent agent([&](char** buffers) { return core.render(buffers); }, 48000, kPeriod, 2, SampleFormat::Float);
+    core.set_device_format(agent.format());
+    REQUIRE(core.set_drift_compensation(true));
+    REQUIRE_FALSE(core.bit_perfect());
+    REQUIRE(core.set_source_format({ SampleFormat::Float, 2, 0, 0, 48000 }));
+
+    // The producer delivers a 1 kHz sine 500 ppm faster than the device plays it
+    size_t next_sample = 0;
+    int64_t produced = 0;
+    auto produce = [&]() {
+        FakeSample& sample = samples[next_sample++ % samples.size()];
+        REQUIRE(sample.references == 0);
+        std::vector<float> frames(2 * kPeriod);
+        for (int32_t i = 0; i < kPeriod; ++i, ++produced) {
+            frames[2 * i] = frames[2 * i + 1] = float(std::sin(2 * 3.14159265358979 * kFrequency * produced));
+        }
+        sample = FakeSample::of<float>(frames);
+        REQUIRE(core.push(&sample, sample.payload.data(), sample.payload.size(), RenderCore<FakeSample>::Silence::Audible));
+    };
+
+    for (int i = 0; i < 8; ++i) {
+        produce();
+    }
+    agent.start();
+
+    size_t most_queued = 0;
+    double ratio = 0;
+    float previous[2] = { 0, 0 };
+    double worst_curvature = 0;
+    for (int tick = 1; tick <= 40000; ++tick) {
+        produce();
+        if (tick % 2000 == 0) {
+            produce();
+        }
+        REQUIRE(agent.tick());
+
+        const float* out = reinterpret_cast<const float*>(agent.buffer(1));
+        if (tick > 1) {
+            // A glitch would show as a kink; a clean sine bends by at most (2 pi f)^2
+            for (int32_t i = 0; i < kPeriod; ++i) {
+                worst_curvature = std::max(worst_curvature, double(std::abs(out[i] - 2 * previous[1] + previous[0])));
+                previous[0] = previous[1];
+                previous[1] = out[i];
+            }
+        } else {
+            previous[0] = out[kPeriod - 2];
+            previous[1] = out[kPeriod - 1];
+        }
+        if (tick > 20000) {
+            most_queued = std::max(most_queued, core.queued_samples());
+            ratio += core.drift_ratio() / 20000;
+        }
+    }
+
+    REQUIRE(ratio == Approx(1.0005).epsilon(5e-5));
+    REQUIRE(most_queued <= 10);
+    REQUIRE(core.stats().underrun_frames == 0);
+    const double bend = 2 * 3.14159265358979 * kFrequency;
+    REQUIRE(worst_curvature < bend * bend * 1.05);
+
+    // Queued float audio would be handed to the device as if it were in its format: switching off waits for a flush
+    agent.stop();
+    REQUIRE_FALSE(core.set_drift_compensation(false));
+    REQUIRE(core.drift_compensation());
+    core.begin_flush();
+    core.release_current();
+    REQUIRE(core.set_drift_compensation(false));
+    REQUIRE_FALSE(core.drift_compensation());
+}
+
+namespace {
+    struct ToneResponse {
+        double amplitude;         // Of the output, for a full-scale input tone
+        double cycles_per_sample; // Per output sample and channel, 0 where there is no cycle counter
+        double ns_per_sample;
+    };
+
+    uint64_t read_cycles() {
+#ifdef STUPIDAR_SSE2
+        return __rdtsc();
+#else
+        return 0;
+#endif
+    }
+
+    // Resamples a sine at `frequency` Hz on every channel and measures what comes out, after the filter settled
+    template <typename Resampler>
+    ToneResponse measure_tone(Resampler& resampler, int32_t source_rate, double frequency, int blocks) {
+        const size_t block = resampler.max_input_frames();
+        const size_t channels = resampler.channels();
+        std::vector<float> output(channels * resampler.max_output_frames());
+        std::vector<float*> out(channels);
+        for (size_t c = 0; c < channels; ++c) {
+            out[c] = &output[c * resampler.max_output_frames()];
+        }
+
+        double energy = 0;
+        size_t measured = 0, produced = 0;
+        uint64_t cycles = 0;
+        std::chrono::steady_clock::duration elapsed(0);
+        int64_t n = 0;
+        for (int b = 0; b < blocks; ++b) {
+            for (size_t i = 0; i < block; ++i, ++n) {
+                for (size_t c = 0; c < channels; ++c) {
+                    resampler.input()[c][i] = float(std::sin(2 * 3.14159265358979 * frequency * double(n) / source_rate));
+                }
+            }
+
+            const auto started = std::chrono::steady_clock::now();
+            const uint64_t start_cycles = read_cycles();
+            const size_t frames = resampler.process(block, out.data());
+            cycles += read_cycles() - start_cycles;
+            elapsed += std::chrono::steady_clock::now() - started;
+            produced += frames;
+
+            if (b >= blocks / 4) {
+                for (size_t i = 0; i < frames; ++i, ++measured) {
+                    energy += double(out[0][i]) * out[0][i];
+                }
+            }
+        }
+
+        const double samples = double(produced * channels);
+        return { std::sqrt(2 * energy / double(measured)), double(cycles) / samples,
+                 std::chrono::duration<double, std::nano>(elapsed).count() / samples };
+    }
+
+    ToneResponse resample_tone(const std::shared_ptr<const PolyphaseFilter>& filter, double frequency, size_t channels, int blocks) {
+        PolyphaseResampler resampler(filter, channels, 1024);
+        return measure_tone(resampler, filter->source_rate(), frequency, blocks);
+    }
+}
+
+TEST_CASE("Drift compensation counts queued frames whatever the buffer sizes", "[render_core][drift]") {
+    const int32_t kPeriod = 480;
+
+    // Exactly the device's rate, in buffers of 60 and 900 frames: the level only looks like it moves if it is
+    // estimated from the number of buffers
+    FakeSample short_sample = FakeSample::of<float>(std::vector<float>(60, 0.25f));
+    FakeSample long_sample = FakeSample::of<float>(std::vector<float>(900, 0.25f));
+
+    RenderCore<FakeSample> core(64);
+    SimulatedOutputAgent agent([&](char** buffers) { return core.render(buffers); }, 48000, kPeriod, 1, SampleFormat::Float);
+    core.set_device_format(agent.format());
+    REQUIRE(core.set_drift_compensation(true));
+    REQUIRE(core.set_source_format({ SampleFormat::Float, 1, 0, 0, 48000 }));
+    auto produce = [&]() {
+        REQUIRE(core.push(&short_sample, short_sample.payload.data(), short_sample.payload.size(), RenderCore<FakeSample>::Silence::Audible));
+        REQUIRE(core.push(&long_sample, long_sample.payload.data(), long_sample.payload.size(), RenderCore<FakeSample>::Silence::Audible));
+    };
+
+    for (int i = 0; i < 4; ++i) {
+        produce();
+    }
+    agent.start();
+
+    double lowest = 2;
+    double highest = 0;
+    for (int tick = 1; tick <= 4000; ++tick) {
+        if (tick % 2 == 0) {
+            produce();
+        }
+        REQUIRE(agent.tick());
+        if (tick > 2000) {
+            lowest = std::min(lowest, core.drift_ratio());
+            highest = std::max(highest, core.drift_ratio());
+        }
+    }
+
+    REQUIRE(highest - lowest < 1e-4);
+    REQUIRE(core.stats().underrun_frames == 0);
+}
+
+TEST_CASE("Polyphase filters pass the band and reject what would alias", "[resampler]") {
+    PolyphaseFilterCache filters;
+    for (ResamplerQuality quality : { ResamplerQuality::Fast, ResamplerQuality::Balanced, ResamplerQuality::High }) {
+        auto down = filters.get(48000, 44100, quality);
+        auto up = filters.get(44100, 48000, quality);
+        REQUIRE(down);
+        REQUIRE(filters.get(48000, 44100, quality) == down);
+        REQUIRE(down->up() == 147);
+        REQUIRE(down->down() == 160);
+        REQUIRE(down->taps() % 4 == 0);
+
+        REQUIRE(resample_tone(down, 1000, 1, 64).amplitude == Approx(1).epsilon(1e-3));
+        REQUIRE(resample_tone(up, 1000, 1, 64).amplitude == Approx(1).epsilon(1e-3));
+
+        // Above the output's Nyquist frequency
+        const double rejection = -20 * std::log10(resample_tone(down, 23500, 1, 64).amplitude);
+        REQUIRE(rejection >= down->stopband_db());
+    }
+
+    REQUIRE_FALSE(PolyphaseFilter::build(44100, 47999, ResamplerQuality::Fast));
+}
+
+TEST_CASE("Render core converts sources to the device's rate", "[render_core][resampler]") {
+    RenderCore<FakeSample> core(256);
+    SimulatedOutputAgent agent([&](char** buffers) { return core.render(buffers); }, 48000, 480, 2, SampleFormat::Float);
+    core.set_device_format(agent.format());
+    REQUIRE(core.set_source_format({ SampleFormat::S16, 2, 0, 0, 44100 }));
+    REQUIRE(core.rate_converter() != nullptr);
+    REQUIRE(core.rate_converter()->polyphase_filter()->up() == 160);
+    REQUIRE_FALSE(core.bit_perfect());
+
+    // One second of a 1 kHz tone, in samples of 10 ms
+    std::vector<FakeSample> samples;
+    for (int s = 0; s < 100; ++s) {
+        std::vector<int16_t> pcm(2 * 441);
+        for (int i = 0; i < 441; ++i) {
+            pcm[2 * i] = pcm[2 * i + 1] = int16_t(16384 * std::sin(2 * 3.14159265358979 * 1000 * (s * 441 + i) / 44100));
+        }
+        samples.push_back(FakeSample::of<int16_t>(pcm));
+    }
+    for (FakeSample& sample : samples) {
+        REQUIRE(core.push(&sample, sample.payload.data(), sample.payload.size()));
+        REQUIRE(sample.references == 0); // Converted on push
+    }
+
+    // Still at 1 kHz at the device's rate: one rising zero crossing every 48 frames
+    agent.start();
+    int crossings = 0;
+    float previous = 0;
+    for (int period = 0; period < 100; ++period) {
+        REQUIRE(agent.tick());
+        const float* out = reinterpret_cast<const float*>(agent.buffer(0));
+        for (int i = 0; i < 480; ++i) {
+            if (period >= 1 && previous < 0 && out[i] >= 0) {
+                ++crossings;
+            }
+            previous = out[i];
+        }
+    }
+    REQUIRE(std::abs(crossings - 990) <= 2);
+    REQUIRE(core.stats().underrun_frames < 480);
+
+    // The same rate has nothing to convert
+    REQUIRE(core.set_source_format({ SampleFormat::S16, 2, 0, 0, 48000 }));
+    REQUIRE(core.rate_converter() == nullptr);
+
+    // Twice the rate goes through a half-band stage
+    REQUIRE(core.set_source_format({ SampleFormat::S16, 2, 0, 0, 24000 }));
+    REQUIRE(core.rate_converter()->half_band_stages() == 1);
+}
+
+TEST_CASE("Converted pushes wake up as soon as the callback frees arena space", "[render_core][resampler]") {
+    // Periods of a second: waiting out a period, rather than being woken, would show
+    RenderCore<FakeSample> core(256);
+    SimulatedOutputAgent agent([&](char** buffers) { return core.render(buffers); }, 48000, 48000, 1, SampleFormat::Float);
+    core.set_device_format(agent.format());
+    REQUIRE(core.set_source_format({ SampleFormat::Float, 1, 0, 0, 44100 }));
+
+    // A second and a half, the arena holds one
+    const std::vector<float> payload(3 * 44100 / 2, 0.25f);
+    auto push = [&]() { return core.push(nullptr, reinterpret_cast<const char*>(payload.data()), payload.size() * sizeof(float)); };
+    auto wait_until_waiting = [&]() {
+        while (!core.push_waiting()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    };
+
+    std::atomic<bool> pushed(false);
+    std::chrono::steady_clock::time_point returned;
+    std::thread producer([&]() {
+        pushed = push();
+        returned = std::chrono::steady_clock::now();
+    });
+    wait_until_waiting();
+    agent.start();
+    REQUIRE(agent.tick());
+    const auto freed = std::chrono::steady_clock::now();
+    producer.join();
+    REQUIRE(pushed);
+    REQUIRE(returned - freed < std::chrono::milliseconds(250));
+
+    // A flush releases it just as quickly
+    producer = std::thread([&]() {
+        pushed = push();
+        returned = std::chrono::steady_clock::now();
+    });
+    wait_until_waiting();
+    core.begin_flush();
+    const auto flushed = std::chrono::steady_clock::now();
+    producer.join();
+    REQUIRE_FALSE(pushed);
+    REQUIRE(returned - flushed < std::chrono::milliseconds(250));
+    core.end_flush();
+}
+
+TEST_CASE("Polyphase resampler cost and rejection", "[.][benchmark][resampler]") {
+    PolyphaseFilterCache filters;
+    for (ResamplerQuality quality : { ResamplerQuality::Fast, ResamplerQuality::Balanced, ResamplerQuality::High }) {
+        for (const auto& rates : { std::make_pair(44100, 48000), std::make_pair(48000, 44100), std::make_pair(44100, 96000),
+                                   std::make_pair(96000, 44100) }) {
+            auto filter = filters.get(rates.first, rates.second, quality);
+            const ToneResponse cost = resample_tone(filter, 1000, 2, 2048);
+            // Aliasing is only there to measure when decimating
+            std::string rejection = "-";
+            if (rates.first > rates.second) {
+                rejection = std::to_string(-20 * std::log10(resample_tone(filter, 0.5 * rates.second + 1500, 1, 256).amplitude)) + " dB";
+            }
+            WARN(rates.first << " -> " << rates.second << ", quality " << int(quality) << ": " << filter->taps() << " taps, "
+                 << cost.cycles_per_sample << " cycles/sample, " << cost.ns_per_sample << " ns/sample, stopband " << rejection);
+        }
+    }
+}
+
+TEST_CASE("Rate converters pick half-band cascades for powers of two", "[resampler]") {
+    RateConverterFactory factory;
+    REQUIRE(factory.create(48000, 96000, ResamplerQuality::Balanced, 2, 1024)->half_band_stages() == 1);
+    REQUIRE(factory.create(192000, 48000, ResamplerQuality::Balanced, 2, 1024)->half_band_stages() == 2);
+    REQUIRE(factory.create(44100, 88200, ResamplerQuality::Balanced, 2, 1024)->half_band_stages() == 1);
+    REQUIRE(factory.create(44100, 48000, ResamplerQuality::Balanced, 2, 1024)->polyphase_filter() != nullptr);
+    REQUIRE(factory.create(48000, 144000, ResamplerQuality::Balanced, 2, 1024)->half_band_stages() == 0);
+
+    for (ResamplerQuality quality : { ResamplerQuality::Fast, ResamplerQuality::Balanced, ResamplerQuality::High }) {
+        const double stopband = ResamplerSpec::of(quality).stopband_db;
+        for (int32_t high : { 96000, 192000 }) {
+            // Every block size, so that decimation has to carry odd frames over
+            auto up = factory.create(48000, high, quality, 2, 1023);
+            auto down = factory.create(high, 48000, quality, 2, 1023);
+            REQUIRE(up->output_frames(1023) == size_t(1023 * high / 48000));
+            REQUIRE(measure_tone(*up, 48000, 1000, 64).amplitude == Approx(1).epsilon(1e-3));
+            REQUIRE(measure_tone(*down, high, 1000, 64).amplitude == Approx(1).epsilon(1e-3));
+
+            // Tones that would alias into the passband, from the top of each stage's band
+            for (double tone : { 30000.0, high == 192000 ? 80000.0 : 40000.0 }) {
+                REQUIRE(-20 * std::log10(measure_tone(*down, high, tone, 64).amplitude) >= stopband);
+            }
+        }
+    }
+}
+
+TEST_CASE("Half-band cascades against the general path", "[.][benchmark][resampler]") {
+    RateConverterFactory factory;
+    PolyphaseFilterCache filters;
+    for (ResamplerQuality quality : { ResamplerQuality::Fast, ResamplerQuality::Balanced, ResamplerQuality::High }) {
+        for (const auto& rates : { std::make_pair(48000, 96000), std::make_pair(96000, 48000), std::make_pair(48000, 192000),
+                                   std::make_pair(192000, 48000), std::make_pair(44100, 88200) }) {
+            auto half_band = factory.create(rates.first, rates.second, quality, 2, 1024);
+            PolyphaseResampler polyphase(filters.get(rates.first, rates.second, quality), 2, 1024);
+            const ToneResponse fast = measure_tone(*half_band, rates.first, 1000, 2048);
+            const ToneResponse general = measure_tone(polyphase, rates.first, 1000, 2048);
+            WARN(rates.first << " -> " << rates.second << ", quality " << int(quality) << ": half-band " << fast.cycles_per_sample
+                 << " cycles/sample, " << fast.ns_per_sample << " ns/sample; polyphase " << general.cycles_per_sample
+                 << " cycles/sample, " << general.ns_per_sample << " ns/sample");
+        }
+    }
+}
+
+namespace {
+    // Runs `input` (planar) through `stretcher` in blocks of `block` frames, then drains it
+    std::vector<std::vector<float>> stretch(WsolaStretcher& stretcher, const std::vector<std::vector<float>>& input, size_t block) {
+        const size_t channels = stretcher.channels();
+        std::vector<std::vector<float>> output(channels);
+        std::vector<std::vector<float>> scratch(channels, std::vector<float>(stretcher.max_output_frames()));
+        std::vector<float*> out(channels);
+        for (size_t c = 0; c < channels; ++c) {
+            out[c] = scratch[c].data();
+        }
+        auto append = [&](size_t frames) {
+            for (size_t c = 0; c < channels; ++c) {
+                output[c].insert(output[c].end(), scratch[c].begin(), scratch[c].begin() + frames);
+            }
+        };
+
+        for (size_t done = 0; done < input[0].size();) {
+            const size_t frames = std::min(block, input[0].size() - done);
+            for (size_t c = 0; c < channels; ++c) {
+                std::copy_n(&input[c][done], frames, stretcher.input()[c]);
+            }
+            append(stretcher.process(frames, out.data()));
+            done += frames;
+        }
+        append(stretcher.drain(out.data()));
+        return output;
+    }
+
+    int rising_zero_crossings(const float* x, size_t frames) {
+        int crossings = 0;
+        for (size_t i = 1; i < frames; ++i) {
+            if (x[i - 1] < 0 && x[i] >= 0) {
+                ++crossings;
+            }
+        }
+        return crossings;
+    }
+}
+
+TEST_CASE("WSOLA changes the duration and keeps the pitch", "[stretch]") {
+    std::vector<std::vector<float>> tone(1, std::vector<float>(96000));
+    for (size_t i = 0; i < tone[0].size(); ++i) {
+        tone[0][i] = float(std::sin(2 * 3.14159265358979 * 440 * double(i) / 48000));
+    }
+
+    for (double rate : { 0.5, 0.8, 1.25, 2.0 }) {
+        WsolaStretcher stretcher(1, 48000, 1000);
+        stretcher.set_rate(rate);
+        const std::vector<float> out = stretch(stretcher, tone, 1000)[0];
+
+        // Up to the held input, drained at the end untouched, the output runs at the rate
+        REQUIRE(std::abs(double(out.size()) - 96000 / rate) < 96000 / rate * 0.05);
+
+        // Still at 440 Hz, and no dips where the segments overlap
+        const size_t steady = size_t(48000 / rate) - 2 * stretcher.hop();
+        REQUIRE(std::abs(rising_zero_crossings(out.data(), steady) - 440 * double(steady) / 48000) <= 2);
+        for (size_t start = 0; start + stretcher.hop() <= steady; start += stretcher.hop()) {
+            const float rms = std::sqrt(simd::dot(&out[start], &out[start], stretcher.hop()) / float(stretcher.hop()));
+            REQUIRE(rms == Approx(std::sqrt(0.5)).epsilon(0.05));
+        }
+    }
+}
+
+TEST_CASE("WSOLA at real time passes its input through", "[stretch]") {
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+    std::vector<std::vector<float>> input(2, std::vector<float>(20000));
+    for (auto& channel : input) {
+        for (float& x : channel) {
+            x = noise(random);
+        }
+    }
+
+    WsolaStretcher stretcher(2, 48000, 777);
+    const std::vector<std::vector<float>> output = stretch(stretcher, input, 777);
+    for (size_t c = 0; c < 2; ++c) {
+        REQUIRE(output[c].size() == input[c].size());
+        float error = 0;
+        for (size_t i = 0; i < input[c].size(); ++i) {
+            error = std::max(error, std::abs(output[c][i] - input[c][i]));
+        }
+        REQUIRE(error < 1e-6f);
+    }
+}
+
+TEST_CASE("Render core time-stretches segments played at another rate", "[render_core][stretch]") {
+    RenderCore<FakeSample> core(256);
+    SimulatedOutputAgent agent([&](char** buffers) { return core.render(buffers); }, 48000, 480, 2, SampleFormat::Float);
+    core.set_device_format(agent.format());
+    REQUIRE(core.set_source_format({ SampleFormat::Float, 2, 0, 0, 48000 }));
+    REQUIRE(core.bit_perfect());
+    core.set_playback_rate(2.0);
+    REQUIRE_FALSE(core.bit_perfect());
+
+    // One second of a 1 kHz tone, in samples of 10 ms, plays in half a second
+    std::vector<FakeSample> samples;
+    for (int s = 0; s < 100; ++s) {
+        std::vector<float> pcm(2 * 480);
+        for (int i = 0; i < 480; ++i) {
+            pcm[2 * i] = pcm[2 * i + 1] = float(0.5 * std::sin(2 * 3.14159265358979 * 1000 * (s * 480 + i) / 48000));
+        }
+        samples.push_back(FakeSample::of<float>(pcm));
+    }
+    for (FakeSample& sample : samples) {
+        REQUIRE(core.push(&sample, sample.payload.data(), sample.payload.size()));
+        REQUIRE(sample.references == 0);
+    }
+
+    agent.start();
+    std::vector<float> played;
+    for (int period = 0; period < 60; ++period) {
+        REQUIRE(agent.tick());
+        const float* out = reinterpret_cast<const float*>(agent.buffer(0));
+        played.insert(played.end(), out, out + 480);
+    }
+    const uint64_t audible = core.stats().frames_rendered - core.stats().underrun_frames;
+    REQUIRE(std::abs(double(audible) - 24000) < 1500);
+    REQUIRE(std::abs(rising_zero_crossings(played.data(), 22000) - 1000 * 22000 / 48000) <= 2);
+
+    // Back at real time, the stretcher hands on what it held and steps aside
+    core.set_playback_rate(1.0);
+    REQUIRE(core.push(&samples[0], samples[0].payload.data(), samples[0].payload.size()));
+    REQUIRE(samples[0].references == 1); // Queued by reference again
+    REQUIRE(core.bit_perfect());
+}
+
+TEST_CASE("WSOLA cost for 8 channels", "[.][benchmark][stretch]") {
+    const size_t frames = 48000 * 4;
+    std::vector<std::vector<float>> input(8, std::vector<float>(frames));
+    std::mt19937 random(3);
+    std::uniform_real_distribution<float> noise(-0.1f, 0.1f);
+    for (size_t c = 0; c < 8; ++c) {
+        for (size_t i = 0; i < frames; ++i) {
+            input[c][i] = float(std::sin(2 * 3.14159265358979 * (220 + 110 * c) * double(i) / 48000)) + noise(random);
+        }
+    }
+
+    for (double rate : { 0.5, 0.8, 1.25, 2.0 }) {
+        WsolaStretcher stretcher(8, 48000, 480);
+        stretcher.set_rate(rate);
+        const auto started = std::chrono::steady_clock::now();
+        const size_t produced = stretch(stretcher, input, 480)[0].size();
+        const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        WARN("rate " << rate << ": " << produced << " frames out, " << (double(produced) / 48000) / elapsed << "x real time");
+    }
+}
+
+namespace {
+    // Mono float samples counting up from `first`, so that played frames tell where they came from
+    FakeSample counting(int first, int frames) {
+        std::vector<float> pcm(frames);
+        for (int i = 0; i < frames; ++i) {
+            pcm[i] = float(first + i);
+        }
+        return FakeSample::of<float>(pcm);
+    }
+
+    // Stream time of frame `frame` at 48 kHz, plus `fraction` of a frame
+    int64_t time_of(int64_t frame, double fraction = 0) {
+        return int64_t(std::llround((double(frame) + fraction) * 10000000 / 48000));
+    }
+}
+
+TEST_CASE("Render core starts on the device frame of the first timestamp", "[render_core][start]") {
+    using Core = RenderCore<FakeSample>;
+    Core core(8);
+    SimulatedOutputAgent agent([&](char** buffers) { return core.render(buffers); }, 48000, 480, 1, SampleFormat::Float);
+    core.set_device_format(agent.format());
+    REQUIRE(core.set_source_format({ SampleFormat::Float, 1, 0, 0, 48000 }));
+
+    FakeSample first = counting(1, 960);
+    FakeSample second = counting(961, 960);
+    std::vector<float> played;
+    auto play = [&](int periods) {
+        for (int period = 0; period < periods; ++period) {
+            REQUIRE(agent.tick());
+            const float* out = reinterpret_cast<const float*>(agent.buffer(0));
+            played.insert(played.end(), out, out + 480);
+        }
+    };
+    auto first_audible = [&]() {
+        return std::find_if(played.begin(), played.end(), [](float x) { return x != 0; }) - played.begin();
+    };
+
+    SECTION("The device starts early: silence first") {
+        // The first frame is due 700.4 frames into the device's first period
+        REQUIRE(core.push(&first, first.payload.data(), first.payload.size(), Core::Silence::Audible, time_of(1000)));
+        REQUIRE(core.push(&second, second.payload.data(), second.payload.size(), Core::Silence::Audible, time_of(1960)));
+        core.align_start(time_of(300, -0.4));
+        agent.start();
+        play(6);
+        REQUIRE(first_audible() == 700);
+        REQUIRE(played[700] == 1);
+        REQUIRE(played[700 + 1919] == 1920); // Continuous across samples
+        REQUIRE(core.stats().underrun_frames == 2880 - 2620); // Only after the end, the silence ahead doesn't count
+    }
+
+    SECTION("The device starts late: the audio that should have played is skipped") {
+        REQUIRE(core.push(&first, first.payload.data(), first.payload.size(), Core::Silence::Audible, time_of(0)));
+        REQUIRE(core.push(&second, second.payload.data(), second.payload.size(), Core::Silence::Audible, time_of(960)));
+        core.align_start(time_of(1100, 0.4));
+        agent.start();
+        play(1);
+        REQUIRE(played[0] == 1101);
+        REQUIRE(played[479] == 1580);
+        REQUIRE(first.references == 0); // Skipped whole
+        REQUIRE(core.stats().underrun_frames == 0);
+    }
+
+    SECTION("Samples arriving after the start still land on their frame") {
+        core.align_start(time_of(0));
+        agent.start();
+        play(1); // Nothing queued yet
+        REQUIRE(core.push(&first, first.payload.data(), first.payload.size(), Core::Silence::Audible, time_of(1000)));
+        play(2);
+        REQUIRE(first_audible() == 1000);
+        REQUIRE(played[1000] == 1);
+    }
+
+    SECTION("Without timestamps, playback starts right away") {
+        REQUIRE(core.push(&first, first.payload.data(), first.payload.size()));
+        core.align_start(time_of(-1000));
+        agent.start();
+        play(1);
+        REQUIRE(played[0] == 1);
+    }
+}
+
+TEST_CASE("Timeline tracker tells gaps and overlaps from rounding", "[timeline]") {
+    TimelineTracker timeline(100, 10000);
+    const FrameRate rate(10000); // A frame every 1000 units
+    REQUIRE(timeline.follow(TimelineTracker::kNoTime, 1, rate) == 0);
+    REQUIRE(timeline.expected() == TimelineTracker::kNoTime);
+
+    REQUIRE(timeline.follow(5000, 1, rate) == 0); // The first timestamp sets the timeline
+    REQUIRE(timeline.follow(6050, 1, rate) == 0); // Rounding: the running position carries on
+    REQUIRE(timeline.expected() == 7000);
+    REQUIRE(timeline.follow(TimelineTracker::kNoTime, 1, rate) == 0);
+    REQUIRE(timeline.expected() == 8000);
+
+    REQUIRE(timeline.follow(8500, 1, rate) == 500); // Gap
+    REQUIRE(timeline.expected() == 9500);
+    REQUIRE(timeline.follow(9200, 1, rate) == -300); // Overlap
+    REQUIRE(timeline.expected() == 10200);
+    REQUIRE(timeline.follow(9000, 1, rate) == -1200); // All of it played already
+    REQUIRE(timeline.expected() == 10200);
+
+    REQUIRE(timeline.follow(50000, 1, rate) == 0); // A new timeline
+    REQUIRE(timeline.expected() == 51000);
+    timeline.reset();
+    REQUIRE(timeline.follow(0, 1, rate) == 0);
+    REQUIRE(timeline.expected() == 1000);
+
+    // At another rate, the position carries on from where it got to
+    REQUIRE(timeline.follow(TimelineTracker::kNoTime, 2, FrameRate(20000)) == 0);
+    REQUIRE(timeline.expected() == 2000);
+}
+
+namespace {
+    FakeSample constant(float value, int frames) {
+        return FakeSample::of<float>(std::vector<float>(frames, value));
+    }
+}
+
+TEST_CASE("Render core fills gaps and drops overlaps with a fade", "[render_core][timeline]") {
+    using Core = RenderCore<FakeSample>;
+    Core core(8);
+    SimulatedOutputAgent agent([&](char** buffers) { return core.render(buffers); }, 48000, 480, 1, SampleFormat::Float);
+    core.set_device_format(agent.format());
+    REQUIRE(core.set_source_format({ SampleFormat::Float, 1, 0, 0, 48000 }));
+
+    FakeSample a = constant(0.5f, 960);
+    FakeSample b = constant(0.25f, 960);
+    FakeSample c = constant(-0.25f, 960);
+    FakeSample d = constant(1.0f, 480);
+    REQUIRE(core.push(&a, a.payload.data(), a.payload.size(), Core::Silence::Audible, time_of(0)));
+    REQUIRE(core.push(&b, b.payload.data(), b.payload.size(), Core::Silence::Audible, time_of(1920))); // 960 frames late
+    REQUIRE(core.push(&c, c.payload.data(), c.payload.size(), Core::Silence::Audible, time_of(2280))); // 600 frames early
+    REQUIRE(core.push(&d, d.payload.data(), d.payload.size(), Core::Silence::Audible, time_of(2000))); // Played already
+    REQUIRE(d.references == 0);
+
+    const auto stats = core.stats();
+    REQUIRE(stats.inserted_frames == 960);
+    REQUIRE(stats.dropped_frames == 600 + 480);
+
+    agent.start();
+    std::vector<float> played;
+    for (int period = 0; period < 8; ++period) {
+        REQUIRE(agent.tick());
+        const float* out = reinterpret_cast<const float*>(agent.buffer(0));
+        played.insert(played.end(), out, out + 480);
+    }
+
+    REQUIRE(played[959] == 0.5f);
+    REQUIRE(std::all_of(played.begin() + 960, played.begin() + 1920, [](float x) { return x == 0; }));
+    // Fades in from silence over 5 ms, then plays on
+    REQUIRE(played[1920] > 0);
+    REQUIRE(played[1920] < 0.01f);
+    for (int i = 1921; i < 1920 + 240; ++i) {
+        REQUIRE(played[i] > played[i - 1]);
+    }
+    REQUIRE(played[1920 + 240] == 0.25f);
+    // Crosses from the end of b into what is left of c
+    REQUIRE(std::abs(played[2880] - 0.25f) < 0.01f);
+    REQUIRE(played[2880 + 240] == -0.25f);
+    REQUIRE(played[2880 + 359] == -0.25f);
+    REQUIRE(played[2880 + 360] == 0); // Nothing of d
+    REQUIRE(core.stats().underrun_frames == 3840 - 3240);
+}
+
+TEST_CASE("Render core plays exactly timestamped audio on for hours", "[render_core][timeline]") {
+    // 1024 frames at 44.1 kHz last 232199.5464... units: durations rounded one by one would drift by a unit every
+    // couple of buffers, and past the tolerance after an hour and a half
+    using Core = RenderCore<FakeSample>;
+    FakeSample sample = constant(0.5f, 1024);
+    Core core(8);
+    SimulatedOutputAgent agent([&](char** buffers) { return core.render(buffers); }, 44100, 1024, 1, SampleFormat::Float);
+    core.set_device_format(agent.format());
+    REQUIRE(core.set_source_format({ SampleFormat::Float, 1, 0, 0, 44100 }));
+    agent.start();
+
+    const FrameRate rate(44100);
+    const int64_t buffers = 3 * 3600 * 44100 / 1024; // Three hours
+    for (int64_t i = 0; i < buffers; ++i) {
+        REQUIRE(core.push(&sample, sample.payload.data(), sample.payload.size(), Core::Silence::Audible, rate.time(i * 1024, Rounding::Down)));
+        REQUIRE(agent.tick());
+    }
+    REQUIRE(core.stats().inserted_frames == 0);
+    REQUIRE(core.stats().dropped_frames == 0);
+}
+
+TEST_CASE("Queued fades survive rate and source changes", "[render_core][timeline]") {
+    using Core = RenderCore<FakeSample>;
+    Core core(8);
+    SimulatedOutputAgent agent([&](char** buffers) { return core.render(buffers); }, 48000, 480, 1, SampleFormat::Float);
+    core.set_device_format(agent.format());
+    REQUIRE(core.set_source_format({ SampleFormat::Float, 1, 0, 0, 48000 }));
+
+    // The fade into b is queued in the arena, and the callback is on its way to it when the stretcher comes in
+    FakeSample a = constant(0.5f, 960);
+    FakeSample b = constant(0.25f, 960);
+    REQUIRE(core.push(&a, a.payload.data(), a.payload.size(), Core::Silence::Audible, time_of(0)));
+    REQUIRE(core.push(&b, b.payload.data(), b.payload.size(), Core::Silence::Audible, time_of(1920)));
+    agent.start();
+    std::vector<float> played;
+    auto play = [&](int periods) {
+        for (int period = 0; period < periods; ++period) {
+            REQUIRE(agent.tick());
+            const float* out = reinterpret_cast<const float*>(agent.buffer(0));
+            played.insert(played.end(), out, out + 480);
+        }
+    };
+    play(1);
+    core.set_playback_rate(1.5);
+    play(5);
+    REQUIRE(played[1920] > 0);
+    REQUIRE(played[1920] < 0.01f);
+    REQUIRE(played[1920 + 240] == 0.25f);
+
+    // Stretched, then converted from another rate, pushes keep finding room in the arena as it is played out
+    FakeSample c = constant(0.25f, 960);
+    for (int s = 0; s < 50; ++s) {
+        if (s == 25) {
+            REQUIRE(core.set_source_format({ SampleFormat::Float, 1, 0, 0, 44100 }));
+        }
+        REQUIRE(core.push(&c, c.payload.data(), c.payload.size(), Core::Silence::Audible));
+        play(2);
+    }
+    REQUIRE(core.stats().frames_rendered - core.stats().underrun_frames > 1920 + 50 * 960 / 2); // 1.5 times as fast
+}
+
+TEST_CASE("Frame rates convert between frames and time exactly", "[frame_time]") {
+    static_assert(FrameRate(44100).time(44100) == FrameRate::kUnitsPerSecond, "constant expression");
+    static_assert(FrameRate(96000, 2) == FrameRate(48000), "lowest terms");
+    static_assert(FrameRate(44100).frames(FrameRate::kUnitsPerSecond * 3600 * 24 * 7) == int64_t(44100) * 3600 * 24 * 7, "a week");
+
+    // 1 frame at 44.1 kHz is 226.757... units
+    const FrameRate cd(44100);
+    REQUIRE(cd.time(1, Rounding::Down) == 226);
+    REQUIRE(cd.time(1, Rounding::Up) == 227);
+    REQUIRE(cd.time(1) == 227);
+    REQUIRE(cd.time(-1, Rounding::Down) == -227);
+    REQUIRE(cd.time(-1, Rounding::Up) == -226);
+    REQUIRE(cd.time(-1) == -227);
+    // Halves go up
+    const FrameRate half(20000000);
+    REQUIRE(half.time(1) == 1);
+    REQUIRE(half.time(-1) == 0);
+    REQUIRE(half.time(3, Rounding::Down) == 1);
+
+    REQUIRE(FrameRate(44100).convert(441, FrameRate(48000)) == 480);
+    REQUIRE(FrameRate(30000, 1001).frames(FrameRate::kUnitsPerSecond * 1001) == 30000);
+
+    // Frames to time and back, at every common rate, anywhere in a week of playback
+    std::mt19937_64 random(48);
+    for (const FrameRate rate : { FrameRate(8000), FrameRate(11025), FrameRate(44100), FrameRate(48000), FrameRate(88200),
+                                  FrameRate(176400), FrameRate(192000), FrameRate(384000), FrameRate(48000000, 1001) }) {
+        const int64_t week = rate.frames(FrameRate::kUnitsPerSecond * 3600 * 24 * 7);
+        std::uniform_int_distribution<int64_t> position(-week, week);
+        for (int i = 0; i < 20000; ++i) {
+            const int64_t frames = i < 10 ? week - i : position(random);
+            REQUIRE(rate.frames(rate.time(frames)) == frames);
+            const int64_t time = rate.time(frames, Rounding::Down);
+            REQUIRE(rate.frames(time, Rounding::Up) == frames);
+        }
+    }
+}
+
+#if defined(__SIZEOF_INT128__)
+TEST_CASE("Portable 128-bit arithmetic matches the compiler's", "[frame_time]") {
+    std::mt19937_64 random(128);
+    std::uniform_int_distribution<int> bits(1, 64);
+    for (int i = 0; i < 200000; ++i) {
+        const uint64_t a = random() >> (64 - bits(random));
+        const uint64_t b = random() >> (64 - bits(random));
+        uint64_t high = 0, low = 0;
+        wide::multiply_limbs(a, b, high, low);
+        const unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+        REQUIRE(high == uint64_t(product >> 64));
+        REQUIRE(low == uint64_t(product));
+
+        const uint64_t divisor = std::max(random() >> (64 - bits(random)), uint64_t(1));
+        if (high < divisor) {
+            uint64_t remainder = 0;
+            const uint64_t quotient = wide::divide_limbs(high, low, divisor, remainder);
+            REQUIRE(quotient == uint64_t(product / divisor));
+            REQUIRE(remainder == uint64_t(product % divisor));
+        }
+    }
+}
+#endif
+
+namespace {
+
+    // The DirectShow base classes' llMulDiv() and Int64x32Div32() as they were, in 32-bit limbs, for reference
+    struct Limbs {
+        uint32_t low, high;
+
+        uint64_t quad() const {
+            return (uint64_t(high) << 32) | low;
+        }
+
+        void set(uint64_t quad) {
+            low = uint32_t(quad);
+            high = uint32_t(quad >> 32);
+        }
+    };
+
+    uint64_t multiply32(uint32_t a, uint32_t b) {
+        return uint64_t(a) * b;
+    }
+
+    int64_t legacy_ll_mul_div(int64_t a, int64_t b, int64_t c, int64_t d) {
+        Limbs ua, ub;
+        ua.set(a >= 0 ? uint64_t(a) : 0 - uint64_t(a));
+        ub.set(b >= 0 ? uint64_t(b) : 0 - uint64_t(b));
+        const uint64_t uc = c >= 0 ? uint64_t(c) : 0 - uint64_t(c);
+        bool sign = (a < 0) ^ (b < 0);
+
+        Limbs p[2];
+        p[0].set(multiply32(ua.low, ub.low));
+        Limbs x;
+        x.set(multiply32(ua.low, ub.high) + multiply32(ua.high, ub.low) + p[0].high);
+        p[0].high = x.low;
+        p[1].set(multiply32(ua.high, ub.high) + x.high);
+
+        if (d != 0) {
+            Limbs ud[2];
+            if (sign) {
+                ud[0].set(0 - uint64_t(d));
+                ud[1].set(d > 0 ? ~uint64_t(0) : 0);
+            } else {
+                ud[0].set(uint64_t(d));
+                ud[1].set(d < 0 ? ~uint64_t(0) : 0);
+            }
+            Limbs total;
+            total.set(uint64_t(ud[0].low) + p[0].low);
+            p[0].low = total.low;
+            total.set(total.high);
+            total.set(total.quad() + ud[0].high + p[0].high);
+            p[0].high = total.low;
+            total.set(total.high);
+            p[1].set(p[1].quad() + ud[1].quad() + total.quad());
+
+            if (int32_t(p[1].high) < 0) {
+                sign = !sign;
+                p[0].set(~p[0].quad());
+                p[1].set(~p[1].quad());
+                p[0].set(p[0].quad() + 1);
+                p[1].set(p[1].quad() + (p[0].quad() == 0));
+            }
+        }
+
+        if (c < 0) {
+            sign = !sign;
+        }
+        if (uc <= p[1].quad()) {
+            return sign ? INT64_MIN : INT64_MAX;
+        }
+
+        if (p[1].quad() == 0) {
+            const uint64_t result = p[0].quad() / uc;
+            return sign ? int64_t(0 - result) : int64_t(result);
+        }
+
+        if ((uc >> 32) == 0) {
+            const uint32_t divisor = uint32_t(uc);
+            Limbs dividend, result;
+            dividend.high = p[1].low;
+            dividend.low = p[0].high;
+            result.high = uint32_t(dividend.quad() / divisor);
+            p[0].high = uint32_t(dividend.quad() % divisor);
+            result.low = 0;
+            result.set(p[0].quad() / divisor + result.quad());
+            return sign ? int64_t(0 - result.quad()) : int64_t(result.quad());
+        }
+
+        uint64_t result = 0;
+        for (int i = 0; i < 64; i++) {
+            result <<= 1;
+            p[1].set(p[1].quad() << 1);
+            if ((p[0].high & 0x80000000) != 0) {
+                p[1].low++;
+            }
+            p[0].set(p[0].quad() << 1);
+            if (uc <= p[1].quad()) {
+                p[1].set(p[1].quad() - uc);
+                result += 1;
+            }
+        }
+        return sign ? int64_t(0 - result) : int64_t(result);
+    }
+
+    int64_t legacy_int64x32_div32(int64_t a, int32_t b, int32_t c, int32_t d) {
+        Limbs ua;
+        ua.set(a >= 0 ? uint64_t(a) : 0 - uint64_t(a));
+        const uint32_t ub = b >= 0 ? uint32_t(b) : 0 - uint32_t(b);
+        const uint32_t uc = c >= 0 ? uint32_t(c) : 0 - uint32_t(c);
+        bool sign = (a < 0) ^ (b < 0);
+
+        Limbs p0;
+        uint32_t p1 = 0;
+        p0.set(multiply32(ua.low, ub));
+        if (ua.high != 0) {
+            Limbs x;
+            x.set(multiply32(ua.high, ub) + p0.high);
+            p0.high = x.low;
+            p1 = x.high;
+        }
+
+        if (d != 0) {
+            Limbs ud0;
+            uint32_t ud1;
+            if (sign) {
+                ud0.set(uint64_t(-int64_t(d)));
+                ud1 = d > 0 ? ~uint32_t(0) : 0;
+            } else {
+                ud0.set(uint64_t(int64_t(d)));
+                ud1 = d < 0 ? ~uint32_t(0) : 0;
+            }
+            Limbs total;
+            total.set(uint64_t(ud0.low) + p0.low);
+            p0.low = total.low;
+            total.set(total.high);
+            total.set(total.quad() + ud0.high + p0.high);
+            p0.high = total.low;
+            p1 += ud1 + total.high;
+
+            if (int32_t(p1) < 0) {
+                sign = !sign;
+                p0.set(~p0.quad());
+                p1 = ~p1;
+                p0.set(p0.quad() + 1);
+                p1 += (p0.quad() == 0);
+            }
+        }
+
+        if (c < 0) {
+            sign = !sign;
+        }
+        if (uc <= p1) {
+            return sign ? INT64_MIN : INT64_MAX;
+        }
+
+        Limbs dividend, result;
+        dividend.high = p1;
+        dividend.low = p0.high;
+        if (dividend.quad() >= uc) {
+            result.high = uint32_t(dividend.quad() / uc);
+            p0.high = uint32_t(dividend.quad() % uc);
+        } else {
+            result.high = 0;
+        }
+        result.low = uint32_t(p0.quad() / uc);
+        return sign ? int64_t(0 - result.quad()) : int64_t(result.quad());
+    }
+
+    // Values around the edges of 32 and 64 bits, both signs
+    std::vector<int64_t> muldiv_edges() {
+        std::vector<int64_t> edges = { 0, 1, 2, 3, 7, 1000, 10000000, 44100, 48000, INT32_MAX, int64_t(INT32_MAX) + 1,
+                                       int64_t(UINT32_MAX), int64_t(UINT32_MAX) + 1, INT64_MAX / 2, INT64_MAX - 1, INT64_MAX };
+        const size_t positive = edges.size();
+        for (size_t i = 1; i < positive; ++i) {
+            edges.push_back(-edges[i]);
+        }
+        edges.push_back(INT64_MIN);
+        edges.push_back(INT64_MIN + 1);
+        return edges;
+    }
+
+    int32_t narrow(int64_t value) {
+        return int32_t(uint32_t(uint64_t(value)));
+    }
+
+}
+
+TEST_CASE("llMulDiv and Int64x32Div32 match the base classes' original", "[muldiv]") {
+    const std::vector<int64_t> edges = muldiv_edges();
+    for (int64_t a : edges) {
+        for (int64_t b : edges) {
+            for (int64_t c : edges) {
+                for (int64_t d : { int64_t(0), int64_t(1), int64_t(-1), int64_t(INT32_MIN), INT64_MAX, INT64_MIN + 1, c / 2 }) {
+                    REQUIRE(MulDiv128(a, b, c, d) == legacy_ll_mul_div(a, b, c, d));
+                }
+                const int32_t b32 = narrow(b), c32 = narrow(c);
+                for (int32_t d32 : { 0, 1, -1, INT32_MIN, INT32_MAX, c32 / 2 }) {
+                    REQUIRE(MulDiv128(a, b32, c32, d32) == legacy_int64x32_div32(a, b32, c32, d32));
+                }
+            }
+        }
+    }
+
+    // Random magnitudes of every width, so that the products cover all of 128 bits
+    std::mt19937_64 random(49);
+    std::uniform_int_distribution<int> bits(0, 63);
+    const auto operand = [&]() {
+        const int64_t magnitude = int64_t(random() >> (1 + bits(random)));
+        return (random() & 1) ? -magnitude : magnitude;
+    };
+    for (int i = 0; i < 1000000; ++i) {
+        const int64_t a = operand(), b = operand(), c = operand(), d = operand();
+        REQUIRE(MulDiv128(a, b, c, d) == legacy_ll_mul_div(a, b, c, d));
+        const int32_t b32 = narrow(b), c32 = narrow(c), d32 = narrow(d);
+        REQUIRE(MulDiv128(a, b32, c32, d32) == legacy_int64x32_div32(a, b32, c32, d32));
+    }
+}
+
+TEST_CASE("llMulDiv cost", "[.][benchmark][muldiv]") {
+    // Timestamp conversions: positions in 100 ns units to frames and back, and media times scaled by a rate
+    const int calls = 1 << 22;
+    std::mt19937_64 random(49);
+    std::uniform_int_distribution<int64_t> time(0, int64_t(10000000) * 3600 * 24);
+    std::vector<int64_t> times(1024);
+    for (auto& t : times) {
+        t = time(random);
+    }
+    const int64_t rates[] = { 44100, 48000, 96000, 10000000, int64_t(10000000) * 1001 };
+
+    const auto measure = [&](int64_t (*mul_div)(int64_t, int64_t, int64_t, int64_t)) {
+        int64_t sum = 0;
+        const auto started = std::chrono::steady_clock::now();
+        for (int i = 0; i < calls; ++i) {
+            const int64_t rate = rates[i % 5];
+            sum += mul_div(times[i & 1023], rate, rates[(i + 3) % 5], i & 1);
+        }
+        const auto finished = std::chrono::steady_clock::now();
+        REQUIRE(sum != 0);
+        return std::chrono::duration<double, std::nano>(finished - started).count() / calls;
+    };
+    const double legacy = measure(legacy_ll_mul_div);
+    const double portable = measure(MulDiv128);
+    WARN("original: " << legacy << " ns/call, 128-bit: " << portable << " ns/call");
+}
+
+TEST_CASE("Latency monitor keeps min, average, max and the 99th percentile", "[latency]") {
+    LatencyMonitor monitor;
+    REQUIRE(monitor.stats().observations == 0);
+    REQUIRE(monitor.stats().max == 0.0);
+
+    for (int i = 1; i <= 100; ++i) {
+        monitor.observe(0.001 * ((i * 37) % 100 + 1)); // 1 to 100 ms, shuffled
+    }
+    LatencyStats stats = monitor.stats();
+    REQUIRE(stats.observations == 100);
+    REQUIRE(stats.current == Approx(0.001 * (3700 % 100 + 1)));
+    REQUIRE(stats.min == Approx(0.001));
+    REQUIRE(stats.max == Approx(0.1));
+    REQUIRE(stats.average == Approx(0.0505));
+    REQUIRE(stats.p99 == Approx(0.099).margin(LatencyMonitor::kResolutionSeconds));
+
+    // Beyond the histogram's range the percentile is still within what was observed
+    monitor.reset();
+    monitor.observe(10.0);
+    stats = monitor.stats();
+    REQUIRE(stats.observations == 1);
+    REQUIRE(stats.p99 == 10.0);
+}
+
+TEST_CASE("Render core estimates the latency from push to the DAC", "[render_core][latency]") {
+    RenderCore<FakeSample> core(64);
+    SimulatedOutputAgent agent([&](char** buffers) { return core.render(buffers); }, 48000, 480, 2, SampleFormat::Float);
+    agent.set_output_latency(960);
+    core.set_device_format(agent.format());
+    core.set_output_latency(agent.output_latency());
+    REQUIRE(core.set_source_format({ SampleFormat::Float, 2, 0, 0, 48000 }));
+
+    std::vector<FakeSample> samples(4, FakeSample::of<float>(std::vector<float>(2 * 480, 0.5f)));
+    for (FakeSample& sample : samples) {
+        REQUIRE(core.push(&sample, sample.payload.data(), sample.payload.size()));
+    }
+    REQUIRE(core.latency() == Approx(0.04));
+
+    // What is left queued, the period played and the device's 20 ms
+    agent.start();
+    for (int period = 0; period < 3; ++period) {
+        REQUIRE(agent.tick());
+        REQUIRE(core.latency_stats().current == Approx(0.06 - 0.01 * period));
+    }
+    LatencyStats stats = core.latency_stats();
+    REQUIRE(stats.observations == 3);
+    REQUIRE(stats.min == Approx(0.04));
+    REQUIRE(stats.average == Approx(0.05));
+    REQUIRE(stats.max == Approx(0.06));
+    core.reset_stats();
+    REQUIRE(core.latency_stats().observations == 0);
+
+    // A flush empties the queue
+    core.begin_flush();
+    core.end_flush();
+    REQUIRE(agent.tick());
+    REQUIRE(core.latency_stats().current == Approx(0.03));
+
+    // Converting from another rate adds the filter's delay
+    REQUIRE(core.set_source_format({ SampleFormat::Float, 2, 0, 0, 44100 }));
+    FakeSample sample = FakeSample::of<float>(std::vector<float>(2 * 4410, 0.5f));
+    REQUIRE(core.push(&sample, sample.payload.data(), sample.payload.size()));
+    REQUIRE(agent.tick());
+    const double delay = core.rate_converter()->delay();
+    REQUIRE(delay > 0.0);
+    REQUIRE(core.latency_stats().current == Approx(core.latency() + 0.03 + delay));
+}
+
+TEST_CASE("Rate converters report their group delay", "[resampler][latency]") {
+    RateConverterFactory factory;
+    for (const auto& rates : { std::make_pair(44100, 48000), std::make_pair(48000, 44100), std::make_pair(24000, 96000),
+                               std::make_pair(192000, 48000) }) {
+        auto converter = factory.create(rates.first, rates.second, ResamplerQuality::Balanced, 1, 8192);
+        REQUIRE(converter != nullptr);
+
+        // The impulse response peaks where the filter is centered
+        std::fill(converter->input()[0], converter->input()[0] + 8192, 0.0f);
+        converter->input()[0][0] = 1.0f;
+        std::vector<float> out(converter->max_output_frames());
+        float* channels[] = { out.data() };
+        const size_t produced = converter->process(8192, channels);
+        const size_t peak = size_t(std::max_element(out.begin(), out.begin() + produced) - out.begin());
+        REQUIRE(double(peak) / rates.second == Approx(converter->delay()).margin(1.0 / std::min(rates.first, rates.second)));
+    }
+}
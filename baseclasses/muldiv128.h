@@ -0,0 +1,120 @@
+//------------------------------------------------------------------------------
+// File: MulDiv128.h
+//
+// Desc: DirectShow base classes - portable 128-bit arithmetic behind
+//       llMulDiv() and Int64x32Div32() in arithutil.cpp.
+//
+//       Plain C++ types only, so that it builds (and is tested) anywhere.
+//------------------------------------------------------------------------------
+
+#ifndef __MULDIV128__
+#define __MULDIV128__
+
+#include <stdint.h>
+
+//  One of: the x64 intrinsics (_udiv128 needs Visual Studio 2019), the
+//  compiler's own 128-bit integers, or 32-bit limbs (x86 and ARM)
+#if defined(_MSC_VER) && _MSC_VER >= 1920 && defined(_M_X64)
+#include <intrin.h>
+#define MULDIV128_MSVC_X64
+#elif defined(__SIZEOF_INT128__)
+#define MULDIV128_INT128
+#endif
+
+//  High and low 64 bits of a * b
+inline void UMul64x64To128(uint64_t a, uint64_t b, uint64_t *pHigh, uint64_t *pLow)
+{
+#if defined(MULDIV128_MSVC_X64)
+    *pLow = _umul128(a, b, pHigh);
+#elif defined(MULDIV128_INT128)
+    unsigned __int128 p = (unsigned __int128)a * b;
+    *pHigh = (uint64_t)(p >> 64);
+    *pLow = (uint64_t)p;
+#else
+    uint64_t a0 = a & 0xFFFFFFFF, a1 = a >> 32;
+    uint64_t b0 = b & 0xFFFFFFFF, b1 = b >> 32;
+    uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+    uint64_t mid = (p00 >> 32) + (p01 & 0xFFFFFFFF) + (p10 & 0xFFFFFFFF);
+    *pHigh = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+    *pLow = (mid << 32) | (p00 & 0xFFFFFFFF);
+#endif
+}
+
+//  (high:low) / c, for high < c so that the quotient fits in 64 bits
+inline uint64_t UDiv128By64(uint64_t high, uint64_t low, uint64_t c)
+{
+#if defined(MULDIV128_MSVC_X64)
+    uint64_t remainder;
+    return _udiv128(high, low, c, &remainder);
+#elif defined(MULDIV128_INT128)
+    return (uint64_t)((((unsigned __int128)high << 64) | low) / c);
+#else
+    if ((c >> 32) == 0) {
+        //  The usual case (c is a rate or a time unit): two 64 by 32 bit divisions
+        uint64_t upper = (high << 32) | (low >> 32);
+        uint64_t qHigh = upper / c;
+        uint64_t lower = ((upper % c) << 32) | (low & 0xFFFFFFFF);
+        return (qHigh << 32) | (lower / c);
+    }
+
+    //  Long division, one bit at a time
+    uint64_t quotient = 0;
+    for (int i = 0; i < 64; i++) {
+        uint64_t carry = high >> 63;
+        high = (high << 1) | (low >> 63);
+        low <<= 1;
+        quotient <<= 1;
+        if (carry || high >= c) {
+            high -= c;
+            quotient |= 1;
+        }
+    }
+    return quotient;
+#endif
+}
+
+//  (a * b + d) / c, exact, truncated toward zero
+//  Returns the largest or smallest LONGLONG (by the sign of the result) when
+//  c == 0 or the quotient does not fit in 64 bits; quotients from 2^63 to
+//  2^64 - 1 wrap around, like they always did.
+inline int64_t MulDiv128(int64_t a, int64_t b, int64_t c, int64_t d)
+{
+    uint64_t ua = a >= 0 ? (uint64_t)a : 0 - (uint64_t)a;
+    uint64_t ub = b >= 0 ? (uint64_t)b : 0 - (uint64_t)b;
+    uint64_t uc = c >= 0 ? (uint64_t)c : 0 - (uint64_t)c;
+    bool bSign = (a < 0) != (b < 0);
+
+    uint64_t high, low;
+    UMul64x64To128(ua, ub, &high, &low);
+
+    if (d != 0) {
+        //  Add d to the magnitude, in the direction of the sign of a * b
+        bool bSubtract = (d < 0) != bSign;
+        uint64_t ud = d >= 0 ? (uint64_t)d : 0 - (uint64_t)d;
+        if (!bSubtract) {
+            low += ud;
+            high += (low < ud);
+        } else if (high != 0 || low >= ud) {
+            high -= (low < ud);
+            low -= ud;
+        } else {
+            //  d is larger than a * b and the sign changes
+            low = ud - low;
+            bSign = !bSign;
+        }
+    }
+
+    if (c < 0) {
+        bSign = !bSign;
+    }
+
+    //  This will catch c == 0 and overflow
+    if (uc <= high) {
+        return bSign ? INT64_MIN : INT64_MAX;
+    }
+
+    uint64_t ullResult = high == 0 ? low / uc : UDiv128By64(high, low, uc);
+    return bSign ? (int64_t)(0 - ullResult) : (int64_t)ullResult;
+}
+
+#endif // __MULDIV128__